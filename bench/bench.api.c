@@ -0,0 +1,278 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/error.h>
+#include <tr50/tr50.h>
+#include <tr50/mqtt/mqtt.h>
+#include <tr50/util/atomic.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/tcp.h>
+#include <tr50/util/thread.h>
+
+#include "bench.h"
+
+// End-to-end tr50_api_call_async() throughput: a real client answered with a successful
+// reply/<seq> for every api/<seq>, once over the in-process loopback transport and once over
+// loopback TCP to a minimal broker stand-in.
+#define BENCH_API_PORT			18830
+#define BENCH_API_PORT_TRIES	10
+#define BENCH_API_BUFFER_SIZE	65536
+#define BENCH_API_REPLY			"{\"1\":{\"success\":true}}"
+
+typedef struct {
+	void *listen_sock;
+	void *sock;
+	void *thread;
+	volatile int is_stopping;
+	char *buffer;
+	int buffer_len;
+} _BENCH_BROKER;
+
+typedef struct {
+	void *tr50;
+	int window;
+	volatile long long completed;
+	volatile int failed;
+} _BENCH_API;
+
+static int _bench_broker_send(_BENCH_BROKER *broker, const char *data, int len) {
+	return _tcp_send(broker->sock, data, len, 5000);
+}
+
+// Handles one complete packet; returns non-zero when the connection should close.
+static int _bench_broker_packet(_BENCH_BROKER *broker, const char *packet, int len, int header_len) {
+	static const char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+	static const char pingresp[] = { (char)0xd0, 0x00 };
+	char suback[5] = { (char)0x90, 0x03, 0x00, 0x00, 0x00 };
+	char puback[4] = { 0x40, 0x02, 0x00, 0x00 };
+	char reply_topic[64];
+	char *topic, *payload, *out;
+	unsigned short msg_id;
+	int ret, qos, payload_len, out_len;
+
+	switch ((packet[0] >> 4) & 0x0f) {
+	case 1: // CONNECT
+		return _bench_broker_send(broker, connack, sizeof(connack));
+	case 3: // PUBLISH
+		if ((ret = mqtt_msg_process_publish(packet, len, &qos, &msg_id, &topic, &payload, &payload_len)) != 0) {
+			return ret;
+		}
+		if (qos > 0) {
+			puback[2] = (char)(msg_id >> 8);
+			puback[3] = (char)(msg_id & 0xff);
+			_bench_broker_send(broker, puback, sizeof(puback));
+		}
+		ret = 0;
+		if (strncmp(topic, "api/", 4) == 0) {
+			snprintf(reply_topic, sizeof(reply_topic), "reply/%s", topic + 4);
+			if ((ret = _mqtt_msg_build_publish(reply_topic, 0, 0, 0, BENCH_API_REPLY, sizeof(BENCH_API_REPLY) - 1, &out, &out_len)) == 0) {
+				ret = _bench_broker_send(broker, out, out_len);
+				_memory_free(out);
+			}
+		}
+		_memory_free(topic);
+		_memory_free(payload);
+		return ret;
+	case 8: // SUBSCRIBE
+		suback[2] = packet[header_len];
+		suback[3] = packet[header_len + 1];
+		return _bench_broker_send(broker, suback, sizeof(suback));
+	case 12: // PINGREQ
+		return _bench_broker_send(broker, pingresp, sizeof(pingresp));
+	case 14: // DISCONNECT
+		return 1;
+	}
+	return 0;
+}
+
+static void *_bench_broker_handler(void *arg) {
+	_BENCH_BROKER *broker = (_BENCH_BROKER *)arg;
+	int ret, len, header_len, remaining, multiplier, pos;
+
+	while (!broker->is_stopping && broker->sock == NULL) {
+		_tcp_accept(broker->listen_sock, &broker->sock, 100);
+	}
+
+	while (!broker->is_stopping && broker->sock) {
+		len = BENCH_API_BUFFER_SIZE - broker->buffer_len;
+		if ((ret = _tcp_recv(broker->sock, broker->buffer + broker->buffer_len, &len, 100)) == ERR_TR50_SOCK_TIMEOUT) {
+			continue;
+		} else if (ret != 0) {
+			break;
+		}
+		broker->buffer_len += len;
+
+		pos = 0;
+		for (;;) {
+			// fixed header: type byte, then a 1-4 byte remaining length
+			remaining = 0;
+			multiplier = 1;
+			for (header_len = 1; header_len < 5 && pos + header_len < broker->buffer_len; ++header_len) {
+				remaining += (broker->buffer[pos + header_len] & 0x7f) * multiplier;
+				multiplier *= 128;
+				if ((broker->buffer[pos + header_len] & 0x80) == 0) {
+					break;
+				}
+			}
+			if (pos + header_len >= broker->buffer_len || pos + header_len + 1 + remaining > broker->buffer_len) {
+				break;
+			}
+			++header_len;
+			if (_bench_broker_packet(broker, broker->buffer + pos, header_len + remaining, header_len) != 0) {
+				goto end;
+			}
+			pos += header_len + remaining;
+		}
+		memmove(broker->buffer, broker->buffer + pos, broker->buffer_len - pos);
+		broker->buffer_len -= pos;
+	}
+end:
+	return NULL;
+}
+
+static int _bench_broker_start(_BENCH_BROKER *broker, int *port) {
+	int i, ret = -1;
+
+	_memory_memset(broker, 0, sizeof(_BENCH_BROKER));
+	for (i = 0; i < BENCH_API_PORT_TRIES; ++i) {
+		*port = BENCH_API_PORT + i;
+		if ((ret = _tcp_listen(&broker->listen_sock, *port)) == 0) {
+			break;
+		}
+	}
+	if (ret != 0) {
+		return ret;
+	}
+	broker->buffer = _memory_malloc(BENCH_API_BUFFER_SIZE);
+	return _thread_create(&broker->thread, "TR50:BenchBroker", _bench_broker_handler, broker);
+}
+
+static void _bench_broker_stop(_BENCH_BROKER *broker) {
+	broker->is_stopping = 1;
+	_thread_join(broker->thread);
+	_thread_delete(broker->thread);
+	if (broker->sock) {
+		_tcp_disconnect(broker->sock);
+	}
+	_tcp_disconnect(broker->listen_sock);
+	_memory_free(broker->buffer);
+}
+
+static void _bench_api_reply(void *tr50, int status, const void *request_message, void *reply_message, void *custom) {
+	_BENCH_API *b = (_BENCH_API *)custom;
+
+	if (status != 0) {
+		_atomic_store32(&b->failed, status);
+	}
+	if (reply_message) {
+		tr50_message_delete(reply_message);
+	}
+	_atomic_add64(&b->completed, 1);
+}
+
+static int _bench_api_call_async(void *arg, long long iterations) {
+	_BENCH_API *b = (_BENCH_API *)arg;
+	long long issued = 0, base = _atomic_load64(&b->completed);
+	void *message;
+	int ret;
+
+	while (issued < iterations) {
+		// keep at most [window] requests in flight
+		while (issued - (_atomic_load64(&b->completed) - base) >= b->window) {
+			_thread_sleep(0);
+		}
+		tr50_message_create(&message);
+		tr50_message_add_command(message, "1", "property.publish", NULL);
+		if ((ret = tr50_api_call_async(b->tr50, message, NULL, _bench_api_reply, b, 10000)) != 0) {
+			tr50_message_delete(message);
+			return ret;
+		}
+		++issued;
+	}
+	while (_atomic_load64(&b->completed) - base < iterations) {
+		_thread_sleep(0);
+	}
+	return b->failed;
+}
+
+static void _bench_api_loopback_publish(void *loopback, void *session, const char *topic, const char *data, int len, void *custom) {
+	char reply_topic[64];
+
+	if (strncmp(topic, "api/", 4) == 0) {
+		snprintf(reply_topic, sizeof(reply_topic), "reply/%s", topic + 4);
+		tr50_loopback_publish(loopback, session, reply_topic, BENCH_API_REPLY, sizeof(BENCH_API_REPLY) - 1);
+	}
+}
+
+static void _bench_api_run(const char *transport_name, const TR50_TRANSPORT *transport, int port) {
+	static const int windows[] = { 1, 64 };
+	_BENCH_API b;
+	char params[48];
+	int i;
+
+	_memory_memset(&b, 0, sizeof(b));
+	if (tr50_create(&b.tr50, "bench", "127.0.0.1", port) != 0) {
+		return;
+	}
+	tr50_config_set_compress(b.tr50, 0);
+	tr50_config_set_transport(b.tr50, transport);
+	if (tr50_start(b.tr50) != 0) {
+		fprintf(stderr, "api: cannot connect over %s\n", transport_name);
+		tr50_delete(b.tr50);
+		return;
+	}
+
+	for (i = 0; i < (int)(sizeof(windows) / sizeof(windows[0])); ++i) {
+		b.window = windows[i];
+		snprintf(params, sizeof(params), "transport=%s,window=%d", transport_name, b.window);
+		bench_run("api.call_async", params, 0, _bench_api_call_async, &b);
+	}
+
+	tr50_stop(b.tr50);
+	tr50_delete(b.tr50);
+}
+
+void bench_api(void) {
+	_BENCH_BROKER broker;
+	void *loopback;
+	int port;
+
+	// the library's own overhead, without the kernel
+	if (tr50_loopback_create(&loopback) == 0) {
+		tr50_loopback_set_publish_handler(loopback, _bench_api_loopback_publish, NULL);
+		_bench_api_run("loopback", tr50_loopback_transport(loopback), 0);
+		tr50_loopback_delete(loopback);
+	}
+
+	if (_bench_broker_start(&broker, &port) != 0) {
+		fprintf(stderr, "api: cannot start the local broker\n");
+		return;
+	}
+	_bench_api_run("tcp", NULL, port);
+	_bench_broker_stop(&broker);
+}
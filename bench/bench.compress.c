@@ -0,0 +1,89 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/util/compress.h>
+#include <tr50/util/memory.h>
+
+#include "bench.h"
+
+typedef struct {
+	char *raw;
+	int raw_len;
+	char *deflated;
+	int deflated_len;
+} _BENCH_COMPRESS;
+
+static int _bench_deflate(void *arg, long long iterations) {
+	_BENCH_COMPRESS *b = (_BENCH_COMPRESS *)arg;
+	char *out;
+	int ret, out_len;
+
+	while (iterations-- > 0) {
+		if ((ret = _compress_deflate(b->raw, b->raw_len, &out, &out_len)) != 0) {
+			return ret;
+		}
+		_memory_free(out);
+	}
+	return 0;
+}
+
+static int _bench_inflate(void *arg, long long iterations) {
+	_BENCH_COMPRESS *b = (_BENCH_COMPRESS *)arg;
+	char *out;
+	int ret, out_len;
+
+	while (iterations-- > 0) {
+		if ((ret = _compress_inflate(b->deflated, b->deflated_len, &out, &out_len)) != 0) {
+			return ret;
+		}
+		_memory_free(out);
+	}
+	return 0;
+}
+
+void bench_compress(void) {
+	static const int sizes[] = { 256, 4096, 65536 };
+	_BENCH_COMPRESS b;
+	char params[32];
+	int i;
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i) {
+		b.raw_len = sizes[i];
+		b.raw = bench_payload(b.raw_len);
+		if (_compress_deflate(b.raw, b.raw_len, &b.deflated, &b.deflated_len) != 0) {
+			_memory_free(b.raw);
+			continue;
+		}
+		snprintf(params, sizeof(params), "size=%d", b.raw_len);
+
+		bench_run("compress.deflate", params, b.raw_len, _bench_deflate, &b);
+		bench_run("compress.inflate", params, b.raw_len, _bench_inflate, &b);
+
+		_memory_free(b.deflated);
+		_memory_free(b.raw);
+	}
+}
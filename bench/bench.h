@@ -0,0 +1,46 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TR50_BENCH_H_
+#define TR50_BENCH_H_
+
+// Runs [iterations] operations; returns 0 on success.
+typedef int(*bench_function)(void *arg, long long iterations);
+
+// Times func and appends one result to the report. bytes_per_op may be 0.
+void bench_run(const char *name, const char *params, long long bytes_per_op, bench_function func, void *arg);
+
+// Deterministic pseudo random numbers and TR50-looking JSON text, so every run sees the same input.
+void bench_seed(unsigned int seed);
+unsigned int bench_random(void);
+char *bench_payload(int len);
+
+void bench_mqtt(void);
+void bench_json(void);
+void bench_compress(void);
+void bench_pending(void);
+void bench_memory(void);
+void bench_api(void);
+
+#endif /*TR50_BENCH_H_*/
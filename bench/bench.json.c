@@ -0,0 +1,98 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/util/json.h>
+#include <tr50/util/memory.h>
+
+#include "bench.h"
+
+typedef struct {
+	char *text;
+	int text_len;
+	JSON *json;
+} _BENCH_JSON;
+
+static int _bench_json_parse(void *arg, long long iterations) {
+	_BENCH_JSON *b = (_BENCH_JSON *)arg;
+	JSON *json;
+
+	while (iterations-- > 0) {
+		if ((json = tr50_json_parse(b->text)) == NULL) {
+			return -1;
+		}
+		tr50_json_delete(json);
+	}
+	return 0;
+}
+
+static int _bench_json_print(void *arg, long long iterations) {
+	_BENCH_JSON *b = (_BENCH_JSON *)arg;
+	char *text;
+
+	while (iterations-- > 0) {
+		if ((text = tr50_json_print_unformatted(b->json)) == NULL) {
+			return -1;
+		}
+		_memory_free(text);
+	}
+	return 0;
+}
+
+// A batch of [commands] property.publish commands, shaped like a typical request.
+static char *_bench_json_request(int commands) {
+	char *text = _memory_malloc(commands * 160 + 16);
+	int i, len = 0;
+
+	bench_seed(0x4a53u);
+	len += sprintf(text, "{");
+	for (i = 0; i < commands; ++i) {
+		len += sprintf(text + len, "%s\"%d\":{\"command\":\"property.publish\",\"params\":{\"thingKey\":\"bench-%04u\",\"key\":\"temp%u\",\"value\":%u.%02u,\"ts\":\"2015-06-18T12:00:%02uZ\"}}",
+			i ? "," : "", i + 1, bench_random() % 10000, bench_random() % 16, bench_random() % 1000, bench_random() % 100, bench_random() % 60);
+	}
+	sprintf(text + len, "}");
+	return text;
+}
+
+void bench_json(void) {
+	static const int commands[] = { 1, 16, 256 };
+	_BENCH_JSON b;
+	char params[32];
+	int i;
+
+	for (i = 0; i < (int)(sizeof(commands) / sizeof(commands[0])); ++i) {
+		b.text = _bench_json_request(commands[i]);
+		b.text_len = (int)strlen(b.text);
+		b.json = tr50_json_parse(b.text);
+		snprintf(params, sizeof(params), "commands=%d", commands[i]);
+
+		bench_run("json.parse", params, b.text_len, _bench_json_parse, &b);
+		bench_run("json.print", params, b.text_len, _bench_json_print, &b);
+
+		tr50_json_delete(b.json);
+		_memory_free(b.text);
+	}
+}
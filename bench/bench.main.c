@@ -0,0 +1,208 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/***************************************************************************/
+/* Microbenchmarks for the codec, JSON, compression and pending paths and  */
+/* end-to-end tr50_api_call_async() throughput against a local broker      */
+/* stand-in. Results are written as JSON so releases can be compared.      */
+/*                                                                         */
+/*   tr50_bench [-f filter] [-r runs] [-t min_time_ms] [-o output.json]    */
+/*                                                                         */
+/* Every benchmark is calibrated until one run takes at least min_time_ms, */
+/* then repeated [runs] times; min/median/max are reported per operation.  */
+/***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tr50/tr50.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/time.h>
+
+#include "bench.h"
+
+#if !defined(BENCH_VERSION)
+#define BENCH_VERSION		"unknown"
+#endif
+
+#define BENCH_MAX_RUNS		32
+
+static const char *g_filter = NULL;
+static int g_runs = 5;
+static long long g_min_time_us = 200000;
+static FILE *g_out;
+static int g_result_count = 0;
+static int g_failed = 0;
+static unsigned int g_random = 1;
+
+void bench_seed(unsigned int seed) {
+	g_random = seed ? seed : 1;
+}
+
+unsigned int bench_random(void) {
+	// xorshift32
+	g_random ^= g_random << 13;
+	g_random ^= g_random >> 17;
+	g_random ^= g_random << 5;
+	return g_random;
+}
+
+char *bench_payload(int len) {
+	static const char *keys[] = { "thingKey", "key", "value", "ts", "lat", "lng", "corrId", "status" };
+	char *out = _memory_malloc(len + 1);
+	char item[64];
+	int pos = 0, n;
+
+	bench_seed(0x7452u);
+	while (pos < len) {
+		n = snprintf(item, sizeof(item), "%s\"%s\":%u", pos == 0 ? "{" : ",", keys[bench_random() % 8], bench_random() % 100000);
+		if (pos + n > len) {
+			n = len - pos;
+		}
+		memcpy(out + pos, item, n);
+		pos += n;
+	}
+	if (len > 0) {
+		out[len - 1] = '}';
+	}
+	out[len] = 0;
+	return out;
+}
+
+static int _bench_compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static long long _bench_time(bench_function func, void *arg, long long iterations, int *ret) {
+	long long started = _time_now_us();
+	*ret = func(arg, iterations);
+	return _time_now_us() - started;
+}
+
+void bench_run(const char *name, const char *params, long long bytes_per_op, bench_function func, void *arg) {
+	double ns_per_op[BENCH_MAX_RUNS];
+	long long iterations = 1, elapsed;
+	double median;
+	int i, ret;
+
+	if (g_filter && strstr(name, g_filter) == NULL) {
+		return;
+	}
+
+	// grow the batch until a single run is long enough to time
+	for (;;) {
+		elapsed = _bench_time(func, arg, iterations, &ret);
+		if (ret != 0) {
+			goto end_error;
+		}
+		if (elapsed >= g_min_time_us) {
+			break;
+		}
+		if (elapsed < g_min_time_us / 100) {
+			iterations *= 100;
+		} else {
+			iterations = iterations * g_min_time_us * 12 / (elapsed * 10) + 1;
+		}
+	}
+
+	for (i = 0; i < g_runs; ++i) {
+		elapsed = _bench_time(func, arg, iterations, &ret);
+		if (ret != 0) {
+			goto end_error;
+		}
+		ns_per_op[i] = (double)elapsed * 1000.0 / (double)iterations;
+	}
+	qsort(ns_per_op, g_runs, sizeof(double), _bench_compare);
+	median = ns_per_op[g_runs / 2];
+
+	fprintf(g_out, "%s\n\t\t{\"name\":\"%s\",\"params\":\"%s\",\"iterations\":%lld,\"ns_per_op\":{\"min\":%.1f,\"median\":%.1f,\"max\":%.1f},\"ops_per_sec\":%.0f",
+		g_result_count++ ? "," : "", name, params, iterations, ns_per_op[0], median, ns_per_op[g_runs - 1], 1e9 / median);
+	if (bytes_per_op > 0) {
+		fprintf(g_out, ",\"bytes_per_sec\":%.0f", (double)bytes_per_op * 1e9 / median);
+	}
+	fprintf(g_out, "}");
+	fflush(g_out);
+	fprintf(stderr, "%-28s %-16s %12.1f ns/op\n", name, params, median);
+	return;
+
+end_error:
+	fprintf(stderr, "%-28s %-16s failed [%d]\n", name, params, ret);
+	++g_failed;
+}
+
+static void _bench_usage(void) {
+	fprintf(stderr, "usage: tr50_bench [-f filter] [-r runs] [-t min_time_ms] [-o output.json]\n");
+}
+
+int main(int argc, char *argv[]) {
+	const char *output = NULL;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (i + 1 < argc && strcmp(argv[i], "-f") == 0) {
+			g_filter = argv[++i];
+		} else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+			g_runs = atoi(argv[++i]);
+		} else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+			g_min_time_us = atoll(argv[++i]) * 1000;
+		} else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+			output = argv[++i];
+		} else {
+			_bench_usage();
+			return 1;
+		}
+	}
+	if (g_runs < 1 || g_runs > BENCH_MAX_RUNS || g_min_time_us <= 0) {
+		_bench_usage();
+		return 1;
+	}
+	if (output == NULL) {
+		g_out = stdout;
+	} else if ((g_out = fopen(output, "w")) == NULL) {
+		fprintf(stderr, "cannot open [%s]\n", output);
+		return 1;
+	}
+
+	log_filter_maximum_log_level(LOG_TYPE_SHOULD_NOT_HAPPEN);
+
+	fprintf(g_out, "{\n\t\"suite\":\"libtr50\",\n\t\"version\":\"%s\",\n\t\"timestamp\":%lld,\n\t\"runs\":%d,\n\t\"min_time_ms\":%lld,\n\t\"results\":[",
+		BENCH_VERSION, (long long)time(NULL), g_runs, g_min_time_us / 1000);
+
+	bench_mqtt();
+	bench_json();
+	bench_compress();
+	bench_pending();
+	bench_memory();
+	bench_api();
+
+	fprintf(g_out, "\n\t]\n}\n");
+	if (g_out != stdout) {
+		fclose(g_out);
+	}
+	return g_failed ? 2 : 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <tr50/tr50.h>
+#include <tr50/util/memory.h>
+
+#include "bench.h"
+
+#define BENCH_MEMORY_LIVE	256
+
+// Frees and reallocates a random slot of a fixed working set, the pattern of request handling.
+typedef struct {
+	int		size;
+	int		system;
+	void	*live[BENCH_MEMORY_LIVE];
+} _BENCH_MEMORY;
+
+static int _bench_memory_churn(void *arg, long long iterations) {
+	_BENCH_MEMORY *b = (_BENCH_MEMORY *)arg;
+	int slot;
+
+	while (iterations-- > 0) {
+		slot = (int)(bench_random() % BENCH_MEMORY_LIVE);
+		if (b->system) {
+			free(b->live[slot]);
+			b->live[slot] = malloc(b->size);
+		} else {
+			_memory_free(b->live[slot]);
+			b->live[slot] = _memory_malloc(b->size);
+		}
+		if (b->live[slot] == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void bench_memory(void) {
+	static const int sizes[] = { 32, 256, 4096 };
+	static const char *allocators[] = { "memory", "accounting", "system" };
+	_BENCH_MEMORY b;
+	char params[48];
+	int i, j, k;
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i) {
+		for (k = 0; k < 3; ++k) {
+			if (k == 1 && tr50_memory_accounting_start() != 0) {
+				continue;
+			}
+			b.system = k == 2;
+			b.size = sizes[i];
+			for (j = 0; j < BENCH_MEMORY_LIVE; ++j) {
+				b.live[j] = b.system ? malloc(b.size) : _memory_malloc(b.size);
+			}
+			snprintf(params, sizeof(params), "allocator=%s,size=%d", allocators[k], b.size);
+			bench_run("memory.churn", params, 0, _bench_memory_churn, &b);
+			for (j = 0; j < BENCH_MEMORY_LIVE; ++j) {
+				if (b.system) {
+					free(b.live[j]);
+				} else {
+					_memory_free(b.live[j]);
+				}
+			}
+			tr50_memory_accounting_stop();
+		}
+	}
+}
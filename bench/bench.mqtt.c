@@ -0,0 +1,88 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/mqtt/mqtt.h>
+#include <tr50/util/memory.h>
+
+#include "bench.h"
+
+typedef struct {
+	char *payload;
+	int payload_len;
+	char *packet;
+	int packet_len;
+} _BENCH_MQTT;
+
+static int _bench_mqtt_build(void *arg, long long iterations) {
+	_BENCH_MQTT *b = (_BENCH_MQTT *)arg;
+	char *data;
+	int ret, data_len;
+
+	while (iterations-- > 0) {
+		if ((ret = _mqtt_msg_build_publish("reply/12345", 1, 0, 42, b->payload, b->payload_len, &data, &data_len)) != 0) {
+			return ret;
+		}
+		_memory_free(data);
+	}
+	return 0;
+}
+
+static int _bench_mqtt_process(void *arg, long long iterations) {
+	_BENCH_MQTT *b = (_BENCH_MQTT *)arg;
+	char *topic, *payload;
+	unsigned short msg_id;
+	int ret, qos, payload_len;
+
+	while (iterations-- > 0) {
+		if ((ret = mqtt_msg_process_publish(b->packet, b->packet_len, &qos, &msg_id, &topic, &payload, &payload_len)) != 0) {
+			return ret;
+		}
+		_memory_free(topic);
+		_memory_free(payload);
+	}
+	return 0;
+}
+
+void bench_mqtt(void) {
+	static const int sizes[] = { 64, 1024, 16384 };
+	_BENCH_MQTT b;
+	char params[32];
+	int i;
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i) {
+		b.payload_len = sizes[i];
+		b.payload = bench_payload(b.payload_len);
+		_mqtt_msg_build_publish("reply/12345", 1, 0, 42, b.payload, b.payload_len, &b.packet, &b.packet_len);
+		snprintf(params, sizeof(params), "payload=%d", b.payload_len);
+
+		bench_run("mqtt.build_publish", params, b.payload_len, _bench_mqtt_build, &b);
+		bench_run("mqtt.process_publish", params, b.payload_len, _bench_mqtt_process, &b);
+
+		_memory_free(b.packet);
+		_memory_free(b.payload);
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+#include <tr50/internal/tr50.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/time.h>
+
+#include "bench.h"
+
+// The pending table is driven directly on a bare client, without the expiration thread,
+// so only the table operations are timed.
+typedef struct {
+	_TR50_CLIENT *client;
+	int size;
+} _BENCH_PENDING;
+
+static int _bench_pending_add_find(void *arg, long long iterations) {
+	_BENCH_PENDING *b = (_BENCH_PENDING *)arg;
+	_TR50_MESSAGE *message;
+	int seq_id;
+
+	while (iterations-- > 0) {
+		seq_id = (int)(bench_random() % b->size) + 1;
+		if ((message = tr50_pending_find_and_remove(b->client, seq_id)) == NULL) {
+			return -1;
+		}
+		tr50_pending_add(b->client, message);
+	}
+	return 0;
+}
+
+// The once-a-second sweep when nothing is due, which is what a busy client pays.
+static int _bench_pending_expire(void *arg, long long iterations) {
+	_BENCH_PENDING *b = (_BENCH_PENDING *)arg;
+	long long now = _time_now();
+
+	while (iterations-- > 0) {
+		if (_tr50_pending_expire(b->client, now) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void bench_pending(void) {
+	static const int sizes[] = { 16, 256, 4096 };
+	_BENCH_PENDING b;
+	_TR50_MESSAGE *message;
+	char params[32];
+	int i, j;
+
+	if ((b.client = _memory_malloc(sizeof(_TR50_CLIENT))) == NULL) {
+		return;
+	}
+	_memory_memset(b.client, 0, sizeof(_TR50_CLIENT));
+	_tr50_mutex_create(&b.client->pending.mux);
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i) {
+		b.size = sizes[i];
+		for (j = 1; j <= b.size; ++j) {
+			tr50_message_create((void **)&message);
+			message->seq_id = j;
+			message->message_type = TR50_MESSAGE_TYPE_OBJ;
+			message->callback_timeout = 3600000;
+			tr50_pending_add(b.client, message);
+		}
+		bench_seed(0x5045u);
+		snprintf(params, sizeof(params), "size=%d", b.size);
+
+		bench_run("pending.add_find", params, 0, _bench_pending_add_find, &b);
+		bench_run("pending.expire", params, 0, _bench_pending_expire, &b);
+
+		while ((message = (_TR50_MESSAGE *)b.client->pending.list_head) != NULL) {
+			tr50_pending_find_and_remove(b.client, message->seq_id);
+			tr50_message_delete(message);
+		}
+	}
+	_tr50_mutex_delete(b.client->pending.mux);
+	_memory_free(b.client);
+}
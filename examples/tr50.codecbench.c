@@ -0,0 +1,236 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/***************************************************************************/
+/* Compares the payload codecs on recorded TR50 traffic.                   */
+/*                                                                         */
+/* The capture file holds one TR50 JSON message per line, as written by an */
+/* api_watcher handler. Every message (or every batch of [batch] messages) */
+/* is encoded the way the client publishes it, decoded by a local platform */
+/* stand-in, re-encoded by the stand-in and decoded through the client's   */
+/* reply path; any mismatch is reported as a failure.                      */
+/*                                                                         */
+/*   tr50_codecbench <capture> [iterations] [batch]                        */
+/***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+#include <tr50/internal/tr50.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/time.h>
+
+#define CODECBENCH_MAX_LINE	65536
+
+static char **g_payloads;
+static int *g_payload_lens;
+static int g_payload_count;
+
+// Consecutive messages are joined with newlines, which stands in for a batched request.
+static int load_capture(const char *path, int batch) {
+	FILE *fp;
+	char *line, *pending = NULL;
+	int cap = 1024, pending_len = 0, pending_count = 0;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		printf("cannot open capture [%s]\n", path);
+		return -1;
+	}
+	line = malloc(CODECBENCH_MAX_LINE);
+	g_payloads = malloc(sizeof(char *) * cap);
+	g_payload_lens = malloc(sizeof(int) * cap);
+	for (;;) {
+		int len = 0, eof = fgets(line, CODECBENCH_MAX_LINE, fp) == NULL;
+
+		if (!eof) {
+			len = strlen(line);
+			while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+				line[--len] = 0;
+			}
+			if (len == 0) {
+				continue;
+			}
+			pending = realloc(pending, pending_len + len + 2);
+			if (pending_len) {
+				pending[pending_len++] = '\n';
+			}
+			memcpy(pending + pending_len, line, len + 1);
+			pending_len += len;
+			++pending_count;
+		}
+		if (pending && (eof || pending_count == batch)) {
+			if (g_payload_count == cap) {
+				cap *= 2;
+				g_payloads = realloc(g_payloads, sizeof(char *) * cap);
+				g_payload_lens = realloc(g_payload_lens, sizeof(int) * cap);
+			}
+			g_payloads[g_payload_count] = pending;
+			g_payload_lens[g_payload_count] = pending_len;
+			++g_payload_count;
+			pending = NULL;
+			pending_len = 0;
+			pending_count = 0;
+		}
+		if (eof) {
+			break;
+		}
+	}
+	free(line);
+	fclose(fp);
+	return g_payload_count;
+}
+
+static double mb_per_sec(long long bytes, long long ms) {
+	if (ms <= 0) {
+		ms = 1;
+	}
+	return ((double)bytes / (1024.0 * 1024.0)) / ((double)ms / 1000.0);
+}
+
+static int bench_codec(_TR50_CLIENT *client, const _TR50_CODEC *codec, int iterations, int first) {
+	long long raw_bytes = 0, encoded_bytes = 0, started, encode_ms, decode_ms;
+	char **encoded;
+	int *encoded_lens;
+	int i, n, failed = 0;
+
+	encoded = malloc(sizeof(char *) * g_payload_count);
+	encoded_lens = malloc(sizeof(int) * g_payload_count);
+	_memory_memset(encoded, 0, sizeof(char *) * g_payload_count);
+
+	started = _time_now();
+	for (n = 0; n < iterations; ++n) {
+		for (i = 0; i < g_payload_count; ++i) {
+			if (encoded[i]) {
+				_memory_free(encoded[i]);
+				encoded[i] = NULL;
+			}
+			if (codec->encode(client, g_payloads[i], g_payload_lens[i], &encoded[i], &encoded_lens[i]) != 0) {
+				encoded[i] = NULL;
+			}
+		}
+	}
+	encode_ms = _time_now() - started;
+
+	for (i = 0; i < g_payload_count; ++i) {
+		raw_bytes += g_payload_lens[i];
+		if (encoded[i] == NULL) {
+			fprintf(stderr, "[%s] payload %d failed to encode\n", codec->name, i + 1);
+			++failed;
+			encoded_bytes += g_payload_lens[i];
+		} else {
+			encoded_bytes += encoded_lens[i];
+		}
+	}
+
+	// platform stand-in decoding what the client published.
+	started = _time_now();
+	for (n = 0; n < iterations; ++n) {
+		for (i = 0; i < g_payload_count; ++i) {
+			char *out = NULL;
+			int out_len;
+
+			if (encoded[i] == NULL) {
+				continue;
+			}
+			if (codec->decode(client, encoded[i], encoded_lens[i], &out, &out_len) != 0) {
+				if (n == 0) {
+					fprintf(stderr, "[%s] payload %d failed to decode\n", codec->name, i + 1);
+					++failed;
+				}
+				continue;
+			}
+			if (n == 0 && (out_len != g_payload_lens[i] || memcmp(out, g_payloads[i], out_len) != 0)) {
+				fprintf(stderr, "[%s] payload %d decoded differently\n", codec->name, i + 1);
+				++failed;
+			}
+			_memory_free(out);
+		}
+	}
+	decode_ms = _time_now() - started;
+
+	// and the client decoding the same bytes sent back on the codec's reply topic.
+	for (i = 0; i < g_payload_count; ++i) {
+		char topic[64], *out = NULL;
+		int out_len;
+
+		if (encoded[i] == NULL) {
+			continue;
+		}
+		snprintf(topic, sizeof(topic), "%s/%d", codec->reply_topic, i + 1);
+		if (_tr50_decompress_payload(client, topic, encoded[i], encoded_lens[i], &out, &out_len) != 0 || out_len != g_payload_lens[i] || memcmp(out, g_payloads[i], out_len) != 0) {
+			fprintf(stderr, "[%s] reply %d failed to round trip\n", codec->name, i + 1);
+			++failed;
+		}
+		if (out) {
+			_memory_free(out);
+		}
+		_memory_free(encoded[i]);
+	}
+	free(encoded);
+	free(encoded_lens);
+
+	printf("%s{\"codec\":\"%s\",\"payloads\":%d,\"raw_bytes\":%lld,\"encoded_bytes\":%lld,\"ratio\":%.3f,\"encode_mb_s\":%.1f,\"decode_mb_s\":%.1f,\"failed\":%d}",
+		first ? "" : ",\n", codec->name, g_payload_count, raw_bytes, encoded_bytes, raw_bytes ? (double)encoded_bytes / raw_bytes : 0.0,
+		mb_per_sec(raw_bytes * iterations, encode_ms), mb_per_sec(raw_bytes * iterations, decode_ms), failed);
+	return failed;
+}
+
+int main(int argc, char *argv[]) {
+	const _TR50_CODEC *codec;
+	void *tr50;
+	int i, iterations, batch, failed = 0, first = 1;
+
+	if (argc < 2) {
+		printf("Usage: tr50_codecbench [capture] [iterations] [batch]\n");
+		return 1;
+	}
+	iterations = argc >= 3 ? atoi(argv[2]) : 100;
+	batch = argc >= 4 ? atoi(argv[3]) : 1;
+	if (iterations <= 0 || batch <= 0) {
+		printf("iterations and batch must be positive\n");
+		return 1;
+	}
+	if (load_capture(argv[1], batch) <= 0) {
+		return 1;
+	}
+
+	tr50_create(&tr50, "codecbench", "localhost", 1883);
+	_tr50_compress_start((_TR50_CLIENT *)tr50); // loads the built-in dictionary
+
+	printf("[\n");
+	for (i = 0; (codec = _tr50_codec_get(i)) != NULL; ++i) {
+		if (!codec->is_supported()) {
+			fprintf(stderr, "[%s] not supported by this build\n", codec->name);
+			continue;
+		}
+		failed += bench_codec((_TR50_CLIENT *)tr50, codec, iterations, first);
+		first = 0;
+	}
+	printf("\n]\n");
+
+	tr50_delete(tr50);
+	return failed ? 1 : 0;
+}
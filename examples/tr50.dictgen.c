@@ -0,0 +1,339 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/***************************************************************************/
+/* Builds and verifies preset compression dictionaries.                    */
+/*                                                                         */
+/* The capture file holds one TR50 JSON message per line, which is what an */
+/* api_watcher handler writing "data" followed by a newline produces.      */
+/*                                                                         */
+/*   tr50_dictgen build <capture> <dictionary> [max_size]                  */
+/*   tr50_dictgen verify <capture> [dictionary]                            */
+/***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+#include <tr50/internal/tr50.h>
+#include <tr50/util/compress.h>
+#include <tr50/util/memory.h>
+
+#define DICTGEN_MAX_LINE		65536
+#define DICTGEN_MIN_FRAGMENT	4
+#define DICTGEN_MAX_FRAGMENT	96
+#define DICTGEN_DEFAULT_SIZE	4096
+#define DICTGEN_TABLE_SIZE		(1 << 20)
+
+typedef struct {
+	char *	text;
+	int		len;
+	int		count;		// number of messages containing the fragment
+	int		last_line;
+} FRAGMENT;
+
+static FRAGMENT *g_table;
+static int g_table_used;
+
+static char **g_lines;
+static int *g_line_lens;
+static int g_line_count;
+
+static int load_capture(const char *path) {
+	FILE *fp;
+	char *buffer;
+	int cap = 1024;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		printf("cannot open capture [%s]\n", path);
+		return -1;
+	}
+	buffer = malloc(DICTGEN_MAX_LINE);
+	g_lines = malloc(sizeof(char *) * cap);
+	g_line_lens = malloc(sizeof(int) * cap);
+	while (fgets(buffer, DICTGEN_MAX_LINE, fp)) {
+		int len = strlen(buffer);
+		while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+			buffer[--len] = 0;
+		}
+		if (len == 0) {
+			continue;
+		}
+		if (g_line_count == cap) {
+			cap *= 2;
+			g_lines = realloc(g_lines, sizeof(char *) * cap);
+			g_line_lens = realloc(g_line_lens, sizeof(int) * cap);
+		}
+		g_lines[g_line_count] = malloc(len + 1);
+		memcpy(g_lines[g_line_count], buffer, len + 1);
+		g_line_lens[g_line_count] = len;
+		++g_line_count;
+	}
+	free(buffer);
+	fclose(fp);
+	return g_line_count;
+}
+
+static unsigned int hash_fragment(const char *text, int len) {
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0; i < len; ++i) {
+		h = (h ^ (unsigned char)text[i]) * 16777619u;
+	}
+	return h;
+}
+
+static void count_fragment(const char *text, int len, int line) {
+	unsigned int slot = hash_fragment(text, len) & (DICTGEN_TABLE_SIZE - 1);
+
+	while (g_table[slot].text) {
+		if (g_table[slot].len == len && memcmp(g_table[slot].text, text, len) == 0) {
+			if (g_table[slot].last_line != line) {
+				g_table[slot].last_line = line;
+				++g_table[slot].count;
+			}
+			return;
+		}
+		slot = (slot + 1) & (DICTGEN_TABLE_SIZE - 1);
+	}
+	if (g_table_used >= DICTGEN_TABLE_SIZE / 2) { // keep probing cheap, drop the long tail
+		return;
+	}
+	g_table[slot].text = malloc(len);
+	memcpy(g_table[slot].text, text, len);
+	g_table[slot].len = len;
+	g_table[slot].count = 1;
+	g_table[slot].last_line = line;
+	++g_table_used;
+}
+
+// Fragments start and end on JSON token boundaries, so numbers and ids in the middle of
+// values are not glued to the keys around them.
+static int is_boundary(char c) {
+	return c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':' || c == '"';
+}
+
+static int score(const FRAGMENT *f) {
+	return (f->count - 1) * (f->len - 3);
+}
+
+static int compare_score_desc(const void *a, const void *b) {
+	return score(*(FRAGMENT **)b) - score(*(FRAGMENT **)a);
+}
+
+static int build(const char *capture, const char *output, int max_size) {
+	FRAGMENT **candidates, **chosen;
+	int i, j, k, candidate_count = 0, chosen_count = 0, size = 0;
+	FILE *fp;
+
+	if (load_capture(capture) <= 0) {
+		return 1;
+	}
+	g_table = calloc(DICTGEN_TABLE_SIZE, sizeof(FRAGMENT));
+
+	for (i = 0; i < g_line_count; ++i) {
+		const char *line = g_lines[i];
+		for (j = 0; j < g_line_lens[i]; ++j) {
+			if (j != 0 && !is_boundary(line[j - 1]) && !is_boundary(line[j])) {
+				continue;
+			}
+			for (k = j + DICTGEN_MIN_FRAGMENT; k <= g_line_lens[i] && k - j <= DICTGEN_MAX_FRAGMENT; ++k) {
+				if (is_boundary(line[k - 1])) {
+					count_fragment(line + j, k - j, i);
+				}
+			}
+		}
+	}
+
+	candidates = malloc(sizeof(FRAGMENT *) * g_table_used);
+	for (i = 0; i < DICTGEN_TABLE_SIZE; ++i) {
+		if (g_table[i].text && g_table[i].count > 1) {
+			candidates[candidate_count++] = &g_table[i];
+		}
+	}
+	qsort(candidates, candidate_count, sizeof(FRAGMENT *), compare_score_desc);
+
+	// greedy pick, skipping fragments already covered by a better one.
+	chosen = malloc(sizeof(FRAGMENT *) * (candidate_count + 1));
+	for (i = 0; i < candidate_count && size < max_size; ++i) {
+		FRAGMENT *f = candidates[i];
+		int covered = 0;
+		if (size + f->len > max_size) {
+			continue;
+		}
+		for (j = 0; j < chosen_count && !covered; ++j) {
+			if (chosen[j]->len >= f->len) {
+				for (k = 0; k + f->len <= chosen[j]->len; ++k) {
+					if (memcmp(chosen[j]->text + k, f->text, f->len) == 0) {
+						covered = 1;
+						break;
+					}
+				}
+			}
+		}
+		if (!covered) {
+			chosen[chosen_count++] = f;
+			size += f->len;
+		}
+	}
+
+	if ((fp = fopen(output, "wb")) == NULL) {
+		printf("cannot write dictionary [%s]\n", output);
+		return 1;
+	}
+	// zlib reaches the end of the dictionary most cheaply: most valuable fragments go last.
+	for (i = chosen_count - 1; i >= 0; --i) {
+		fwrite(chosen[i]->text, 1, chosen[i]->len, fp);
+	}
+	fclose(fp);
+
+	printf("{\"messages\":%d,\"fragments\":%d,\"dictionary_size\":%d}\n", g_line_count, chosen_count, size);
+	return 0;
+}
+
+static char *load_dictionary(const char *path, int *len) {
+	FILE *fp;
+	char *dict;
+	long size;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		printf("cannot open dictionary [%s]\n", path);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	dict = malloc(size > 0 ? size : 1);
+	*len = fread(dict, 1, size, fp);
+	fclose(fp);
+	return dict;
+}
+
+// Round trips every captured message through the client code paths and a local platform
+// stand-in that only knows zlib and the dictionary: requests are encoded by the client and
+// decoded by the stand-in, replies are encoded by the stand-in and decoded by the client.
+static int verify(const char *capture, const char *dictionary) {
+	_TR50_CLIENT *client;
+	void *tr50;
+	char *dict = NULL;
+	int dict_len = 0, i, failed = 0, sent_dict = 0;
+	long long raw_bytes = 0, deflate_bytes = 0, dict_bytes = 0;
+
+	if (load_capture(capture) <= 0) {
+		return 1;
+	}
+	if (!_compress_is_supported()) {
+		printf("compression is not supported by this build\n");
+		return 1;
+	}
+
+	tr50_create(&tr50, "dictgen", "localhost", 1883);
+	client = (_TR50_CLIENT *)tr50;
+	tr50_config_set_compress(tr50, TR50_COMPRESS_DICTIONARY);
+	if (dictionary) {
+		if ((dict = load_dictionary(dictionary, &dict_len)) == NULL) {
+			return 1;
+		}
+		tr50_config_set_compress_dictionary(tr50, dict, dict_len);
+	}
+	_tr50_compress_start(client);
+	client->compress_state = TR50_COMPRESS_STATE_ACTIVE; // as if the probe succeeded
+
+	for (i = 0; i < g_line_count; ++i) {
+		const char *line = g_lines[i];
+		int len = g_line_lens[i];
+		const char *topic;
+		char *out = NULL, *back = NULL, *plain = NULL;
+		int out_len, back_len, plain_len;
+
+		raw_bytes += len;
+		if (_compress_deflate(line, len, &plain, &plain_len) == 0) {
+			deflate_bytes += plain_len;
+			_memory_free(plain);
+		}
+
+		// client -> platform
+		_tr50_compress_payload(client, line, len, &topic, &out, &out_len);
+		if (out == NULL) {
+			dict_bytes += len;
+		} else {
+			dict_bytes += out_len;
+			if (strcmp(topic, TR50_TOPIC_COMPRESS_DICT_API) == 0) {
+				++sent_dict;
+				if (_compress_inflate_dict(out, out_len, client->compress_dictionary, client->compress_dictionary_len, &back, &back_len) != 0) {
+					back = NULL;
+				}
+			} else if (_compress_inflate(out, out_len, &back, &back_len) != 0) {
+				back = NULL;
+			}
+			if (back == NULL || back_len != len || memcmp(back, line, len) != 0) {
+				printf("request %d failed to round trip on [%s]\n", i + 1, topic);
+				++failed;
+			}
+			if (back) {
+				_memory_free(back);
+			}
+			_memory_free(out);
+		}
+
+		// platform -> client
+		back = NULL;
+		if (_compress_deflate_dict(line, len, client->compress_dictionary, client->compress_dictionary_len, &out, &out_len) != 0) {
+			printf("reply %d failed to compress\n", i + 1);
+			++failed;
+			continue;
+		}
+		if (_tr50_decompress_payload(client, TR50_TOPIC_COMPRESS_DICT_REPLY "/1", out, out_len, &back, &back_len) != 0 || back_len != len || memcmp(back, line, len) != 0) {
+			printf("reply %d failed to round trip\n", i + 1);
+			++failed;
+		}
+		if (back) {
+			_memory_free(back);
+		}
+		_memory_free(out);
+	}
+
+	printf("{\"messages\":%d,\"dictionary_id\":\"%08lx\",\"dictionary_size\":%d,\"raw_bytes\":%lld,\"deflate_bytes\":%lld,\"dictionary_bytes\":%lld,\"sent_with_dictionary\":%d,\"failed\":%d}\n",
+		g_line_count, _compress_dictionary_id(client->compress_dictionary, client->compress_dictionary_len), client->compress_dictionary_len,
+		raw_bytes, deflate_bytes, dict_bytes, sent_dict, failed);
+
+	tr50_delete(tr50);
+	if (dict) {
+		free(dict);
+	}
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc >= 4 && strcmp(argv[1], "build") == 0) {
+		return build(argv[2], argv[3], argc >= 5 ? atoi(argv[4]) : DICTGEN_DEFAULT_SIZE);
+	}
+	if (argc >= 3 && strcmp(argv[1], "verify") == 0) {
+		return verify(argv[2], argc >= 4 ? argv[3] : NULL);
+	}
+	printf("Usage: tr50_dictgen build [capture] [dictionary] [max_size]\n");
+	printf("       tr50_dictgen verify [capture] [dictionary]\n");
+	return 1;
+}
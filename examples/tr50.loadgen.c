@@ -0,0 +1,669 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/***************************************************************************/
+/* Load generator: N things on M connections.                              */
+/*                                                                         */
+/* Thing i is served by connection i % M, whose client id is the key of    */
+/* its first thing. Property, alarm and location publishes and mailbox     */
+/* round trips (method.exec to the connection's own thing, acked by the    */
+/* connection) are paced per thing. Requests are sent one at a time        */
+/* (sync), up to [window] outstanding per connection (async), or [batch]   */
+/* commands per message (batch). Without -H the in-process emulator is     */
+/* used in process, or over localhost TCP with -e.                         */
+/*                                                                         */
+/*   tr50_loadgen [-H host | -e port] [-p port] [-s] [-k app_token]        */
+/*                [-x prefix] [-n things] [-c connections] [-d seconds]    */
+/*                [-m sync|async|batch] [-w window] [-b batch]             */
+/*                [-P rate] [-A rate] [-L rate] [-C rate] [-z codec]       */
+/*                [-l min_ms,max_ms] [-j]                                  */
+/*                                                                         */
+/* Rates are per thing per second and may be fractional.                   */
+/***************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <tr50/tr50.h>
+#include <tr50/util/atomic.h>
+#include <tr50/util/histogram.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+#define LOADGEN_PROPERTY		0
+#define LOADGEN_ALARM			1
+#define LOADGEN_LOCATION		2
+#define LOADGEN_MAILBOX			3
+#define LOADGEN_KINDS			4
+
+#define LOADGEN_MODE_SYNC		0
+#define LOADGEN_MODE_ASYNC		1
+#define LOADGEN_MODE_BATCH		2
+
+#define LOADGEN_KEY_MAX			64
+#define LOADGEN_COMMAND_MAX		512
+#define LOADGEN_TIMEOUT			30000
+#define LOADGEN_BATCH_FLUSH_US	50000
+#define LOADGEN_METHOD			"loadgen.ping"
+
+static const char *g_kind_names[LOADGEN_KINDS] = { "property", "alarm", "location", "mailbox" };
+static const char g_kind_ids[LOADGEN_KINDS] = { 'p', 'a', 'l', 'm' };
+
+typedef struct {
+	const char	*host;
+	int			port;
+	int			emulator_port;
+	int			ssl;
+	const char	*app_token;
+	const char	*prefix;
+	int			things;
+	int			connections;
+	int			seconds;
+	int			mode;
+	int			window;
+	int			batch;
+	double		rates[LOADGEN_KINDS];
+	int			compress;
+	int			latency_min;
+	int			latency_max;
+	int			json;
+} LOADGEN_OPTIONS;
+
+typedef struct {
+	volatile long long	sent;
+	volatile long long	ok;
+	volatile long long	failed;
+	_HISTOGRAM			*latency;	// microseconds
+} LOADGEN_KIND_STATS;
+
+typedef struct {
+	int					index;
+	void				*tr50;
+	void				*thread;
+	char				gateway[LOADGEN_KEY_MAX];
+	int					thing_count;
+	int					next_thing[LOADGEN_KINDS];
+	long long			interval_us[LOADGEN_KINDS];
+	long long			next_due[LOADGEN_KINDS];
+	volatile long long	in_flight;
+	long long			sequence;
+
+	char				*batch;
+	int					batch_len;
+	int					batch_cap;
+	int					batch_counts[LOADGEN_KINDS];
+	long long			batch_started;
+} LOADGEN_CONNECTION;
+
+// One outstanding message and how many commands of each kind it carries.
+typedef struct {
+	LOADGEN_CONNECTION	*connection;
+	long long			started;
+	int					counts[LOADGEN_KINDS];
+} LOADGEN_REQUEST;
+
+static LOADGEN_OPTIONS g_options;
+static LOADGEN_KIND_STATS g_stats[LOADGEN_KINDS];
+static LOADGEN_KIND_STATS g_batch;	// messages of batch mode
+static volatile int g_stopping;
+
+static void usage() {
+	printf("Usage: tr50_loadgen [-H host | -e port] [-p port] [-s] [-k app_token] [-x prefix]\n");
+	printf("                    [-n things] [-c connections] [-d seconds]\n");
+	printf("                    [-m sync|async|batch] [-w window] [-b batch]\n");
+	printf("                    [-P rate] [-A rate] [-L rate] [-C rate] [-z codec]\n");
+	printf("                    [-l min_ms,max_ms] [-j]\n");
+	printf("Rates are per thing per second. Without -H the in-process emulator is used,\n");
+	printf("-e serves it on a localhost port instead and -l sets its reply latency.\n");
+}
+
+static int parse_options(int argc, char *argv[], LOADGEN_OPTIONS *options) {
+	int i;
+
+	_memory_memset(options, 0, sizeof(LOADGEN_OPTIONS));
+	options->port = 1883;
+	options->prefix = "loadgen-";
+	options->things = 100;
+	options->connections = 4;
+	options->seconds = 10;
+	options->mode = LOADGEN_MODE_ASYNC;
+	options->window = 64;
+	options->batch = 10;
+	options->rates[LOADGEN_PROPERTY] = 1.0;
+
+	for (i = 1; i < argc; ++i) {
+		const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-' || arg[1] == 0 || arg[2] != 0) {
+			return -1;
+		}
+		if (arg[1] == 's') {
+			options->ssl = 1;
+			continue;
+		}
+		if (arg[1] == 'j') {
+			options->json = 1;
+			continue;
+		}
+		if (value == NULL) {
+			return -1;
+		}
+		++i;
+		switch (arg[1]) {
+		case 'H': options->host = value; break;
+		case 'p': options->port = atoi(value); break;
+		case 'e': options->emulator_port = atoi(value); break;
+		case 'k': options->app_token = value; break;
+		case 'x': options->prefix = value; break;
+		case 'n': options->things = atoi(value); break;
+		case 'c': options->connections = atoi(value); break;
+		case 'd': options->seconds = atoi(value); break;
+		case 'w': options->window = atoi(value); break;
+		case 'b': options->batch = atoi(value); break;
+		case 'P': options->rates[LOADGEN_PROPERTY] = atof(value); break;
+		case 'A': options->rates[LOADGEN_ALARM] = atof(value); break;
+		case 'L': options->rates[LOADGEN_LOCATION] = atof(value); break;
+		case 'C': options->rates[LOADGEN_MAILBOX] = atof(value); break;
+		case 'z': options->compress = atoi(value); break;
+		case 'l':
+			if (sscanf(value, "%d,%d", &options->latency_min, &options->latency_max) == 1) {
+				options->latency_max = options->latency_min;
+			}
+			break;
+		case 'm':
+			if (strcmp(value, "sync") == 0) {
+				options->mode = LOADGEN_MODE_SYNC;
+			} else if (strcmp(value, "async") == 0) {
+				options->mode = LOADGEN_MODE_ASYNC;
+			} else if (strcmp(value, "batch") == 0) {
+				options->mode = LOADGEN_MODE_BATCH;
+			} else {
+				return -1;
+			}
+			break;
+		default:
+			return -1;
+		}
+	}
+	if (options->things <= 0 || options->connections <= 0 || options->seconds <= 0 || options->window <= 0 || options->batch <= 0) {
+		return -1;
+	}
+	if (options->host && options->emulator_port) {
+		return -1;
+	}
+	if (options->connections > options->things) {
+		options->connections = options->things;
+	}
+	for (i = 0; i < LOADGEN_KINDS; ++i) {
+		if (options->rates[i] < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void thing_key(int index, char *key) {
+	snprintf(key, LOADGEN_KEY_MAX, "%s%d", g_options.prefix, index);
+}
+
+// The thing a command is for: connection c serves things c, c + M, c + 2M, ...
+static void next_thing_key(LOADGEN_CONNECTION *connection, int kind, char *key) {
+	int slot = connection->next_thing[kind];
+
+	connection->next_thing[kind] = (slot + 1) % connection->thing_count;
+	thing_key(connection->index + slot * g_options.connections, key);
+}
+
+static int build_command(LOADGEN_CONNECTION *connection, int kind, char *command) {
+	char key[LOADGEN_KEY_MAX];
+	long long sequence = ++connection->sequence;
+
+	next_thing_key(connection, kind, key);
+	switch (kind) {
+	case LOADGEN_PROPERTY:
+		return snprintf(command, LOADGEN_COMMAND_MAX, "\"%c%lld\":{\"command\":\"property.publish\",\"params\":{\"thingKey\":\"%s\",\"key\":\"load\",\"value\":%lld}}",
+			g_kind_ids[kind], sequence, key, sequence % 1000);
+	case LOADGEN_ALARM:
+		return snprintf(command, LOADGEN_COMMAND_MAX, "\"%c%lld\":{\"command\":\"alarm.publish\",\"params\":{\"thingKey\":\"%s\",\"key\":\"state\",\"state\":%lld}}",
+			g_kind_ids[kind], sequence, key, sequence % 4);
+	case LOADGEN_LOCATION:
+		return snprintf(command, LOADGEN_COMMAND_MAX, "\"%c%lld\":{\"command\":\"location.publish\",\"params\":{\"thingKey\":\"%s\",\"lat\":%.5f,\"lng\":%.5f}}",
+			g_kind_ids[kind], sequence, key, 40.0 + (sequence % 1000) / 10000.0, -75.0 - (sequence % 1000) / 10000.0);
+	default:
+		return snprintf(command, LOADGEN_COMMAND_MAX, "\"%c%lld\":{\"command\":\"method.exec\",\"params\":{\"thingKey\":\"%s\",\"method\":\"" LOADGEN_METHOD "\",\"ackTimeout\":%d,\"params\":{\"thing\":\"%s\"}}}",
+			g_kind_ids[kind], sequence, connection->gateway, LOADGEN_TIMEOUT / 1000, key);
+	}
+}
+
+// A failed call fails every command of the message. The latency is the command's own, except in
+// batch mode where a message mixes kinds and it is counted once for the message.
+static void complete_request(LOADGEN_REQUEST *request, int status, const char *reply_json) {
+	long long latency = _time_now_us() - request->started;
+	int kind, i, counted[LOADGEN_KINDS] = { 0 }, batched = g_options.mode == LOADGEN_MODE_BATCH;
+	JSON *reply, *item;
+
+	if (status == 0 && reply_json && (reply = tr50_json_parse(reply_json)) != NULL) {
+		for (item = reply->child; item; item = item->next) {
+			int *success = tr50_json_get_object_item_as_bool(item, "success");
+
+			for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+				if (item->string && item->string[0] == g_kind_ids[kind] && counted[kind] < request->counts[kind]) {
+					break;
+				}
+			}
+			if (kind == LOADGEN_KINDS) {
+				continue;
+			}
+			++counted[kind];
+			_atomic_add64(success && *success ? &g_stats[kind].ok : &g_stats[kind].failed, 1);
+			if (!batched) {
+				_histogram_record(g_stats[kind].latency, latency);
+			}
+		}
+		tr50_json_delete(reply);
+		if (batched) {
+			_atomic_add64(&g_batch.ok, 1);
+			_histogram_record(g_batch.latency, latency);
+		}
+	} else if (batched) {
+		_atomic_add64(&g_batch.failed, 1);
+	}
+	for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+		for (i = counted[kind]; i < request->counts[kind]; ++i) {
+			_atomic_add64(&g_stats[kind].failed, 1);
+		}
+	}
+	_atomic_add64(&request->connection->in_flight, -1);
+	free(request);
+}
+
+static void on_reply(int status, const char *reply_json, void *custom) {
+	complete_request((LOADGEN_REQUEST *)custom, status, reply_json);
+}
+
+static int loadgen_method(void *tr50, const char *id, const char *thing_key, const char *method, const char *from, JSON *params, void *custom) {
+	return tr50_method_ack(tr50, id, 0, NULL, NULL);
+}
+
+// Sends "{<commands>}" the way the mode asks for and accounts for it.
+static void send_message(LOADGEN_CONNECTION *connection, const char *commands, const int *counts) {
+	LOADGEN_REQUEST *request;
+	char *json, *reply = NULL;
+	int kind, len = strlen(commands), ret;
+
+	while (g_options.mode != LOADGEN_MODE_SYNC && _atomic_load64(&connection->in_flight) >= g_options.window && !g_stopping) {
+		_thread_sleep(1);
+	}
+	request = (LOADGEN_REQUEST *)malloc(sizeof(LOADGEN_REQUEST));
+	json = (char *)malloc(len + 3);
+	json[0] = '{';
+	memcpy(json + 1, commands, len);
+	json[len + 1] = '}';
+	json[len + 2] = 0;
+
+	request->connection = connection;
+	memcpy(request->counts, counts, sizeof(request->counts));
+	for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+		_atomic_add64(&g_stats[kind].sent, counts[kind]);
+	}
+	_atomic_add64(&g_batch.sent, 1);
+	_atomic_add64(&connection->in_flight, 1);
+	request->started = _time_now_us();
+
+	if (g_options.mode == LOADGEN_MODE_SYNC) {
+		ret = tr50_api_raw_sync(connection->tr50, json, &reply, LOADGEN_TIMEOUT);
+		complete_request(request, ret, reply);
+		if (reply) {
+			_memory_free(reply);
+		}
+	} else if ((ret = tr50_api_raw_async(connection->tr50, json, NULL, on_reply, request, LOADGEN_TIMEOUT)) != 0) {
+		complete_request(request, ret, NULL);
+	}
+	free(json);
+}
+
+static void flush_batch(LOADGEN_CONNECTION *connection) {
+	if (connection->batch_len == 0) {
+		return;
+	}
+	send_message(connection, connection->batch, connection->batch_counts);
+	connection->batch_len = 0;
+	_memory_memset(connection->batch_counts, 0, sizeof(connection->batch_counts));
+}
+
+static void issue(LOADGEN_CONNECTION *connection, int kind) {
+	char command[LOADGEN_COMMAND_MAX];
+	int counts[LOADGEN_KINDS] = { 0 }, len, batched = 0;
+
+	len = build_command(connection, kind, command);
+	if (g_options.mode != LOADGEN_MODE_BATCH) {
+		counts[kind] = 1;
+		send_message(connection, command, counts);
+		return;
+	}
+	if (connection->batch_len + len + 2 > connection->batch_cap) {
+		connection->batch_cap = (connection->batch_len + len + 2) * 2;
+		connection->batch = (char *)realloc(connection->batch, connection->batch_cap);
+	}
+	if (connection->batch_len == 0) {
+		connection->batch_started = _time_now_us();
+	} else {
+		connection->batch[connection->batch_len++] = ',';
+	}
+	memcpy(connection->batch + connection->batch_len, command, len + 1);
+	connection->batch_len += len;
+	++connection->batch_counts[kind];
+
+	for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+		batched += connection->batch_counts[kind];
+	}
+	if (batched >= g_options.batch) {
+		flush_batch(connection);
+	}
+}
+
+// Issues whichever kind is most overdue first, so a kind that cannot keep up does not starve the others.
+static void *connection_handler(void *arg) {
+	LOADGEN_CONNECTION *connection = (LOADGEN_CONNECTION *)arg;
+	long long now, next;
+	int kind, due;
+
+	while (!g_stopping) {
+		now = _time_now_us();
+		due = -1;
+		for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+			if (connection->interval_us[kind] && (due < 0 || connection->next_due[kind] < connection->next_due[due])) {
+				due = kind;
+			}
+		}
+		next = due < 0 ? now + 100000 : connection->next_due[due];
+		if (next <= now) {
+			issue(connection, due);
+			connection->next_due[due] += connection->interval_us[due];
+			continue;
+		}
+		if (g_options.mode == LOADGEN_MODE_BATCH && connection->batch_len) {
+			if (now - connection->batch_started >= LOADGEN_BATCH_FLUSH_US) {
+				flush_batch(connection);
+				continue;
+			}
+			if (connection->batch_started + LOADGEN_BATCH_FLUSH_US < next) {
+				next = connection->batch_started + LOADGEN_BATCH_FLUSH_US;
+			}
+		}
+		_thread_sleep(next - now >= 1000 ? (int)((next - now) / 1000) : 1);
+	}
+	flush_batch(connection);
+	return NULL;
+}
+
+static void process_usage(double *cpu_seconds, double *rss_mb, double *peak_rss_mb) {
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+	PROCESS_MEMORY_COUNTERS memory;
+
+	*cpu_seconds = 0;
+	*rss_mb = *peak_rss_mb = 0;
+	if (GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+		*cpu_seconds = ((((long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) + (((long long)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 1e7;
+	}
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory))) {
+		*rss_mb = memory.WorkingSetSize / (1024.0 * 1024.0);
+		*peak_rss_mb = memory.PeakWorkingSetSize / (1024.0 * 1024.0);
+	}
+#else
+	struct rusage usage;
+	FILE *fp;
+	char line[128];
+	long kb;
+
+	getrusage(RUSAGE_SELF, &usage);
+	*cpu_seconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	*peak_rss_mb = usage.ru_maxrss / 1024.0; // kB on Linux and FreeBSD
+	*rss_mb = *peak_rss_mb;
+	// both from one read, so the peak is never below the current size
+	if ((fp = fopen("/proc/self/status", "r")) != NULL) {
+		while (fgets(line, sizeof(line), fp) != NULL) {
+			if (sscanf(line, "VmRSS: %ld", &kb) == 1) {
+				*rss_mb = kb / 1024.0;
+			} else if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+				*peak_rss_mb = kb / 1024.0;
+			}
+		}
+		fclose(fp);
+	}
+#endif
+	if (*peak_rss_mb < *rss_mb) {
+		*peak_rss_mb = *rss_mb;
+	}
+}
+
+// The percentile columns of a row, dashes without a histogram.
+static void report_latency(_HISTOGRAM *latency, int json) {
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	long long values[4];
+
+	if (latency == NULL) {
+		if (!json) {
+			printf(" %9s %9s %9s %9s %9s", "-", "-", "-", "-", "-");
+		}
+		return;
+	}
+	_histogram_percentiles(latency, percentiles, values, 4, NULL);
+	if (json) {
+		printf(",\"p50_us\":%lld,\"p90_us\":%lld,\"p99_us\":%lld,\"p999_us\":%lld,\"max_us\":%lld", values[0], values[1], values[2], values[3], _atomic_load64(&latency->max));
+	} else {
+		printf(" %9.2f %9.2f %9.2f %9.2f %9.2f", values[0] / 1000.0, values[1] / 1000.0, values[2] / 1000.0, values[3] / 1000.0, _atomic_load64(&latency->max) / 1000.0);
+	}
+}
+
+// In batch mode the kinds show counts only, and the latency is on a row of its own for messages.
+static void report(LOADGEN_CONNECTION *connections, double seconds, double cpu_seconds) {
+	long long ok, total_ok = 0, total_failed = 0, byte_sent = 0, byte_recv = 0;
+	double rss_mb, peak_rss_mb, ignored;
+	int kind, i, first = 1, batched = g_options.mode == LOADGEN_MODE_BATCH;
+
+	process_usage(&ignored, &rss_mb, &peak_rss_mb);
+	for (i = 0; i < g_options.connections; ++i) {
+		byte_sent += tr50_stats_byte_sent(connections[i].tr50);
+		byte_recv += tr50_stats_byte_recv(connections[i].tr50);
+	}
+
+	if (g_options.json) {
+		printf("{\"mode\":\"%s\",\"things\":%d,\"connections\":%d,\"seconds\":%.3f,\"kinds\":[",
+			g_options.mode == LOADGEN_MODE_SYNC ? "sync" : g_options.mode == LOADGEN_MODE_ASYNC ? "async" : "batch", g_options.things, g_options.connections, seconds);
+	} else {
+		printf("%-10s %10s %10s %10s %8s %9s %9s %9s %9s %9s\n", "kind", "target/s", "done/s", "ok", "failed", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+	}
+	for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+		if (g_options.rates[kind] == 0) {
+			continue;
+		}
+		ok = _atomic_load64(&g_stats[kind].ok);
+		total_ok += ok;
+		total_failed += _atomic_load64(&g_stats[kind].failed);
+		if (g_options.json) {
+			printf("%s{\"kind\":\"%s\",\"target_per_sec\":%.1f,\"done_per_sec\":%.1f,\"sent\":%lld,\"ok\":%lld,\"failed\":%lld",
+				first ? "" : ",", g_kind_names[kind], g_options.rates[kind] * g_options.things, ok / seconds, _atomic_load64(&g_stats[kind].sent),
+				ok, _atomic_load64(&g_stats[kind].failed));
+			report_latency(batched ? NULL : g_stats[kind].latency, 1);
+			printf("}");
+			first = 0;
+		} else {
+			printf("%-10s %10.1f %10.1f %10lld %8lld", g_kind_names[kind], g_options.rates[kind] * g_options.things, ok / seconds, ok, _atomic_load64(&g_stats[kind].failed));
+			report_latency(batched ? NULL : g_stats[kind].latency, 0);
+			printf("\n");
+		}
+	}
+	if (batched) {
+		ok = _atomic_load64(&g_batch.ok);
+		if (g_options.json) {
+			printf("],\"batch\":{\"done_per_sec\":%.1f,\"sent\":%lld,\"ok\":%lld,\"failed\":%lld", ok / seconds, _atomic_load64(&g_batch.sent), ok, _atomic_load64(&g_batch.failed));
+			report_latency(g_batch.latency, 1);
+			printf("}");
+		} else {
+			printf("%-10s %10s %10.1f %10lld %8lld", "batch", "-", ok / seconds, ok, _atomic_load64(&g_batch.failed));
+			report_latency(g_batch.latency, 0);
+			printf("\n");
+		}
+	} else if (g_options.json) {
+		printf("]");
+	}
+	if (g_options.json) {
+		printf(",\"commands_per_sec\":%.1f,\"failed\":%lld,\"bytes_sent\":%lld,\"bytes_recv\":%lld,\"cpu_percent\":%.1f,\"rss_mb\":%.1f,\"peak_rss_mb\":%.1f}\n",
+			total_ok / seconds, total_failed, byte_sent, byte_recv, 100.0 * cpu_seconds / seconds, rss_mb, peak_rss_mb);
+	} else {
+		printf("total %.1f commands/s, %lld failed, %.1f kB/s sent, %.1f kB/s received\n", total_ok / seconds, total_failed, byte_sent / 1024.0 / seconds, byte_recv / 1024.0 / seconds);
+		printf("cpu %.2f s (%.1f%% of one core), rss %.1f MB, peak %.1f MB\n", cpu_seconds, 100.0 * cpu_seconds / seconds, rss_mb, peak_rss_mb);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	LOADGEN_CONNECTION *connections;
+	void *emulator = NULL;
+	long long started, stopped, wait, last_ok = 0, ok;
+	double cpu_start, cpu_end, ignored;
+	int i, kind, ret, failed = 0;
+
+	if (parse_options(argc, argv, &g_options) != 0) {
+		usage();
+		return 1;
+	}
+	if (g_options.host == NULL) {
+		if ((ret = tr50_emulator_create(&emulator)) != 0) {
+			printf("tr50_emulator_create(): ERROR [%d]\n", ret);
+			return 1;
+		}
+		tr50_emulator_set_latency(emulator, g_options.latency_min, g_options.latency_max);
+		if (g_options.emulator_port) {
+			if ((ret = tr50_emulator_listen(emulator, g_options.emulator_port)) != 0) {
+				printf("tr50_emulator_listen(): ERROR [%d]\n", ret);
+				return 1;
+			}
+			g_options.host = "127.0.0.1";
+			g_options.port = g_options.emulator_port;
+		}
+	}
+	for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+		_histogram_create(&g_stats[kind].latency);
+	}
+	_histogram_create(&g_batch.latency);
+
+	connections = (LOADGEN_CONNECTION *)calloc(g_options.connections, sizeof(LOADGEN_CONNECTION));
+	for (i = 0; i < g_options.connections; ++i) {
+		LOADGEN_CONNECTION *connection = &connections[i];
+
+		connection->index = i;
+		connection->thing_count = (g_options.things - i + g_options.connections - 1) / g_options.connections;
+		thing_key(i, connection->gateway);
+		tr50_create(&connection->tr50, connection->gateway, g_options.host ? g_options.host : "emulator", g_options.port);
+		tr50_config_set_compress(connection->tr50, g_options.compress);
+		if (emulator && !g_options.emulator_port) {
+			tr50_config_set_transport(connection->tr50, tr50_emulator_transport(emulator));
+		} else {
+			tr50_config_set_ssl(connection->tr50, g_options.ssl);
+			tr50_config_set_username(connection->tr50, connection->gateway);
+			if (g_options.app_token) {
+				tr50_config_set_password(connection->tr50, g_options.app_token);
+			}
+		}
+		tr50_method_register(connection->tr50, LOADGEN_METHOD, loadgen_method);
+		if ((ret = tr50_start(connection->tr50)) != 0) {
+			printf("tr50_start(%s): ERROR [%d]\n", connection->gateway, ret);
+			return 1;
+		}
+	}
+
+	process_usage(&cpu_start, &ignored, &ignored);
+	started = _time_now_us();
+	for (i = 0; i < g_options.connections; ++i) {
+		LOADGEN_CONNECTION *connection = &connections[i];
+
+		for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+			if (g_options.rates[kind] > 0) {
+				connection->interval_us[kind] = (long long)(1000000.0 / (g_options.rates[kind] * connection->thing_count));
+				if (connection->interval_us[kind] <= 0) {
+					connection->interval_us[kind] = 1;
+				}
+				// spread the connections over the first interval
+				connection->next_due[kind] = started + connection->interval_us[kind] * i / g_options.connections;
+			}
+		}
+		_thread_create(&connection->thread, "TR50:Loadgen", connection_handler, connection);
+	}
+
+	for (i = 1; i <= g_options.seconds; ++i) {
+		if ((wait = started + i * 1000000LL - _time_now_us()) > 0) {
+			_thread_sleep((int)(wait / 1000));
+		}
+		for (ok = 0, kind = 0; kind < LOADGEN_KINDS; ++kind) {
+			ok += _atomic_load64(&g_stats[kind].ok);
+		}
+		if (!g_options.json) {
+			fprintf(stderr, "%3ds %10lld commands/s\n", i, ok - last_ok);
+		}
+		last_ok = ok;
+	}
+	stopped = _time_now_us();
+	g_stopping = 1;
+	for (i = 0; i < g_options.connections; ++i) {
+		_thread_join(connections[i].thread);
+		_thread_delete(connections[i].thread);
+	}
+	// let outstanding requests finish or time out
+	for (i = 0; i < g_options.connections; ++i) {
+		while (_atomic_load64(&connections[i].in_flight) > 0) {
+			_thread_sleep(10);
+		}
+	}
+	process_usage(&cpu_end, &ignored, &ignored);
+
+	report(connections, (stopped - started) / 1e6, cpu_end - cpu_start);
+
+	for (i = 0; i < g_options.connections; ++i) {
+		tr50_stop(connections[i].tr50);
+		tr50_delete(connections[i].tr50);
+		free(connections[i].batch);
+	}
+	free(connections);
+	for (kind = 0; kind < LOADGEN_KINDS; ++kind) {
+		failed += _atomic_load64(&g_stats[kind].failed) > 0;
+		_histogram_delete(g_stats[kind].latency);
+	}
+	_histogram_delete(g_batch.latency);
+	if (emulator) {
+		tr50_emulator_delete(emulator);
+	}
+	return failed ? 1 : 0;
+}
@@ -50,6 +50,28 @@ TR50_EXPORT int tr50_at_init(tr50_at_unsol_callback callback);
 TR50_EXPORT int tr50_at_process(const char *at_input, char **at_output, int *at_output_len, char **data, int *data_len);
 TR50_EXPORT void *tr50_at_handle();
 
+// Replies wait for AT#DWRCV/AT#DWRCVR in a store of capacity entries indexed by id. When it is
+// full, LIFO keeps what is stored and refuses new replies (and AT#DWSEND up front), FIFO drops the
+// oldest reply to make room, and TTL also drops replies stored ttl_ms or longer. tr50_at_init()
+// sets 20 entries and LIFO; changing it keeps what is stored, as far as the new capacity allows.
+#define TR50_AT_STORAGE_LIFO			0
+#define TR50_AT_STORAGE_FIFO			1
+#define TR50_AT_STORAGE_TTL				2
+#define TR50_AT_STORAGE_SIZE_DEFAULT	20
+typedef struct {
+	int			capacity;
+	int			count;
+	int			peak;
+	long long	stored;
+	long long	taken;			// by AT#DWRCV/AT#DWRCVR
+	long long	evicted;		// dropped to make room
+	long long	expired;		// dropped past the TTL
+	long long	refused;		// replies lost to a full store
+	long long	not_found;		// reads of an id that was not stored
+} TR50_AT_STORAGE_STATS;
+TR50_EXPORT int tr50_at_storage_config(int capacity, int policy, int ttl_ms);
+TR50_EXPORT int tr50_at_storage_stats(TR50_AT_STORAGE_STATS *stats);
+
 #ifdef __cplusplus
 }
 #endif
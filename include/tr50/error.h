@@ -59,6 +59,11 @@
 #define ERR_TR50_METHOD_UNKNOWN				-18030
 #define ERR_TR50_MAILBOX_SUSPENDED			-18031
 #define ERR_TR50_MAILBOX_CHECK_IN_PROGRESS  -18032
+#define ERR_TR50_COMPRESS_DICTIONARY		-18033
+#define ERR_TR50_CAPTURE_INVALID			-18034
+#define ERR_TR50_NOT_SUPPORTED				-18035
+#define ERR_TR50_WOULD_BLOCK				-18036
+#define ERR_TR50_CANCELED					-18037
 
 #define ERR_TR50_AT_STORAGE_FULL			-18101
 #define ERR_TR50_AT_SEND_MODE_UNKNOWN		-18102
@@ -101,6 +106,9 @@
 #define ERR_TR50_SOCK_SHUTDOWN				-18324
 #define ERR_TR50_SSL_GENERIC				-18325
 #define ERR_TR50_SSL_CTX					-18326
+#define ERR_TR50_SOCK_BIND_FAILED			-18327
+#define ERR_TR50_SOCK_LISTEN_FAILED			-18328
+#define ERR_TR50_SOCK_ACCEPT_FAILED			-18329
 
 /* connack errors */
 #define ERR_MQTT_MSG_CONNACK_TYPE				-18201
@@ -24,22 +24,27 @@
 
 #include <tr50/tr50.h>
 
+#include <tr50/util/histogram.h>
+
 #define TR50_COMMAND_NAME_LEN	64
 #define TR50_METHOD_NAME_LEN	64
+#define TR50_HANDLER_NAME_LEN	64
 
+// A registered command or method, chained in its registry bucket.
 typedef struct {
-	int						hash;
-	char					name[TR50_COMMAND_NAME_LEN];
-	tr50_command_callback	callback;
+	unsigned int			hash;
+	char					name[TR50_HANDLER_NAME_LEN];
+	void *					callback;	// tr50_command_callback or tr50_method_callback
 	void *					next;
-} _TR50_COMMAND; 
+} _TR50_HANDLER;
 
+// Per-client name to callback table; mux guards lookups too, callbacks run outside it.
 typedef struct {
-	int						hash;
-	char					name[TR50_METHOD_NAME_LEN];
-	tr50_method_callback	callback;
-	void *					next;
-} _TR50_METHOD;
+	void *			mux;
+	_TR50_HANDLER **buckets;
+	int				bucket_count;	// power of two
+	int				count;
+} _TR50_REGISTRY;
 
 typedef struct {
 	char *	client_id;
@@ -51,6 +56,8 @@ typedef struct {
 	int		keepalive_in_ms;
 	int		timeout_in_ms;
 	int		compress;
+	char *	compress_dictionary;
+	int		compress_dictionary_len;
 
 	char *	username;
 	char *	password;
@@ -60,6 +67,27 @@ typedef struct {
 	char *	proxy_username;
 	char *	proxy_password;
 
+	const TR50_TRANSPORT *transport;
+
+	int		inflight_max_requests;
+	long long inflight_max_bytes;
+
+	int		executor_threads;
+	int		executor_queue_depth;
+	int		executor_order;
+
+	int		mailbox_page_size;
+	int		mailbox_ack_batch;
+
+	int		file_chunk_size;
+	int		file_connections;
+	int		file_segment_size;
+	int		file_workers;
+	int		file_queue_max;
+	long long file_bytes_per_second;
+	int		file_gzip_level;
+	int		file_gunzip;
+
 	tr50_async_should_reconnect_callback should_reconnect_callback;
 	void * should_reconnect_custom;
 	tr50_async_non_api_callback non_api_handler;
@@ -67,23 +95,51 @@ typedef struct {
 	tr50_async_state_change_callback state_change_handler;
 	void *	state_change_handler_custom;
 	tr50_async_api_watcher_callback api_watcher_handler;
+	tr50_async_writable_callback writable_handler;
+	void *	writable_handler_custom;
+	tr50_file_progress_callback file_progress_handler;
+	void *	file_progress_handler_custom;
 } _TR50_CONFIG;
 
 #define _TR50_COMPRESSION_HISTORY_MAX		100
 #define _TR50_STATS_LAST_ERROR_MESSAGE_LEN	128
+#define _TR50_STATS_LATENCY_COMMANDS_MAX	64
+
+#define _TR50_STATS_LATENCY_SLOT_FREE		0
+#define _TR50_STATS_LATENCY_SLOT_CLAIMED	1
+#define _TR50_STATS_LATENCY_SLOT_READY		2
+
+// Slots are claimed once per command name and never released, so readers need no lock.
+typedef struct {
+	volatile int	state;
+	char			command[TR50_COMMAND_NAME_LEN];
+	_HISTOGRAM *	histogram;
+} _TR50_STATS_LATENCY_SLOT;
+
+#define _TR50_STATS_RATE_INTERVAL			5000
+#define _TR50_STATS_RATE_WINDOWS			3
+
+// The counters below are bumped with atomic adds and never take mux; mux only guards the
+// error, compression history and rate fields that are updated off the publish path.
 typedef struct {
 	void *		mux;
-	int			pub_sent;
-	int			pub_recv;
-	int			pub_byte_sent;
-	int			pub_byte_recv;
-	long long	total_sent;
-	long long	total_recv;
+	volatile long long	pub_sent;
+	volatile long long	pub_recv;
+	volatile long long	pub_byte_sent;
+	volatile long long	pub_byte_recv;
+	volatile long long	total_sent;
+	volatile long long	total_recv;
 	long long	connected_timestamp;
-	int			connected_count;
-	int			notify_count;
-	int			mailbox_check_count;
-	
+	volatile long long	connected_count;
+	volatile long long	notify_count;
+	volatile long long	mailbox_check_count;
+
+	long long	rate_timestamp;
+	long long	rate_last_msgs;
+	long long	rate_last_bytes;
+	double		rate_msgs[_TR50_STATS_RATE_WINDOWS];
+	double		rate_bytes[_TR50_STATS_RATE_WINDOWS];
+
 	int			last_error;
 	long long	last_error_timestamp;
 	char		last_error_message[_TR50_STATS_LAST_ERROR_MESSAGE_LEN + 1];
@@ -94,16 +150,107 @@ typedef struct {
 
 	int			in_api_call_async;
 	int			in_api_raw_async;
+
+	_HISTOGRAM *latency;
+	_TR50_STATS_LATENCY_SLOT latency_commands[_TR50_STATS_LATENCY_COMMANDS_MAX];
 } _TR50_STATS;
 
+// Request lifecycle events, in the order a request normally sees them.
+#define _TR50_TRACE_SUBMITTED		1
+#define _TR50_TRACE_LOCKED			2
+#define _TR50_TRACE_SERIALIZED		3
+#define _TR50_TRACE_COMPRESSED		4
+#define _TR50_TRACE_ENQUEUED		5
+#define _TR50_TRACE_WRITTEN			6
+#define _TR50_TRACE_REPLY_RECEIVED	7
+#define _TR50_TRACE_PARSED			8
+#define _TR50_TRACE_CALLBACK_START	9
+#define _TR50_TRACE_CALLBACK_END	10
+#define _TR50_TRACE_EXPIRED			11
+
+#define _TR50_TRACE_CAPACITY_MAX	(1 << 20)
+
+typedef struct {
+	volatile long long	sequence;	// ring index + 1 once written, 0 while a writer owns the slot
+	long long			timestamp;	// _time_now_us()
+	int					seq_id;
+	int					type;
+	int					thread_id;
+} _TR50_TRACE_EVENT;
+
+// Overwriting ring; writers claim a slot with one atomic add and never block.
+typedef struct {
+	_TR50_TRACE_EVENT *	events;
+	int					mask;
+	volatile int		enabled;
+	volatile int		writers;	// writers between their check of enabled and their last store
+	volatile long long	head;
+} _TR50_TRACE;
+
+// Byte ring of captured packets: producers copy a record in under mux, the writer thread
+// drains [tail, head) to the file without the lock since producers only write free space.
+typedef struct {
+	void *			mux;
+	void *			evt;
+	volatile int	enabled;
+	void *			thread;
+	void *			file;			// FILE *
+	char *			ring;
+	int				size;
+	long long		head;			// bytes ever written
+	long long		tail;			// bytes ever drained
+	long long		last_us;		// writer only, for timestamp deltas
+	long long		frames;
+	long long		dropped;
+} _TR50_CAPTURE;
+
+// Background file transfers and the keep-alive connections every transfer of the client shares.
+typedef struct {
+	void *			mux;
+	void *			evt;			// set while tasks are queued
+	struct _TR50_FILE_TASK *queue;	// by priority, then submission order
+	struct _TR50_FILE_TASK *running;
+	int				queued;
+	int				running_count;
+	int				next_id;
+	int				stopping;
+	void *			threads[TR50_FILE_WORKERS_MAX];
+	int				thread_count;
+	struct _TR50_HTTP_IDLE *idle;	// connections to the file endpoint between requests
+	int				idle_count;
+	long long		send_at;		// us, when the bandwidth cap lets the next bytes through
+	void *			deflaters[TR50_FILE_WORKERS_MAX];	// gzip streams reset between transfers
+	int				deflater_count;
+	int				deflater_level;
+	void *			inflaters[TR50_FILE_WORKERS_MAX];
+	int				inflater_count;
+	TR50_FILE_STATS	stats;
+} _TR50_FILES;
+
+typedef struct {
+	void *			mux;
+	volatile int	is_stopping;
+	void *			http_thread;
+	void *			http_sock;
+	void *			file_thread;
+	char *			file_path;
+	int				file_interval_in_ms;
+} _TR50_METRICS;
+
 typedef struct {
 	void *	list_head;
 	void *	list_tail;
 	void *	mux;
 	int		count;
+	long long bytes;
 	void *	thread;
 	int		is_deleting;
 	int		expired_count;
+
+	// credit: set when a submit is refused, cleared with credit_evt signaled once one fits again
+	int		refused;
+	int		refused_count;
+	void *	credit_evt;
 } _TR50_PENDING;
 
 typedef struct {
@@ -116,14 +263,21 @@ typedef struct {
 	int		compress;
 	int		is_stopping;
 
+	const char *compress_dictionary;
+	int		compress_dictionary_len;
+	int		compress_state;
+
 	tr50_async_should_reconnect_callback should_reconnect_callback;
 	void * should_reconnect_custom;
 
 	tr50_async_non_api_callback non_api_callback;
 	void *	non_api_callback_custom;
 
+	void *	executor;			// callbacks run here when set, see tr50_config_set_executor()
+	int		executor_order;
+
 // command
-	_TR50_COMMAND *command_head;
+	_TR50_REGISTRY commands;
 
 // pending
 	_TR50_PENDING pending;
@@ -133,15 +287,25 @@ typedef struct {
 
 // stats
 	_TR50_STATS stats;
+	_TR50_METRICS metrics;
+	_TR50_TRACE trace;
+	_TR50_CAPTURE capture;
+
+// file transfers
+	_TR50_FILES files;
 
 // method
-	_TR50_METHOD *method_head;
+	_TR50_REGISTRY methods;
 
 // mailbox
 	int	mailbox_suspend;
 	void * mailbox_check_mux;
 	int mailbox_send_in_progress;
 	int mailbox_another_request;
+	void * mailbox_ack_mux;
+	void * mailbox_acks;			// acks and updates waiting to go out as one message
+	int mailbox_ack_count;
+	volatile int mailbox_dispatching;	// items of checked pages not handled yet
 
 } _TR50_CLIENT;
 
@@ -156,6 +320,8 @@ typedef struct {
 	long long pending_expiration_timestamp;
 	void *	pending_previous;
 	void *	pending_next;
+	int		pending_bytes;		// serialized request, charged against the in-flight cap
+	unsigned int order_key;		// executor key of its reply under TR50_EXECUTOR_ORDER_THING
 
 	JSON *  json;
 	int		is_reply;
@@ -165,28 +331,120 @@ typedef struct {
 
 	void *	raw_callback;
 	void *	reply_callback;
+	int		raw_handoff;		// raw_callback keeps the reply text and frees it
 } _TR50_MESSAGE;
 
+#define TR50_MAX_ID					65536
+
 #define TR50_TOPIC_API				"api"
 #define TR50_TOPIC_REPLY			"reply"
 #define TR50_TOPIC_COMPRESS_API		"apiz"
 #define TR50_TOPIC_COMPRESS_REPLY	"replyz"
+#define TR50_TOPIC_COMPRESS_DICT_API	"apizd"
+#define TR50_TOPIC_COMPRESS_DICT_REPLY	"replyzd"
+#define TR50_TOPIC_COMPRESS_LZ4_API		"apiz4"
+#define TR50_TOPIC_COMPRESS_LZ4_REPLY	"replyz4"
+#define TR50_TOPIC_COMPRESS_ZSTD_API	"apizs"
+#define TR50_TOPIC_COMPRESS_ZSTD_REPLY	"replyzs"
 
 // Pending
 int tr50_pending_create(_TR50_CLIENT *client);
 int tr50_pending_delete(_TR50_CLIENT *client);
 int tr50_pending_add(_TR50_CLIENT *client, _TR50_MESSAGE *message);
 _TR50_MESSAGE *tr50_pending_find_and_remove(_TR50_CLIENT *client, int hash);
+int _tr50_pending_expire(_TR50_CLIENT *client, long long now);
+int _tr50_pending_admit(_TR50_CLIENT *client);
+int _tr50_pending_wait_credit(_TR50_CLIENT *client, int timeout);
+void _tr50_pending_notify(_TR50_CLIENT *client);
+int _tr50_pending_cancel(_TR50_CLIENT *client, int seq_id);
+
+// Executor
+unsigned int _tr50_order_key(const char *text, int len);
+unsigned int _tr50_order_key_json(const char *json);
+void _tr50_executor_start(_TR50_CLIENT *client);
+void _tr50_executor_stop(_TR50_CLIENT *client);
+
+// Mailbox
+int _tr50_mailbox_reply(_TR50_CLIENT *client, const char *command, JSON *params);
+int _tr50_mailbox_flush(_TR50_CLIENT *client);
+
+// Api
+int _tr50_api_raw_async_ex(void *tr50, const char *request_json, int *seq_id, tr50_async_raw_reply_callback reply_callback, void *custom, int timeout, int handoff);
+int _tr50_api_call_async_ex(void *tr50, void *message, int *seq_id, tr50_async_reply_callback reply_callback, void *custom, int timeout, int admit);
+void _tr50_api_call_sync_callback(void *tr50, int status, const void *request_message, void *message, void *custom);
+void _tr50_api_raw_sync_callback(int status, const char *reply_json, void *custom);
+
+// Registry
+int _tr50_registry_create(_TR50_REGISTRY *registry);
+void _tr50_registry_delete(_TR50_REGISTRY *registry);
+int _tr50_registry_set(_TR50_REGISTRY *registry, const char *name, void *callback);
+int _tr50_registry_remove(_TR50_REGISTRY *registry, const char *name);
+void *_tr50_registry_find(_TR50_REGISTRY *registry, const char *name);
+int _tr50_registry_count(_TR50_REGISTRY *registry);
+
+// Payload
+int _tr50_message_from_json(JSON *json, void **tr50_message);
 
 // Stats
 void _tr50_stats_pub_recv_up(_TR50_CLIENT *client, int byte_recv);
 void _tr50_stats_pub_sent_up(_TR50_CLIENT *client, int byte_sent);
 void _tr50_stats_set_compress_ratio(_TR50_CLIENT *client, int data_len, int compressed_len);
 void _tr50_stats_set_connected(_TR50_CLIENT *client);
-void _tr50_stats_latency(_TR50_CLIENT *client, int latency);
+void _tr50_stats_create(_TR50_CLIENT *client);
+void _tr50_stats_delete(_TR50_CLIENT *client);
+void _tr50_stats_latency(_TR50_CLIENT *client, _TR50_MESSAGE *request, long long latency);
+void _tr50_stats_tick(_TR50_CLIENT *client);
 void _tr50_stats_set_last_error(_TR50_CLIENT *client, int error, const char *error_message);
 void _tr50_stats_notify_up(_TR50_CLIENT *client);
 void _tr50_stats_mailbox_check_up(_TR50_CLIENT *client);
 
+// Metrics
+void _tr50_metrics_create(_TR50_CLIENT *client);
+void _tr50_metrics_delete(_TR50_CLIENT *client);
+
+// Trace
+void _tr50_trace(_TR50_CLIENT *client, int seq_id, int type);
+void _tr50_trace_submitted(_TR50_CLIENT *client, int seq_id, long long submitted);
+void _tr50_trace_delete(_TR50_CLIENT *client);
+
+// File transfers
+void _tr50_file_create(_TR50_CLIENT *client);
+void _tr50_file_delete(_TR50_CLIENT *client);
+
+// Capture
+void _tr50_capture_create(_TR50_CLIENT *client);
+void _tr50_capture_delete(_TR50_CLIENT *client);
+void _tr50_capture_frame(int direction, const char **bufs, const int *lens, int count, void *custom);
+void _tr50_publish_handler(const char *topic, const char *data, int data_len, void *custom);
+
+// Loopback
+int _tr50_loopback_publish_named(void *loopback, const char *name, const char *topic, const char *data, int len);
+int _tr50_loopback_has_sessions(void *loopback);
+
 // Config
 void _tr50_config_delete(_TR50_CONFIG *config);
+
+// Compression
+typedef struct {
+	int			id;				// TR50_COMPRESS_*
+	const char *name;
+	const char *api_topic;
+	const char *reply_topic;
+	int			min_len;		// smaller payloads are not worth encoding
+	int			negotiate;		// the platform has to answer a probe before the codec is used
+
+	int (*is_supported)(void);
+	int (*encode)(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len);
+	int (*decode)(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len);
+	int (*decode_stream)(_TR50_CLIENT *client, const char *in, int in_len, int (*sink)(const char *data, int data_len, void *custom), void *custom);
+} _TR50_CODEC;
+
+const _TR50_CODEC *_tr50_codec_get(int index);
+const _TR50_CODEC *_tr50_codec_find(int id);
+const _TR50_CODEC *_tr50_codec_find_by_reply_topic(const char *topic);
+const _TR50_CODEC *_tr50_codec_find_by_api_topic(const char *topic);
+void _tr50_compress_dictionary_default(const char **dictionary, int *dictionary_len);
+void _tr50_compress_start(_TR50_CLIENT *client);
+int _tr50_compress_payload(_TR50_CLIENT *client, const char *raw, int raw_len, const char **topic, char **out, int *out_len);
+int _tr50_decompress_payload(_TR50_CLIENT *client, const char *topic, const char *data, int data_len, char **out, int *out_len);
+int _tr50_decompress_payload_json(_TR50_CLIENT *client, const char *topic, const char *data, int data_len, JSON **json, int *decoded_len);
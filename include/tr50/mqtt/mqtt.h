@@ -25,11 +25,16 @@
 #define _TR50_MQTT_H_
 
 #include <tr50/error.h>
+#include <tr50/transport.h>
 
 typedef void(*mqtt_async_publish_callback)(const char *topic, const char *data, int len, void *custom);
 typedef void(*mqtt_async_state_change_callback)(int previous_state, int current_state, int status, const char *why, void *custom);
 typedef int(*mqtt_async_should_reconnect_callback)(int disconnected_in_ms, int last_reconnect_in_ms, void *custom);
 typedef void(*mqtt_qos_callback)(int status, void *custom);
+// One complete MQTT packet, possibly in several buffers, after it was sent or received.
+typedef void(*mqtt_frame_callback)(int direction, const char **bufs, const int *lens, int count, void *custom);
+#define MQTT_FRAME_IN	0
+#define MQTT_FRAME_OUT	1
 
 #if defined(_WIN32)
 #  if defined(EXPORT_TR50_SYMS)
@@ -52,6 +57,9 @@ TR50_EXPORT unsigned short mqtt_connect_params_get_keepalive(void *connect_param
 TR50_EXPORT int mqtt_connect_params_use_ssl(void *connect_params);
 TR50_EXPORT int mqtt_connect_params_use_https_proxy(void *connect_params);
 TR50_EXPORT int mqtt_connect_params_use_proxy(void *connect_params, int type, const char *addr, const char *username, const char *password);
+TR50_EXPORT int mqtt_connect_params_set_transport(void *connect_params, const TR50_TRANSPORT *transport);
+// Every packet after CONNECT (which carries the password) is passed to the callback on the I/O thread.
+TR50_EXPORT int mqtt_connect_params_set_frame_callback(void *connect_params, mqtt_frame_callback callback, void *custom);
 
 TR50_EXPORT int mqtt_async_connect(	void **async_client,
 									void *connect_params,
@@ -91,6 +99,9 @@ TR50_EXPORT int mqtt_async_disconnect(void *async_client);
 }
     
 
+/* Largest PUBLISH header mqtt_publish() builds on the stack; longer topics take the copying path */
+#define MQTT_PUBLISH_HEADER_MAX		256
+
 /* Mask to get the message type from a MQIsdp message */
 #define MQTT_GET_MSG_TYPE 0xF0
 
@@ -118,6 +129,17 @@ TR50_EXPORT int mqtt_async_disconnect(void *async_client);
 #define MQTT_OPT_DUPLICATE		0x08
 #define MQTT_OPT_QOS_FAILURE	0x80
 
+/* Variable header connect options */
+#define MQTT_CONN_OPT_USERNAME        0x80
+#define MQTT_CONN_OPT_PASSWORD        0x40
+#define MQTT_CONN_OPT_WILL_RETAIN     0x20
+#define MQTT_CONN_OPT_WILL            0x04
+#define MQTT_CONN_OPT_CLEAN_START     0x02
+#define MQTT_CONN_OPT_CLEAN_START_OFF 0xFD /* AND mask - turn off bit 1 */
+#define MQTT_CONN_OPT_QOS_0           0xE7 /* AND mask - turn off bits 3 and 4 */
+#define MQTT_CONN_OPT_QOS_1           0x08
+#define MQTT_CONN_OPT_QOS_2           0x10
+
 /* Subscribe payload QoS options */
 #define MQTT_PAYLOAD_QOS_0       0x00
 #define MQTT_PAYLOAD_QOS_1       0x01
@@ -125,8 +147,12 @@ TR50_EXPORT int mqtt_async_disconnect(void *async_client);
 
 typedef struct {
 	void *		sock;
+	const TR50_TRANSPORT *transport;
 	long long	last_recv;
 
+	mqtt_frame_callback frame_callback;
+	void *		frame_custom;
+
 	long long	byte_sent;
 	long long	byte_recv;
 } _MQTT_CLIENT;
@@ -150,6 +176,7 @@ int mqtt_connect_params_use_proxy(void *connect_params, int type, const char *ad
 int mqtt_connect(void **mqtt_handle, void *connect_params);
 int mqtt_disconnect(void *mqtt_handle);
 int mqtt_send(void *mqtt_handle, const char *buf, int len, int timeout);
+int mqtt_sendv(void *mqtt_handle, const char **bufs, const int *lens, int count, int timeout);
 int mqtt_recv(void *mqtt_handle, char **data, int *len, int timeout);
 int mqtt_publish(void *mqtt_handle, int qos, int retain, unsigned short message_id, const char *topic, const char *data, int data_len);
 int mqtt_subscribe(void *mqtt_handle, unsigned short msg_id, const char *topic, int qos);
@@ -171,6 +198,7 @@ int mqtt_msg_process_unsuback(const char *data, int data_len, unsigned short *ms
 // internal function to build message
 int _mqtt_msg_build_connect(const char *client_id, const char *username, const char *password, unsigned short keepalive, char **data, int *data_len);
 int _mqtt_msg_build_publish(const char *topic, int qos, int retain, unsigned short msg_id, const char *payload, int payload_len, char **data, int *data_len);
+int _mqtt_msg_build_publish_header(const char *topic, int qos, int retain, unsigned short msg_id, int payload_len, char *header, int header_size, int *header_len);
 int _mqtt_msg_build_subscribe(const char *topic, int qos, unsigned short msg_id, char **data, int *data_len);
 int _mqtt_msg_build_unsubscribe(const char *topic, unsigned short msg_id, char **data, int *data_len);
 int _mqtt_msg_build_disconnect(char **data, int *data_len);
@@ -183,6 +211,7 @@ int mqtt_qos_add(void *qos, unsigned short msg_id, mqtt_qos_callback callback, v
 int mqtt_qos_signal(void *qos, unsigned short msg_id);
 int mqtt_qos_clear(void *qos, int status);
 int mqtt_qos_any_expired(void *qos);
+int mqtt_qos_count(void *qos);
 
 int _mqtt_decode_header_length(char *ptr, long ptr_len, int *encoded_size, int *decoded_len);
 
@@ -209,11 +238,16 @@ int _mqtt_decode_header_length(char *ptr, long ptr_len, int *encoded_size, int *
 //int	mqtt_async_publish(void *async_client, const char *topic, const char *data, int len);
 //int mqtt_async_disconnect(void *async_client);
 int mqtt_async_state(void *async_client);
+// Called from the publish callback, keeps the payload it was handed: the caller then frees it
+// with _memory_free(). NULL on any other thread or for any other buffer, copy it then.
+char *mqtt_async_take_payload(void *async_client, const char *payload);
 //void *mqtt_async_base_handle(void *async_client);
 int mqtt_async_reconnect_count(void *async_client);
 int mqtt_async_reconnect_attempt_count(void *async_client);
 long long mqtt_async_stats_byte_sent(void *async_client);
 long long mqtt_async_stats_byte_recv(void *async_client);
 void mqtt_async_stats_clear(void *async_client);
+int mqtt_async_stats_qos_inflight(void *async_client);
+int mqtt_async_stats_qos_expired(void *async_client);
 
 #endif  //_TR50_MQTT_H_
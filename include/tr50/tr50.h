@@ -42,6 +42,7 @@ extern "C" {
 #include <stddef.h>
 #include <tr50/util/json.h>
 #include <tr50/error.h>
+#include <tr50/transport.h>
 
 #if !defined(TRUE)
 #  define TRUE 1
@@ -108,14 +109,17 @@ TR50_EXPORT int tr50_api_raw_async(void *tr50, const char *request_json, int *se
 TR50_EXPORT int tr50_api_raw_sync(void *tr50, const char *request_json, char **reply_json, int timeout);
 // method
 typedef int(*tr50_method_callback)(void * tr50, const char *id, const char *thing_key, const char *method, const char *from, JSON *params, void * custom);
+// Registering a name again replaces its callback; names are shorter than 64 bytes.
 TR50_EXPORT int tr50_method_register(void *tr50, const char *method, tr50_method_callback callback);
+TR50_EXPORT int tr50_method_unregister(void *tr50, const char *method);
 TR50_EXPORT int tr50_method_process(void *tr50, const char *id, const char *thing_key, const char *method, const char *from, JSON *params, void *custom);
 TR50_EXPORT int tr50_method_update(void *tr50, const char *id, const char *msg);
 TR50_EXPORT int tr50_method_ack(void *tr50, const char *id, int status, const char *err_message, JSON *ack_params);
-TR50_EXPORT int tr50_is_method_registered();
+TR50_EXPORT int tr50_is_method_registered(void *tr50);
 // Command
 typedef int (*tr50_command_callback)(const char *id, const char *thing_key, const char *command, const char *from, JSON *params);
 TR50_EXPORT int tr50_command_register(void *tr50, const char *command, tr50_command_callback callback);
+TR50_EXPORT int tr50_command_unregister(void *tr50, const char *command);
 TR50_EXPORT int tr50_command_process(void *tr50, const char *id, const char *thing_key, const char *command, const char *from, JSON *params, void *custom);
 TR50_EXPORT int tr50_command_update(void *tr50, const char *id, const char *msg);
 TR50_EXPORT int tr50_command_ack(void *tr50, const char *id, int status, const char *err_message, JSON *ack_params);
@@ -123,6 +127,8 @@ TR50_EXPORT int tr50_command_ack(void *tr50, const char *id, int status, const c
 // Statistic
 TR50_EXPORT int tr50_pending_count(void *tr50);
 TR50_EXPORT int tr50_pending_expired_count(void *tr50);
+TR50_EXPORT long long tr50_pending_bytes(void *tr50);
+TR50_EXPORT int tr50_pending_refused_count(void *tr50);
 
 // configuration
 typedef void (*tr50_async_non_api_callback)(const char *topic, const char *data, int data_len, void *custom);
@@ -133,6 +139,76 @@ typedef void(*tr50_async_api_watcher_callback)(const char *data, int len, int is
 TR50_EXPORT int			tr50_config_set_api_watcher_handler(void *tr50, tr50_async_api_watcher_callback callback);
 typedef int(*tr50_async_should_reconnect_callback)(int disconnected_in_ms, int last_reconnect_in_ms, void *custom);
 TR50_EXPORT int			tr50_config_set_should_reconnect_handler(void *tr50, tr50_async_should_reconnect_callback callback, void *custom);
+// Caps on requests waiting for a reply and on their serialized bytes, 0 for no cap. A request
+// is admitted while both are under their cap, so bytes overshoot by at most one request.
+// tr50_api_call(), tr50_api_call_async() and tr50_api_raw_async() fail with ERR_TR50_WOULD_BLOCK
+// past a cap; the sync calls wait for credit within their timeout. Mailbox acks and updates
+// are not capped.
+TR50_EXPORT int			tr50_config_set_inflight_limit(void *tr50, int max_requests, long long max_bytes);
+// Callback executor: with threads > 0, reply callbacks, mailbox commands and methods and the
+// non-API handler run on a pool of worker threads, and the receive thread only parses packets
+// and matches replies to requests. Each worker queues up to queue_depth tasks; past that the
+// receive thread waits for room. order picks the key that keeps tasks on one worker in arrival
+// order:
+//   TR50_EXECUTOR_ORDER_NONE    none, tasks go round robin
+//   TR50_EXECUTOR_ORDER_THING   thingKey: a reply by the first thingKey in its request (none means
+//                               the client's own thing), a mailbox item by its own
+//   TR50_EXECUTOR_ORDER_SEQ_ID  request: a reply alone, the items of one mailbox check together
+// Other publishes are ordered by topic unless order is NONE. Replies to the sync calls are not
+// queued, so a callback may make them. Takes effect at the next tr50_start().
+#define TR50_EXECUTOR_ORDER_NONE	0
+#define TR50_EXECUTOR_ORDER_THING	1
+#define TR50_EXECUTOR_ORDER_SEQ_ID	2
+TR50_EXPORT int			tr50_config_set_executor(void *tr50, int threads, int queue_depth, int order);
+// Mailbox draining: page_size > 0 limits each mailbox.check to that many messages, and a full
+// page has the next check sent before its messages are handled. With ack_batch > 1 the acks and
+// updates sent while checked messages are being handled go out together, up to ack_batch per
+// message, once the last of them is handled; the ack and update calls then return 0 as soon as
+// they are queued. Defaults are 0 and 1, one unlimited check at a time and one message per ack.
+#define TR50_MAILBOX_ACK_BATCH_MAX	100
+TR50_EXPORT int			tr50_config_set_mailbox_batch(void *tr50, int page_size, int ack_batch);
+// Size of the HTTP chunks tr50_helper_file_upload() sends and of the buffer tr50_file_download()
+// receives into, 64 KB by default. Uploads over plain TCP on Linux and FreeBSD are sent from the
+// file cache with sendfile() and only buffer when it is not available.
+#define TR50_FILE_CHUNK_SIZE_MIN		1024
+#define TR50_FILE_CHUNK_SIZE_MAX		(16 * 1024 * 1024)
+#define TR50_FILE_CHUNK_SIZE_DEFAULT	(64 * 1024)
+TR50_EXPORT int			tr50_config_set_file_chunk_size(void *tr50, int chunk_size);
+// tr50_file_download() fetches files in HTTP Range segments of segment_size bytes over up to
+// connections parallel connections, retrying a failed segment from where it stopped. Finished
+// segments are recorded in "<dest>.part", and a later download to the same dest skips them as
+// long as the file is unchanged on the server. Servers that do not answer ranges are read in one
+// stream. Defaults are 1 connection and 4 MB segments.
+#define TR50_FILE_CONNECTIONS_MAX		16
+#define TR50_FILE_SEGMENT_SIZE_DEFAULT	(4 * 1024 * 1024)
+TR50_EXPORT int			tr50_config_set_file_download(void *tr50, int connections, int segment_size);
+// Download progress: bytes of the file written so far (a resumed download starts above 0), its
+// size or -1 when unknown, and the receive rate of this call. Called from the download threads,
+// one at a time, at most every 250 ms and when the last byte is written.
+typedef void(*tr50_file_progress_callback)(void *tr50, const char *file_name, long long done, long long total, long long bytes_per_second, void *custom);
+TR50_EXPORT int			tr50_config_set_file_progress_handler(void *tr50, tr50_file_progress_callback callback, void *custom);
+// Background transfers (tr50_file_upload_async(), tr50_file_download_async()) run on up to workers
+// threads, started by the first submit; up to queue_max more wait by priority and submits past
+// that fail with ERR_TR50_WOULD_BLOCK. bytes_per_second > 0 caps the combined rate of every file
+// transfer of the client, sync ones included. Defaults are 2 workers, 64 queued and no cap.
+#define TR50_FILE_WORKERS_MAX			8
+TR50_EXPORT int			tr50_config_set_file_transfer(void *tr50, int workers, int queue_max, long long bytes_per_second);
+// gzip_level 1-9 gzips uploads while they are sent, so the platform stores the gzip data; 0 sends
+// files as they are. gunzip picks the downloads that are inflated into dest:
+//   TR50_FILE_GUNZIP_OFF      none
+//   TR50_FILE_GUNZIP_ENCODED  those sent with Content-Encoding: gzip
+//   TR50_FILE_GUNZIP_SNIFF    those too, and any body starting with the gzip magic bytes; a stored
+//                             .gz file is inflated as well
+// With gunzip on, downloads come in one stream instead of ranges. Both are off by default, and
+// need a port with zlib (ERR_TR50_NOT_SUPPORTED otherwise).
+#define TR50_FILE_GUNZIP_OFF			0
+#define TR50_FILE_GUNZIP_ENCODED		1
+#define TR50_FILE_GUNZIP_SNIFF			2
+TR50_EXPORT int			tr50_config_set_file_gzip(void *tr50, int gzip_level, int gunzip);
+// Called once credit frees up after a submit was refused, on the thread that took the reply or
+// expired the request; it should only wake producers.
+typedef void(*tr50_async_writable_callback)(void *tr50, void *custom);
+TR50_EXPORT int			tr50_config_set_writable_handler(void *tr50, tr50_async_writable_callback callback, void *custom);
 TR50_EXPORT int			tr50_config_set_host(void *tr50, const char *host);
 TR50_EXPORT int			tr50_config_set_port(void *tr50, int port);
 TR50_EXPORT int			tr50_config_set_keeplive(void *tr50, int keepalive_in_ms);
@@ -143,12 +219,23 @@ TR50_EXPORT int			tr50_config_set_password(void *tr50, const char *password);
 TR50_EXPORT int			tr50_config_set_ssl(void *tr50, int enabled);
 TR50_EXPORT int			tr50_config_set_https_proxy(void *tr50, int enabled);
 TR50_EXPORT int			tr50_config_set_compress(void *tr50, int enabled);
+#define TR50_COMPRESS_NONE			0
+#define TR50_COMPRESS_DEFLATE		1
+#define TR50_COMPRESS_DICTIONARY	2
+#define TR50_COMPRESS_LZ4			3
+#define TR50_COMPRESS_ZSTD			4
+// Whether this build can encode and decode the given TR50_COMPRESS_* codec.
+TR50_EXPORT int			tr50_compress_is_supported(int codec);
+// Dictionary used by TR50_COMPRESS_DICTIONARY, NULL restores the built-in one.
+TR50_EXPORT int			tr50_config_set_compress_dictionary(void *tr50, const char *dictionary, int dictionary_len);
 #define TR50_PROXY_TYPE_NONE	0
 #define TR50_PROXY_TYPE_HTTP	1
 #define TR50_PROXY_TYPE_SOCK4	2
 #define TR50_PROXY_TYPE_SOCK4A	3
 #define TR50_PROXY_TYPE_SOCK5	4
 TR50_EXPORT int			tr50_config_set_proxy(void *tr50, int type, const char *addr, const char *username, const char *password);
+// Transport used from the next tr50_start(), NULL restores TCP. The transport must outlive the connection.
+TR50_EXPORT int			tr50_config_set_transport(void *tr50, const TR50_TRANSPORT *transport);
 
 TR50_EXPORT const char *tr50_config_get_host(void *tr50);
 TR50_EXPORT int			tr50_config_get_port(void *tr50);
@@ -158,11 +245,17 @@ TR50_EXPORT int			tr50_config_get_timeout(void *tr50);
 TR50_EXPORT const char *tr50_config_get_username(void *tr50);
 TR50_EXPORT const char *tr50_config_get_password(void *tr50);
 
-TR50_EXPORT int			tr50_stats_byte_recv(void *tr50);
-TR50_EXPORT int			tr50_stats_byte_sent(void *tr50);
+TR50_EXPORT long long	tr50_stats_byte_recv(void *tr50);
+TR50_EXPORT long long	tr50_stats_byte_sent(void *tr50);
 TR50_EXPORT int			tr50_stats_pub_recv(void *tr50);
 TR50_EXPORT int			tr50_stats_pub_sent(void *tr50);
 TR50_EXPORT int			tr50_stats_compress_ratio(void *tr50);
+// Negotiation state of the dictionary, LZ4 and zstd codecs.
+#define TR50_COMPRESS_STATE_UNKNOWN		0
+#define TR50_COMPRESS_STATE_PROBING		1
+#define TR50_COMPRESS_STATE_ACTIVE		2
+#define TR50_COMPRESS_STATE_REJECTED	3
+TR50_EXPORT int			tr50_stats_compress_state(void *tr50);
 TR50_EXPORT long long	tr50_stats_last_connected(void *tr50);
 TR50_EXPORT int			tr50_stats_reconnect_attempt_count(void *tr50);
 TR50_EXPORT int			tr50_stats_reconnect_count(void *tr50);
@@ -172,9 +265,199 @@ TR50_EXPORT int			tr50_stats_mailbox_check(void *tr50);
 TR50_EXPORT int			tr50_stats_in_api_call_async(void *tr50);
 TR50_EXPORT int			tr50_stats_in_api_raw_async(void *tr50);
 
+// Request to reply round trip in ms, overall (command NULL) or per command name.
+typedef struct {
+	long long	count;
+	long long	p50;
+	long long	p90;
+	long long	p99;
+	long long	p999;
+	long long	max;
+} TR50_STATS_LATENCY;
+TR50_EXPORT int			tr50_stats_latency(void *tr50, const char *command, TR50_STATS_LATENCY *latency);
+typedef void (*tr50_stats_latency_callback)(const char *command, const TR50_STATS_LATENCY *latency, void *custom);
+TR50_EXPORT int			tr50_stats_latency_for_each(void *tr50, tr50_stats_latency_callback callback, void *custom);
+
+// Rates are exponentially weighted moving averages of publishes (sent + received) per second
+// and their payload bytes per second, updated every 5 seconds.
+#define TR50_STATS_RATE_1M		0
+#define TR50_STATS_RATE_5M		1
+#define TR50_STATS_RATE_15M		2
+typedef struct {
+	long long	timestamp;
+	long long	pub_sent;
+	long long	pub_recv;
+	long long	pub_byte_sent;
+	long long	pub_byte_recv;
+	long long	byte_sent;
+	long long	byte_recv;
+	long long	connected_timestamp;
+	long long	connected_count;
+	int			reconnect_attempt_count;
+	int			reconnect_count;
+	long long	notify_count;
+	long long	mailbox_check_count;
+	int			last_error;
+	long long	last_error_timestamp;
+	int			compress_ratio;
+	int			compress_state;
+	int			pending_count;
+	int			pending_expired_count;
+	long long	pending_bytes;
+	int			pending_refused_count;
+	int			qos_inflight;
+	int			qos_expired_count;
+	double		msg_rate[3];
+	double		byte_rate[3];
+} TR50_STATS_SNAPSHOT;
+TR50_EXPORT int			tr50_stats_snapshot(void *tr50, TR50_STATS_SNAPSHOT *snapshot);
+
+// Lag is the time a task waited in its queue. All zero while no executor runs.
+typedef struct {
+	int			threads;
+	int			queue_depth;
+	int			queued;
+	int			queued_max;
+	long long	executed;
+	long long	blocked;		// times the receive thread waited for room
+	long long	lag_p50_us;
+	long long	lag_p99_us;
+	long long	lag_max_us;
+} TR50_EXECUTOR_STATS;
+TR50_EXPORT int			tr50_executor_stats(void *tr50, TR50_EXECUTOR_STATS *stats);
+
+// File bytes read or written locally and body bytes on the wire, which differ by what gzip saved.
+typedef struct {
+	long long	uploads;
+	long long	upload_bytes;
+	long long	upload_wire_bytes;
+	long long	downloads;
+	long long	download_bytes;
+	long long	download_wire_bytes;
+} TR50_FILE_STATS;
+TR50_EXPORT int			tr50_file_stats(void *tr50, TR50_FILE_STATS *stats);
+
 TR50_EXPORT void		tr50_stats_clear_compression_ratio(void *tr50);
 TR50_EXPORT void		tr50_stats_clear_send_recv(void *tr50);
 TR50_EXPORT void		tr50_stats_clear_last_error(void *tr50);
+TR50_EXPORT void		tr50_stats_clear_latency(void *tr50);
+
+// Metrics exporter, OpenMetrics text format. The rendered text is released with _memory_free().
+TR50_EXPORT int			tr50_metrics_render(void *tr50, char **text, int *text_len);
+TR50_EXPORT int			tr50_metrics_serve(void *tr50, int port);
+TR50_EXPORT int			tr50_metrics_write_file(void *tr50, const char *path, int interval_in_ms);
+TR50_EXPORT int			tr50_metrics_stop(void *tr50);
+
+// Request lifecycle tracing into a ring of the last capacity events, exported as Chrome trace
+// JSON (chrome://tracing, ui.perfetto.dev). The exported text is released with _memory_free().
+TR50_EXPORT int			tr50_trace_start(void *tr50, int capacity);
+TR50_EXPORT int			tr50_trace_stop(void *tr50);
+TR50_EXPORT int			tr50_trace_export(void *tr50, char **json, int *json_len);
+
+// Traffic capture: every MQTT packet after CONNECT (which carries the password) is copied
+// into a ring of ring_size bytes on the I/O threads and written to path by a background
+// thread. Packets that do not fit in the ring are dropped and counted. The file starts with
+// "TR50CAP" and a version byte, then the wall clock start time in ms (8 bytes, little endian);
+// each packet is a direction byte, varint microseconds since the previous packet on the
+// monotonic clock, varint length and the packet itself.
+#define TR50_CAPTURE_IN				0
+#define TR50_CAPTURE_OUT			1
+TR50_EXPORT int			tr50_capture_start(void *tr50, const char *path, int ring_size);
+// Drains the ring and closes the file.
+TR50_EXPORT int			tr50_capture_stop(void *tr50);
+TR50_EXPORT int			tr50_capture_stats(void *tr50, long long *frames, long long *dropped);
+// Replay paces packets by their recorded timestamps divided by speed; speed 0 replays as fast
+// as possible. The callback returns non-zero to stop, which tr50_capture_read() returns.
+typedef int(*tr50_capture_frame_callback)(int direction, long long timestamp_us, const char *frame, int len, void *custom);
+TR50_EXPORT int			tr50_capture_read(const char *path, double speed, tr50_capture_frame_callback callback, void *custom);
+// Inbound PUBLISH packets go through the client's receive path (decompression, reply
+// matching, mailbox notifications) without a connection. Replies to requests this client
+// did not send are logged and dropped.
+TR50_EXPORT int			tr50_capture_replay(void *tr50, const char *path, double speed);
+
+// Allocation accounting for the whole process: while started, every allocation is charged to
+// its call site and to a subsystem (mqtt, json, pending, compress or other). Blocks are still
+// credited when freed after a stop and counters are kept across stop and start. Needs the
+// memory pool; ERR_TR50_NOT_SUPPORTED otherwise.
+typedef struct {
+	const char	*file;			// NULL for a subsystem or the total
+	int			line;
+	const char	*subsystem;		// NULL for the total
+	long long	live_bytes;
+	long long	live_count;
+	long long	total_count;
+	long long	total_bytes;
+	long long	peak_bytes;
+} TR50_MEMORY_SITE;
+TR50_EXPORT int			tr50_memory_accounting_start();
+TR50_EXPORT int			tr50_memory_accounting_stop();
+typedef void(*tr50_memory_site_callback)(const TR50_MEMORY_SITE *site, void *custom);
+// Sites come largest live bytes first.
+TR50_EXPORT int			tr50_memory_site_for_each(tr50_memory_site_callback callback, void *custom);
+TR50_EXPORT int			tr50_memory_subsystem_for_each(tr50_memory_site_callback callback, void *custom);
+TR50_EXPORT int			tr50_memory_total(TR50_MEMORY_SITE *total);
+// The total, subsystems and top sites (0 for all) as JSON, released with _memory_free().
+TR50_EXPORT int			tr50_memory_dump(int top, char **json, int *json_len);
+
+// In-process loopback transport with a minimal embedded broker, for tests and benchmarks.
+// Every PUBLISH from a client reaches the publish handler on the publishing thread; the
+// handler answers with tr50_loopback_publish() (data is only valid during the call).
+// A NULL session publishes to, or closes, every connected session. Delete the loopback
+// after the clients using it are stopped.
+typedef void(*tr50_loopback_publish_callback)(void *loopback, void *session, const char *topic, const char *data, int len, void *custom);
+TR50_EXPORT int			tr50_loopback_create(void **loopback);
+TR50_EXPORT const TR50_TRANSPORT *tr50_loopback_transport(void *loopback);
+TR50_EXPORT int			tr50_loopback_set_publish_handler(void *loopback, tr50_loopback_publish_callback callback, void *custom);
+TR50_EXPORT int			tr50_loopback_publish(void *loopback, void *session, const char *topic, const char *data, int len);
+// The CONNECT username of a session, or its client id when it connected without one.
+TR50_EXPORT const char *tr50_loopback_session_name(void *session);
+TR50_EXPORT int			tr50_loopback_close(void *loopback, void *session);
+TR50_EXPORT int			tr50_loopback_delete(void *loopback);
+
+// In-process TR50 platform emulator for load tests, served over its own loopback transport
+// and optionally on a localhost TCP port. Every api/<seq> (or compressed apiz*/<seq>) request
+// is answered on reply/<seq> (replyz*/<seq>, same codec). Publishes are accepted, the last
+// property and attribute values are kept for *.current, and each thing (the CONNECT username)
+// has a mailbox: tr50_emulator_mailbox_send() queues a message and publishes
+// notify/mailbox_activity, mailbox.check hands the queued messages out and mailbox.ack
+// completes them. A method.exec request from a client is queued to the target thing's mailbox
+// and its reply is held until that thing acks it. Latency, injected errors, dropped replies and
+// reply padding apply to every reply. Delete the emulator after the clients using it are stopped.
+typedef struct {
+	long long requests;			// api publishes received
+	long long commands;
+	long long compressed;		// requests received on a codec topic
+	long long replies;
+	long long errors_injected;	// commands failed on purpose
+	long long dropped;			// requests left unanswered on purpose
+	long long mailbox_sent;
+	long long mailbox_delivered;	// handed out by mailbox.check
+	long long mailbox_acked;
+	long long mailbox_updates;
+} TR50_EMULATOR_STATS;
+typedef void(*tr50_emulator_ack_callback)(void *emulator, const char *thing_key, const char *id, int error_code, const char *error_message, JSON *params, void *custom);
+TR50_EXPORT int			tr50_emulator_create(void **emulator);
+TR50_EXPORT const TR50_TRANSPORT *tr50_emulator_transport(void *emulator);
+TR50_EXPORT int			tr50_emulator_listen(void *emulator, int port);
+// Each reply is delayed by a uniform random time in [min_in_ms, max_in_ms].
+TR50_EXPORT int			tr50_emulator_set_latency(void *emulator, int min_in_ms, int max_in_ms);
+// Percentages per command (error_percent) and per request (drop_percent); error_code is reported in errorCodes.
+TR50_EXPORT int			tr50_emulator_set_errors(void *emulator, int error_percent, int error_code, int drop_percent);
+// Pads every successful reply with a "pad" param of this many bytes.
+TR50_EXPORT int			tr50_emulator_set_reply_size(void *emulator, int pad_bytes);
+// Bit (1 << TR50_COMPRESS_*) per codec the emulator answers; requests on other codecs go unanswered. All by default.
+TR50_EXPORT int			tr50_emulator_set_codecs(void *emulator, int mask);
+TR50_EXPORT int			tr50_emulator_set_dictionary(void *emulator, const char *dictionary, int dictionary_len);
+// Called for every mailbox.ack, outside the emulator's locks.
+TR50_EXPORT int			tr50_emulator_set_ack_handler(void *emulator, tr50_emulator_ack_callback callback, void *custom);
+// id (optional) receives the mailbox message id.
+TR50_EXPORT int			tr50_emulator_mailbox_send(void *emulator, const char *thing_key, const char *command, JSON *params, char *id, int id_size);
+TR50_EXPORT int			tr50_emulator_method_exec(void *emulator, const char *thing_key, const char *method, JSON *params, char *id, int id_size);
+TR50_EXPORT int			tr50_emulator_stats(void *emulator, TR50_EMULATOR_STATS *stats);
+// Outbound packets of a capture are sent to the emulator as one new connection of thing_key;
+// its replies are discarded.
+TR50_EXPORT int			tr50_emulator_replay(void *emulator, const char *path, const char *thing_key, double speed);
+TR50_EXPORT int			tr50_emulator_delete(void *emulator);
 
 // Misc
 TR50_EXPORT int			tr50_mailbox_suspend(void *tr50);
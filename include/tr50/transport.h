@@ -0,0 +1,51 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _TR50_TRANSPORT_H_
+#define _TR50_TRANSPORT_H_
+
+// A byte stream the MQTT layer runs over. The default is TCP (with SSL and proxies as
+// configured); a client can be pointed at any other implementation with
+// tr50_config_set_transport(). Functions return 0 or an ERR_TR50_* code like the _tcp_*
+// functions they stand in for: recv returns ERR_TR50_SOCK_TIMEOUT when nothing arrived
+// within timeout ms (timeout <= 0 waits indefinitely) and ERR_TR50_SOCK_SHUTDOWN once the
+// peer closed.
+typedef struct {
+	const char *name;
+
+	int(*connect)(void *custom, void **sock, const char *host, long port, int options);
+	int(*disconnect)(void *sock);
+	int(*send)(void *sock, const char *buf, int len, int timeout);
+	int(*recv)(void *sock, char *buf, int *len, int timeout);
+
+	// Optional, may be NULL: sends count buffers back to back as one write.
+	int(*writev)(void *sock, const char **bufs, const int *lens, int count, int timeout);
+	// Optional, may be NULL: a descriptor that polls readable when recv will not block, or -1.
+	int(*readiness_fd)(void *sock);
+
+	// Passed to connect.
+	void *custom;
+} TR50_TRANSPORT;
+
+#endif /*_TR50_TRANSPORT_H_*/
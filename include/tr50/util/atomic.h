@@ -0,0 +1,69 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef ATOMIC_H_
+#define ATOMIC_H_
+
+// Lock-free primitives for counters that are bumped on hot paths. 64-bit operations are
+// used on 32-bit targets too, where the compiler falls back to its own safe sequences.
+#if defined(_WIN32)
+
+#include <windows.h>
+
+#define _atomic_add64(ptr, value)			InterlockedExchangeAdd64((volatile LONGLONG *)(ptr), (LONGLONG)(value))
+#define _atomic_load64(ptr)					InterlockedCompareExchange64((volatile LONGLONG *)(ptr), 0, 0)
+#define _atomic_store64(ptr, value)			InterlockedExchange64((volatile LONGLONG *)(ptr), (LONGLONG)(value))
+#define _atomic_cas64(ptr, expected, desired)	(InterlockedCompareExchange64((volatile LONGLONG *)(ptr), (LONGLONG)(desired), (LONGLONG)(expected)) == (LONGLONG)(expected))
+#define _atomic_load32(ptr)					InterlockedCompareExchange((volatile LONG *)(ptr), 0, 0)
+#define _atomic_store32(ptr, value)			InterlockedExchange((volatile LONG *)(ptr), (LONG)(value))
+#define _atomic_cas32(ptr, expected, desired)	(InterlockedCompareExchange((volatile LONG *)(ptr), (LONG)(desired), (LONG)(expected)) == (LONG)(expected))
+#define _atomic_add32(ptr, value)			InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(value))
+#define _atomic_exchange32(ptr, value)		InterlockedExchange((volatile LONG *)(ptr), (LONG)(value))
+#define _atomic_fence()						MemoryBarrier()
+
+#else
+
+#define _atomic_add64(ptr, value)			__sync_fetch_and_add((ptr), (long long)(value))
+#define _atomic_load64(ptr)					__sync_fetch_and_add((ptr), 0)
+#define _atomic_store64(ptr, value)			(void)__sync_lock_test_and_set((ptr), (long long)(value))
+#define _atomic_cas64(ptr, expected, desired)	__sync_bool_compare_and_swap((ptr), (long long)(expected), (long long)(desired))
+#define _atomic_load32(ptr)					__sync_fetch_and_add((ptr), 0)
+#define _atomic_store32(ptr, value)			(void)__sync_lock_test_and_set((ptr), (value))
+#define _atomic_cas32(ptr, expected, desired)	__sync_bool_compare_and_swap((ptr), (expected), (desired))
+#define _atomic_add32(ptr, value)			__sync_fetch_and_add((ptr), (value))
+#define _atomic_exchange32(ptr, value)		__sync_lock_test_and_set((ptr), (value))
+#define _atomic_fence()						__sync_synchronize()
+
+#endif
+
+// Raises *ptr to value if it is larger.
+#define _atomic_max64(ptr, value) \
+	do { \
+		long long _atomic_max_seen = _atomic_load64(ptr); \
+		while ((long long)(value) > _atomic_max_seen && !_atomic_cas64((ptr), _atomic_max_seen, (value))) { \
+			_atomic_max_seen = _atomic_load64(ptr); \
+		} \
+	} while (0)
+
+#endif /*ATOMIC_H_*/
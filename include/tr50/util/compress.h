@@ -25,3 +25,23 @@
 int _compress_is_supported();
 int _compress_deflate(const char *in, int in_len, char **out, int *out_len);
 int _compress_inflate(const char *in, int in_len, char **out, int *out_len);
+
+// Preset dictionary variants. The dictionary id (adler32) is carried in the zlib header,
+// so the inflating side can tell whether both ends agree on the dictionary.
+unsigned long _compress_dictionary_id(const char *dict, int dict_len);
+int _compress_deflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len);
+int _compress_inflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len);
+
+// Streaming inflate: each decompressed chunk is handed to sink as soon as it is produced,
+// nothing is accumulated. dict may be NULL. A non-zero return from sink aborts with that code.
+typedef int(*_compress_sink)(const char *data, int data_len, void *custom);
+int _compress_inflate_stream(const char *in, int in_len, const char *dict, int dict_len, _compress_sink sink, void *custom);
+
+// Streaming gzip for file transfers. A stream deflates (or inflates) one file in pieces and is
+// reset for the next one instead of being set up again. _compress_gzip_step() takes what it can
+// from *in and fills *out, moving both pointers and lengths; with finish set a deflate stream
+// writes its trailer. Returns 1 once the stream ended, 0 while it needs input or output room.
+int _compress_gzip_create(void **stream, int is_inflate, int level);
+int _compress_gzip_reset(void *stream);
+int _compress_gzip_step(void *stream, const char **in, int *in_len, char **out, int *out_len, int finish);
+void _compress_gzip_delete(void *stream);
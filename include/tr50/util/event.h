@@ -26,3 +26,16 @@ int _tr50_event_create(void **evt);
 int _tr50_event_wait(void *evt);
 int _tr50_event_signal(void *evt);
 int _tr50_event_delete(void *evt);
+
+// Events stay signaled until reset, so one event can be waited on repeatedly.
+int _tr50_event_reset(void *evt);
+int _tr50_event_wait_timeout(void *evt, int timeout_in_ms);
+
+// A waiter parks one thread until one wake. Ports that can keep one per thread hand that
+// out again, so a sync call normally creates nothing. timeout_in_ms < 0 waits for the wake;
+// otherwise ERR_TR50_TIMEOUT once it passes. Give it back once woken, or once the wake is known
+// never to come.
+int _tr50_waiter_take(void **waiter);
+int _tr50_waiter_wait(void *waiter, int timeout_in_ms);
+int _tr50_waiter_wake(void *waiter);
+void _tr50_waiter_give(void *waiter);
@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef EXECUTOR_H_
+#define EXECUTOR_H_
+
+// Fixed pool of worker threads, each with its own FIFO. Tasks with the same non-zero key run
+// on the same worker in submission order; key 0 goes round robin. Tasks are intrusive: the
+// caller puts _EXECUTOR_TASK first in its own struct and releases that in run().
+typedef struct _EXECUTOR_TASK_S {
+	struct _EXECUTOR_TASK_S *next;
+	void		(*run)(struct _EXECUTOR_TASK_S *task);
+	long long	enqueued_us;
+} _EXECUTOR_TASK;
+
+typedef struct {
+	int			threads;
+	int			queue_depth;
+	int			queued;
+	int			queued_max;
+	long long	executed;
+	long long	blocked;		// submits that waited for room
+	long long	lag_p50_us;		// enqueue to start of run
+	long long	lag_p99_us;
+	long long	lag_max_us;
+	long long	lag_sum_us;
+} _EXECUTOR_STATS;
+
+int _executor_create(void **executor, int threads, int queue_depth);
+
+// Waits while the worker already holds queue_depth tasks. Submits from a worker thread never
+// wait, they go over the bound instead, so a task may fan out without deadlocking the pool.
+int _executor_submit(void *executor, unsigned int key, _EXECUTOR_TASK *task);
+
+// Runs what is still queued, including tasks those submit, then joins the workers.
+void _executor_delete(void *executor);
+
+void _executor_stats(void *executor, _EXECUTOR_STATS *stats);
+
+#endif /*EXECUTOR_H_*/
@@ -0,0 +1,54 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+// Log-linear (HDR style) histogram: values below 16 get a bucket each, every power of two
+// above that is split into 16 linear buckets, so any reported value is within 1/16 of the
+// real one. Values beyond 2^25 land in the last bucket. Recording is lock-free.
+#define HISTOGRAM_SUB_BUCKET_BITS	4
+#define HISTOGRAM_SUB_BUCKETS		(1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_MAGNITUDE		25
+#define HISTOGRAM_BUCKETS			(HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_SUB_BUCKET_BITS + 2))
+
+typedef struct {
+	volatile long long	counts[HISTOGRAM_BUCKETS];
+	volatile long long	max;
+	volatile long long	sum;
+} _HISTOGRAM;
+
+int _histogram_create(_HISTOGRAM **histogram);
+void _histogram_delete(_HISTOGRAM *histogram);
+void _histogram_record(_HISTOGRAM *histogram, long long value);
+void _histogram_clear(_HISTOGRAM *histogram);
+
+// Percentiles (0..100) from one pass over a copy of the buckets; count may be NULL.
+void _histogram_percentiles(_HISTOGRAM *histogram, const double *percentiles, long long *values, int percentile_count, long long *count);
+
+// Cumulative counts at the given ascending bounds, for exporters with fixed buckets. A bucket
+// counts towards a bound once its highest value is within it. count and sum may be NULL.
+void _histogram_cumulative(_HISTOGRAM *histogram, const long long *bounds, long long *counts, int bound_count, long long *count, long long *sum);
+
+#endif /*HISTOGRAM_H_*/
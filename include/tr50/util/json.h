@@ -139,6 +139,13 @@ TR50_EXPORT void tr50_json_replace_item_in_object(JSON *object, const char *stri
 #define tr50_json_add_string_to_object(object,name,s)	tr50_json_add_item_to_object(object, name, tr50_json_create_string(s))
 #define tr50_json_add_integer_to_object(object,name,n)	tr50_json_add_item_to_object(object, name, tr50_json_create_integer(n))
 
+// Incremental parsing for text that arrives in chunks (e.g. straight out of a decompressor).
+// Feed returns 0 or a negative ERR_TR50_*; finish hands over the parsed tree.
+void *_json_stream_create(void);
+int   _json_stream_feed(void *stream, const char *data, int data_len);
+int   _json_stream_finish(void *stream, JSON **json);
+void  _json_stream_delete(void *stream);
+
 #ifdef __cplusplus
 }
 #endif
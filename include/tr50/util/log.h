@@ -28,6 +28,16 @@
 #define LOG_TYPE_DEBUG					3
 #define LOG_TYPE_LOW_LEVEL				4
 
+// Log sites above TR50_LOG_MAX_LEVEL are compiled out. Sites at or below it are still
+// filtered at run time by log_filter_maximum_log_level() before any formatting happens.
+#if !defined(TR50_LOG_MAX_LEVEL)
+#define TR50_LOG_MAX_LEVEL				LOG_TYPE_LOW_LEVEL
+#endif
+
+extern int g_log_filter_level;
+
+#define _log_enabled(type)					((type) <= TR50_LOG_MAX_LEVEL && (type) <= g_log_filter_level)
+
 #if defined (_NO_VA_ARGS)
 void log_should_not_happen(const char *msg, ...);
 void log_need_investigation(const char *msg, ...);
@@ -35,11 +45,12 @@ void log_important_info(const char *msg, ...);
 void log_debug(const char *msg, ...);
 void log_low_level(const char *msg, ...);
 #else
-#define log_should_not_happen(msg,...)		_log_this(LOG_TYPE_SHOULD_NOT_HAPPEN,__FILE__,__LINE__,msg,##__VA_ARGS__)
-#define log_need_investigation(msg,...)		_log_this(LOG_TYPE_NEED_INVESTIGATION,__FILE__,__LINE__,msg,##__VA_ARGS__)
-#define log_important_info(msg,...)			_log_this(LOG_TYPE_IMPORTANT_INFO,__FILE__,__LINE__,msg,##__VA_ARGS__)
-#define log_debug(msg,...)					_log_this(LOG_TYPE_DEBUG,__FILE__,__LINE__,msg,##__VA_ARGS__)
-#define log_low_level(msg,...)				_log_this(LOG_TYPE_LOW_LEVEL,__FILE__,__LINE__,msg,##__VA_ARGS__)
+#define _log_if_enabled(type,msg,...)		do { if (_log_enabled(type)) _log_this(type,__FILE__,__LINE__,msg,##__VA_ARGS__); } while (0)
+#define log_should_not_happen(msg,...)		_log_if_enabled(LOG_TYPE_SHOULD_NOT_HAPPEN,msg,##__VA_ARGS__)
+#define log_need_investigation(msg,...)		_log_if_enabled(LOG_TYPE_NEED_INVESTIGATION,msg,##__VA_ARGS__)
+#define log_important_info(msg,...)			_log_if_enabled(LOG_TYPE_IMPORTANT_INFO,msg,##__VA_ARGS__)
+#define log_debug(msg,...)					_log_if_enabled(LOG_TYPE_DEBUG,msg,##__VA_ARGS__)
+#define log_low_level(msg,...)				_log_if_enabled(LOG_TYPE_LOW_LEVEL,msg,##__VA_ARGS__)
 #endif
 void log_hexdump(int type, const char *msg, const char *buffer, int len);
 void log_recurring(int type, const char *filename, int line, int minutes_between_logs, int check_for_changes, const char *msg, ...);
@@ -47,3 +58,9 @@ void log_recurring(int type, const char *filename, int line, int minutes_between
 void log_filter_maximum_log_level(int level);
 
 void _log_this(int type, const char *file, int line, const char *msg, ...);
+
+// Asynchronous output shared by the desktop ports (util/common/tr50.log.c).
+void _log_write(int type, const char *text, int len);
+// text is only read with check_for_changes, and may be NULL without it.
+int _log_recurring_check(const char *file, int line, int minutes_between_logs, int check_for_changes, const char *text, int *suppressed);
+void log_flush(void);
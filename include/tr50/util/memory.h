@@ -37,3 +37,11 @@ void *_memory_memset(void *ptr, int value, size_t size);
 void *_memory_memcpy(void *dest, void *src, size_t size);
 
 int _memory_handle_count();
+
+// Allocation accounting (tr50_memory_accounting_start). Ports that can keep a site id with each
+// block charge allocations while g_memory_accounting is set and credit tagged blocks on free.
+extern volatile int g_memory_accounting;
+int _memory_accounting_supported();
+// Returns the site id to keep with the block, 0 when it could not be charged.
+int _memory_account_alloc(size_t size, const char *file, int line);
+void _memory_account_free(int site, size_t size);
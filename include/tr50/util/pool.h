@@ -0,0 +1,75 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+
+// Size-class allocator behind _memory_* on the Linux, FreeBSD and Windows ports. Requests up to
+// POOL_MAX_SIZE are rounded up to one of POOL_CLASSES sizes (16 byte steps to 128, then four
+// steps per power of two) and served from free lists carved out of POOL_CHUNK_SIZE chunks;
+// larger ones go to the system allocator. A per-thread cache in front of the shared lists
+// means steady-state allocation takes no lock; the cache moves POOL_BATCH blocks at a time to
+// and from the shared lists. Pooled memory is kept for reuse and never handed back to the
+// system. Build with TR50_MEMORY_POOL=0 to compile it out (for ASan or valgrind runs).
+#if !defined(TR50_MEMORY_POOL)
+#define TR50_MEMORY_POOL		1
+#endif
+
+#define POOL_MAX_SIZE			32768
+#define POOL_CLASSES			40
+#define POOL_CHUNK_SIZE			65536
+#define POOL_BATCH				32
+
+// In front of every block, including large ones; 16 bytes keeps payloads 16 byte aligned.
+typedef union {
+	struct {
+		size_t	size;	// as requested
+		int		index;	// size class, POOL_CLASSES for a large block
+		int		site;	// allocation site when accounting, else 0
+	} info;
+	char		align[16];
+} _POOL_HEADER;
+
+#define _pool_header(block)		((_POOL_HEADER *)(block) - 1)
+
+typedef struct {
+	void	*heads[POOL_CLASSES];
+	int		counts[POOL_CLASSES];
+} _POOL_CACHE;
+
+// A NULL cache goes straight to the shared lists.
+void *_pool_malloc(_POOL_CACHE *cache, size_t size);
+void *_pool_realloc(_POOL_CACHE *cache, void *ptr, size_t size);
+void _pool_free(_POOL_CACHE *cache, void *ptr);
+
+// The cache itself lives in the pool; delete returns it and everything it holds.
+_POOL_CACHE *_pool_cache_create();
+void _pool_cache_delete(_POOL_CACHE *cache);
+
+// Bytes taken from the system for chunks and for allocations above POOL_MAX_SIZE.
+void _pool_stats(long long *chunk_bytes, long long *large_bytes);
+
+#endif /*POOL_H_*/
@@ -22,6 +22,8 @@
  * THE SOFTWARE.
  */
 
+#include <stdio.h>
+
 #define TCP_DONT_SET_QUEUE_SIZES	1
 #define TCP_USE_NODELAY				2
 #define TCP_OPTION_SECURE			4
@@ -40,3 +42,11 @@ int _tcp_connect(void **sock, const char *addr, long port, int options);
 int _tcp_disconnect(void *sock);
 int _tcp_send(void *sock, const char *buf, int len, int timeout);
 int _tcp_recv(void *sock, char *buf, int *len, int timeout);
+
+/* sends length bytes of fp from offset straight from the file cache; ERR_TR50_NOT_SUPPORTED
+   when the port or the socket (TLS) cannot, the caller then reads and sends them itself */
+int _tcp_send_file(void *sock, FILE *fp, long long offset, int length, int timeout);
+
+/* loopback-only listener for local tooling such as the metrics endpoint */
+int _tcp_listen(void **sock, long port);
+int _tcp_accept(void *listen_sock, void **sock, int timeout);
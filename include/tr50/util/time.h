@@ -24,6 +24,8 @@
 
 long long _time_now();
 int _time_now_in_sec();
+// Monotonic microseconds for measuring intervals; the epoch is unspecified.
+long long _time_now_us();
 void tr50_time_sprintf2(char *buffer, const char *time_format, long long mstime, int use_gmt);
 void tr50_time_sprintf(char *buffer, const char *time_format, long long mstime);
 void tr50_time_strptime(const char *buffer, const char *time_format, long long *mstime);
@@ -81,7 +81,19 @@ TR50_EXPORT int tr50_method_exec_ex_async(void *tr50, const char *method, int* i
 TR50_EXPORT int tr50_method_exec_ex_sync(void *tr50, const char *method, JSON* req_params, void* optional_params, void** optional_reply);
 TR50_EXPORT int tr50_file_put_ex(void *tr50, const char *filename, void* optional_params, void** optional_reply, char** error_msg);
 TR50_EXPORT int tr50_file_get_ex(void *tr50, const char *filename, void* optional_params, void** optional_reply, char** error_msg);
+TR50_EXPORT int tr50_helper_file_upload(void* tr50, const char *thing_key, const char *src, const char *dest, const char *tags, char* is_public, char **error_msg, int is_global, int log_completion);
 TR50_EXPORT int tr50_file_download(void* tr50, const char *thing_key, const char *src, const char *dest, char **error_msg, int is_global);
+// Background transfers, see tr50_config_set_file_transfer(). The callback runs on the worker once
+// the transfer ends, with what the sync call would have returned and its error message; tasks
+// still queued when the client is deleted end with ERR_TR50_STOPPED, canceled ones with
+// ERR_TR50_CANCELED. Higher priorities start first.
+typedef void(*tr50_file_transfer_callback)(void *tr50, int id, int ret, const char *error_msg, void *custom);
+TR50_EXPORT int tr50_file_upload_async(void* tr50, const char *thing_key, const char *src, const char *dest, const char *tags, char* is_public, int is_global, int log_completion, int priority, int *id, tr50_file_transfer_callback callback, void *custom);
+TR50_EXPORT int tr50_file_download_async(void* tr50, const char *thing_key, const char *src, const char *dest, int is_global, int priority, int *id, tr50_file_transfer_callback callback, void *custom);
+// Removes a queued transfer, or stops a running one at its next receive or send.
+TR50_EXPORT int tr50_file_transfer_cancel(void *tr50, int id);
+// Transfers queued and running.
+TR50_EXPORT int tr50_file_transfer_count(void *tr50);
 #ifdef __cplusplus
 }
 #endif
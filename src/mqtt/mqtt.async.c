@@ -55,11 +55,13 @@ typedef struct {
 	void 			*mqtt;
 	void			*qos;
 	int				outstanding_ping;
+	char			*payload;		// publish being handed to publish_callback
 
 	int				stats_reconnect_count;
 	int				stats_reconnect_attempt_count;
 	long long		stats_total_byte_sent;
 	long long		stats_total_byte_recv;
+	int				stats_qos_expired_count;
 } _MQTT_ASYNC_CLIENT;
 
 void *_mqtt_async_handler(void *arg);
@@ -274,9 +276,13 @@ int _mqtt_async_handler_process(_MQTT_ASYNC_CLIENT *client, const char *data, in
 			_tr50_mutex_unlock(client->mux);
 		}
 		log_hexdump(LOG_TYPE_LOW_LEVEL, "mqtt_msg_process_publish():", payload, payload_len);
+		client->payload = payload;
 		client->publish_callback(topic, payload, payload_len, client->callback_custom);
 		log_recurring(LOG_TYPE_IMPORTANT_INFO, __FILE__, __LINE__, 5, 0, "publish callback: OK");
-		_memory_free(payload);
+		if (client->payload) {
+			_memory_free(client->payload);
+			client->payload = NULL;
+		}
 		_memory_free(topic);
 		break;
 	}
@@ -369,6 +375,7 @@ void *_mqtt_async_handler(void *arg) {
 				_mqtt_async_state_change(client, MQTT_ASYNC_CLIENT_STATE_CONNECTED, MQTT_ASYNC_CLIENT_STATE_BROKEN, ret, "MQTT Ack not recevied.");
 			}
 			_tr50_mutex_unlock(client->mux);
+			++client->stats_qos_expired_count;
 			mqtt_qos_clear(client->qos, ERR_MQTT_QOS_FAILURE);
 		}
 
@@ -492,6 +499,17 @@ int mqtt_async_unsubscribe(void *async_client, const char *topic, mqtt_qos_callb
 	return ret;
 }
 
+char *mqtt_async_take_payload(void *async_client, const char *payload) {
+	_MQTT_ASYNC_CLIENT *client = (_MQTT_ASYNC_CLIENT *)async_client;
+	int thread_id;
+
+	if (client == NULL || payload == NULL || _thread_id(&thread_id) != 0 || thread_id != client->thread_id || client->payload != payload) {
+		return NULL;
+	}
+	client->payload = NULL;
+	return (char *)payload;
+}
+
 int mqtt_async_state(void *async_client) {
 	_MQTT_ASYNC_CLIENT *client = (_MQTT_ASYNC_CLIENT *)async_client;
 	return client->state;
@@ -549,3 +567,13 @@ void mqtt_async_stats_clear(void *async_client) {
 		mqtt_stats_clear(client->mqtt);
 	}
 }
+
+int mqtt_async_stats_qos_inflight(void *async_client) {
+	_MQTT_ASYNC_CLIENT *client = (_MQTT_ASYNC_CLIENT *)async_client;
+	return mqtt_qos_count(client->qos);
+}
+
+int mqtt_async_stats_qos_expired(void *async_client) {
+	_MQTT_ASYNC_CLIENT *client = (_MQTT_ASYNC_CLIENT *)async_client;
+	return client->stats_qos_expired_count;
+}
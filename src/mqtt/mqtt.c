@@ -46,10 +46,31 @@ typedef struct {
 	char 	*proxy_addr;
 	char 	*proxy_username;
 	char 	*proxy_password;
+
+	const TR50_TRANSPORT *transport;
+	mqtt_frame_callback frame_callback;
+	void *	frame_custom;
 } _MQTT_COONNECT_PARAMS;
 
 int _mqtt_https_connect(void *sock, _MQTT_COONNECT_PARAMS *params);
 
+static int _mqtt_tcp_connect(void *custom, void **sock, const char *host, long port, int options) {
+	return _tcp_connect(sock, host, port, options);
+}
+
+// Used when no transport is configured; connect is only called through it for custom
+// transports, TCP connects directly so proxies and the https upgrade can be applied.
+static const TR50_TRANSPORT g_mqtt_transport_tcp = {
+	"tcp",
+	_mqtt_tcp_connect,
+	_tcp_disconnect,
+	_tcp_send,
+	_tcp_recv,
+	NULL,
+	NULL,
+	NULL
+};
+
 int mqtt_connect_params_create(void **connect_params, const char *client_id, const char *host, long port, unsigned short keepalive_in_sec) {
 	_MQTT_COONNECT_PARAMS *params;
 
@@ -100,6 +121,19 @@ int mqtt_connect_params_use_proxy(void *connect_params, int type, const char *ad
 	return 0;
 }
 
+int mqtt_connect_params_set_transport(void *connect_params, const TR50_TRANSPORT *transport) {
+	_MQTT_COONNECT_PARAMS *params = (_MQTT_COONNECT_PARAMS *)connect_params;
+	params->transport = transport;
+	return 0;
+}
+
+int mqtt_connect_params_set_frame_callback(void *connect_params, mqtt_frame_callback callback, void *custom) {
+	_MQTT_COONNECT_PARAMS *params = (_MQTT_COONNECT_PARAMS *)connect_params;
+	params->frame_callback = callback;
+	params->frame_custom = custom;
+	return 0;
+}
+
 int mqtt_connect_params_delete(void *connect_params) {
 	_MQTT_COONNECT_PARAMS *params = (_MQTT_COONNECT_PARAMS *)connect_params;
 	if (params->host) {
@@ -132,11 +166,16 @@ int mqtt_connect(void **mqtt_handle, void *connect_params) {
 		return ERR_TR50_MALLOC;
 	}
 	_memory_memset(client, 0, sizeof(_MQTT_CLIENT));
+	client->transport = params->transport ? params->transport : &g_mqtt_transport_tcp;
 
 	if (params->use_ssl) {
 		options |= TCP_OPTION_SECURE;
 	}
-	if (params->proxy_type > 0) {
+	if (params->transport) {
+		if ((ret = params->transport->connect(params->transport->custom, &sock, params->host, params->port, options)) != 0) {
+			goto end_error;
+		}
+	} else if (params->proxy_type > 0) {
 		if ((ret = _tcp_connect_proxy(&sock,
 									  params->host,
 									  params->port,
@@ -154,7 +193,7 @@ int mqtt_connect(void **mqtt_handle, void *connect_params) {
 	}
 	client->sock = sock;
 
-	if (params->use_https_proxy) {
+	if (params->use_https_proxy && params->transport == NULL) {
 		if ((ret = _mqtt_https_connect(sock, params)) != 0) {
 			goto end_error;
 		}
@@ -167,6 +206,8 @@ int mqtt_connect(void **mqtt_handle, void *connect_params) {
 	if ((ret = mqtt_send(client, req, req_len, 5000)) != 0) {
 		goto end_error;
 	}
+	client->frame_callback = params->frame_callback;
+	client->frame_custom = params->frame_custom;
 
 	if ((ret = mqtt_recv(client, &rsp, &rsp_len, 5000)) != 0) {
 		goto end_error;
@@ -189,8 +230,8 @@ end_error:
 		_memory_free(rsp);
 	}
 
-	if (ret != 0) {
-		_tcp_disconnect(sock);
+	if (ret != 0 && sock) {
+		client->transport->disconnect(sock);
 	}
 
 	if (client) {
@@ -212,7 +253,7 @@ int mqtt_disconnect(void *mqtt_handle) {
 
 	_memory_free(msg);
 
-	_tcp_disconnect(client->sock);
+	client->transport->disconnect(client->sock);
 
 	_memory_free(client);
 
@@ -260,8 +301,22 @@ int mqtt_publish(void *mqtt_handle, int qos, int retain, unsigned short message_
 	_MQTT_CLIENT *client = (_MQTT_CLIENT *)mqtt_handle;
 	int req_len;
 	char *req = NULL;
+	char header[MQTT_PUBLISH_HEADER_MAX];
+	const char *bufs[2];
+	int lens[2];
 	int ret;
 
+	// transports that can gather send the header and the caller's payload without a copy
+	if (client->transport->writev && _mqtt_msg_build_publish_header(topic, qos, retain, message_id, data_len, header, sizeof(header), &lens[0]) == 0) {
+		bufs[0] = header;
+		bufs[1] = data;
+		lens[1] = data_len;
+		if ((ret = mqtt_sendv(client, bufs, lens, 2, 5000)) != 0) {
+			log_debug("mqtt_publish(): failed [%d]", ret);
+		}
+		return ret;
+	}
+
 	if ((ret = _mqtt_msg_build_publish(topic, qos, retain, message_id, data, data_len, &req, &req_len)) != 0) {
 		return ret;
 	}
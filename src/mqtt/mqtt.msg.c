@@ -108,17 +108,6 @@ int _mqtt_decode_string(char *ptr, int *output_len, char **output) {
 #define MQTT_CONN_PROTOCOL_NAME_LEN  6
 #define MQTT_CONN_PROTOCOL_VERSION_3 0x03
 
-/* Variable header connect options */
-#define MQTT_CONN_OPT_USERNAME        0x80
-#define MQTT_CONN_OPT_PASSWORD        0x40
-#define MQTT_CONN_OPT_WILL_RETAIN     0x20
-#define MQTT_CONN_OPT_WILL            0x04
-#define MQTT_CONN_OPT_CLEAN_START     0x02
-#define MQTT_CONN_OPT_CLEAN_START_OFF 0xFD /* AND mask - turn off bit 1 */
-#define MQTT_CONN_OPT_QOS_0           0xE7 /* AND mask - turn off bits 3 and 4 */
-#define MQTT_CONN_OPT_QOS_1           0x08
-#define MQTT_CONN_OPT_QOS_2           0x10
-
 int _mqtt_msg_build_connect(const char *client_id,
 							const char *username,
 							const char *password,
@@ -210,7 +199,6 @@ int _mqtt_msg_build_connect(const char *client_id,
 	return 0;
 }
 
-
 /* Some response flags specific to CONNACK */
 #define MQTT_CONNACK_ACCEPTED						0x00
 #define MQTT_CONNACK_REFUSED_VERSION				0x01
@@ -272,12 +260,12 @@ int _mqtt_msg_build_ping(char **data, int *data_len) {
 	return 0;
 }
 
-int _mqtt_msg_build_publish(const char *topic, int qos, int retain, unsigned short msg_id, const char *payload, int payload_len, char **data, int *data_len) {
+// Writes the fixed and variable header of a PUBLISH; the payload follows it on the wire.
+int _mqtt_msg_build_publish_header(const char *topic, int qos, int retain, unsigned short msg_id, int payload_len, char *header, int header_size, int *header_len) {
 	int remaining_len = 0;
 	int topic_len = 0;
 	int fixed_header_len = 0;
-	int total_len = 0;
-	char *msg, *ptr;
+	char *ptr;
 	unsigned short msg_id_swap;
 
 	topic_len = strlen(topic);
@@ -291,12 +279,10 @@ int _mqtt_msg_build_publish(const char *topic, int qos, int retain, unsigned sho
 
 	MQTT_CALC_FHEADER_LENGTH(remaining_len, fixed_header_len);
 
-	total_len = fixed_header_len + remaining_len;
-
-	if ((msg = (char *)_memory_malloc(total_len)) == NULL) {
-		return ERR_TR50_MALLOC;
+	if (fixed_header_len < 0 || fixed_header_len + remaining_len - payload_len > header_size) {
+		return ERR_TR50_PARMS;
 	}
-	ptr = msg;
+	ptr = header;
 
 	// set byte1
 	*ptr = 0x00 | MQTT_MSG_TYPE_PUBLISH;
@@ -310,7 +296,7 @@ int _mqtt_msg_build_publish(const char *topic, int qos, int retain, unsigned sho
 
 	// Encode the message length
 	_mqtt_encode_fixed_header_len(remaining_len, ptr);
-	ptr = msg + fixed_header_len;
+	ptr = header + fixed_header_len;
 
 	// Variable header
 	// Add the topic name
@@ -324,11 +310,28 @@ int _mqtt_msg_build_publish(const char *topic, int qos, int retain, unsigned sho
 		ptr += 2;
 	}
 
+	*header_len = (int)(ptr - header);
+	return 0;
+}
+
+int _mqtt_msg_build_publish(const char *topic, int qos, int retain, unsigned short msg_id, const char *payload, int payload_len, char **data, int *data_len) {
+	int ret, header_len;
+	int header_size = 5 + 2 + strlen(topic) + 2; // fixed header, topic length, topic, message id
+	char *msg;
+
+	if ((msg = (char *)_memory_malloc(header_size + payload_len)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	if ((ret = _mqtt_msg_build_publish_header(topic, qos, retain, msg_id, payload_len, msg, header_size, &header_len)) != 0) {
+		_memory_free(msg);
+		return ret;
+	}
+
 	// Add payload
-	_memory_memcpy(ptr, (void *)payload, payload_len);
+	_memory_memcpy(msg + header_len, (void *)payload, payload_len);
 
 	*data = msg;
-	*data_len = total_len;
+	*data_len = header_len + payload_len;
 	return 0;
 }
 
@@ -150,3 +150,8 @@ int mqtt_qos_any_expired(void *qos) {
 	_tr50_mutex_unlock(mq->mux);
 	return FALSE;
 }
+
+int mqtt_qos_count(void *qos) {
+	_MQTT_QOS *mq = qos;
+	return mq->current_size;
+}
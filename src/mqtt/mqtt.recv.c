@@ -36,11 +36,35 @@
 int mqtt_send(void *mqtt_handle, const char *buf, int len, int timeout) {
 	_MQTT_CLIENT *client = (_MQTT_CLIENT *)mqtt_handle;
 	int ret;
-	if ((ret = _tcp_send(client->sock, buf, len, timeout)) == 0) {
+	if ((ret = client->transport->send(client->sock, buf, len, timeout)) == 0) {
 		client->byte_sent += len;
+		if (client->frame_callback) {
+			client->frame_callback(MQTT_FRAME_OUT, &buf, &len, 1, client->frame_custom);
+		}
 	}
+	return ret;
+}
 
-	return 0;
+int mqtt_sendv(void *mqtt_handle, const char **bufs, const int *lens, int count, int timeout) {
+	_MQTT_CLIENT *client = (_MQTT_CLIENT *)mqtt_handle;
+	int i, ret = 0;
+
+	if (client->transport->writev) {
+		ret = client->transport->writev(client->sock, bufs, lens, count, timeout);
+	} else {
+		for (i = 0; i < count && ret == 0; ++i) {
+			ret = client->transport->send(client->sock, bufs[i], lens[i], timeout);
+		}
+	}
+	if (ret == 0) {
+		for (i = 0; i < count; ++i) {
+			client->byte_sent += lens[i];
+		}
+		if (client->frame_callback) {
+			client->frame_callback(MQTT_FRAME_OUT, bufs, lens, count, client->frame_custom);
+		}
+	}
+	return ret;
 }
 
 int mqtt_recv(void *mqtt_handle, char **data, int *len, int timeout) {
@@ -77,7 +101,7 @@ int mqtt_recv(void *mqtt_handle, char **data, int *len, int timeout) {
 			buffer_max_len = buffer_cur_len + read_len;
 		}
 
-		if ((ret = _tcp_recv(client->sock, buffer + buffer_cur_len, &read_len, (int)wait_time)) < 0) {
+		if ((ret = client->transport->recv(client->sock, buffer + buffer_cur_len, &read_len, (int)wait_time)) < 0) {
 			_memory_free(buffer);
 			if (buffer_cur_len > 0 && ret == ERR_TR50_TIMEOUT) { // timeout reading the remaining packet, we should treat it as hard error
 				return ERR_TR50_TIMEOUT;
@@ -122,7 +146,7 @@ int mqtt_recv(void *mqtt_handle, char **data, int *len, int timeout) {
 
 	while (read_len > 0) {
 		recv_len = read_len;
-		if ((ret = _tcp_recv(client->sock, buffer + buffer_cur_len, &recv_len, (int)wait_time)) < 0) {
+		if ((ret = client->transport->recv(client->sock, buffer + buffer_cur_len, &recv_len, (int)wait_time)) < 0) {
 			_memory_free(buffer);
 			return ret;
 		}
@@ -135,5 +159,8 @@ int mqtt_recv(void *mqtt_handle, char **data, int *len, int timeout) {
 	*data = buffer;
 	*len = buffer_cur_len;
 	client->last_recv = _time_now();
+	if (client->frame_callback) {
+		client->frame_callback(MQTT_FRAME_IN, (const char **)data, len, 1, client->frame_custom);
+	}
 	return 0;
 }
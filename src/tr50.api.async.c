@@ -31,15 +31,17 @@
 
 #include <tr50/tr50.h>
 
+#include <tr50/util/atomic.h>
 #include <tr50/util/compress.h>
 #include <tr50/util/event.h>
 #include <tr50/util/log.h>
 #include <tr50/util/memory.h>
 #include <tr50/util/mutex.h>
 #include <tr50/util/platform.h>
+#include <tr50/util/time.h>
 
-#define TR50_MAX_ID					65536
-#define TR50_MIN_COMPRESSION_LEN	128
+// How long a sync call still waits past its timeout for a callback that is already on its way.
+#define TR50_SYNC_GRACE_MS		1000
 
 int _tr50_build_payload(_TR50_CLIENT *client, const char **topic, _TR50_MESSAGE *message, char **data, int *data_len);
 
@@ -56,19 +58,39 @@ int tr50_api_msg_id_next(void *tr50) {
 	return id;
 }
 
+// Submits, waiting up to [timeout] for in-flight credit; the request gets what is left of it.
+static int _tr50_api_call_wait(void *tr50, void *message, int *seq_id, tr50_async_reply_callback reply_callback, void *custom, int timeout) {
+	long long deadline = _time_now() + timeout;
+	int ret, remaining = timeout;
+
+	while ((ret = tr50_api_call_async(tr50, message, seq_id, reply_callback, custom, remaining)) == ERR_TR50_WOULD_BLOCK) {
+		if ((remaining = (int)(deadline - _time_now())) <= 0 || _tr50_pending_wait_credit((_TR50_CLIENT *)tr50, remaining) != 0) {
+			return ERR_TR50_WOULD_BLOCK;
+		}
+	}
+	return ret;
+}
+
+// Never waits for credit: it is called from callbacks, and the receive thread among them.
 int tr50_api_call(void *tr50, void *message) {
 	int id;
 	return tr50_api_call_async(tr50, message, &id, NULL, NULL, 30000);
 }
 
 int tr50_api_call_async(void *tr50, void *message, int *seq_id, tr50_async_reply_callback reply_callback, void *custom, int timeout) {
+	return _tr50_api_call_async_ex(tr50, message, seq_id, reply_callback, custom, timeout, TRUE);
+}
+
+// [admit] FALSE skips the in-flight caps, for internal requests that are bounded already.
+int _tr50_api_call_async_ex(void *tr50, void *message, int *seq_id, tr50_async_reply_callback reply_callback, void *custom, int timeout, int admit) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 	_TR50_MESSAGE *msg = (_TR50_MESSAGE *)message;
 
-	const char *topic = client->compress ? TR50_TOPIC_COMPRESS_API : TR50_TOPIC_API;
+	const char *topic = TR50_TOPIC_API;
 	char topic_with_seq[64];
 	char *data = NULL;
 	int data_len, ret, local_seq_id;
+	long long submitted = client->trace.enabled ? _time_now_us() : 0;
 
 	_tr50_mutex_lock(client->mux);
 	client->stats.in_api_call_async = 1;
@@ -81,6 +103,9 @@ int tr50_api_call_async(void *tr50, void *message, int *seq_id, tr50_async_reply
 		ret = ERR_TR50_STOPPING;
 		goto end_error;
 	}
+	if (admit && (ret = _tr50_pending_admit(client)) != 0) {
+		goto end_error;
+	}
 
 	if (client->seq_id == TR50_MAX_ID) {
 		client->seq_id = 0;
@@ -92,6 +117,7 @@ int tr50_api_call_async(void *tr50, void *message, int *seq_id, tr50_async_reply
 
 	msg->seq_id = local_seq_id;
 	msg->message_type = TR50_MESSAGE_TYPE_OBJ;
+	_tr50_trace_submitted(client, local_seq_id, submitted);
 	msg->reply_callback = (void *)reply_callback;
 	msg->callback_custom = custom;
 	msg->callback_timeout = timeout;
@@ -107,7 +133,9 @@ int tr50_api_call_async(void *tr50, void *message, int *seq_id, tr50_async_reply
 	}
 
 	client->stats.in_api_call_async = 2;
-	if ((ret = mqtt_async_publish(client->mqtt, topic_with_seq, data, data_len, 0)) != 0) {
+	ret = mqtt_async_publish(client->mqtt, topic_with_seq, data, data_len, 0);
+	_tr50_trace(client, local_seq_id, _TR50_TRACE_WRITTEN);
+	if (ret != 0) {
 		if ((msg = tr50_pending_find_and_remove(client, local_seq_id)) != NULL) {
 			goto end_error;
 		}
@@ -132,48 +160,50 @@ end_error:
 
 int _tr50_build_payload(_TR50_CLIENT *client, const char **topic, _TR50_MESSAGE *message, char **data, int *data_len) {
 	int ret = 0;
-	if (client->compress) {
-		char *raw;
-		int raw_len;
+	char *raw, *out;
+	int raw_len, out_len;
 
-		if ((ret = tr50_message_to_string(*topic, message, &raw, &raw_len)) != 0) {
-			return ret;
-		}
-		if (client->config.api_watcher_handler) {
-			client->config.api_watcher_handler(raw, raw_len, 0);
-		}
-		if (raw_len <= TR50_MIN_COMPRESSION_LEN) {
-			*data_len = raw_len;
-			*data = raw;
-			*topic = TR50_TOPIC_API;
-			return ret;
-		}
-		if ((ret = _compress_deflate(raw, raw_len, data, data_len)) != 0) { // if compression failed, send without compression
-			log_need_investigation("_compress_deflate(): failed [%d]", ret);
-			*data = raw;
-			*data_len = raw_len;
-			*topic = TR50_TOPIC_API;
-		} else {
-			_tr50_stats_set_compress_ratio(client, raw_len, *data_len);
-			_memory_free(raw);
-		}
+	if ((ret = tr50_message_to_string(*topic, message, &raw, &raw_len)) != 0) {
+		return ret;
+	}
+	_tr50_trace(client, message->seq_id, _TR50_TRACE_SERIALIZED);
+	message->pending_bytes = raw_len;
+	if (client->executor_order == TR50_EXECUTOR_ORDER_THING) {
+		message->order_key = _tr50_order_key_json(raw);
+	}
+	if (client->config.api_watcher_handler) {
+		client->config.api_watcher_handler(raw, raw_len, 0);
+	}
+	if ((ret = _tr50_compress_payload(client, raw, raw_len, topic, &out, &out_len)) != 0) {
+		_memory_free(raw);
+		return ret;
+	}
+	_tr50_trace(client, message->seq_id, _TR50_TRACE_COMPRESSED);
+	if (out) {
+		_memory_free(raw);
+		*data = out;
+		*data_len = out_len;
 	} else {
-		if ((ret = tr50_message_to_string(*topic, message, data, data_len)) != 0) {
-			return ret;
-		}
-		if (client->config.api_watcher_handler) {
-			client->config.api_watcher_handler(*data, *data_len, 0);
-		}
+		*data = raw;
+		*data_len = raw_len;
 	}
 	return ret;
 }
 
 int tr50_api_raw_async(void *tr50, const char *request_json, int *seq_id, tr50_async_raw_reply_callback reply_callback, void *custom, int timeout) {
+	return _tr50_api_raw_async_ex(tr50, request_json, seq_id, reply_callback, custom, timeout, FALSE);
+}
+
+// With handoff the callback is given a reply it keeps, see _TR50_MESSAGE.raw_handoff.
+int _tr50_api_raw_async_ex(void *tr50, const char *request_json, int *seq_id, tr50_async_raw_reply_callback reply_callback, void *custom, int timeout, int handoff) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 	_TR50_MESSAGE *msg = NULL;
 
+	const char *topic;
 	char topic_with_seq[64];
-	int request_len, ret, local_seq_id;
+	char *out = NULL;
+	int request_len, out_len, ret, local_seq_id;
+	long long submitted = client->trace.enabled ? _time_now_us() : 0;
 
 	_tr50_mutex_lock(client->mux);
 	client->stats.in_api_raw_async = 1;
@@ -186,6 +216,9 @@ int tr50_api_raw_async(void *tr50, const char *request_json, int *seq_id, tr50_a
 		ret = ERR_TR50_STOPPING;
 		goto end_error;
 	}
+	if ((ret = _tr50_pending_admit(client)) != 0) {
+		goto end_error;
+	}
 
 	if (client->seq_id == TR50_MAX_ID) {
 		client->seq_id = 0;
@@ -199,9 +232,15 @@ int tr50_api_raw_async(void *tr50, const char *request_json, int *seq_id, tr50_a
 	tr50_message_create((void *)&msg);
 	msg->seq_id = local_seq_id;
 	msg->message_type = TR50_MESSAGE_TYPE_RAW;
+	_tr50_trace_submitted(client, local_seq_id, submitted);
 	msg->raw_callback = (void *)reply_callback;
+	msg->raw_handoff = handoff;
 	msg->callback_custom = custom;
 	msg->callback_timeout = timeout;
+	msg->pending_bytes = request_len;
+	if (client->executor_order == TR50_EXECUTOR_ORDER_THING) {
+		msg->order_key = _tr50_order_key_json(request_json);
+	}
 
 	if ((ret = tr50_pending_add(client, msg)) != 0) {
 		goto end_error;
@@ -212,35 +251,26 @@ int tr50_api_raw_async(void *tr50, const char *request_json, int *seq_id, tr50_a
 	}
 
 	client->stats.in_api_raw_async = 2;
-	if (client->compress && request_len >= TR50_MIN_COMPRESSION_LEN) {
-		int out_len;
-		char *out;
-
-		snprintf(topic_with_seq, 63, "%s/%d", TR50_TOPIC_COMPRESS_API, msg->seq_id);
-
-		if ((ret = _compress_deflate(request_json, request_len, &out, &out_len)) != 0) { // if compression failed, send without compression
-			log_need_investigation("_compress_deflate(): failed [%d]", ret);
-			goto end_error;
-		}
-		_tr50_stats_set_compress_ratio(client, request_len, out_len);
+	if ((ret = _tr50_compress_payload(client, request_json, request_len, &topic, &out, &out_len)) != 0) {
+		tr50_pending_find_and_remove(client, local_seq_id);
+		goto end_error;
+	}
+	_tr50_trace(client, local_seq_id, _TR50_TRACE_COMPRESSED);
+	snprintf(topic_with_seq, 63, "%s/%d", topic, msg->seq_id);
 
-		if ((ret = mqtt_async_publish(client->mqtt, topic_with_seq, out, out_len, 0)) != 0) {
-			if ((msg = tr50_pending_find_and_remove(client, local_seq_id)) != NULL) {
+	ret = mqtt_async_publish(client->mqtt, topic_with_seq, out ? out : request_json, out ? out_len : request_len, 0);
+	_tr50_trace(client, local_seq_id, _TR50_TRACE_WRITTEN);
+	if (ret != 0) {
+		if ((msg = tr50_pending_find_and_remove(client, local_seq_id)) != NULL) {
+			if (out) {
 				_memory_free(out);
-				goto end_error;
 			}
-			// already expirated, return okay.
+			goto end_error;
 		}
+		// already expirated, return okay.
+	}
+	if (out) {
 		_memory_free(out);
-	} else {
-		snprintf(topic_with_seq, 63, "%s/%d", TR50_TOPIC_API, msg->seq_id);
-
-		if ((ret = mqtt_async_publish(client->mqtt, topic_with_seq, request_json, request_len, 0)) != 0) {
-			if ((msg = tr50_pending_find_and_remove(client, local_seq_id)) != NULL) {
-				goto end_error;
-			}
-			// already expirated, return okay.
-		}
 	}
 	_tr50_stats_pub_sent_up(client, request_len);
 	client->stats.in_api_raw_async = 0;
@@ -255,80 +285,150 @@ end_error:
 	return ret;
 }
 
+#define _TR50_SYNC_WAITING		0
+#define _TR50_SYNC_ANSWERED		1
+#define _TR50_SYNC_ABANDONED	2
+
+// Lives on the heap: a caller that gives up leaves it to the callback still on its way.
 typedef struct {
-	void *evt;
+	void *waiter;
+	volatile int state;
 	int status;
 	void *reply;
 } _TR50_SYNC_OBJ;
 
-void _tr50_api_call_sync_callback(void *tr50, int status, const void *request_message, void *message, void *custom) {
-	_TR50_SYNC_OBJ *sync = (_TR50_SYNC_OBJ *)custom;
-	if (status == 0) {
-		sync->reply = message;
+static int _tr50_api_sync_create(_TR50_SYNC_OBJ **sync) {
+	int ret;
+
+	if ((*sync = (_TR50_SYNC_OBJ *)_memory_malloc(sizeof(_TR50_SYNC_OBJ))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(*sync, 0, sizeof(_TR50_SYNC_OBJ));
+	if ((ret = _tr50_waiter_take(&(*sync)->waiter)) != 0) {
+		_memory_free(*sync);
+		return ret;
 	}
+	(*sync)->status = -1;
+	return 0;
+}
+
+static void _tr50_api_sync_delete(_TR50_SYNC_OBJ *sync) {
+	_tr50_waiter_give(sync->waiter);
+	_memory_free(sync);
+}
+
+// Called by the reply callbacks; FALSE when the caller gave up, the callback frees it then.
+static int _tr50_api_sync_answer(_TR50_SYNC_OBJ *sync, int status, void *reply) {
+	void *waiter = sync->waiter;
+
 	sync->status = status;
-	_tr50_event_signal(sync->evt);
+	sync->reply = reply;
+	if (!_atomic_cas32(&sync->state, _TR50_SYNC_WAITING, _TR50_SYNC_ANSWERED)) {
+		_memory_free(sync);
+		return FALSE;
+	}
+	_tr50_waiter_wake(waiter);
+	return TRUE;
+}
+
+// Waits for the reply until [deadline]. Past it the request is expired right here instead of at
+// the next pass of the expiry thread; when a reply or that thread took it first, its callback is
+// already on the way and is given TR50_SYNC_GRACE_MS more. Returns 0 when [sync] is still the
+// caller's, or ERR_TR50_REQ_TIMEOUT when it was left to that callback.
+static int _tr50_api_sync_wait(_TR50_CLIENT *client, _TR50_SYNC_OBJ *sync, int seq_id, long long deadline) {
+	int remaining = (int)(deadline - _time_now());
+
+	if (_tr50_waiter_wait(sync->waiter, remaining > 0 ? remaining : 0) != ERR_TR50_TIMEOUT) {
+		return 0;
+	}
+	if (_tr50_pending_cancel(client, seq_id)) {
+		sync->status = ERR_TR50_REQ_TIMEOUT;
+		return 0;
+	}
+	if (_tr50_waiter_wait(sync->waiter, TR50_SYNC_GRACE_MS) != ERR_TR50_TIMEOUT) {
+		return 0;
+	}
+	if (_atomic_cas32(&sync->state, _TR50_SYNC_WAITING, _TR50_SYNC_ABANDONED)) {
+		log_important_info("_tr50_api_sync_wait(): reply callback for [%d] did not run in time, giving up.", seq_id);
+		_tr50_waiter_give(sync->waiter);
+		return ERR_TR50_REQ_TIMEOUT;
+	}
+	// answered just now, the wake follows at once
+	_tr50_waiter_wait(sync->waiter, -1);
+	return 0;
+}
+
+void _tr50_api_call_sync_callback(void *tr50, int status, const void *request_message, void *message, void *custom) {
+	if (!_tr50_api_sync_answer((_TR50_SYNC_OBJ *)custom, status, status == 0 ? message : NULL) && status == 0) {
+		tr50_message_delete(message);
+	}
 }
 
 int tr50_api_call_sync(void *tr50, void *message, void **reply_message, int timeout) {
-	int ret, id;
-	_TR50_SYNC_OBJ sync;
+	int ret, id, status;
+	long long deadline = _time_now() + timeout;
+	_TR50_SYNC_OBJ *sync;
 
-	_memory_memset(&sync, 0, sizeof(_TR50_SYNC_OBJ));
-	if ((ret = _tr50_event_create(&sync.evt)) != 0) {
+	if ((ret = _tr50_api_sync_create(&sync)) != 0) {
 		return ret;
 	}
-	sync.status = -1;
 
-	if ((ret = tr50_api_call_async(tr50, message, &id, _tr50_api_call_sync_callback, &sync, timeout)) != 0) {
-		_tr50_event_delete(sync.evt);
+	if ((ret = _tr50_api_call_wait(tr50, message, &id, _tr50_api_call_sync_callback, sync, timeout)) != 0) {
+		_tr50_api_sync_delete(sync);
 		return ret;
 	}
-	_tr50_event_wait(sync.evt);
+	if ((status = _tr50_api_sync_wait((_TR50_CLIENT *)tr50, sync, id, deadline)) == 0) {
+		status = sync->status;
+		if (status == 0) {
+			*reply_message = sync->reply;
+		}
+		_tr50_api_sync_delete(sync);
+	}
 
-	if (sync.status == 0) {
-		*reply_message = sync.reply;
-	} else {
+	if (status != 0) {
 		const char *err_message = "TR50: Operation Timeout.";
 		// since the message will expire, we are creating an error reply and return 0, so that the caller does not free the request.
 		tr50_message_create(reply_message);
 		((_TR50_MESSAGE *)*reply_message)->is_reply=TRUE;
 		tr50_json_add_false_to_object(((_TR50_MESSAGE *)*reply_message)->json, "success");
-		tr50_json_add_item_to_object(((_TR50_MESSAGE *)*reply_message)->json, "errorcodes", tr50_json_create_int_array(&sync.status, 1));
+		tr50_json_add_item_to_object(((_TR50_MESSAGE *)*reply_message)->json, "errorcodes", tr50_json_create_int_array(&status, 1));
 		tr50_json_add_item_to_object(((_TR50_MESSAGE *)*reply_message)->json, "errormessages", tr50_json_create_string_array(&err_message, 1));
 	}
-	_tr50_event_delete(sync.evt);
 	return 0;
 }
 
+// Registered with handoff: reply_json is ours and goes to the caller as it is.
 void _tr50_api_raw_sync_callback(int status, const char *reply_json, void *custom) {
-	_TR50_SYNC_OBJ *sync = (_TR50_SYNC_OBJ *)custom;
-	if (status == 0) {
-		sync->reply = _memory_clone((void *)reply_json, strlen(reply_json));
+	if (!_tr50_api_sync_answer((_TR50_SYNC_OBJ *)custom, status, status == 0 ? (void *)reply_json : NULL) && reply_json) {
+		_memory_free((void *)reply_json);
 	}
-	sync->status = status;
-	_tr50_event_signal(sync->evt);
 }
 
 int tr50_api_raw_sync(void *tr50, const char *request_json, char **reply_json, int timeout) {
-	int ret, id;
-	_TR50_SYNC_OBJ sync;
+	int ret, id, remaining = timeout;
+	long long deadline = _time_now() + timeout;
+	_TR50_SYNC_OBJ *sync;
 
-	_memory_memset(&sync, 0, sizeof(_TR50_SYNC_OBJ));
-	if ((ret = _tr50_event_create(&sync.evt)) != 0) {
+	if ((ret = _tr50_api_sync_create(&sync)) != 0) {
 		return ret;
 	}
-	sync.status = -1;
 
-	if ((ret = tr50_api_raw_async(tr50, request_json, &id, _tr50_api_raw_sync_callback, &sync, timeout)) != 0) {
-		_tr50_event_delete(sync.evt);
+	while ((ret = _tr50_api_raw_async_ex(tr50, request_json, &id, _tr50_api_raw_sync_callback, sync, remaining, TRUE)) == ERR_TR50_WOULD_BLOCK) {
+		if ((remaining = (int)(deadline - _time_now())) <= 0 || _tr50_pending_wait_credit((_TR50_CLIENT *)tr50, remaining) != 0) {
+			break;
+		}
+	}
+	if (ret != 0) {
+		_tr50_api_sync_delete(sync);
+		return ret;
+	}
+	if ((ret = _tr50_api_sync_wait((_TR50_CLIENT *)tr50, sync, id, deadline)) != 0) {
 		return ret;
 	}
-	_tr50_event_wait(sync.evt);
 
-	if (sync.status == 0) {
-		*reply_json = sync.reply;
+	if ((ret = sync->status) == 0) {
+		*reply_json = sync->reply;
 	}
-	_tr50_event_delete(sync.evt);
-	return sync.status;
+	_tr50_api_sync_delete(sync);
+	return ret;
 }
@@ -32,7 +32,9 @@
 
 #include <tr50/mqtt/mqtt.h>
 
+#include <tr50/util/atomic.h>
 #include <tr50/util/compress.h>
+#include <tr50/util/executor.h>
 #include <tr50/util/log.h>
 #include <tr50/util/memory.h>
 #include <tr50/util/mutex.h>
@@ -40,7 +42,6 @@
 #include <tr50/util/time.h>
 
 void _tr50_pending_expiration_handler(_TR50_CLIENT *client);
-void _tr50_publish_handler(const char *topic, const char *data, int data_len, void *custom);
 void _tr50_api_watcher_reply(_TR50_CLIENT *client, const char *data, int data_len);
 static void _tr50_state_change_handler(int previous_mqtt_state, int current_mqtt_state, int error, const char *why, void *custom);
 
@@ -66,12 +67,22 @@ int tr50_create(void **tr50, const char *client_id, const char *host, int port)
 
 	tr50_config_set_timeout(client, 5000);
 	tr50_config_set_keeplive(client, 60000);
+	tr50_config_set_mailbox_batch(client, 0, 1);
+	tr50_config_set_file_chunk_size(client, TR50_FILE_CHUNK_SIZE_DEFAULT);
+	tr50_config_set_file_download(client, 1, TR50_FILE_SEGMENT_SIZE_DEFAULT);
+	tr50_config_set_file_transfer(client, 2, 64, 0);
 
 	// creating objects
+	_tr50_stats_create(client); // before pending, its thread ticks the rates
 	tr50_pending_create(client);
 	_tr50_mutex_create(&client->mux);
-	_tr50_mutex_create(&client->stats.mux);
 	_tr50_mutex_create(&client->mailbox_check_mux);
+	_tr50_mutex_create(&client->mailbox_ack_mux);
+	_tr50_registry_create(&client->commands);
+	_tr50_registry_create(&client->methods);
+	_tr50_metrics_create(client);
+	_tr50_capture_create(client);
+	_tr50_file_create(client);
 	
 	*tr50 = client;
 	return 0;
@@ -80,10 +91,20 @@ int tr50_create(void **tr50, const char *client_id, const char *host, int port)
 int tr50_delete(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 
+	_tr50_file_delete(client);
+	_tr50_metrics_delete(client);
+	_tr50_capture_delete(client);
+	_tr50_registry_delete(&client->methods);
+	_tr50_registry_delete(&client->commands);
+	if (client->mailbox_acks) {
+		tr50_message_delete(client->mailbox_acks);
+	}
+	_tr50_mutex_delete(client->mailbox_ack_mux);
 	_tr50_mutex_delete(client->mailbox_check_mux);
 	_tr50_mutex_delete(client->mux);
-	_tr50_mutex_delete(client->stats.mux);
 	tr50_pending_delete(client);
+	_tr50_stats_delete(client);
+	_tr50_trace_delete(client);
 	_tr50_config_delete(&client->config);
 	return 0;
 }
@@ -122,7 +143,12 @@ int tr50_start2(void *tr50, int *connect_error) {
 		mqtt_connect_params_set_username(client->connect_params, config->username, config->password);
 	}
 
-	client->compress = config->compress;
+	if (config->transport) {
+		mqtt_connect_params_set_transport(client->connect_params, config->transport);
+	}
+	mqtt_connect_params_set_frame_callback(client->connect_params, _tr50_capture_frame, client);
+
+	_tr50_compress_start(client);
 	tr50_stats_clear_compression_ratio(client);
 
 	client->should_reconnect_callback = config->should_reconnect_callback;
@@ -132,10 +158,12 @@ int tr50_start2(void *tr50, int *connect_error) {
 	client->non_api_callback_custom = config->non_api_handler_custom;
 
 	client->state = TR50_STATE_STARTED;
+	_tr50_executor_start(client);
 
 	// connect!
 	if ((ret = mqtt_async_connect(&client->mqtt, client->connect_params, _tr50_publish_handler, _tr50_state_change_handler, _tr50_should_reconnect_callback, client, connect_error)) != 0) {
 		client->state = TR50_STATE_STOPPED;
+		_tr50_executor_stop(client);
 		goto end_error;
 	}
 
@@ -153,7 +181,8 @@ int tr50_start(void *tr50) {
 
 int tr50_stop(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	int ret, last_sent, last_recv;
+	long long last_sent, last_recv;
+	int ret;
 
 	_tr50_mutex_lock(client->mux);
 	if (client->state == TR50_STATE_STOPPED) {
@@ -166,16 +195,26 @@ int tr50_stop(void *tr50) {
 	}
 
 	client->is_stopping = 1;
+	// counted now; the stats getters leave the mqtt client alone from here on
 	last_sent = mqtt_async_stats_byte_sent(client->mqtt);
 	last_recv = mqtt_async_stats_byte_recv(client->mqtt);
+	_atomic_add64(&client->stats.total_sent, last_sent);
+	_atomic_add64(&client->stats.total_recv, last_recv);
 	_tr50_mutex_unlock(client->mux);
 
+	// acks still batched go out while the connection is up
+	_tr50_mailbox_flush(client);
+
 	// release the mux because one of the publish callback might try to grab it.
 	if ((ret = mqtt_async_disconnect(client->mqtt)) != 0) {
 		_tr50_mutex_lock(client->mux);
 		client->is_stopping = 0;
+		_atomic_add64(&client->stats.total_sent, -last_sent);
+		_atomic_add64(&client->stats.total_recv, -last_recv);
 		goto end_error;
 	}
+	// nothing is routed any more; callbacks still queued run now
+	_tr50_executor_stop(client);
 
 	_tr50_mutex_lock(client->mux);
 	if (client->connect_params) {
@@ -185,8 +224,6 @@ int tr50_stop(void *tr50) {
 	client->mqtt = NULL;
 	client->state = TR50_STATE_STOPPED;
 	client->is_stopping = 0;
-	client->stats.total_sent += last_sent;
-	client->stats.total_recv += last_recv;
 	_tr50_mutex_unlock(client->mux);
 	return 0;
 
@@ -289,34 +326,75 @@ const char *tr50_current_status_string(void *tr50) {
 	return "Unknown";
 }
 
-void _tr50_publish_handle_publish(_TR50_CLIENT *client, const char *data, int data_len, int seq_id) {
-	_TR50_MESSAGE *request, *reply;
+// Fails [request] with [status] instead of letting it time out, and frees it.
+static void _tr50_publish_fail(_TR50_CLIENT *client, _TR50_MESSAGE *request, int status) {
+	if (request->message_type == TR50_MESSAGE_TYPE_OBJ && request->reply_callback) {
+		((tr50_async_reply_callback)request->reply_callback)(client, status, request, NULL, request->callback_custom);
+	} else if (request->message_type == TR50_MESSAGE_TYPE_RAW && request->raw_callback) {
+		((tr50_async_raw_reply_callback)request->raw_callback)(status, NULL, request->callback_custom);
+	}
+	tr50_message_delete(request);
+}
+
+// Deliver a reply to its request. The reply is either text, or for compressed replies that
+// were inflated straight into the parser, an already parsed tree (data is NULL then). When
+// *owned is set it is data as a buffer the callee may keep.
+static void _tr50_publish_handle_reply(_TR50_CLIENT *client, _TR50_MESSAGE *request, const char *data, int data_len, JSON *json, int seq_id, char **owned) {
+	_TR50_MESSAGE *reply;
+	char *text;
 	int ret;
 
-	if ((request = (_TR50_MESSAGE *)tr50_pending_find_and_remove(client, seq_id)) == NULL) {
-		log_important_info("tr50_pending_find_and_remove(): message[%d] not in pending", seq_id);
-		return;
-	}
+	_tr50_stats_latency(client, request, _time_now() - request->pending_sent_timestamp);
 
-	if (request->message_type == TR50_MESSAGE_TYPE_RAW) {
+	if (request->message_type == TR50_MESSAGE_TYPE_RAW && request->raw_handoff) {
+		// the text is given away and may be freed at once, so whatever reads it goes first
+		_tr50_trace(client, seq_id, _TR50_TRACE_PARSED);
+		_tr50_stats_pub_recv_up(client, data_len);
+		_tr50_api_watcher_reply(client, data, data_len);
+		if ((text = *owned) != NULL) {
+			*owned = NULL;
+		} else {
+			text = (char *)_memory_clone((void *)data, data_len);
+		}
+		_tr50_trace(client, seq_id, _TR50_TRACE_CALLBACK_START);
+		((tr50_async_raw_reply_callback)request->raw_callback)(text ? 0 : ERR_TR50_MALLOC, text, request->callback_custom);
+		_tr50_trace(client, seq_id, _TR50_TRACE_CALLBACK_END);
+		tr50_message_delete(request);
+		return;
+	} else if (request->message_type == TR50_MESSAGE_TYPE_RAW) {
+		_tr50_trace(client, seq_id, _TR50_TRACE_PARSED);
 		if (request->raw_callback) {
+			_tr50_trace(client, seq_id, _TR50_TRACE_CALLBACK_START);
 			((tr50_async_raw_reply_callback)request->raw_callback)(0, data, request->callback_custom);
+			_tr50_trace(client, seq_id, _TR50_TRACE_CALLBACK_END);
 		}
 	} else if (request->message_type == TR50_MESSAGE_TYPE_OBJ) {
-		if ((ret = tr50_message_from_string(data, data_len, (void *)&reply)) != 0) {
-			_tr50_api_watcher_reply(client, data, data_len);
+		if (json) {
+			ret = _tr50_message_from_json(json, (void *)&reply);
+		} else {
+			ret = tr50_message_from_string(data, data_len, (void *)&reply);
+		}
+		if (ret != 0) {
+			if (data) {
+				_tr50_api_watcher_reply(client, data, data_len);
+			}
 			log_important_info("_tr50_publish_handler(): Invalid message recv'ed length[%d].", data_len);
+			_tr50_publish_fail(client, request, ret);
 			return;
 		}
 		if (!reply->is_reply) {
 			log_important_info("_tr50_publish_handler(): TR50 does not support PUSH request.");
 			tr50_message_delete(reply);
+			_tr50_publish_fail(client, request, ERR_TR50_NOT_SUPPORTED);
 			return;
 		}
 		reply->seq_id = seq_id;
+		_tr50_trace(client, seq_id, _TR50_TRACE_PARSED);
 		if (request->reply_callback) {
 			long long ended, started = _time_now();
+			_tr50_trace(client, seq_id, _TR50_TRACE_CALLBACK_START);
 			((tr50_async_reply_callback)request->reply_callback)(client, 0, request, reply, request->callback_custom);
+			_tr50_trace(client, seq_id, _TR50_TRACE_CALLBACK_END);
 			ended = _time_now();
 			if (ended - started > 1000) {
 				log_need_investigation("_tr50_publish_handle_publish(): reply callback for [%d] is taking [%d]ms.", request->seq_id, (int)(ended - started));
@@ -327,43 +405,166 @@ void _tr50_publish_handle_publish(_TR50_CLIENT *client, const char *data, int da
 	}
 
 	_tr50_stats_pub_recv_up(client, data_len); // compress or not?
-	_tr50_api_watcher_reply(client, data, data_len);
+	if (data) {
+		_tr50_api_watcher_reply(client, data, data_len);
+	}
 	tr50_message_delete(request);
 }
 
+// Takes the request a reply topic answers off the pending list; NULL when it expired or was
+// never sent, or when the topic is not a reply.
+static _TR50_MESSAGE *_tr50_publish_match(_TR50_CLIENT *client, const char *topic, int *seq_id) {
+	_TR50_MESSAGE *request;
+
+	if (_tr50_codec_find_by_reply_topic(topic) != NULL) {
+		*seq_id = atoi(strchr(topic, '/') + 1);
+	} else if (strncmp(topic, "reply/", 6) == 0) {
+		*seq_id = atoi(topic + 6);
+	} else {
+		return NULL;
+	}
+	_tr50_trace(client, *seq_id, _TR50_TRACE_REPLY_RECEIVED);
+	if ((request = (_TR50_MESSAGE *)tr50_pending_find_and_remove(client, *seq_id)) == NULL) {
+		log_important_info("tr50_pending_find_and_remove(): message[%d] not in pending", *seq_id);
+	}
+	return request;
+}
+
+static void _tr50_publish_handle_compressed(_TR50_CLIENT *client, _TR50_MESSAGE *request, const char *topic, const char *data, int data_len, int seq_id) {
+	JSON *json = NULL;
+	char *out = NULL;
+	int ret, out_len = 0;
+
+	// raw callbacks and the api watcher need the text; everything else is parsed while it inflates.
+	if (request->message_type == TR50_MESSAGE_TYPE_OBJ && client->config.api_watcher_handler == NULL) {
+		ret = _tr50_decompress_payload_json(client, topic, data, data_len, &json, &out_len);
+	} else {
+		ret = _tr50_decompress_payload(client, topic, data, data_len, &out, &out_len);
+	}
+	if (ret != 0) {
+		log_important_info("_tr50_publish_handler(): Decompression failed [%d].", ret);
+		_tr50_publish_fail(client, request, ret);
+		return;
+	}
+
+	_tr50_publish_handle_reply(client, request, out, out_len, json, seq_id, &out);
+	if (out) {
+		_memory_free(out);
+	}
+}
+
 void _tr50_api_watcher_reply(_TR50_CLIENT *client, const char *data, int data_len) {
 	if (client->config.api_watcher_handler) {
 		client->config.api_watcher_handler(data, data_len, 1);
 	}
 }
 
-void _tr50_publish_handler(const char *topic, const char *data, int data_len, void *custom) {
-	_TR50_CLIENT *client = (_TR50_CLIENT *)custom;
-	int ret;
-	
+// [request] was matched to the topic already, see _tr50_publish_match(). *owned is data when
+// the caller holds it as a buffer it may give away, else NULL.
+static void _tr50_publish_dispatch(_TR50_CLIENT *client, _TR50_MESSAGE *request, const char *topic, const char *data, int data_len, int seq_id, char **owned) {
 	if (client->non_api_callback) {
 		client->non_api_callback(topic, data, data_len, client->non_api_callback_custom);
 	}
 
-	if (strncmp(topic, "replyz/", 7) == 0) {
-		char *out;
-		int out_len = 0;
-
-		if ((ret = _compress_inflate(data, data_len, &out, &out_len)) != 0) {
-			log_important_info("_tr50_publish_handler(): Decompression failed [%d].", ret);
-			return;
+	if (request) {
+		if (_tr50_codec_find_by_reply_topic(topic) != NULL) {
+			_tr50_publish_handle_compressed(client, request, topic, data, data_len, seq_id);
+		} else {
+			_tr50_publish_handle_reply(client, request, data, data_len, NULL, seq_id, owned);
 		}
-		_tr50_stats_set_compress_ratio(client, out_len, data_len);
+	} else if (strcmp(topic, "notify/mailbox_activity") == 0) { // Non-tr50 requests
+		_tr50_stats_notify_up(client);
+		tr50_mailbox_check(client);
+	}
+}
 
-		_tr50_publish_handle_publish(client, out, out_len, atoi(topic[0] == 'a' ? topic + 5 : topic + 7));
-		_memory_free(out);
-	} else if (strncmp(topic, "reply/", 6) == 0) {
-		_tr50_publish_handle_publish(client, data, data_len, atoi(topic[0] == 'a' ? topic + 4 : topic + 6));
-	} else { // Non-tr50 requests
-		if (strcmp(topic, "notify/mailbox_activity") == 0) {
-			_tr50_stats_notify_up(client);
-			tr50_mailbox_check(client);
+typedef struct {
+	_EXECUTOR_TASK	task;
+	_TR50_CLIENT *	client;
+	_TR50_MESSAGE *	request;
+	char *			topic;		// topic follows the struct, and data too unless it is payload
+	char *			data;
+	char *			payload;	// the receive buffer itself when it could be kept
+	int				data_len;
+	int				seq_id;
+} _TR50_PUBLISH_TASK;
+
+static void _tr50_publish_task_run(_EXECUTOR_TASK *task) {
+	_TR50_PUBLISH_TASK *publish = (_TR50_PUBLISH_TASK *)task;
+
+	_tr50_publish_dispatch(publish->client, publish->request, publish->topic, publish->data, publish->data_len, publish->seq_id, &publish->payload);
+	if (publish->payload) {
+		_memory_free(publish->payload);
+	}
+	_memory_free(publish);
+}
+
+// A sync call's callback only hands the reply to the thread waiting for it. Queued, it could
+// sit behind that very thread, so it runs on the receive thread instead.
+static int _tr50_publish_is_sync(_TR50_MESSAGE *request) {
+	return request && (request->reply_callback == (void *)_tr50_api_call_sync_callback || request->raw_callback == (void *)_tr50_api_raw_sync_callback);
+}
+
+// On the receive thread with an executor: pick the matched reply's key and queue the rest.
+// The task keeps the receive buffer when the transport lets go of it, else a copy.
+static void _tr50_publish_route(_TR50_CLIENT *client, _TR50_MESSAGE *request, int seq_id, const char *topic, const char *data, int data_len) {
+	_TR50_PUBLISH_TASK *publish;
+	char *payload = mqtt_async_take_payload(client->mqtt, data);
+	int topic_len = (int)strlen(topic);
+	unsigned int key = 0;
+
+	if ((publish = (_TR50_PUBLISH_TASK *)_memory_malloc(sizeof(_TR50_PUBLISH_TASK) + topic_len + (payload ? 0 : data_len + 1) + 1)) == NULL) {
+		log_should_not_happen("_tr50_publish_route(): out of memory, running inline");
+		_tr50_publish_dispatch(client, request, topic, data, data_len, seq_id, &payload);
+		if (payload) {
+			_memory_free(payload);
 		}
+		return;
+	}
+	publish->task.run = _tr50_publish_task_run;
+	publish->client = client;
+	publish->request = request;
+	publish->topic = (char *)(publish + 1);
+	publish->payload = payload;
+	publish->data_len = data_len;
+	publish->seq_id = seq_id;
+	_memory_memcpy(publish->topic, (void *)topic, topic_len + 1);
+	if (payload) {
+		publish->data = payload;
+	} else {
+		publish->data = publish->topic + topic_len + 1;
+		_memory_memcpy(publish->data, (void *)data, data_len);
+		publish->data[data_len] = 0;
+	}
+
+	if (client->executor_order == TR50_EXECUTOR_ORDER_THING && request) {
+		key = request->order_key;
+	} else if (client->executor_order == TR50_EXECUTOR_ORDER_SEQ_ID && request) {
+		key = (unsigned int)seq_id;
+	} else if (client->executor_order != TR50_EXECUTOR_ORDER_NONE) {
+		key = _tr50_order_key(topic, topic_len);
+	}
+	_executor_submit(client->executor, key, &publish->task);
+}
+
+void _tr50_publish_handler(const char *topic, const char *data, int data_len, void *custom) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)custom;
+	_TR50_MESSAGE *request;
+	char *payload = NULL;
+	int seq_id = 0;
+
+	request = _tr50_publish_match(client, topic, &seq_id);
+	if (client->executor && !_tr50_publish_is_sync(request)) {
+		_tr50_publish_route(client, request, seq_id, topic, data, data_len);
+		return;
+	}
+	// only a reply handed off keeps the receive buffer
+	if (request && request->raw_handoff) {
+		payload = mqtt_async_take_payload(client->mqtt, data);
+	}
+	_tr50_publish_dispatch(client, request, topic, data, data_len, seq_id, &payload);
+	if (payload) {
+		_memory_free(payload);
 	}
 }
 
@@ -0,0 +1,413 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+#include <tr50/mqtt/mqtt.h>
+
+#include <tr50/internal/tr50.h>
+
+#include <tr50/util/event.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+#define TR50_CAPTURE_MAGIC				"TR50CAP"
+#define TR50_CAPTURE_VERSION			1
+#define TR50_CAPTURE_HEADER_SIZE		16
+#define TR50_CAPTURE_RING_MIN			4096
+#define TR50_CAPTURE_IDLE_WAIT			500
+#define TR50_CAPTURE_FRAME_MAX			(256 * 1024 * 1024)
+
+// What a record looks like in the ring, followed by len bytes of packet.
+typedef struct {
+	long long	timestamp;	// _time_now_us()
+	int			len;
+	int			direction;
+} _TR50_CAPTURE_RECORD;
+
+void _tr50_capture_create(_TR50_CLIENT *client) {
+	_tr50_mutex_create(&client->capture.mux);
+	_tr50_event_create(&client->capture.evt);
+}
+
+void _tr50_capture_delete(_TR50_CLIENT *client) {
+	_TR50_CAPTURE *capture = &client->capture;
+
+	tr50_capture_stop(client);
+	if (capture->ring) {
+		_memory_free(capture->ring);
+		capture->ring = NULL;
+	}
+	_tr50_event_delete(capture->evt);
+	_tr50_mutex_delete(capture->mux);
+}
+
+// Copies into the ring at a running byte offset, wrapping at the end.
+static void _tr50_capture_ring_write(_TR50_CAPTURE *capture, long long offset, const char *data, int len) {
+	int pos = (int)(offset % capture->size);
+	int first = len < capture->size - pos ? len : capture->size - pos;
+
+	_memory_memcpy(capture->ring + pos, (void *)data, first);
+	if (first < len) {
+		_memory_memcpy(capture->ring, (void *)(data + first), len - first);
+	}
+}
+
+static void _tr50_capture_ring_read(_TR50_CAPTURE *capture, long long offset, char *data, int len) {
+	int pos = (int)(offset % capture->size);
+	int first = len < capture->size - pos ? len : capture->size - pos;
+
+	_memory_memcpy(data, capture->ring + pos, first);
+	if (first < len) {
+		_memory_memcpy(data + first, capture->ring, len - first);
+	}
+}
+
+static int _tr50_capture_ring_fwrite(_TR50_CAPTURE *capture, long long offset, int len) {
+	int pos = (int)(offset % capture->size);
+	int first = len < capture->size - pos ? len : capture->size - pos;
+	FILE *fp = (FILE *)capture->file;
+
+	if ((int)fwrite(capture->ring + pos, 1, first, fp) != first) {
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	if (first < len && (int)fwrite(capture->ring, 1, len - first, fp) != len - first) {
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	return 0;
+}
+
+// Installed as the MQTT frame callback of every connection; a flag check while not capturing.
+void _tr50_capture_frame(int direction, const char **bufs, const int *lens, int count, void *custom) {
+	_TR50_CAPTURE *capture = &((_TR50_CLIENT *)custom)->capture;
+	_TR50_CAPTURE_RECORD record;
+	long long offset;
+	int i;
+
+	if (!capture->enabled) {
+		return;
+	}
+	record.timestamp = _time_now_us();
+	record.direction = direction;
+	record.len = 0;
+	for (i = 0; i < count; ++i) {
+		record.len += lens[i];
+	}
+
+	_tr50_mutex_lock(capture->mux);
+	if (!capture->enabled) {
+		_tr50_mutex_unlock(capture->mux);
+		return;
+	}
+	if ((long long)sizeof(record) + record.len > capture->size - (capture->head - capture->tail)) {
+		++capture->dropped;
+		_tr50_mutex_unlock(capture->mux);
+		return;
+	}
+	offset = capture->head;
+	_tr50_capture_ring_write(capture, offset, (const char *)&record, sizeof(record));
+	offset += sizeof(record);
+	for (i = 0; i < count; ++i) {
+		_tr50_capture_ring_write(capture, offset, bufs[i], lens[i]);
+		offset += lens[i];
+	}
+	capture->head = offset;
+	++capture->frames;
+	_tr50_mutex_unlock(capture->mux);
+	_tr50_event_signal(capture->evt);
+}
+
+static int _tr50_capture_varint(unsigned long long value, char *out) {
+	int len = 0;
+
+	do {
+		out[len] = (char)(value & 0x7f);
+		value >>= 7;
+		if (value) {
+			out[len] |= 0x80;
+		}
+		++len;
+	} while (value);
+	return len;
+}
+
+// Writes the records in [tail, head) to the file.
+static int _tr50_capture_drain(_TR50_CAPTURE *capture, long long tail, long long head) {
+	_TR50_CAPTURE_RECORD record;
+	char prefix[21];
+	int prefix_len, ret;
+
+	while (tail < head) {
+		_tr50_capture_ring_read(capture, tail, (char *)&record, sizeof(record));
+		tail += sizeof(record);
+
+		prefix[0] = (char)record.direction;
+		prefix_len = 1;
+		prefix_len += _tr50_capture_varint(record.timestamp > capture->last_us ? record.timestamp - capture->last_us : 0, prefix + prefix_len);
+		prefix_len += _tr50_capture_varint(record.len, prefix + prefix_len);
+		if (record.timestamp > capture->last_us) {
+			capture->last_us = record.timestamp;
+		}
+		if ((int)fwrite(prefix, 1, prefix_len, (FILE *)capture->file) != prefix_len || (ret = _tr50_capture_ring_fwrite(capture, tail, record.len)) != 0) {
+			return ERR_TR50_FILE_WRITE_FAILED;
+		}
+		tail += record.len;
+	}
+	return 0;
+}
+
+static void *_tr50_capture_handler(void *tr50) {
+	_TR50_CAPTURE *capture = &((_TR50_CLIENT *)tr50)->capture;
+	long long tail, head;
+	int enabled, failed = 0;
+
+	for (;;) {
+		_tr50_mutex_lock(capture->mux);
+		tail = capture->tail;
+		head = capture->head;
+		enabled = capture->enabled;
+		if (tail == head) {
+			if (!enabled) {
+				_tr50_mutex_unlock(capture->mux);
+				break;
+			}
+			_tr50_event_reset(capture->evt);
+			_tr50_mutex_unlock(capture->mux);
+			fflush((FILE *)capture->file);
+			_tr50_event_wait_timeout(capture->evt, TR50_CAPTURE_IDLE_WAIT);
+			continue;
+		}
+		_tr50_mutex_unlock(capture->mux);
+
+		if (!failed && _tr50_capture_drain(capture, tail, head) != 0) {
+			log_important_info("_tr50_capture_handler(): write failed, dropping the rest of the capture");
+			failed = 1;
+		}
+
+		_tr50_mutex_lock(capture->mux);
+		capture->tail = head;
+		_tr50_mutex_unlock(capture->mux);
+	}
+	return NULL;
+}
+
+// The ring is kept until tr50_delete() because a producer may still be checking the flag.
+int tr50_capture_start(void *tr50, const char *path, int ring_size) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_CAPTURE *capture;
+	char header[TR50_CAPTURE_HEADER_SIZE];
+	long long started = _time_now();
+	FILE *fp;
+	int i;
+
+	if (client == NULL || path == NULL || ring_size < TR50_CAPTURE_RING_MIN) {
+		return ERR_TR50_PARMS;
+	}
+	capture = &client->capture;
+	_tr50_mutex_lock(capture->mux);
+	if (capture->thread) {
+		_tr50_mutex_unlock(capture->mux);
+		return ERR_TR50_ALREADY_STARTED;
+	}
+	if (capture->ring == NULL || capture->size != ring_size) {
+		if (capture->ring) {
+			_memory_free(capture->ring);
+		}
+		if ((capture->ring = (char *)_memory_malloc(ring_size)) == NULL) {
+			capture->size = 0;
+			_tr50_mutex_unlock(capture->mux);
+			return ERR_TR50_MALLOC;
+		}
+		capture->size = ring_size;
+	}
+	if ((fp = fopen(path, "wb")) == NULL) {
+		_tr50_mutex_unlock(capture->mux);
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	_memory_memcpy(header, TR50_CAPTURE_MAGIC, 7);
+	header[7] = TR50_CAPTURE_VERSION;
+	for (i = 0; i < 8; ++i) {
+		header[8 + i] = (char)((started >> (8 * i)) & 0xff);
+	}
+	if (fwrite(header, 1, sizeof(header), fp) != sizeof(header)) {
+		fclose(fp);
+		_tr50_mutex_unlock(capture->mux);
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	capture->file = fp;
+	capture->head = 0;
+	capture->tail = 0;
+	capture->frames = 0;
+	capture->dropped = 0;
+	capture->last_us = _time_now_us();
+	capture->enabled = 1;
+	_thread_create(&capture->thread, "TR50:Capture", _tr50_capture_handler, client);
+	_tr50_mutex_unlock(capture->mux);
+	return 0;
+}
+
+int tr50_capture_stop(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_CAPTURE *capture;
+	void *thread;
+
+	if (client == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	capture = &client->capture;
+	_tr50_mutex_lock(capture->mux);
+	capture->enabled = 0;
+	thread = capture->thread;
+	_tr50_mutex_unlock(capture->mux);
+	if (thread == NULL) {
+		return 0;
+	}
+	_tr50_event_signal(capture->evt);
+	_thread_join(thread);
+	_thread_delete(thread);
+
+	_tr50_mutex_lock(capture->mux);
+	capture->thread = NULL;
+	fclose((FILE *)capture->file);
+	capture->file = NULL;
+	_tr50_mutex_unlock(capture->mux);
+	return 0;
+}
+
+int tr50_capture_stats(void *tr50, long long *frames, long long *dropped) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+
+	if (client == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(client->capture.mux);
+	if (frames) {
+		*frames = client->capture.frames;
+	}
+	if (dropped) {
+		*dropped = client->capture.dropped;
+	}
+	_tr50_mutex_unlock(client->capture.mux);
+	return 0;
+}
+
+static int _tr50_capture_read_varint(FILE *fp, unsigned long long *value) {
+	int c, shift = 0;
+
+	*value = 0;
+	do {
+		if ((c = fgetc(fp)) == EOF || shift > 63) {
+			return ERR_TR50_CAPTURE_INVALID;
+		}
+		*value |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+int tr50_capture_read(const char *path, double speed, tr50_capture_frame_callback callback, void *custom) {
+	char header[TR50_CAPTURE_HEADER_SIZE];
+	unsigned long long delta, len;
+	long long timestamp = 0, started = 0, wait;
+	char *frame = NULL, *grown;
+	int direction, frame_size = 0, ret = 0;
+	FILE *fp;
+
+	if (path == NULL || callback == NULL || speed < 0) {
+		return ERR_TR50_PARMS;
+	}
+	if ((fp = fopen(path, "rb")) == NULL) {
+		return ERR_TR50_LOCAL_FILE_NOTFOUND;
+	}
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header) || memcmp(header, TR50_CAPTURE_MAGIC, 7) != 0 || header[7] != TR50_CAPTURE_VERSION) {
+		fclose(fp);
+		return ERR_TR50_CAPTURE_INVALID;
+	}
+
+	while ((direction = fgetc(fp)) != EOF) {
+		if (_tr50_capture_read_varint(fp, &delta) != 0 || _tr50_capture_read_varint(fp, &len) != 0 || len > TR50_CAPTURE_FRAME_MAX) {
+			ret = ERR_TR50_CAPTURE_INVALID;
+			break;
+		}
+		if ((int)len > frame_size) {
+			if ((grown = (char *)_memory_realloc(frame, (int)len)) == NULL) {
+				ret = ERR_TR50_MALLOC;
+				break;
+			}
+			frame = grown;
+			frame_size = (int)len;
+		}
+		if (len > 0 && fread(frame, 1, (size_t)len, fp) != (size_t)len) {
+			ret = ERR_TR50_CAPTURE_INVALID;
+			break;
+		}
+		timestamp += (long long)delta;
+
+		if (speed > 0) {
+			if (started == 0) {
+				started = _time_now_us();
+			} else if ((wait = (long long)(timestamp / speed) - (_time_now_us() - started)) >= 1000) {
+				_thread_sleep((int)(wait / 1000));
+			}
+		}
+		if ((ret = callback(direction, timestamp, frame, (int)len, custom)) != 0) {
+			break;
+		}
+	}
+	if (frame) {
+		_memory_free(frame);
+	}
+	fclose(fp);
+	return ret;
+}
+
+static int _tr50_capture_replay_frame(int direction, long long timestamp_us, const char *frame, int len, void *tr50) {
+	unsigned short msg_id;
+	char *topic, *payload;
+	int qos, payload_len;
+
+	if (direction != TR50_CAPTURE_IN || len < 2 || (frame[0] & MQTT_GET_MSG_TYPE) != MQTT_MSG_TYPE_PUBLISH) {
+		return 0;
+	}
+	if (mqtt_msg_process_publish(frame, len, &qos, &msg_id, &topic, &payload, &payload_len) != 0) {
+		log_important_info("_tr50_capture_replay_frame(): bad publish at [%lld]us", timestamp_us);
+		return 0;
+	}
+	_tr50_publish_handler(topic, payload, payload_len, tr50);
+	_memory_free(payload);
+	_memory_free(topic);
+	return 0;
+}
+
+int tr50_capture_replay(void *tr50, const char *path, double speed) {
+	if (tr50 == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	return tr50_capture_read(path, speed, _tr50_capture_replay_frame, tr50);
+}
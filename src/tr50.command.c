@@ -35,44 +35,52 @@
 
 int tr50_command_register(void *tr50, const char *cmd, tr50_command_callback func) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	_TR50_COMMAND *command = (_TR50_COMMAND *)_memory_malloc(sizeof(_TR50_COMMAND));
-	_memory_memset(command, 0, sizeof(_TR50_COMMAND));
-
-	command->callback = func;
-	strncpy(command->name, cmd, TR50_COMMAND_NAME_LEN);
-	command->next = client->command_head;
-	client->command_head = command;
-	log_important_info("tr50_command_register(): cmd[%s] registered.", command->name);
+	int ret;
+
+	if ((ret = _tr50_registry_set(&client->commands, cmd, (void *)func)) != 0) {
+		return ret;
+	}
+	log_important_info("tr50_command_register(): cmd[%s] registered.", cmd);
+	return 0;
+}
+
+int tr50_command_unregister(void *tr50, const char *cmd) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+
+	if (cmd == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if (!_tr50_registry_remove(&client->commands, cmd)) {
+		return ERR_TR50_CMD_UNKNOWN;
+	}
+	log_important_info("tr50_command_unregister(): cmd[%s] unregistered.", cmd);
 	return 0;
 }
  
 int tr50_command_process(void *tr50, const char *id, const char *key, const char *command, const char *from, JSON *params, void * custom) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 	int ret;
-	_TR50_COMMAND *cmd = client->command_head;
+	tr50_command_callback callback;
 
 	if (!command) {
 		return ERR_TR50_CMD_UNKNOWN;
 	}
 
-	if (strcmp(command, "method.exec") == 0 && (tr50_is_method_registered()== TRUE)) {
+	if (strcmp(command, "method.exec") == 0 && tr50_is_method_registered(tr50)) {
 		return 0;
 	}
-	while(cmd) {
-		if(strcmp(cmd->name,command)==0) {
-			long long ended, started;
-			log_debug("tr50_command_process(): executing cmd[%s] ...", cmd->name);
-			started = _time_now();
-			if((ret=cmd->callback(id,key,command,from,params))!=0) {
-				log_important_info("tr50_command_process(): cmd[%s] failed [%d]", command, ret);
-			}
-			ended = _time_now();
-			if (ended - started > 1000) {
-				log_need_investigation("tr50_command_process(): cmd callback for [%s] is taking [%d]ms.", cmd->name, (int)(ended - started));
-			}
-			return ret;
+	if ((callback = (tr50_command_callback)_tr50_registry_find(&client->commands, command)) != NULL) {
+		long long ended, started;
+		log_debug("tr50_command_process(): executing cmd[%s] ...", command);
+		started = _time_now();
+		if((ret=callback(id,key,command,from,params))!=0) {
+			log_important_info("tr50_command_process(): cmd[%s] failed [%d]", command, ret);
+		}
+		ended = _time_now();
+		if (ended - started > 1000) {
+			log_need_investigation("tr50_command_process(): cmd callback for [%s] is taking [%d]ms.", command, (int)(ended - started));
 		}
-		cmd = (_TR50_COMMAND *)cmd->next;
+		return ret;
 	}
 	log_need_investigation("tr50_command_process(): unknown cmd[%s] recv'ed", command);
 	tr50_command_ack(tr50, id, ERR_TR50_CMD_UNKNOWN, "Unknown command", NULL);
@@ -80,7 +88,6 @@ int tr50_command_process(void *tr50, const char *id, const char *key, const char
 }
 
 int tr50_command_update(void *tr50, const char *id, const char *msg) {
-	void *message;
 	JSON *params = tr50_json_create_object();
 
 	tr50_json_add_string_to_object(params, "id", id);
@@ -88,17 +95,11 @@ int tr50_command_update(void *tr50, const char *id, const char *msg) {
 		tr50_json_add_string_to_object(params, "msg", msg);
 	}
 
-	tr50_message_create(&message);
-	tr50_message_add_command(message,"1","mailbox.update", params);
-	if (tr50_api_call(tr50, message) != 0) {
-		tr50_message_delete(message);
-	}
+	_tr50_mailbox_reply((_TR50_CLIENT *)tr50, "mailbox.update", params);
 	return 0;
 }
 
 int tr50_command_ack(void *tr50, const char *id, int status, const char *err_message, JSON *ack_params) {
-	int ret;
-	void *message;
 	JSON *params = tr50_json_create_object();
 
 	tr50_json_add_string_to_object(params, "id", id);
@@ -113,10 +114,5 @@ int tr50_command_ack(void *tr50, const char *id, int status, const char *err_mes
 		tr50_json_add_item_to_object(params, "params", ack_params);
 	}
 
-	tr50_message_create(&message);
-	tr50_message_add_command(message,"1","mailbox.ack", params);
-	if ((ret = tr50_api_call(tr50, message)) != 0) {
-		tr50_message_delete(message);
-	}
-	return ret;
+	return _tr50_mailbox_reply((_TR50_CLIENT *)tr50, "mailbox.ack", params);
 }
@@ -0,0 +1,556 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(HAVE_LIBLZ4) && defined(HAVE_LZ4FRAME_H)
+#define TR50_CODEC_LZ4
+#include <lz4frame.h>
+#endif
+
+#if defined(HAVE_LIBZSTD) && defined(HAVE_ZSTD_H)
+#define TR50_CODEC_ZSTD
+#include <zstd.h>
+#endif
+
+#include <tr50/internal/tr50.h>
+
+#include <tr50/mqtt/mqtt.h>
+
+#include <tr50/tr50.h>
+
+#include <tr50/util/blob.h>
+#include <tr50/util/compress.h>
+#include <tr50/util/json.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+
+#define TR50_MIN_COMPRESSION_LEN			128
+#define TR50_MIN_DICTIONARY_COMPRESSION_LEN	24
+#define TR50_MIN_LZ4_COMPRESSION_LEN		128
+#define TR50_MIN_ZSTD_COMPRESSION_LEN		96
+
+#define TR50_ZSTD_LEVEL						3
+#define TR50_CODEC_CHUNK					16384
+
+#define TR50_CODEC_PROBE					"{\"1\":{\"command\":\"diag.ping\"}}"
+
+// Built-in preset dictionary. zlib matches against the tail of the dictionary most cheaply,
+// so the fragments are ordered from least to most frequent in typical TR50 traffic.
+// Regenerate from real captures with examples/tr50_dictgen.
+static const char _tr50_compress_default_dictionary[] =
+	"\"command\":\"diag.ping\"}}"
+	"\"command\":\"file.get\",\"params\":{\"fileName\":\"\",\"global\":false,\"public\":false}}}"
+	"\"command\":\"file.put\",\"params\":{\"fileName\":\"\",\"global\":false,\"public\":false}}}"
+	"\"command\":\"thing.tag.add\",\"params\":{\"tags\":[\""
+	"\"command\":\"thing.tag.delete\",\"params\":{\"tags\":[\""
+	"\"command\":\"thing.bind\",\"params\":{\"key\":\""
+	"\"command\":\"thing.unbind\",\"params\":{\"key\":\""
+	"\"command\":\"attribute.current\",\"params\":{\"key\":\""
+	"\"command\":\"attribute.unset\",\"params\":{\"key\":\""
+	"\"command\":\"property.current\",\"params\":{\"key\":\""
+	"\"command\":\"mailbox.send\",\"params\":{\"thingKey\":\"\",\"command\":\""
+	"\"command\":\"method.exec\",\"params\":{\"thingKey\":\"\",\"method\":\"\",\"params\":{"
+	"\"command\":\"log.publish\",\"params\":{\"msg\":\"\",\"level\":"
+	"\"command\":\"location.publish\",\"params\":{\"lat\":,\"lng\":,\"heading\":,\"altitude\":,\"speed\":,\"fixAcc\":,\"fixType\":\"\","
+	"\"command\":\"alarm.publish\",\"params\":{\"key\":\"\",\"state\":,\"msg\":\"\"}}}"
+	"\"command\":\"attribute.publish\",\"params\":{\"key\":\"\",\"value\":\"\"}}}"
+	"{\"1\":{\"success\":false,\"errorCodes\":[],\"errorMessages\":[\"\"]}}"
+	"\"command\":\"mailbox.update\",\"params\":{\"id\":\"\",\"msg\":\"\"}}}"
+	"\"command\":\"mailbox.ack\",\"params\":{\"id\":\"\",\"errorCode\":0,\"errorMessage\":\"\",\"params\":{}}}}"
+	"{\"1\":{\"success\":true,\"params\":{\"messages\":[{\"id\":\"\",\"thingKey\":\"\",\"command\":\"method.exec\",\"params\":{\"method\":\"\",\"params\":{}},\"from\":\"\"}]}}}"
+	"{\"1\":{\"command\":\"mailbox.check\",\"params\":{\"autoComplete\":false}}}"
+	"\"command\":\"property.publish\",\"params\":{\"key\":\"\",\"value\":,\"ts\":\"\",\"corrId\":\"\"}}}"
+	"{\"1\":{\"command\":\"property.publish\",\"params\":{\"key\":\"\",\"value\":"
+	"{\"1\":{\"success\":true}}";
+
+void _tr50_compress_dictionary_default(const char **dictionary, int *dictionary_len) {
+	*dictionary = _tr50_compress_default_dictionary;
+	*dictionary_len = sizeof(_tr50_compress_default_dictionary) - 1;
+}
+
+static int _tr50_codec_deflate_encode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return _compress_deflate(in, in_len, out, out_len);
+}
+
+static int _tr50_codec_deflate_decode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return _compress_inflate(in, in_len, out, out_len);
+}
+
+static int _tr50_codec_deflate_decode_stream(_TR50_CLIENT *client, const char *in, int in_len, _compress_sink sink, void *custom) {
+	return _compress_inflate_stream(in, in_len, NULL, 0, sink, custom);
+}
+
+static int _tr50_codec_dictionary_encode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return _compress_deflate_dict(in, in_len, client->compress_dictionary, client->compress_dictionary_len, out, out_len);
+}
+
+static int _tr50_codec_dictionary_decode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return _compress_inflate_dict(in, in_len, client->compress_dictionary, client->compress_dictionary_len, out, out_len);
+}
+
+static int _tr50_codec_dictionary_decode_stream(_TR50_CLIENT *client, const char *in, int in_len, _compress_sink sink, void *custom) {
+	return _compress_inflate_stream(in, in_len, client->compress_dictionary, client->compress_dictionary_len, sink, custom);
+}
+
+static int _tr50_codec_blob_sink(const char *data, int data_len, void *blob) {
+	return _blob_append(blob, data, data_len);
+}
+
+// Materializes a streaming decoder's output. Like _compress_inflate()'s, the result is NUL
+// terminated and *out_len excludes the NUL.
+static int _tr50_codec_decode_to_blob(_TR50_CLIENT *client, int (*decode_stream)(_TR50_CLIENT *, const char *, int, _compress_sink, void *), const char *in, int in_len, char **out, int *out_len) {
+	void *blob = NULL;
+	int ret;
+
+	if ((ret = _blob_create(&blob, in_len * 4)) != 0) {
+		return ret;
+	}
+	if ((ret = decode_stream(client, in, in_len, _tr50_codec_blob_sink, blob)) != 0 || (ret = _blob_append(blob, "", 1)) != 0) {
+		_blob_delete(blob);
+		return ret;
+	}
+	*out = _blob_get_buffer(blob);
+	*out_len = _blob_get_length(blob) - 1;
+	_blob_delete_object(blob);
+	return 0;
+}
+
+#if defined(TR50_CODEC_LZ4)
+
+static int _tr50_codec_lz4_is_supported(void) {
+	return 1;
+}
+
+// LZ4 frame format, so the platform side can use any stock lz4 decoder.
+static int _tr50_codec_lz4_encode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	LZ4F_preferences_t prefs;
+	size_t bound, len;
+	char *buffer;
+
+	_memory_memset(&prefs, 0, sizeof(LZ4F_preferences_t));
+	prefs.frameInfo.contentSize = in_len;
+
+	bound = LZ4F_compressFrameBound(in_len, &prefs);
+	if ((buffer = _memory_malloc(bound)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	len = LZ4F_compressFrame(buffer, bound, in, in_len, &prefs);
+	if (LZ4F_isError(len)) {
+		_memory_free(buffer);
+		return ERR_TR50_COMPRESS_DEFLATE;
+	}
+	*out = buffer;
+	*out_len = (int)len;
+	return 0;
+}
+
+static int _tr50_codec_lz4_decode_stream(_TR50_CLIENT *client, const char *in, int in_len, _compress_sink sink, void *custom) {
+	LZ4F_dctx *dctx = NULL;
+	char chunk[TR50_CODEC_CHUNK];
+	size_t pos = 0, remaining = 1;
+	int ret = 0;
+
+	if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+		return ERR_TR50_COMPRESS_INFLATE;
+	}
+
+	while (remaining != 0) {
+		size_t dst_len = sizeof(chunk);
+		size_t src_len = in_len - pos;
+
+		remaining = LZ4F_decompress(dctx, chunk, &dst_len, in + pos, &src_len, NULL);
+		if (LZ4F_isError(remaining)) {
+			ret = ERR_TR50_COMPRESS_INFLATE;
+			break;
+		}
+		pos += src_len;
+		if (dst_len > 0 && (ret = sink(chunk, (int)dst_len, custom)) != 0) {
+			break;
+		}
+		if (remaining != 0 && pos == (size_t)in_len && dst_len == 0) { // truncated frame
+			ret = ERR_TR50_COMPRESS_INFLATE;
+			break;
+		}
+	}
+	LZ4F_freeDecompressionContext(dctx);
+	return ret;
+}
+
+#else
+
+static int _tr50_codec_lz4_is_supported(void) {
+	return 0;
+}
+
+static int _tr50_codec_lz4_encode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return ERR_TR50_NOPORT;
+}
+
+static int _tr50_codec_lz4_decode_stream(_TR50_CLIENT *client, const char *in, int in_len, _compress_sink sink, void *custom) {
+	return ERR_TR50_NOPORT;
+}
+
+#endif
+
+#if defined(TR50_CODEC_ZSTD)
+
+static int _tr50_codec_zstd_is_supported(void) {
+	return 1;
+}
+
+static int _tr50_codec_zstd_encode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	size_t bound, len;
+	char *buffer;
+
+	bound = ZSTD_compressBound(in_len);
+	if ((buffer = _memory_malloc(bound)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	len = ZSTD_compress(buffer, bound, in, in_len, TR50_ZSTD_LEVEL);
+	if (ZSTD_isError(len)) {
+		_memory_free(buffer);
+		return ERR_TR50_COMPRESS_DEFLATE;
+	}
+	*out = buffer;
+	*out_len = (int)len;
+	return 0;
+}
+
+// Streams so frames written without a content size (e.g. by a streaming platform encoder) decode too.
+static int _tr50_codec_zstd_decode_stream(_TR50_CLIENT *client, const char *in, int in_len, _compress_sink sink, void *custom) {
+	ZSTD_DCtx *dctx;
+	ZSTD_inBuffer input;
+	char chunk[TR50_CODEC_CHUNK];
+	size_t remaining = 1;
+	int ret = 0;
+
+	if ((dctx = ZSTD_createDCtx()) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+
+	input.src = in;
+	input.size = in_len;
+	input.pos = 0;
+	while (remaining != 0) {
+		ZSTD_outBuffer output;
+
+		output.dst = chunk;
+		output.size = sizeof(chunk);
+		output.pos = 0;
+		remaining = ZSTD_decompressStream(dctx, &output, &input);
+		if (ZSTD_isError(remaining)) {
+			ret = ERR_TR50_COMPRESS_INFLATE;
+			break;
+		}
+		if (output.pos > 0 && (ret = sink(chunk, (int)output.pos, custom)) != 0) {
+			break;
+		}
+		if (remaining != 0 && input.pos == input.size && output.pos < output.size) { // truncated frame
+			ret = ERR_TR50_COMPRESS_INFLATE;
+			break;
+		}
+	}
+	ZSTD_freeDCtx(dctx);
+	return ret;
+}
+
+#else
+
+static int _tr50_codec_zstd_is_supported(void) {
+	return 0;
+}
+
+static int _tr50_codec_zstd_encode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return ERR_TR50_NOPORT;
+}
+
+static int _tr50_codec_zstd_decode_stream(_TR50_CLIENT *client, const char *in, int in_len, _compress_sink sink, void *custom) {
+	return ERR_TR50_NOPORT;
+}
+
+#endif
+
+static int _tr50_codec_lz4_decode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return _tr50_codec_decode_to_blob(client, _tr50_codec_lz4_decode_stream, in, in_len, out, out_len);
+}
+
+static int _tr50_codec_zstd_decode(_TR50_CLIENT *client, const char *in, int in_len, char **out, int *out_len) {
+	return _tr50_codec_decode_to_blob(client, _tr50_codec_zstd_decode_stream, in, in_len, out, out_len);
+}
+
+// Deflate comes first: it is the fallback whenever a negotiated codec is not (yet) accepted.
+static const _TR50_CODEC _tr50_codecs[] = {
+	{ TR50_COMPRESS_DEFLATE, "deflate", TR50_TOPIC_COMPRESS_API, TR50_TOPIC_COMPRESS_REPLY, TR50_MIN_COMPRESSION_LEN, 0,
+		_compress_is_supported, _tr50_codec_deflate_encode, _tr50_codec_deflate_decode, _tr50_codec_deflate_decode_stream },
+	{ TR50_COMPRESS_DICTIONARY, "deflate-dictionary", TR50_TOPIC_COMPRESS_DICT_API, TR50_TOPIC_COMPRESS_DICT_REPLY, TR50_MIN_DICTIONARY_COMPRESSION_LEN, 1,
+		_compress_is_supported, _tr50_codec_dictionary_encode, _tr50_codec_dictionary_decode, _tr50_codec_dictionary_decode_stream },
+	{ TR50_COMPRESS_LZ4, "lz4", TR50_TOPIC_COMPRESS_LZ4_API, TR50_TOPIC_COMPRESS_LZ4_REPLY, TR50_MIN_LZ4_COMPRESSION_LEN, 1,
+		_tr50_codec_lz4_is_supported, _tr50_codec_lz4_encode, _tr50_codec_lz4_decode, _tr50_codec_lz4_decode_stream },
+	{ TR50_COMPRESS_ZSTD, "zstd", TR50_TOPIC_COMPRESS_ZSTD_API, TR50_TOPIC_COMPRESS_ZSTD_REPLY, TR50_MIN_ZSTD_COMPRESSION_LEN, 1,
+		_tr50_codec_zstd_is_supported, _tr50_codec_zstd_encode, _tr50_codec_zstd_decode, _tr50_codec_zstd_decode_stream },
+};
+
+#define TR50_CODEC_COUNT	(int)(sizeof(_tr50_codecs) / sizeof(_TR50_CODEC))
+
+const _TR50_CODEC *_tr50_codec_get(int index) {
+	if (index < 0 || index >= TR50_CODEC_COUNT) {
+		return NULL;
+	}
+	return &_tr50_codecs[index];
+}
+
+const _TR50_CODEC *_tr50_codec_find(int id) {
+	int i;
+	for (i = 0; i < TR50_CODEC_COUNT; ++i) {
+		if (_tr50_codecs[i].id == id) {
+			return &_tr50_codecs[i];
+		}
+	}
+	return NULL;
+}
+
+// Matches "<reply_topic>/<seq>".
+const _TR50_CODEC *_tr50_codec_find_by_reply_topic(const char *topic) {
+	int i, len;
+	for (i = 0; i < TR50_CODEC_COUNT; ++i) {
+		len = strlen(_tr50_codecs[i].reply_topic);
+		if (strncmp(topic, _tr50_codecs[i].reply_topic, len) == 0 && topic[len] == '/') {
+			return &_tr50_codecs[i];
+		}
+	}
+	return NULL;
+}
+
+// Matches "<api_topic>/<seq>".
+const _TR50_CODEC *_tr50_codec_find_by_api_topic(const char *topic) {
+	int i, len;
+	for (i = 0; i < TR50_CODEC_COUNT; ++i) {
+		len = strlen(_tr50_codecs[i].api_topic);
+		if (strncmp(topic, _tr50_codecs[i].api_topic, len) == 0 && topic[len] == '/') {
+			return &_tr50_codecs[i];
+		}
+	}
+	return NULL;
+}
+
+int tr50_compress_is_supported(int codec) {
+	const _TR50_CODEC *found;
+
+	if (codec == TR50_COMPRESS_NONE) {
+		return 1;
+	}
+	if ((found = _tr50_codec_find(codec)) == NULL) {
+		return 0;
+	}
+	return found->is_supported();
+}
+
+void _tr50_compress_start(_TR50_CLIENT *client) {
+	_TR50_CONFIG *config = &client->config;
+
+	client->compress = config->compress;
+	if (config->compress_dictionary) {
+		client->compress_dictionary = config->compress_dictionary;
+		client->compress_dictionary_len = config->compress_dictionary_len;
+	} else {
+		_tr50_compress_dictionary_default(&client->compress_dictionary, &client->compress_dictionary_len);
+	}
+	// the platform has to prove it knows the codec again after every start.
+	client->compress_state = TR50_COMPRESS_STATE_UNKNOWN;
+}
+
+static void _tr50_compress_probe_callback(int status, const char *reply_json, void *custom) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)custom;
+	const _TR50_CODEC *codec = _tr50_codec_find(client->compress);
+	JSON *json = NULL;
+
+	// any well formed reply to the probe means the platform decoded it.
+	if (status == 0 && reply_json && (json = tr50_json_parse(reply_json)) != NULL && tr50_json_get_object_item(json, "1") != NULL) {
+		client->compress_state = TR50_COMPRESS_STATE_ACTIVE;
+		log_important_info("_tr50_compress_probe_callback(): codec [%s] accepted.", codec ? codec->name : "?");
+	} else {
+		client->compress_state = TR50_COMPRESS_STATE_REJECTED;
+		log_important_info("_tr50_compress_probe_callback(): codec [%s] not accepted [%d], using deflate only.", codec ? codec->name : "?", status);
+	}
+	if (json) {
+		tr50_json_delete(json);
+	}
+}
+
+// Must be called with client->mux held.
+static int _tr50_compress_probe(_TR50_CLIENT *client, const _TR50_CODEC *codec) {
+	_TR50_MESSAGE *msg = NULL;
+	char topic_with_seq[64];
+	char *out = NULL;
+	int ret, out_len;
+
+	client->compress_state = TR50_COMPRESS_STATE_PROBING;
+
+	if ((ret = codec->encode(client, TR50_CODEC_PROBE, strlen(TR50_CODEC_PROBE), &out, &out_len)) != 0) {
+		goto end_error;
+	}
+	if ((ret = tr50_message_create((void *)&msg)) != 0) {
+		goto end_error;
+	}
+
+	if (client->seq_id == TR50_MAX_ID) {
+		client->seq_id = 0;
+	}
+	msg->seq_id = ++client->seq_id;
+	msg->message_type = TR50_MESSAGE_TYPE_RAW;
+	msg->raw_callback = (void *)_tr50_compress_probe_callback;
+	msg->callback_custom = client;
+	msg->callback_timeout = client->config.timeout_in_ms;
+
+	if ((ret = tr50_pending_add(client, msg)) != 0) {
+		goto end_error;
+	}
+
+	snprintf(topic_with_seq, 63, "%s/%d", codec->api_topic, msg->seq_id);
+	if ((ret = mqtt_async_publish(client->mqtt, topic_with_seq, out, out_len, 0)) != 0) {
+		if ((msg = tr50_pending_find_and_remove(client, msg->seq_id)) == NULL) {
+			// already expired, the callback has settled the state.
+			_memory_free(out);
+			return ret;
+		}
+		goto end_error;
+	}
+	_memory_free(out);
+	return 0;
+
+end_error:
+	log_need_investigation("_tr50_compress_probe(): [%s] failed [%d]", codec->name, ret);
+	client->compress_state = TR50_COMPRESS_STATE_UNKNOWN;
+	if (msg) {
+		tr50_message_delete(msg);
+	}
+	if (out) {
+		_memory_free(out);
+	}
+	return ret;
+}
+
+static int _tr50_compress_with(_TR50_CLIENT *client, const _TR50_CODEC *codec, const char *raw, int raw_len, const char **topic, char **out, int *out_len) {
+	int ret;
+
+	if ((ret = codec->encode(client, raw, raw_len, out, out_len)) != 0) {
+		log_need_investigation("_tr50_compress_with(): [%s] failed [%d]", codec->name, ret);
+		*out = NULL;
+		return ret;
+	}
+	*topic = codec->api_topic;
+	_tr50_stats_set_compress_ratio(client, raw_len, *out_len);
+	return 0;
+}
+
+// Pick the topic and encoding for an outgoing request. On return *out is NULL when the raw
+// payload should be sent as is on *topic. Must be called with client->mux held.
+int _tr50_compress_payload(_TR50_CLIENT *client, const char *raw, int raw_len, const char **topic, char **out, int *out_len) {
+	const _TR50_CODEC *codec, *fallback = &_tr50_codecs[0];
+
+	*out = NULL;
+	*out_len = 0;
+	*topic = TR50_TOPIC_API;
+
+	if (client->compress == TR50_COMPRESS_NONE || (codec = _tr50_codec_find(client->compress)) == NULL) {
+		return 0;
+	}
+
+	if (codec->negotiate) {
+		if (client->compress_state == TR50_COMPRESS_STATE_UNKNOWN) {
+			_tr50_compress_probe(client, codec);
+		}
+		if (client->compress_state == TR50_COMPRESS_STATE_ACTIVE) {
+			if (raw_len > codec->min_len && _tr50_compress_with(client, codec, raw, raw_len, topic, out, out_len) == 0) {
+				return 0;
+			}
+		}
+	} else {
+		fallback = codec;
+	}
+
+	// if compression failed, send without compression
+	if (raw_len > fallback->min_len && fallback->is_supported()) {
+		_tr50_compress_with(client, fallback, raw, raw_len, topic, out, out_len);
+	}
+	return 0;
+}
+
+// Decode a reply received on any codec's reply topic.
+int _tr50_decompress_payload(_TR50_CLIENT *client, const char *topic, const char *data, int data_len, char **out, int *out_len) {
+	const _TR50_CODEC *codec;
+	int ret;
+
+	if ((codec = _tr50_codec_find_by_reply_topic(topic)) == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((ret = codec->decode(client, data, data_len, out, out_len)) != 0) {
+		return ret;
+	}
+	_tr50_stats_set_compress_ratio(client, *out_len, data_len);
+	return 0;
+}
+
+typedef struct {
+	void *	parser;
+	int		decoded_len;
+} _TR50_DECODE_JSON;
+
+static int _tr50_codec_json_sink(const char *data, int data_len, void *custom) {
+	_TR50_DECODE_JSON *decode = (_TR50_DECODE_JSON *)custom;
+	decode->decoded_len += data_len;
+	return _json_stream_feed(decode->parser, data, data_len);
+}
+
+// Decode a reply straight into the JSON parser, chunk by chunk, without materializing the text.
+int _tr50_decompress_payload_json(_TR50_CLIENT *client, const char *topic, const char *data, int data_len, JSON **json, int *decoded_len) {
+	const _TR50_CODEC *codec;
+	_TR50_DECODE_JSON decode;
+	int ret;
+
+	if ((codec = _tr50_codec_find_by_reply_topic(topic)) == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	decode.decoded_len = 0;
+	if ((decode.parser = _json_stream_create()) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	if ((ret = codec->decode_stream(client, data, data_len, _tr50_codec_json_sink, &decode)) == 0) {
+		ret = _json_stream_finish(decode.parser, json);
+	}
+	_json_stream_delete(decode.parser);
+	if (ret != 0) {
+		return ret;
+	}
+	*decoded_len = decode.decoded_len;
+	_tr50_stats_set_compress_ratio(client, decode.decoded_len, data_len);
+	return 0;
+}
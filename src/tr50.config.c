@@ -52,6 +52,9 @@ void _tr50_config_delete(_TR50_CONFIG *config) {
 	if (config->proxy_password) {
 		_memory_free(config->proxy_password);
 	}
+	if (config->compress_dictionary) {
+		_memory_free(config->compress_dictionary);
+	}
 	_memory_memset(config, 0, sizeof(_TR50_CONFIG));
 }
 
@@ -154,6 +157,95 @@ int tr50_config_set_state_change_handler(void *tr50, tr50_async_state_change_cal
 	return 0;
 }
 
+int tr50_config_set_writable_handler(void *tr50, tr50_async_writable_callback callback, void *custom) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	config->writable_handler = callback;
+	config->writable_handler_custom = custom;
+	return 0;
+}
+
+int tr50_config_set_executor(void *tr50, int threads, int queue_depth, int order) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (threads < 0 || threads > 64 || (threads > 0 && queue_depth < 1) || order < TR50_EXECUTOR_ORDER_NONE || order > TR50_EXECUTOR_ORDER_SEQ_ID) {
+		return ERR_TR50_PARMS;
+	}
+	config->executor_threads = threads;
+	config->executor_queue_depth = queue_depth;
+	config->executor_order = order;
+	return 0;
+}
+
+int tr50_config_set_mailbox_batch(void *tr50, int page_size, int ack_batch) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (page_size < 0 || ack_batch < 1 || ack_batch > TR50_MAILBOX_ACK_BATCH_MAX) {
+		return ERR_TR50_PARMS;
+	}
+	config->mailbox_page_size = page_size;
+	config->mailbox_ack_batch = ack_batch;
+	return 0;
+}
+
+int tr50_config_set_file_chunk_size(void *tr50, int chunk_size) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (chunk_size < TR50_FILE_CHUNK_SIZE_MIN || chunk_size > TR50_FILE_CHUNK_SIZE_MAX) {
+		return ERR_TR50_PARMS;
+	}
+	config->file_chunk_size = chunk_size;
+	return 0;
+}
+
+int tr50_config_set_file_download(void *tr50, int connections, int segment_size) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (connections < 1 || connections > TR50_FILE_CONNECTIONS_MAX || segment_size < TR50_FILE_CHUNK_SIZE_MIN) {
+		return ERR_TR50_PARMS;
+	}
+	config->file_connections = connections;
+	config->file_segment_size = segment_size;
+	return 0;
+}
+
+int tr50_config_set_file_transfer(void *tr50, int workers, int queue_max, long long bytes_per_second) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (workers < 1 || workers > TR50_FILE_WORKERS_MAX || queue_max < 0 || bytes_per_second < 0) {
+		return ERR_TR50_PARMS;
+	}
+	config->file_workers = workers;
+	config->file_queue_max = queue_max;
+	config->file_bytes_per_second = bytes_per_second;
+	return 0;
+}
+
+int tr50_config_set_file_gzip(void *tr50, int gzip_level, int gunzip) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (gzip_level < 0 || gzip_level > 9 || gunzip < TR50_FILE_GUNZIP_OFF || gunzip > TR50_FILE_GUNZIP_SNIFF) {
+		return ERR_TR50_PARMS;
+	}
+	if ((gzip_level || gunzip) && !_compress_is_supported()) {
+		return ERR_TR50_NOT_SUPPORTED;
+	}
+	config->file_gzip_level = gzip_level;
+	config->file_gunzip = gunzip;
+	return 0;
+}
+
+int tr50_config_set_file_progress_handler(void *tr50, tr50_file_progress_callback callback, void *custom) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	config->file_progress_handler = callback;
+	config->file_progress_handler_custom = custom;
+	return 0;
+}
+
+int tr50_config_set_inflight_limit(void *tr50, int max_requests, long long max_bytes) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (max_requests < 0 || max_bytes < 0) {
+		return ERR_TR50_PARMS;
+	}
+	config->inflight_max_requests = max_requests;
+	config->inflight_max_bytes = max_bytes;
+	_tr50_pending_notify((_TR50_CLIENT *)tr50);
+	return 0;
+}
+
 int	tr50_config_set_api_watcher_handler(void *tr50, tr50_async_api_watcher_callback callback) {
 	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
 	config->api_watcher_handler = callback;
@@ -172,15 +264,46 @@ int tr50_config_set_https_proxy(void *tr50, int enabled) {
 	return 0;
 }
 
+int tr50_config_set_transport(void *tr50, const TR50_TRANSPORT *transport) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (transport && (transport->connect == NULL || transport->disconnect == NULL || transport->send == NULL || transport->recv == NULL)) {
+		return ERR_TR50_PARMS;
+	}
+	config->transport = transport;
+	return 0;
+}
+
 int tr50_config_set_compress(void *tr50, int enabled) {
 	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
-	if (!_compress_is_supported()) {
+	if (enabled != TR50_COMPRESS_NONE && _tr50_codec_find(enabled) == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if (!tr50_compress_is_supported(enabled)) {
 		return ERR_TR50_COMPRESS_NOT_SUPPORTED;
 	}
 	config->compress = enabled;
 	return 0;
 }
 
+int tr50_config_set_compress_dictionary(void *tr50, const char *dictionary, int dictionary_len) {
+	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
+	if (dictionary && dictionary_len <= 0) {
+		return ERR_TR50_PARMS;
+	}
+	if (config->compress_dictionary) {
+		_memory_free(config->compress_dictionary);
+	}
+	config->compress_dictionary = NULL;
+	config->compress_dictionary_len = 0;
+	if (dictionary) {
+		if ((config->compress_dictionary = _memory_clone((void *)dictionary, dictionary_len)) == NULL) {
+			return ERR_TR50_MALLOC;
+		}
+		config->compress_dictionary_len = dictionary_len;
+	}
+	return 0;
+}
+
 int	tr50_config_set_should_reconnect_handler(void *tr50, tr50_async_should_reconnect_callback callback, void *custom) {
 	_TR50_CONFIG *config = &((_TR50_CLIENT *)tr50)->config;
 	config->should_reconnect_callback = callback;
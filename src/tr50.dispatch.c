@@ -0,0 +1,107 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <tr50/internal/tr50.h>
+
+#include <tr50/util/executor.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+
+// FNV-1a, never 0 so the executor does not take it for "any worker".
+unsigned int _tr50_order_key(const char *text, int len) {
+	unsigned int hash = 2166136261u;
+
+	while (len-- > 0) {
+		hash = (hash ^ (unsigned char)*text++) * 16777619u;
+	}
+	return hash ? hash : 1;
+}
+
+// Key of the first "thingKey" string in a JSON text, or of "" when there is none.
+unsigned int _tr50_order_key_json(const char *json) {
+	const char *p = strstr(json, "\"thingKey\""), *end;
+
+	if (p != NULL) {
+		for (p += 10; *p == ' ' || *p == ':' || *p == '\t' || *p == '\r' || *p == '\n'; ++p) {
+		}
+		if (*p == '"' && (end = strchr(++p, '"')) != NULL) {
+			return _tr50_order_key(p, (int)(end - p));
+		}
+	}
+	return _tr50_order_key("", 0);
+}
+
+void _tr50_executor_start(_TR50_CLIENT *client) {
+	_TR50_CONFIG *config = &client->config;
+	int ret;
+
+	client->executor_order = config->executor_order;
+	if (config->executor_threads > 0 && (ret = _executor_create(&client->executor, config->executor_threads, config->executor_queue_depth)) != 0) {
+		log_important_info("_tr50_executor_start(): failed [%d], callbacks run on the receive thread", ret);
+		client->executor = NULL;
+	}
+}
+
+// Detached under the client mux so tr50_executor_stats() never reads a pool being deleted.
+void _tr50_executor_stop(_TR50_CLIENT *client) {
+	void *executor;
+
+	_tr50_mutex_lock(client->mux);
+	executor = client->executor;
+	client->executor = NULL;
+	_tr50_mutex_unlock(client->mux);
+	if (executor) {
+		_executor_delete(executor);
+	}
+}
+
+int tr50_executor_stats(void *tr50, TR50_EXECUTOR_STATS *stats) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_EXECUTOR_STATS executor_stats;
+
+	if (client == NULL || stats == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_memory_memset(stats, 0, sizeof(TR50_EXECUTOR_STATS));
+	_tr50_mutex_lock(client->mux);
+	if (client->executor == NULL) {
+		_tr50_mutex_unlock(client->mux);
+		return 0;
+	}
+	_executor_stats(client->executor, &executor_stats);
+	_tr50_mutex_unlock(client->mux);
+	stats->threads = executor_stats.threads;
+	stats->queue_depth = executor_stats.queue_depth;
+	stats->queued = executor_stats.queued;
+	stats->queued_max = executor_stats.queued_max;
+	stats->executed = executor_stats.executed;
+	stats->blocked = executor_stats.blocked;
+	stats->lag_p50_us = executor_stats.lag_p50_us;
+	stats->lag_p99_us = executor_stats.lag_p99_us;
+	stats->lag_max_us = executor_stats.lag_max_us;
+	return 0;
+}
@@ -0,0 +1,1140 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tr50/tr50.h>
+#include <tr50/internal/tr50.h>
+#include <tr50/mqtt/mqtt.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/event.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/tcp.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+#define TR50_EMULATOR_ID_SIZE			25
+#define TR50_EMULATOR_TOPIC_MAX			64
+#define TR50_EMULATOR_ACCEPT_TIMEOUT	500
+#define TR50_EMULATOR_IO_TIMEOUT		500
+#define TR50_EMULATOR_IO_BUFFER			8192
+#define TR50_EMULATOR_IDLE_WAIT			1000
+#define TR50_EMULATOR_FROM				"emulator"
+#define TR50_EMULATOR_TOPIC_NOTIFY		"notify/mailbox_activity"
+
+#define TR50_EMULATOR_MAIL_QUEUED		0
+#define TR50_EMULATOR_MAIL_DELIVERED	1
+
+// A reply being assembled. It goes out once every method.exec in the request has been acked.
+typedef struct _TR50_EMULATOR_REPLY {
+	void *	session;
+	const _TR50_CODEC *codec;	// NULL for api/reply
+	int		seq_id;
+	JSON *	json;
+	int		waiting;
+	int		drop;
+	struct _TR50_EMULATOR_REPLY *next_completed;
+} _TR50_EMULATOR_REPLY;
+
+typedef struct _TR50_EMULATOR_MAIL {
+	char	id[TR50_EMULATOR_ID_SIZE];
+	char *	thing_key;
+	char *	command;
+	char *	params;		// JSON text, NULL without params
+	char *	from;
+	int		state;
+
+	// set when a client's method.exec is waiting on this message's ack
+	_TR50_EMULATOR_REPLY *reply;
+	char *	reply_cmd_id;
+
+	struct _TR50_EMULATOR_MAIL *next;
+} _TR50_EMULATOR_MAIL;
+
+// An encoded reply waiting out its latency.
+typedef struct _TR50_EMULATOR_DELAYED {
+	long long	due;
+	void *		session;
+	char		topic[TR50_EMULATOR_TOPIC_MAX];
+	char *		data;
+	int			len;
+	struct _TR50_EMULATOR_DELAYED *next;
+} _TR50_EMULATOR_DELAYED;
+
+// One TCP connection fed through its own loopback session.
+typedef struct _TR50_EMULATOR_BRIDGE {
+	struct _TR50_EMULATOR *emulator;
+	void *	sock;
+	void *	session;
+	void *	reader_thread;
+	void *	writer_thread;
+	volatile int is_done;
+	struct _TR50_EMULATOR_BRIDGE *next;
+} _TR50_EMULATOR_BRIDGE;
+
+typedef struct _TR50_EMULATOR {
+	void *	loopback;
+	void *	mux;
+
+	int		latency_min;
+	int		latency_max;
+	int		error_percent;
+	int		error_code;
+	int		drop_percent;
+	char *	pad;
+	int		codecs;
+	_TR50_CLIENT *codec_context;	// only carries the dictionary the codecs read
+	char *	dictionary;
+	tr50_emulator_ack_callback ack_callback;
+	void *	ack_custom;
+	unsigned int random;
+
+	_TR50_EMULATOR_MAIL *mail_head;
+	_TR50_EMULATOR_MAIL *mail_tail;
+	long long mail_next_id;
+	JSON *	properties;		// thing key -> key -> { value, ts }
+	JSON *	attributes;
+
+	void *	delay_mux;
+	void *	delay_evt;
+	void *	delay_thread;
+	_TR50_EMULATOR_DELAYED *delayed;
+	_TR50_EMULATOR_DELAYED *delayed_tail;
+	volatile int is_stopping;
+
+	// only touched by the listener thread, and by _tr50_emulator_stop_listen() once it is joined
+	void *	listen_sock;
+	void *	listen_thread;
+	volatile int is_listen_stopping;
+	_TR50_EMULATOR_BRIDGE *bridges;
+
+	TR50_EMULATOR_STATS stats;
+} _TR50_EMULATOR;
+
+// Must be called with emulator->mux held.
+static unsigned int _tr50_emulator_random(_TR50_EMULATOR *emulator) {
+	unsigned int x = emulator->random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return emulator->random = x;
+}
+
+static int _tr50_emulator_chance(_TR50_EMULATOR *emulator, int percent) {
+	if (percent <= 0) {
+		return 0;
+	}
+	return percent >= 100 || (int)(_tr50_emulator_random(emulator) % 100) < percent;
+}
+
+static char *_tr50_emulator_strdup(const char *value) {
+	return value ? (char *)_memory_clone((void *)value, strlen(value) + 1) : NULL;
+}
+
+static JSON *_tr50_emulator_json_clone(JSON *json) {
+	char *text;
+	JSON *clone;
+
+	if (json == NULL || (text = tr50_json_print_unformatted(json)) == NULL) {
+		return NULL;
+	}
+	clone = tr50_json_parse(text);
+	_memory_free(text);
+	return clone;
+}
+
+static int _tr50_emulator_json_int(JSON *object, const char *name, int def) {
+	JSON *item = tr50_json_get_object_item(object, name);
+
+	if (item == NULL) {
+		return def;
+	}
+	if (item->type == JSON_INTEGER) {
+		return (int)item->valuelonglong;
+	}
+	return item->type == JSON_NUMBER ? item->valueint : def;
+}
+
+static void _tr50_emulator_timestamp(char *buffer, int size) {
+	time_t now = time(NULL);
+	strftime(buffer, size, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+}
+
+static void _tr50_emulator_success(_TR50_EMULATOR *emulator, JSON *result, JSON *params) {
+	tr50_json_add_true_to_object(result, "success");
+	if (emulator->pad) {
+		if (params == NULL) {
+			params = tr50_json_create_object();
+		}
+		tr50_json_add_string_to_object(params, "pad", emulator->pad);
+	}
+	if (params) {
+		tr50_json_add_item_to_object(result, "params", params);
+	}
+}
+
+static void _tr50_emulator_failure(JSON *result, int error_code, const char *error_message) {
+	JSON *codes = tr50_json_create_array();
+	JSON *messages = tr50_json_create_array();
+
+	tr50_json_add_false_to_object(result, "success");
+	if (error_code != 0) {
+		tr50_json_add_item_to_array(codes, tr50_json_create_integer(error_code));
+	}
+	tr50_json_add_item_to_array(messages, tr50_json_create_string(error_message ? error_message : ""));
+	tr50_json_add_item_to_object(result, "errorCodes", codes);
+	tr50_json_add_item_to_object(result, "errorMessages", messages);
+}
+
+// Delivers now, or after the configured latency. Takes ownership of data.
+static void _tr50_emulator_deliver(_TR50_EMULATOR *emulator, void *session, const char *topic, char *data, int len) {
+	_TR50_EMULATOR_DELAYED *delayed, **ptr;
+	int latency;
+
+	_tr50_mutex_lock(emulator->mux);
+	latency = emulator->latency_min;
+	if (emulator->latency_max > emulator->latency_min) {
+		latency += (int)(_tr50_emulator_random(emulator) % (unsigned int)(emulator->latency_max - emulator->latency_min + 1));
+	}
+	_tr50_mutex_unlock(emulator->mux);
+
+	if (latency <= 0 || (delayed = (_TR50_EMULATOR_DELAYED *)_memory_malloc(sizeof(_TR50_EMULATOR_DELAYED))) == NULL) {
+		tr50_loopback_publish(emulator->loopback, session, topic, data, len);
+		_memory_free(data);
+		return;
+	}
+	delayed->due = _time_now() + latency;
+	delayed->session = session;
+	snprintf(delayed->topic, sizeof(delayed->topic), "%s", topic);
+	delayed->data = data;
+	delayed->len = len;
+	delayed->next = NULL;
+
+	// kept in due order; with a fixed latency every reply goes to the tail
+	_tr50_mutex_lock(emulator->delay_mux);
+	if (emulator->delayed_tail == NULL || emulator->delayed_tail->due <= delayed->due) {
+		if (emulator->delayed_tail) {
+			emulator->delayed_tail->next = delayed;
+		} else {
+			emulator->delayed = delayed;
+		}
+		emulator->delayed_tail = delayed;
+	} else {
+		for (ptr = &emulator->delayed; (*ptr)->due <= delayed->due; ptr = &(*ptr)->next);
+		delayed->next = *ptr;
+		*ptr = delayed;
+	}
+	_tr50_mutex_unlock(emulator->delay_mux);
+	_tr50_event_signal(emulator->delay_evt);
+}
+
+static void *_tr50_emulator_delay_handler(void *arg) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)arg;
+	_TR50_EMULATOR_DELAYED *delayed;
+	long long now;
+	int wait;
+
+	while (!emulator->is_stopping) {
+		_tr50_mutex_lock(emulator->delay_mux);
+		now = _time_now();
+		if ((delayed = emulator->delayed) != NULL && delayed->due <= now) {
+			if ((emulator->delayed = delayed->next) == NULL) {
+				emulator->delayed_tail = NULL;
+			}
+			_tr50_mutex_unlock(emulator->delay_mux);
+			tr50_loopback_publish(emulator->loopback, delayed->session, delayed->topic, delayed->data, delayed->len);
+			_memory_free(delayed->data);
+			_memory_free(delayed);
+			continue;
+		}
+		wait = delayed ? (int)(delayed->due - now) : TR50_EMULATOR_IDLE_WAIT;
+		_tr50_event_reset(emulator->delay_evt);
+		_tr50_mutex_unlock(emulator->delay_mux);
+		_tr50_event_wait_timeout(emulator->delay_evt, wait);
+	}
+	return NULL;
+}
+
+// Encodes and sends a completed reply, then frees it.
+static void _tr50_emulator_reply_finish(_TR50_EMULATOR *emulator, _TR50_EMULATOR_REPLY *reply) {
+	char topic[TR50_EMULATOR_TOPIC_MAX];
+	char *text, *out = NULL;
+	int out_len;
+
+	if (reply->drop) {
+		_atomic_add64(&emulator->stats.dropped, 1);
+	} else if ((text = tr50_json_print_unformatted(reply->json)) != NULL) {
+		if (reply->codec == NULL) {
+			snprintf(topic, sizeof(topic), "%s/%d", TR50_TOPIC_REPLY, reply->seq_id);
+			_tr50_emulator_deliver(emulator, reply->session, topic, text, strlen(text));
+			text = NULL;
+		} else if (reply->codec->encode(emulator->codec_context, text, strlen(text), &out, &out_len) == 0) {
+			snprintf(topic, sizeof(topic), "%s/%d", reply->codec->reply_topic, reply->seq_id);
+			_tr50_emulator_deliver(emulator, reply->session, topic, out, out_len);
+		} else {
+			log_important_info("_tr50_emulator_reply_finish(): [%s] encode failed", reply->codec->name);
+		}
+		if (text) {
+			_memory_free(text);
+		}
+		_atomic_add64(&emulator->stats.replies, 1);
+	}
+	tr50_json_delete(reply->json);
+	_memory_free(reply);
+}
+
+static void _tr50_emulator_mail_delete(_TR50_EMULATOR_MAIL *mail) {
+	_memory_free(mail->thing_key);
+	_memory_free(mail->command);
+	if (mail->params) {
+		_memory_free(mail->params);
+	}
+	if (mail->from) {
+		_memory_free(mail->from);
+	}
+	if (mail->reply_cmd_id) {
+		_memory_free(mail->reply_cmd_id);
+	}
+	_memory_free(mail);
+}
+
+// Must be called with emulator->mux held.
+static _TR50_EMULATOR_MAIL *_tr50_emulator_mail_add(_TR50_EMULATOR *emulator, const char *thing_key, const char *command, JSON *params, const char *from) {
+	_TR50_EMULATOR_MAIL *mail;
+
+	if ((mail = (_TR50_EMULATOR_MAIL *)_memory_malloc(sizeof(_TR50_EMULATOR_MAIL))) == NULL) {
+		return NULL;
+	}
+	_memory_memset(mail, 0, sizeof(_TR50_EMULATOR_MAIL));
+	snprintf(mail->id, sizeof(mail->id), "%024llx", ++emulator->mail_next_id);
+	mail->thing_key = _tr50_emulator_strdup(thing_key);
+	mail->command = _tr50_emulator_strdup(command);
+	mail->params = params ? tr50_json_print_unformatted(params) : NULL;
+	mail->from = _tr50_emulator_strdup(from);
+	mail->state = TR50_EMULATOR_MAIL_QUEUED;
+	if (mail->thing_key == NULL || mail->command == NULL) {
+		_tr50_emulator_mail_delete(mail);
+		return NULL;
+	}
+	if (emulator->mail_tail) {
+		emulator->mail_tail->next = mail;
+	} else {
+		emulator->mail_head = mail;
+	}
+	emulator->mail_tail = mail;
+	_atomic_add64(&emulator->stats.mailbox_sent, 1);
+	return mail;
+}
+
+// Must be called with emulator->mux held.
+static _TR50_EMULATOR_MAIL *_tr50_emulator_mail_find(_TR50_EMULATOR *emulator, const char *id, int remove) {
+	_TR50_EMULATOR_MAIL *mail, *previous = NULL;
+
+	for (mail = emulator->mail_head; mail; previous = mail, mail = mail->next) {
+		if (strcmp(mail->id, id) == 0) {
+			break;
+		}
+	}
+	if (mail && remove) {
+		if (previous) {
+			previous->next = mail->next;
+		} else {
+			emulator->mail_head = mail->next;
+		}
+		if (emulator->mail_tail == mail) {
+			emulator->mail_tail = previous;
+		}
+		mail->next = NULL;
+	}
+	return mail;
+}
+
+// Answers the method.exec waiting on a removed message, adding its reply to completed once
+// nothing else holds it. Must be called with emulator->mux held.
+static void _tr50_emulator_mail_complete(_TR50_EMULATOR *emulator, _TR50_EMULATOR_MAIL *mail, int error_code, const char *error_message, JSON *params, _TR50_EMULATOR_REPLY **completed) {
+	_TR50_EMULATOR_REPLY *reply = mail->reply;
+	JSON *result;
+
+	if (reply == NULL) {
+		return;
+	}
+	result = tr50_json_create_object();
+	if (error_code != 0) {
+		_tr50_emulator_failure(result, error_code, error_message);
+	} else {
+		_tr50_emulator_success(emulator, result, _tr50_emulator_json_clone(params));
+	}
+	tr50_json_add_item_to_object(reply->json, mail->reply_cmd_id, result);
+	mail->reply = NULL;
+	if (--reply->waiting == 0) {
+		reply->next_completed = *completed;
+		*completed = reply;
+	}
+}
+
+static void _tr50_emulator_notify(_TR50_EMULATOR *emulator, const char *thing_key) {
+	_tr50_loopback_publish_named(emulator->loopback, thing_key, TR50_EMULATOR_TOPIC_NOTIFY, NULL, 0);
+}
+
+// Must be called with emulator->mux held.
+static void _tr50_emulator_store(JSON *store, const char *thing_key, const char *key, JSON *value, JSON *ts) {
+	JSON *thing, *entry;
+	char now[32];
+
+	if (key == NULL || value == NULL) {
+		return;
+	}
+	if ((thing = tr50_json_get_object_item(store, thing_key)) == NULL) {
+		thing = tr50_json_create_object();
+		tr50_json_add_item_to_object(store, thing_key, thing);
+	}
+	entry = tr50_json_create_object();
+	tr50_json_add_item_to_object(entry, "value", _tr50_emulator_json_clone(value));
+	if (ts && ts->type == JSON_STRING) {
+		tr50_json_add_string_to_object(entry, "ts", ts->valuestring);
+	} else {
+		_tr50_emulator_timestamp(now, sizeof(now));
+		tr50_json_add_string_to_object(entry, "ts", now);
+	}
+	if (tr50_json_get_object_item(thing, key)) {
+		tr50_json_replace_item_in_object(thing, key, entry);
+	} else {
+		tr50_json_add_item_to_object(thing, key, entry);
+	}
+}
+
+static void _tr50_emulator_current(_TR50_EMULATOR *emulator, JSON *result, JSON *store, const char *thing_key, const char *key) {
+	JSON *entry;
+
+	if (key == NULL || (entry = tr50_json_get_object_item(tr50_json_get_object_item(store, thing_key), key)) == NULL) {
+		_tr50_emulator_failure(result, 0, "Not found.");
+		return;
+	}
+	_tr50_emulator_success(emulator, result, _tr50_emulator_json_clone(entry));
+}
+
+static void _tr50_emulator_mailbox_check(_TR50_EMULATOR *emulator, JSON *result, const char *thing_key, JSON *params, _TR50_EMULATOR_REPLY **completed) {
+	_TR50_EMULATOR_MAIL *mail, *next;
+	JSON *messages = tr50_json_create_array(), *item, *out;
+	int *auto_complete = tr50_json_get_object_item_as_bool(params, "autoComplete");
+	int limit = _tr50_emulator_json_int(params, "limit", 0), count = 0;
+
+	for (mail = emulator->mail_head; mail && (limit <= 0 || count < limit); mail = next) {
+		next = mail->next;
+		if (mail->state != TR50_EMULATOR_MAIL_QUEUED || strcmp(mail->thing_key, thing_key) != 0) {
+			continue;
+		}
+		item = tr50_json_create_object();
+		tr50_json_add_string_to_object(item, "id", mail->id);
+		tr50_json_add_string_to_object(item, "thingKey", mail->thing_key);
+		tr50_json_add_string_to_object(item, "command", mail->command);
+		if (mail->params) {
+			tr50_json_add_item_to_object(item, "params", tr50_json_parse(mail->params));
+		}
+		tr50_json_add_string_to_object(item, "from", mail->from ? mail->from : TR50_EMULATOR_FROM);
+		tr50_json_add_item_to_array(messages, item);
+		_atomic_add64(&emulator->stats.mailbox_delivered, 1);
+		++count;
+
+		if (auto_complete && *auto_complete) {
+			_tr50_emulator_mail_find(emulator, mail->id, 1);
+			_tr50_emulator_mail_complete(emulator, mail, 0, NULL, NULL, completed);
+			_tr50_emulator_mail_delete(mail);
+		} else {
+			mail->state = TR50_EMULATOR_MAIL_DELIVERED;
+		}
+	}
+	out = tr50_json_create_object();
+	tr50_json_add_item_to_object(out, "messages", messages);
+	_tr50_emulator_success(emulator, result, out);
+}
+
+// Runs one command of a request. After the mutex is released the caller notifies the thing
+// key in notify, which points into params or session_name rather than the mail, hands ack to the ack callback and finishes the completed replies.
+// Must be called with emulator->mux held.
+static void _tr50_emulator_command(_TR50_EMULATOR *emulator, _TR50_EMULATOR_REPLY *reply, const char *session_name, const char *cmd_id, const char *command, JSON *params,
+								const char **notify, _TR50_EMULATOR_MAIL **ack, _TR50_EMULATOR_REPLY **completed) {
+	const char *thing_key = tr50_json_get_object_item_as_string(params, "thingKey");
+	JSON *result = tr50_json_create_object(), *out, *data, *item;
+	_TR50_EMULATOR_MAIL *mail = NULL;
+	char now[32];
+	int i;
+
+	if (thing_key == NULL) {
+		thing_key = session_name;
+	}
+
+	if (_tr50_emulator_chance(emulator, emulator->error_percent)) {
+		_atomic_add64(&emulator->stats.errors_injected, 1);
+		_tr50_emulator_failure(result, emulator->error_code, "Injected error.");
+	} else if (strcmp(command, "mailbox.check") == 0) {
+		_tr50_emulator_mailbox_check(emulator, result, thing_key, params, completed);
+	} else if (strcmp(command, "mailbox.ack") == 0) {
+		const char *id = tr50_json_get_object_item_as_string(params, "id");
+		if (id == NULL || (mail = _tr50_emulator_mail_find(emulator, id, 1)) == NULL) {
+			_tr50_emulator_failure(result, 0, "Mailbox message not found.");
+		} else {
+			_atomic_add64(&emulator->stats.mailbox_acked, 1);
+			_tr50_emulator_mail_complete(emulator, mail, _tr50_emulator_json_int(params, "errorCode", 0),
+								tr50_json_get_object_item_as_string(params, "errorMessage"), tr50_json_get_object_item(params, "params"), completed);
+			*ack = mail;
+			_tr50_emulator_success(emulator, result, NULL);
+		}
+	} else if (strcmp(command, "mailbox.update") == 0) {
+		const char *id = tr50_json_get_object_item_as_string(params, "id");
+		if (id == NULL || _tr50_emulator_mail_find(emulator, id, 0) == NULL) {
+			_tr50_emulator_failure(result, 0, "Mailbox message not found.");
+		} else {
+			_atomic_add64(&emulator->stats.mailbox_updates, 1);
+			_tr50_emulator_success(emulator, result, NULL);
+		}
+	} else if (strcmp(command, "mailbox.send") == 0 || strcmp(command, "method.exec") == 0) {
+		int is_method = strcmp(command, "method.exec") == 0;
+		const char *mail_command = is_method ? "method.exec" : tr50_json_get_object_item_as_string(params, "command");
+		JSON *mail_params = tr50_json_get_object_item(params, "params");
+
+		if (is_method) {
+			mail_params = tr50_json_create_object();
+			tr50_json_add_string_to_object(mail_params, "method", tr50_json_get_object_item_as_string(params, "method"));
+			tr50_json_add_item_to_object(mail_params, "params", _tr50_emulator_json_clone(tr50_json_get_object_item(params, "params")));
+		}
+		if (mail_command == NULL || (mail = _tr50_emulator_mail_add(emulator, thing_key, mail_command, mail_params, session_name)) == NULL) {
+			_tr50_emulator_failure(result, 0, "Invalid mailbox message.");
+		} else {
+			if (is_method) {
+				// answered when the target acks
+				mail->reply = reply;
+				mail->reply_cmd_id = _tr50_emulator_strdup(cmd_id);
+				++reply->waiting;
+				tr50_json_delete(result);
+				result = NULL;
+			} else {
+				out = tr50_json_create_object();
+				tr50_json_add_string_to_object(out, "id", mail->id);
+				_tr50_emulator_success(emulator, result, out);
+			}
+			// the mail may be acked and freed by another session once the mutex is released
+			*notify = thing_key;
+		}
+		if (is_method) {
+			tr50_json_delete(mail_params);
+		}
+	} else if (strcmp(command, "property.publish") == 0 || strcmp(command, "attribute.publish") == 0) {
+		_tr50_emulator_store(command[0] == 'p' ? emulator->properties : emulator->attributes, thing_key,
+							tr50_json_get_object_item_as_string(params, "key"), tr50_json_get_object_item(params, "value"), tr50_json_get_object_item(params, "ts"));
+		_tr50_emulator_success(emulator, result, NULL);
+	} else if (strcmp(command, "property.batch") == 0) {
+		data = tr50_json_get_object_item(params, "data");
+		for (i = 0; i < tr50_json_get_array_size(data); ++i) {
+			item = tr50_json_get_array_item(data, i);
+			_tr50_emulator_store(emulator->properties, thing_key,
+								tr50_json_get_object_item_as_string(item, "key"), tr50_json_get_object_item(item, "value"), tr50_json_get_object_item(item, "ts"));
+		}
+		_tr50_emulator_success(emulator, result, NULL);
+	} else if (strcmp(command, "property.current") == 0 || strcmp(command, "attribute.current") == 0) {
+		_tr50_emulator_current(emulator, result, command[0] == 'p' ? emulator->properties : emulator->attributes, thing_key, tr50_json_get_object_item_as_string(params, "key"));
+	} else if (strcmp(command, "diag.time") == 0) {
+		out = tr50_json_create_object();
+		_tr50_emulator_timestamp(now, sizeof(now));
+		tr50_json_add_string_to_object(out, "time", now);
+		_tr50_emulator_success(emulator, result, out);
+	} else if (strcmp(command, "file.put") == 0 || strcmp(command, "file.get") == 0) {
+		// the transfer itself is HTTP to port 80 of the host, the file name stands in for its id
+		out = tr50_json_create_object();
+		tr50_json_add_string_to_object(out, "fileId", tr50_json_get_object_item_as_string(params, "fileName"));
+		_tr50_emulator_success(emulator, result, out);
+	} else {
+		// alarm.publish, location.publish, log.publish, diag.ping, ...
+		_tr50_emulator_success(emulator, result, NULL);
+	}
+
+	if (result) {
+		tr50_json_add_item_to_object(reply->json, cmd_id, result);
+	}
+}
+
+static void _tr50_emulator_acked(_TR50_EMULATOR *emulator, _TR50_EMULATOR_MAIL *mail, JSON *params) {
+	if (emulator->ack_callback) {
+		emulator->ack_callback(emulator, mail->thing_key, mail->id, _tr50_emulator_json_int(params, "errorCode", 0),
+								tr50_json_get_object_item_as_string(params, "errorMessage"), tr50_json_get_object_item(params, "params"), emulator->ack_custom);
+	}
+	_tr50_emulator_mail_delete(mail);
+}
+
+static void _tr50_emulator_publish_handler(void *loopback, void *session, const char *topic, const char *data, int len, void *custom) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)custom;
+	const char *session_name = tr50_loopback_session_name(session);
+	const _TR50_CODEC *codec = NULL;
+	_TR50_EMULATOR_REPLY *reply, *completed, *reply_done;
+	_TR50_EMULATOR_MAIL *ack;
+	JSON *request, *cmd;
+	const char *seq, *command, *notify;
+	char *text = NULL;
+	int text_len;
+
+	if (strncmp(topic, TR50_TOPIC_API "/", sizeof(TR50_TOPIC_API)) == 0) {
+		seq = topic + sizeof(TR50_TOPIC_API);
+		text = (char *)_memory_malloc(len + 1);
+		if (text) {
+			_memory_memcpy(text, (void *)data, len);
+			text[len] = 0;
+		}
+	} else if ((codec = _tr50_codec_find_by_api_topic(topic)) != NULL) {
+		seq = topic + strlen(codec->api_topic) + 1;
+		_atomic_add64(&emulator->stats.compressed, 1);
+		if ((emulator->codecs & (1 << codec->id)) == 0) {
+			log_debug("_tr50_emulator_publish_handler(): codec [%s] disabled, not answering [%s]", codec->name, topic);
+			return;
+		}
+		if (codec->decode(emulator->codec_context, data, len, &text, &text_len) != 0) {
+			log_important_info("_tr50_emulator_publish_handler(): [%s] decode of [%s] failed", codec->name, topic);
+			return;
+		}
+	} else {
+		return; // not a TR50 request
+	}
+	_atomic_add64(&emulator->stats.requests, 1);
+	if (text == NULL) {
+		return;
+	}
+	request = tr50_json_parse(text);
+	_memory_free(text);
+	if (request == NULL) {
+		log_important_info("_tr50_emulator_publish_handler(): unparsable request on [%s]", topic);
+		return;
+	}
+
+	if ((reply = (_TR50_EMULATOR_REPLY *)_memory_malloc(sizeof(_TR50_EMULATOR_REPLY))) == NULL) {
+		tr50_json_delete(request);
+		return;
+	}
+	reply->session = session;
+	reply->codec = codec;
+	reply->seq_id = atoi(seq);
+	reply->json = tr50_json_create_object();
+	reply->waiting = 1; // held while the commands run
+
+	_tr50_mutex_lock(emulator->mux);
+	reply->drop = _tr50_emulator_chance(emulator, emulator->drop_percent);
+	_tr50_mutex_unlock(emulator->mux);
+
+	for (cmd = request->child; cmd; cmd = cmd->next) {
+		if (cmd->type != JSON_OBJECT || cmd->string == NULL || (command = tr50_json_get_object_item_as_string(cmd, "command")) == NULL) {
+			continue;
+		}
+		_atomic_add64(&emulator->stats.commands, 1);
+		notify = NULL;
+		ack = NULL;
+		completed = NULL;
+		_tr50_mutex_lock(emulator->mux);
+		_tr50_emulator_command(emulator, reply, session_name, cmd->string, command, tr50_json_get_object_item(cmd, "params"), &notify, &ack, &completed);
+		_tr50_mutex_unlock(emulator->mux);
+
+		if (notify) {
+			_tr50_emulator_notify(emulator, notify);
+		}
+		if (ack) {
+			_tr50_emulator_acked(emulator, ack, tr50_json_get_object_item(cmd, "params"));
+		}
+		while ((reply_done = completed) != NULL) {
+			completed = completed->next_completed;
+			_tr50_emulator_reply_finish(emulator, reply_done);
+		}
+	}
+	tr50_json_delete(request);
+
+	_tr50_mutex_lock(emulator->mux);
+	reply_done = --reply->waiting == 0 ? reply : NULL;
+	_tr50_mutex_unlock(emulator->mux);
+	if (reply_done) {
+		_tr50_emulator_reply_finish(emulator, reply_done);
+	}
+}
+
+static void *_tr50_emulator_bridge_reader(void *arg) {
+	_TR50_EMULATOR_BRIDGE *bridge = (_TR50_EMULATOR_BRIDGE *)arg;
+	const TR50_TRANSPORT *transport = tr50_loopback_transport(bridge->emulator->loopback);
+	char buffer[TR50_EMULATOR_IO_BUFFER];
+	int len, ret;
+
+	while (!bridge->is_done) {
+		len = sizeof(buffer);
+		if ((ret = _tcp_recv(bridge->sock, buffer, &len, TR50_EMULATOR_IO_TIMEOUT)) == ERR_TR50_SOCK_TIMEOUT) {
+			continue;
+		}
+		if (ret != 0 || transport->send(bridge->session, buffer, len, TR50_EMULATOR_IO_TIMEOUT) != 0) {
+			break;
+		}
+	}
+	bridge->is_done = 1;
+	tr50_loopback_close(bridge->emulator->loopback, bridge->session);
+	return NULL;
+}
+
+static void *_tr50_emulator_bridge_writer(void *arg) {
+	_TR50_EMULATOR_BRIDGE *bridge = (_TR50_EMULATOR_BRIDGE *)arg;
+	const TR50_TRANSPORT *transport = tr50_loopback_transport(bridge->emulator->loopback);
+	char buffer[TR50_EMULATOR_IO_BUFFER];
+	int len, ret;
+
+	while (!bridge->is_done) {
+		len = sizeof(buffer);
+		if ((ret = transport->recv(bridge->session, buffer, &len, TR50_EMULATOR_IO_TIMEOUT)) == ERR_TR50_SOCK_TIMEOUT) {
+			continue;
+		}
+		if (ret != 0 || _tcp_send(bridge->sock, buffer, len, TR50_EMULATOR_IO_TIMEOUT) != 0) {
+			break;
+		}
+	}
+	bridge->is_done = 1;
+	return NULL;
+}
+
+// Joins and frees finished bridges, or all of them.
+static void _tr50_emulator_bridge_reap(_TR50_EMULATOR *emulator, int all) {
+	const TR50_TRANSPORT *transport = tr50_loopback_transport(emulator->loopback);
+	_TR50_EMULATOR_BRIDGE *bridge, **ptr = &emulator->bridges;
+
+	while ((bridge = *ptr) != NULL) {
+		if (all) {
+			bridge->is_done = 1;
+		}
+		if (!bridge->is_done) {
+			ptr = &bridge->next;
+			continue;
+		}
+		*ptr = bridge->next;
+		_thread_join(bridge->reader_thread);
+		_thread_delete(bridge->reader_thread);
+		_thread_join(bridge->writer_thread);
+		_thread_delete(bridge->writer_thread);
+		transport->disconnect(bridge->session);
+		_tcp_disconnect(bridge->sock);
+		_memory_free(bridge);
+	}
+}
+
+static void *_tr50_emulator_listen_handler(void *arg) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)arg;
+	const TR50_TRANSPORT *transport = tr50_loopback_transport(emulator->loopback);
+	_TR50_EMULATOR_BRIDGE *bridge;
+	void *sock;
+	int ret;
+
+	while (!emulator->is_listen_stopping) {
+		_tr50_emulator_bridge_reap(emulator, 0);
+		if ((ret = _tcp_accept(emulator->listen_sock, &sock, TR50_EMULATOR_ACCEPT_TIMEOUT)) != 0) {
+			if (ret != ERR_TR50_SOCK_TIMEOUT) {
+				log_recurring(LOG_TYPE_IMPORTANT_INFO, __FILE__, __LINE__, 60, 1, "_tr50_emulator_listen_handler(): accept failed [%d]", ret);
+				_thread_sleep(TR50_EMULATOR_ACCEPT_TIMEOUT);
+			}
+			continue;
+		}
+		if ((bridge = (_TR50_EMULATOR_BRIDGE *)_memory_malloc(sizeof(_TR50_EMULATOR_BRIDGE))) == NULL) {
+			_tcp_disconnect(sock);
+			continue;
+		}
+		_memory_memset(bridge, 0, sizeof(_TR50_EMULATOR_BRIDGE));
+		bridge->emulator = emulator;
+		bridge->sock = sock;
+		if ((ret = transport->connect(transport->custom, &bridge->session, NULL, 0, 0)) != 0) {
+			log_important_info("_tr50_emulator_listen_handler(): session failed [%d]", ret);
+			_tcp_disconnect(sock);
+			_memory_free(bridge);
+			continue;
+		}
+		_thread_create(&bridge->reader_thread, "TR50:EmulatorIn", _tr50_emulator_bridge_reader, bridge);
+		_thread_create(&bridge->writer_thread, "TR50:EmulatorOut", _tr50_emulator_bridge_writer, bridge);
+		bridge->next = emulator->bridges;
+		emulator->bridges = bridge;
+	}
+	_tr50_emulator_bridge_reap(emulator, 1);
+	return NULL;
+}
+
+// The listener is joined without the mutex: it joins the bridge readers, which take it to
+// handle what they read. listen_thread stays set meanwhile, so tr50_emulator_listen() refuses.
+static void _tr50_emulator_stop_listen(_TR50_EMULATOR *emulator) {
+	void *listen_thread;
+
+	_tr50_mutex_lock(emulator->mux);
+	emulator->is_listen_stopping = 1;
+	listen_thread = emulator->listen_thread;
+	_tr50_mutex_unlock(emulator->mux);
+
+	if (listen_thread) {
+		_thread_join(listen_thread);
+		_thread_delete(listen_thread);
+	}
+
+	_tr50_mutex_lock(emulator->mux);
+	emulator->listen_thread = NULL;
+	if (emulator->listen_sock) {
+		_tcp_disconnect(emulator->listen_sock);
+		emulator->listen_sock = NULL;
+	}
+	emulator->is_listen_stopping = 0;
+	_tr50_mutex_unlock(emulator->mux);
+}
+
+int tr50_emulator_create(void **emulator_handle) {
+	_TR50_EMULATOR *emulator;
+	int ret;
+
+	if (emulator_handle == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((emulator = (_TR50_EMULATOR *)_memory_malloc(sizeof(_TR50_EMULATOR))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(emulator, 0, sizeof(_TR50_EMULATOR));
+	if ((emulator->codec_context = (_TR50_CLIENT *)_memory_malloc(sizeof(_TR50_CLIENT))) == NULL) {
+		_memory_free(emulator);
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(emulator->codec_context, 0, sizeof(_TR50_CLIENT));
+	_tr50_compress_dictionary_default((const char **)&emulator->codec_context->compress_dictionary, &emulator->codec_context->compress_dictionary_len);
+	if ((ret = tr50_loopback_create(&emulator->loopback)) != 0) {
+		_memory_free(emulator->codec_context);
+		_memory_free(emulator);
+		return ret;
+	}
+	tr50_loopback_set_publish_handler(emulator->loopback, _tr50_emulator_publish_handler, emulator);
+
+	emulator->codecs = -1;
+	emulator->random = (unsigned int)_time_now_us() | 1;
+	emulator->properties = tr50_json_create_object();
+	emulator->attributes = tr50_json_create_object();
+	_tr50_mutex_create(&emulator->mux);
+	_tr50_mutex_create(&emulator->delay_mux);
+	_tr50_event_create(&emulator->delay_evt);
+	_thread_create(&emulator->delay_thread, "TR50:Emulator", _tr50_emulator_delay_handler, emulator);
+
+	*emulator_handle = emulator;
+	return 0;
+}
+
+const TR50_TRANSPORT *tr50_emulator_transport(void *emulator_handle) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	return emulator ? tr50_loopback_transport(emulator->loopback) : NULL;
+}
+
+int tr50_emulator_listen(void *emulator_handle, int port) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	int ret;
+
+	if (emulator == NULL || port <= 0 || port > 65535) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(emulator->mux);
+	if (emulator->listen_thread) {
+		_tr50_mutex_unlock(emulator->mux);
+		return ERR_TR50_ALREADY_STARTED;
+	}
+	if ((ret = _tcp_listen(&emulator->listen_sock, port)) != 0) {
+		log_important_info("tr50_emulator_listen(): listen on [%d] failed [%d]", port, ret);
+		emulator->listen_sock = NULL;
+		_tr50_mutex_unlock(emulator->mux);
+		return ret;
+	}
+	_thread_create(&emulator->listen_thread, "TR50:EmulatorTcp", _tr50_emulator_listen_handler, emulator);
+	_tr50_mutex_unlock(emulator->mux);
+	return 0;
+}
+
+int tr50_emulator_set_latency(void *emulator_handle, int min_in_ms, int max_in_ms) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+
+	if (emulator == NULL || min_in_ms < 0 || max_in_ms < min_in_ms) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(emulator->mux);
+	emulator->latency_min = min_in_ms;
+	emulator->latency_max = max_in_ms;
+	_tr50_mutex_unlock(emulator->mux);
+	return 0;
+}
+
+int tr50_emulator_set_errors(void *emulator_handle, int error_percent, int error_code, int drop_percent) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+
+	if (emulator == NULL || error_percent < 0 || error_percent > 100 || drop_percent < 0 || drop_percent > 100) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(emulator->mux);
+	emulator->error_percent = error_percent;
+	emulator->error_code = error_code;
+	emulator->drop_percent = drop_percent;
+	_tr50_mutex_unlock(emulator->mux);
+	return 0;
+}
+
+int tr50_emulator_set_reply_size(void *emulator_handle, int pad_bytes) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	char *pad = NULL;
+
+	if (emulator == NULL || pad_bytes < 0) {
+		return ERR_TR50_PARMS;
+	}
+	if (pad_bytes > 0) {
+		if ((pad = (char *)_memory_malloc(pad_bytes + 1)) == NULL) {
+			return ERR_TR50_MALLOC;
+		}
+		_memory_memset(pad, 'x', pad_bytes);
+		pad[pad_bytes] = 0;
+	}
+	_tr50_mutex_lock(emulator->mux);
+	if (emulator->pad) {
+		_memory_free(emulator->pad);
+	}
+	emulator->pad = pad;
+	_tr50_mutex_unlock(emulator->mux);
+	return 0;
+}
+
+int tr50_emulator_set_codecs(void *emulator_handle, int mask) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+
+	if (emulator == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	emulator->codecs = mask;
+	return 0;
+}
+
+// Set before clients connect; the codecs read the dictionary without locking.
+int tr50_emulator_set_dictionary(void *emulator_handle, const char *dictionary, int dictionary_len) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	_TR50_CLIENT *context;
+
+	if (emulator == NULL || (dictionary && dictionary_len <= 0)) {
+		return ERR_TR50_PARMS;
+	}
+	context = emulator->codec_context;
+	if (emulator->dictionary) {
+		_memory_free(emulator->dictionary);
+		emulator->dictionary = NULL;
+	}
+	if (dictionary == NULL) {
+		_tr50_compress_dictionary_default((const char **)&context->compress_dictionary, &context->compress_dictionary_len);
+		return 0;
+	}
+	if ((emulator->dictionary = (char *)_memory_clone((void *)dictionary, dictionary_len)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	context->compress_dictionary = emulator->dictionary;
+	context->compress_dictionary_len = dictionary_len;
+	return 0;
+}
+
+int tr50_emulator_set_ack_handler(void *emulator_handle, tr50_emulator_ack_callback callback, void *custom) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+
+	if (emulator == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(emulator->mux);
+	emulator->ack_callback = callback;
+	emulator->ack_custom = custom;
+	_tr50_mutex_unlock(emulator->mux);
+	return 0;
+}
+
+int tr50_emulator_mailbox_send(void *emulator_handle, const char *thing_key, const char *command, JSON *params, char *id, int id_size) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	_TR50_EMULATOR_MAIL *mail;
+
+	if (emulator == NULL || thing_key == NULL || command == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(emulator->mux);
+	if ((mail = _tr50_emulator_mail_add(emulator, thing_key, command, params, TR50_EMULATOR_FROM)) != NULL && id && id_size > 0) {
+		snprintf(id, id_size, "%s", mail->id);
+	}
+	_tr50_mutex_unlock(emulator->mux);
+	if (mail == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_tr50_emulator_notify(emulator, thing_key);
+	return 0;
+}
+
+int tr50_emulator_method_exec(void *emulator_handle, const char *thing_key, const char *method, JSON *params, char *id, int id_size) {
+	JSON *mail_params;
+	int ret;
+
+	if (method == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	mail_params = tr50_json_create_object();
+	tr50_json_add_string_to_object(mail_params, "method", method);
+	if (params) {
+		tr50_json_add_item_reference_to_object(mail_params, "params", params);
+	}
+	ret = tr50_emulator_mailbox_send(emulator_handle, thing_key, "method.exec", mail_params, id, id_size);
+	tr50_json_delete(mail_params);
+	return ret;
+}
+
+int tr50_emulator_stats(void *emulator_handle, TR50_EMULATOR_STATS *stats) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	TR50_EMULATOR_STATS *from;
+
+	if (emulator == NULL || stats == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	from = &emulator->stats;
+	stats->requests = _atomic_load64(&from->requests);
+	stats->commands = _atomic_load64(&from->commands);
+	stats->compressed = _atomic_load64(&from->compressed);
+	stats->replies = _atomic_load64(&from->replies);
+	stats->errors_injected = _atomic_load64(&from->errors_injected);
+	stats->dropped = _atomic_load64(&from->dropped);
+	stats->mailbox_sent = _atomic_load64(&from->mailbox_sent);
+	stats->mailbox_delivered = _atomic_load64(&from->mailbox_delivered);
+	stats->mailbox_acked = _atomic_load64(&from->mailbox_acked);
+	stats->mailbox_updates = _atomic_load64(&from->mailbox_updates);
+	return 0;
+}
+
+typedef struct {
+	const TR50_TRANSPORT	*transport;
+	void					*session;
+	volatile int			is_done;
+} _TR50_EMULATOR_REPLAY;
+
+// Replies to a replayed connection go nowhere.
+static void *_tr50_emulator_replay_drain(void *arg) {
+	_TR50_EMULATOR_REPLAY *replay = (_TR50_EMULATOR_REPLAY *)arg;
+	char buffer[TR50_EMULATOR_IO_BUFFER];
+	int len, ret;
+
+	while (!replay->is_done) {
+		len = sizeof(buffer);
+		if ((ret = replay->transport->recv(replay->session, buffer, &len, TR50_EMULATOR_IO_TIMEOUT)) != 0 && ret != ERR_TR50_SOCK_TIMEOUT) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int _tr50_emulator_replay_frame(int direction, long long timestamp_us, const char *frame, int len, void *arg) {
+	_TR50_EMULATOR_REPLAY *replay = (_TR50_EMULATOR_REPLAY *)arg;
+
+	if (direction != TR50_CAPTURE_OUT) {
+		return 0;
+	}
+	return replay->transport->send(replay->session, frame, len, TR50_EMULATOR_IO_TIMEOUT);
+}
+
+// Captures start after CONNECT, so the session is opened with one built from thing_key.
+int tr50_emulator_replay(void *emulator_handle, const char *path, const char *thing_key, double speed) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	_TR50_EMULATOR_REPLAY replay;
+	void *drain_thread = NULL;
+	char *connect = NULL;
+	int connect_len, ret;
+
+	if (emulator == NULL || path == NULL || thing_key == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_memory_memset(&replay, 0, sizeof(replay));
+	replay.transport = tr50_loopback_transport(emulator->loopback);
+	if ((ret = _mqtt_msg_build_connect(thing_key, thing_key, NULL, 0, &connect, &connect_len)) != 0) {
+		return ret;
+	}
+	if ((ret = replay.transport->connect(replay.transport->custom, &replay.session, NULL, 0, 0)) != 0) {
+		_memory_free(connect);
+		return ret;
+	}
+	_thread_create(&drain_thread, "TR50:EmulatorReplay", _tr50_emulator_replay_drain, &replay);
+
+	if ((ret = replay.transport->send(replay.session, connect, connect_len, TR50_EMULATOR_IO_TIMEOUT)) == 0) {
+		ret = tr50_capture_read(path, speed, _tr50_emulator_replay_frame, &replay);
+	}
+	_memory_free(connect);
+
+	replay.is_done = 1;
+	tr50_loopback_close(emulator->loopback, replay.session);
+	_thread_join(drain_thread);
+	_thread_delete(drain_thread);
+	replay.transport->disconnect(replay.session);
+	return ret;
+}
+
+int tr50_emulator_delete(void *emulator_handle) {
+	_TR50_EMULATOR *emulator = (_TR50_EMULATOR *)emulator_handle;
+	_TR50_EMULATOR_DELAYED *delayed;
+	_TR50_EMULATOR_MAIL *mail;
+	_TR50_EMULATOR_REPLY *reply;
+
+	if (emulator == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_emulator_stop_listen(emulator);
+	if (_tr50_loopback_has_sessions(emulator->loopback)) {
+		return ERR_TR50_CONNECTED;
+	}
+
+	emulator->is_stopping = 1;
+	_tr50_event_signal(emulator->delay_evt);
+	_thread_join(emulator->delay_thread);
+	_thread_delete(emulator->delay_thread);
+	tr50_loopback_delete(emulator->loopback);
+
+	while ((delayed = emulator->delayed) != NULL) {
+		emulator->delayed = delayed->next;
+		_memory_free(delayed->data);
+		_memory_free(delayed);
+	}
+	while ((mail = emulator->mail_head) != NULL) {
+		emulator->mail_head = mail->next;
+		// a reply held by several messages goes with the last of them
+		if ((reply = mail->reply) != NULL && --reply->waiting == 0) {
+			tr50_json_delete(reply->json);
+			_memory_free(reply);
+		}
+		_tr50_emulator_mail_delete(mail);
+	}
+	tr50_json_delete(emulator->properties);
+	tr50_json_delete(emulator->attributes);
+	if (emulator->pad) {
+		_memory_free(emulator->pad);
+	}
+	if (emulator->dictionary) {
+		_memory_free(emulator->dictionary);
+	}
+	_memory_free(emulator->codec_context);
+	_tr50_event_delete(emulator->delay_evt);
+	_tr50_mutex_delete(emulator->delay_mux);
+	_tr50_mutex_delete(emulator->mux);
+	_memory_free(emulator);
+	return 0;
+}
@@ -0,0 +1,1364 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/internal/tr50.h>
+#include <tr50/worker.h>
+
+#include <tr50/util/compress.h>
+#include <tr50/util/event.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/tcp.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+#if defined (_WIN32)
+#  define strtok_r strtok_s
+#endif
+
+#define _TR50_FILE_HTTP_PORT		80
+#define _TR50_FILE_HTTP_TIMEOUT		5000
+// room in front of the data for "\r\n" + up to 7 hex digits + "\r\n"
+#define _TR50_FILE_CHUNK_HEAD		16
+// attempts at a segment without any progress before the download gives up on it
+#define _TR50_FILE_SEGMENT_RETRIES	3
+#define _TR50_FILE_PROGRESS_MS		250
+// longest a throttled transfer sleeps before it looks at its abort flag again
+#define _TR50_FILE_THROTTLE_SLICE_MS	100
+// keep-alive connections kept between requests, and for how long
+#define _TR50_FILE_IDLE_MAX			8
+#define _TR50_FILE_IDLE_MS			15000
+#define _TR50_FILE_REQUEST_MAX		1024
+
+// whether a download body goes through the inflater
+#define _TR50_GUNZIP_OFF			0
+#define _TR50_GUNZIP_DETECT			1	// decided by the first two body bytes, see TR50_FILE_GUNZIP_SNIFF
+#define _TR50_GUNZIP_ON				2
+#define _TR50_GUNZIP_END			3	// the gzip stream ended, the rest is ignored
+
+#define POST_COMMAND "POST /file/%s HTTP/1.1\r\nHost:%s:80\r\nTransfer-Encoding: chunked\r\nContent-Type: application/octet-stream\r\n\r\n"
+#define GET_COMMAND "GET /file/%s HTTP/1.1\r\nHost:%s:80\r\n\r\n"
+#define GET_RANGE_COMMAND "GET /file/%s HTTP/1.1\r\nHost:%s:80\r\nRange: bytes=%lld-%lld\r\n\r\n"
+#define JOURNAL_HEADER "tr50-download %lld %d %s\n"
+
+typedef struct _TR50_HTTP_IDLE {
+	void *			socket;
+	char			host[128];
+	long long		since;
+	struct _TR50_HTTP_IDLE *next;
+} _TR50_HTTP_IDLE;
+
+typedef struct _TR50_FILE_TASK {
+	int				id;
+	int				priority;
+	int				is_upload;
+	char *			thing_key;
+	char *			src;
+	char *			dest;
+	char *			tags;
+	char			is_public;
+	int				has_public;
+	int				is_global;
+	int				log_completion;
+	volatile int	abort;
+	tr50_file_transfer_callback callback;
+	void *			custom;
+	struct _TR50_FILE_TASK *next;
+} _TR50_FILE_TASK;
+
+typedef struct {
+	_TR50_CLIENT *	client;
+	const char *	file_id;
+	const char *	file_name;
+	const char *	dest;
+	void *			mux;
+	FILE *			journal;
+	long long		total;
+	long long		done;
+	long long		received;
+	long long		started;
+	long long		reported;
+	int				segment_size;
+	int				segments;
+	int				next;
+	char *			completed;
+	int				error;
+	volatile int *	abort;
+} _TR50_FILE_DOWNLOAD;
+
+// Response reader: lines are parsed out of the buffer, body bytes left over from the last recv()
+// are written before the next one.
+typedef struct {
+	_TR50_CLIENT *	client;
+	void *			socket;
+	int				reused;			// socket came from the keep-alive pool
+	char *			buffer;
+	int				size;
+	int				start;
+	int				end;
+	long long		written;		// file bytes read or written
+	long long		wire;			// body bytes sent or received
+	_TR50_FILE_DOWNLOAD *progress;
+	volatile int *	abort;			// set to stop the transfer at its next recv or send
+	int				gunzip;			// _TR50_GUNZIP_*
+	int				held;			// a first body byte of 0x1f waits for the second one to detect
+	void *			inflater;
+	char *			inflated;		// size bytes
+} _TR50_HTTP_READER;
+
+typedef struct {
+	int			status;
+	int			is_chunked;
+	int			is_gzip;		// Content-Encoding: gzip
+	long long	content_length;
+	long long	range_start;	// Content-Range, -1 when absent or unsatisfied
+	long long	range_total;	// -1 when absent or unknown
+	int			close;			// the server closes the connection after this response
+	char		etag[128];
+} _TR50_HTTP_RESPONSE;
+
+static int _tr50_file_seek(FILE *fp, long long offset) {
+#if defined(_WIN32)
+	return _fseeki64(fp, offset, SEEK_SET);
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// Leaves the file at its start; -1 when it cannot seek.
+static long long _tr50_file_size(FILE *fp) {
+	long long size;
+
+#if defined(_WIN32)
+	if (_fseeki64(fp, 0, SEEK_END) != 0 || (size = _ftelli64(fp)) < 0) {
+#else
+	if (fseeko(fp, 0, SEEK_END) != 0 || (size = (long long)ftello(fp)) < 0) {
+#endif
+		return -1;
+	}
+	return _tr50_file_seek(fp, 0) == 0 ? size : -1;
+}
+
+static void _tr50_file_progress(_TR50_FILE_DOWNLOAD *download, int len) {
+	_TR50_CONFIG *config = &download->client->config;
+	long long now = _time_now();
+
+	_tr50_mutex_lock(download->mux);
+	download->done += len;
+	download->received += len;
+	if (config->file_progress_handler && (now - download->reported >= _TR50_FILE_PROGRESS_MS || download->done == download->total)) {
+		download->reported = now;
+		config->file_progress_handler(download->client, download->file_name, download->done, download->total,
+									download->received * 1000 / (now > download->started ? now - download->started : 1), config->file_progress_handler_custom);
+	}
+	_tr50_mutex_unlock(download->mux);
+}
+
+// Paces every file transfer of the client to the configured rate: each caller reserves the time
+// its bytes take and sleeps until the reservation before its own starts. The sleep is cut into
+// slices so a cancel or _tr50_file_delete() gets through; the reservation is given back then.
+static int _tr50_file_throttle(_TR50_HTTP_READER *reader, int len) {
+	_TR50_FILES *files = &reader->client->files;
+	long long rate = reader->client->config.file_bytes_per_second;
+	long long now, start, cost;
+
+	if (rate <= 0) {
+		return 0;
+	}
+	cost = len * 1000000LL / rate;
+	_tr50_mutex_lock(files->mux);
+	now = _time_now_us();
+	if (files->send_at < now) {
+		files->send_at = now;
+	}
+	start = files->send_at;
+	files->send_at += cost;
+	_tr50_mutex_unlock(files->mux);
+
+	while ((now = _time_now_us()) < start - 1000) {
+		if ((reader->abort && *reader->abort) || files->stopping) {
+			_tr50_mutex_lock(files->mux);
+			files->send_at -= cost;
+			_tr50_mutex_unlock(files->mux);
+			return ERR_TR50_CANCELED;
+		}
+		_thread_sleep(start - now > _TR50_FILE_THROTTLE_SLICE_MS * 1000LL ? _TR50_FILE_THROTTLE_SLICE_MS : (int)((start - now) / 1000));
+	}
+	return 0;
+}
+
+// A gzip stream from the client's pool, or a new one. The pool holds deflaters of one level.
+static void *_tr50_file_gzip_take(_TR50_CLIENT *client, int is_inflate, int level) {
+	_TR50_FILES *files = &client->files;
+	void *stream = NULL;
+
+	_tr50_mutex_lock(files->mux);
+	if (is_inflate && files->inflater_count > 0) {
+		stream = files->inflaters[--files->inflater_count];
+	} else if (!is_inflate && files->deflater_count > 0 && files->deflater_level == level) {
+		stream = files->deflaters[--files->deflater_count];
+	}
+	_tr50_mutex_unlock(files->mux);
+	if (stream == NULL && _compress_gzip_create(&stream, is_inflate, level) != 0) {
+		return NULL;
+	}
+	return stream;
+}
+
+static void _tr50_file_gzip_release(_TR50_CLIENT *client, void *stream, int is_inflate, int level) {
+	_TR50_FILES *files = &client->files;
+
+	if (stream == NULL) {
+		return;
+	}
+	if (_compress_gzip_reset(stream) == 0) {
+		_tr50_mutex_lock(files->mux);
+		if (!is_inflate && files->deflater_level != level) {
+			// the level changed, streams of the previous one are of no use any more
+			while (files->deflater_count > 0) {
+				_compress_gzip_delete(files->deflaters[--files->deflater_count]);
+			}
+			files->deflater_level = level;
+		}
+		if (files->stopping) {
+			// _tr50_file_delete() already emptied the pool
+		} else if (is_inflate && files->inflater_count < TR50_FILE_WORKERS_MAX) {
+			files->inflaters[files->inflater_count++] = stream;
+			stream = NULL;
+		} else if (!is_inflate && files->deflater_count < TR50_FILE_WORKERS_MAX) {
+			files->deflaters[files->deflater_count++] = stream;
+			stream = NULL;
+		}
+		_tr50_mutex_unlock(files->mux);
+	}
+	if (stream) {
+		_compress_gzip_delete(stream);
+	}
+}
+
+static void _tr50_file_count(_TR50_CLIENT *client, int is_upload, long long bytes, long long wire_bytes) {
+	TR50_FILE_STATS *stats = &client->files.stats;
+
+	_tr50_mutex_lock(client->files.mux);
+	if (is_upload) {
+		++stats->uploads;
+		stats->upload_bytes += bytes;
+		stats->upload_wire_bytes += wire_bytes;
+	} else {
+		++stats->downloads;
+		stats->download_bytes += bytes;
+		stats->download_wire_bytes += wire_bytes;
+	}
+	_tr50_mutex_unlock(client->files.mux);
+}
+
+static int _tr50_file_write_raw(_TR50_HTTP_READER *reader, FILE *fp, const char *data, int len) {
+	if (fwrite(data, 1, len, fp) != (size_t)len) {
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	reader->written += len;
+	if (reader->progress) {
+		_tr50_file_progress(reader->progress, len);
+	}
+	return 0;
+}
+
+static int _tr50_file_inflate(_TR50_HTTP_READER *reader, FILE *fp, const char *data, int len) {
+	char *out;
+	int room, ret;
+
+	if (reader->gunzip == _TR50_GUNZIP_OFF) {
+		return _tr50_file_write_raw(reader, fp, data, len);
+	}
+	if (reader->progress && reader->progress->total >= 0) {
+		reader->progress->total = -1; // the inflated size shows at the end
+	}
+	// output left in the inflater when the room ran out comes with the next step, even without input
+	room = reader->size;
+	while (reader->gunzip == _TR50_GUNZIP_ON && (len > 0 || room == 0)) {
+		out = reader->inflated;
+		room = reader->size;
+		if ((ret = _compress_gzip_step(reader->inflater, &data, &len, &out, &room, 0)) < 0) {
+			return ERR_TR50_FILE_GET_HTTP;
+		} else if (ret == 1) {
+			reader->gunzip = _TR50_GUNZIP_END;
+		}
+		if (room < reader->size && (ret = _tr50_file_write_raw(reader, fp, reader->inflated, reader->size - room)) != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// Body bytes to the file, through the inflater when the body is gzip. Detecting takes both
+// magic bytes, so a first byte of 0x1f on its own is held until the next one comes.
+static int _tr50_file_write(_TR50_HTTP_READER *reader, FILE *fp, const char *data, int len) {
+	static const char magic = 0x1f;
+	int ret;
+
+	reader->wire += len;
+	if (reader->gunzip == _TR50_GUNZIP_DETECT && len > 0) {
+		if (!reader->held && len == 1 && data[0] == magic) {
+			reader->held = 1;
+			return 0;
+		}
+		if ((reader->held || data[0] == magic) && (unsigned char)data[reader->held ? 0 : 1] == 0x8b) {
+			reader->gunzip = _TR50_GUNZIP_ON;
+		} else {
+			reader->gunzip = _TR50_GUNZIP_OFF;
+		}
+		if (reader->held) {
+			reader->held = 0;
+			if ((ret = _tr50_file_inflate(reader, fp, &magic, 1)) != 0) {
+				return ret;
+			}
+		}
+	}
+	return _tr50_file_inflate(reader, fp, data, len);
+}
+
+// After the last body byte: a gzip stream must have ended, and a held byte is plain data.
+static int _tr50_file_write_end(_TR50_HTTP_READER *reader, FILE *fp) {
+	if (reader->gunzip == _TR50_GUNZIP_ON) {
+		return ERR_TR50_FILE_GET_HTTP;
+	}
+	if (reader->held) {
+		reader->held = 0;
+		return _tr50_file_write_raw(reader, fp, "\x1f", 1);
+	}
+	return 0;
+}
+
+static int _tr50_http_fill(_TR50_HTTP_READER *reader) {
+	int len, ret;
+
+	if (reader->start > 0) {
+		memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if ((len = reader->size - reader->end) <= 0) {
+		return ERR_TR50_FILE_GET_HTTP; // a line longer than the buffer
+	}
+	if ((ret = _tcp_recv(reader->socket, reader->buffer + reader->end, &len, _TR50_FILE_HTTP_TIMEOUT)) != 0) {
+		return ret;
+	}
+	reader->end += len;
+	return 0;
+}
+
+// Next line without its CRLF, valid until the reader is used again.
+static int _tr50_http_line(_TR50_HTTP_READER *reader, char **line) {
+	char *eol;
+	int ret;
+
+	while ((eol = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start)) == NULL) {
+		if ((ret = _tr50_http_fill(reader)) != 0) {
+			return ret;
+		}
+	}
+	*eol = 0;
+	if (eol > reader->buffer + reader->start && eol[-1] == '\r') {
+		eol[-1] = 0;
+	}
+	*line = reader->buffer + reader->start;
+	reader->start = (int)(eol - reader->buffer) + 1;
+	return 0;
+}
+
+// Value of a "name: value" header line when it has that name.
+static const char *_tr50_http_header(const char *line, const char *name) {
+	while (*name && tolower((unsigned char)*line) == tolower((unsigned char)*name)) {
+		++line;
+		++name;
+	}
+	if (*name || *line != ':') {
+		return NULL;
+	}
+	for (++line; *line == ' ' || *line == '\t'; ++line)
+		; /* Nothing. */
+	return line;
+}
+
+// Status line and headers.
+static int _tr50_http_response(_TR50_HTTP_READER *reader, _TR50_HTTP_RESPONSE *response) {
+	const char *value;
+	char *line;
+	int ret;
+
+	_memory_memset(response, 0, sizeof(_TR50_HTTP_RESPONSE));
+	response->content_length = response->range_start = response->range_total = -1;
+
+	if ((ret = _tr50_http_line(reader, &line)) != 0) {
+		return ret;
+	}
+	if (strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ' || (response->status = atoi(line + 9)) <= 0) {
+		return ERR_TR50_FILE_GET_HTTP;
+	}
+	response->close = line[7] == '0';
+	while ((ret = _tr50_http_line(reader, &line)) == 0 && *line) {
+		if ((value = _tr50_http_header(line, "Content-Length")) != NULL) {
+			response->content_length = strtoll(value, NULL, 10);
+		} else if ((value = _tr50_http_header(line, "Transfer-Encoding")) != NULL) {
+			response->is_chunked = strstr(value, "chunked") != NULL;
+		} else if ((value = _tr50_http_header(line, "Content-Range")) != NULL && strncmp(value, "bytes ", 6) == 0) {
+			// "bytes 0-99/1000", "bytes */1000" or "bytes 0-99/*"
+			if (value[6] != '*') {
+				response->range_start = strtoll(value + 6, NULL, 10);
+			}
+			if ((value = strchr(value, '/')) != NULL && value[1] != '*') {
+				response->range_total = strtoll(value + 1, NULL, 10);
+			}
+		} else if ((value = _tr50_http_header(line, "ETag")) != NULL) {
+			snprintf(response->etag, sizeof(response->etag), "%s", value);
+		} else if ((value = _tr50_http_header(line, "Content-Encoding")) != NULL) {
+			response->is_gzip = strstr(value, "gzip") != NULL;
+		} else if ((value = _tr50_http_header(line, "Connection")) != NULL) {
+			response->close = strstr(value, "close") != NULL || (response->close && strstr(value, "eep-alive") == NULL);
+		}
+	}
+	return ret;
+}
+
+// Writes length body bytes to fp, or everything up to the end of the connection when length < 0;
+// without fp they are read and dropped. Each recv() asks for the whole buffer and goes to the file
+// in one fwrite().
+static int _tr50_http_body(_TR50_HTTP_READER *reader, FILE *fp, long long length) {
+	int len, ret;
+
+	while (length != 0) {
+		if (reader->abort && *reader->abort) {
+			return ERR_TR50_CANCELED;
+		}
+		if (reader->start == reader->end) {
+			reader->start = reader->end = 0;
+			if ((ret = _tr50_http_fill(reader)) != 0) {
+				return (length < 0 && ret == ERR_TR50_SOCK_SHUTDOWN) ? 0 : ret;
+			}
+			if ((ret = _tr50_file_throttle(reader, reader->end)) != 0) {
+				return ret;
+			}
+		}
+		len = reader->end - reader->start;
+		if (length >= 0 && len > length) {
+			len = (int)length;
+		}
+		reader->start += len;
+		if (length > 0) {
+			length -= len;
+		}
+		if (fp != NULL && (ret = _tr50_file_write(reader, fp, reader->buffer + reader->start - len, len)) != 0) {
+			return ret;
+		}
+	}
+	return 0;
+}
+
+static int _tr50_http_chunked_body(_TR50_HTTP_READER *reader, FILE *fp) {
+	long long size;
+	char *line;
+	int ret;
+
+	while ((ret = _tr50_http_line(reader, &line)) == 0) {
+		if ((size = strtoll(line, NULL, 16)) < 0) {
+			return ERR_TR50_FILE_GET_HTTP;
+		} else if (size == 0) {
+			// trailers up to the empty line end the body
+			while ((ret = _tr50_http_line(reader, &line)) == 0 && *line)
+				; /* Nothing. */
+			return ret;
+		}
+		if ((ret = _tr50_http_body(reader, fp, size)) != 0 || (ret = _tr50_http_line(reader, &line)) != 0) {
+			break;
+		}
+	}
+	return ret;
+}
+
+// Idle keep-alive connection to host, dropping the ones kept too long.
+static void *_tr50_http_take(_TR50_CLIENT *client, const char *host) {
+	_TR50_FILES *files = &client->files;
+	_TR50_HTTP_IDLE *idle, **link;
+	long long now = _time_now();
+	void *socket = NULL;
+
+	_tr50_mutex_lock(files->mux);
+	for (link = &files->idle; (idle = *link) != NULL && socket == NULL;) {
+		if (now - idle->since > _TR50_FILE_IDLE_MS || strcmp(idle->host, host) == 0) {
+			*link = idle->next;
+			--files->idle_count;
+			if (now - idle->since > _TR50_FILE_IDLE_MS) {
+				_tcp_disconnect(idle->socket);
+			} else {
+				socket = idle->socket;
+			}
+			_memory_free(idle);
+		} else {
+			link = &idle->next;
+		}
+	}
+	_tr50_mutex_unlock(files->mux);
+	return socket;
+}
+
+// Ends the request on the reader's connection, keeping the connection for the next one when the
+// response was read to its end and the server keeps it open.
+static void _tr50_http_close(_TR50_HTTP_READER *reader, int keep) {
+	_TR50_FILES *files = &reader->client->files;
+	_TR50_HTTP_IDLE *idle = NULL;
+
+	if (reader->socket == NULL) {
+		return;
+	}
+	if (keep && reader->start == reader->end && (idle = _memory_malloc(sizeof(_TR50_HTTP_IDLE))) != NULL) {
+		idle->socket = reader->socket;
+		idle->since = _time_now();
+		snprintf(idle->host, sizeof(idle->host), "%s", tr50_config_get_host(reader->client));
+		_tr50_mutex_lock(files->mux);
+		if (files->stopping || files->idle_count >= _TR50_FILE_IDLE_MAX) {
+			_memory_free(idle);
+			idle = NULL;
+		} else {
+			idle->next = files->idle;
+			files->idle = idle;
+			++files->idle_count;
+		}
+		_tr50_mutex_unlock(files->mux);
+	}
+	if (idle == NULL) {
+		_tcp_disconnect(reader->socket);
+	}
+	reader->socket = NULL;
+}
+
+// Reads past a body nobody wants, 1 when the connection can take another request after it.
+static int _tr50_http_finish(_TR50_HTTP_READER *reader, _TR50_HTTP_RESPONSE *response) {
+	if (response->close) {
+		return 0;
+	} else if (response->is_chunked) {
+		return _tr50_http_chunked_body(reader, NULL) == 0;
+	} else if (response->content_length >= 0) {
+		return _tr50_http_body(reader, NULL, response->content_length) == 0;
+	}
+	return response->status == 204 || response->status == 304;
+}
+
+// Sends the request on a kept connection or a new one and reads the response headers. A kept
+// connection the server closed in the meantime fails before any response byte; the request then
+// goes out again on the next one.
+static int _tr50_http_open(_TR50_HTTP_READER *reader, const char *request, _TR50_HTTP_RESPONSE *response) {
+	const char *host = tr50_config_get_host(reader->client);
+	int ret;
+
+	while (1) {
+		reader->start = reader->end = 0;
+		reader->reused = (reader->socket = _tr50_http_take(reader->client, host)) != NULL;
+		if (!reader->reused && (ret = _tcp_connect(&reader->socket, host, _TR50_FILE_HTTP_PORT, 0)) != 0) {
+			reader->socket = NULL;
+			return ret;
+		}
+		if ((ret = _tcp_send(reader->socket, request, (int)strlen(request), _TR50_FILE_HTTP_TIMEOUT)) == 0 && response) {
+			ret = _tr50_http_response(reader, response);
+		}
+		if (ret == 0 || !reader->reused || reader->end > 0) {
+			return ret;
+		}
+		_tr50_http_close(reader, 0);
+	}
+}
+
+static int _tr50_file_chunk_head(char *buffer, long long offset, int size) {
+	char head[_TR50_FILE_CHUNK_HEAD];
+	int len = snprintf(head, sizeof(head), "%s%x\r\n", offset > 0 ? "\r\n" : "", size);
+
+	_memory_memcpy(buffer - len, head, len);
+	return len;
+}
+
+static int _tr50_file_send_chunk(_TR50_HTTP_READER *reader, int bytes) {
+	int len, ret;
+
+	if (reader->abort && *reader->abort) {
+		return ERR_TR50_CANCELED;
+	}
+	if ((ret = _tr50_file_throttle(reader, bytes)) != 0) {
+		return ret;
+	}
+	len = _tr50_file_chunk_head(reader->buffer + _TR50_FILE_CHUNK_HEAD, reader->wire, bytes);
+	reader->wire += bytes;
+	return _tcp_send(reader->socket, reader->buffer + _TR50_FILE_CHUNK_HEAD - len, len + bytes, _TR50_FILE_HTTP_TIMEOUT);
+}
+
+// Deflates the file through the buffer, a chunk each time it fills up. The file is read into
+// the inflated buffer, which a send has no other use for.
+static int _tr50_file_send_gzip(_TR50_HTTP_READER *reader, FILE *fp, void *deflater) {
+	const char *in = reader->inflated;
+	char *out = reader->buffer + _TR50_FILE_CHUNK_HEAD;
+	int in_len = 0, room = reader->size, eof = 0, step, ret;
+
+	while (1) {
+		if (in_len == 0 && !eof) {
+			in = reader->inflated;
+			in_len = (int)fread(reader->inflated, 1, reader->size, fp);
+			if (ferror(fp)) {
+				return ERR_TR50_FILE_PUT_HTTP;
+			}
+			eof = in_len < reader->size;
+			reader->written += in_len;
+		}
+		if ((step = _compress_gzip_step(deflater, &in, &in_len, &out, &room, eof)) < 0) {
+			return ERR_TR50_FILE_PUT_HTTP;
+		}
+		if (room == 0 || step == 1) {
+			if (room < reader->size && (ret = _tr50_file_send_chunk(reader, reader->size - room)) != 0) {
+				return ret;
+			}
+			if (step == 1) { // the stream is complete and its last chunk is out
+				return 0;
+			}
+			out = reader->buffer + _TR50_FILE_CHUNK_HEAD;
+			room = reader->size;
+		}
+	}
+}
+
+// Sends the file as chunked encoding: each chunk from the file cache with _tcp_send_file() while
+// the port and socket support it, otherwise read into the buffer behind its header and sent in
+// one _tcp_send(). With a deflater the chunks carry the file gzipped.
+static int _tr50_file_send(_TR50_HTTP_READER *reader, FILE *fp, void *deflater) {
+	void *socket = reader->socket;
+	char *buffer = reader->buffer;
+	int chunk_size = reader->size;
+	long long size;
+	int zero_copy = deflater == NULL;
+	int bytes, len, ret;
+
+	reader->written = reader->wire = 0;
+	if ((size = _tr50_file_size(fp)) < 0) {
+		zero_copy = 0;
+		size = 0;
+	}
+	if (deflater && (ret = _tr50_file_send_gzip(reader, fp, deflater)) != 0) {
+		return ret;
+	}
+	while (zero_copy && reader->wire < size) {
+		if (reader->abort && *reader->abort) {
+			return ERR_TR50_CANCELED;
+		}
+		bytes = (size - reader->wire > chunk_size) ? chunk_size : (int)(size - reader->wire);
+		if ((ret = _tr50_file_throttle(reader, bytes)) != 0) {
+			return ret;
+		}
+		len = _tr50_file_chunk_head(buffer + _TR50_FILE_CHUNK_HEAD, reader->wire, bytes);
+		if ((ret = _tcp_send(socket, buffer + _TR50_FILE_CHUNK_HEAD - len, len, _TR50_FILE_HTTP_TIMEOUT)) != 0) {
+			return ret;
+		}
+		if ((ret = _tcp_send_file(socket, fp, reader->wire, bytes, _TR50_FILE_HTTP_TIMEOUT)) == ERR_TR50_NOT_SUPPORTED) {
+			// nothing of this chunk went out, its header did: send its data from the buffer
+			zero_copy = 0;
+			if (_tr50_file_seek(fp, reader->wire) != 0 || (int)fread(buffer, 1, bytes, fp) != bytes) {
+				return ERR_TR50_FILE_PUT_HTTP;
+			}
+			ret = _tcp_send(socket, buffer, bytes, _TR50_FILE_HTTP_TIMEOUT);
+		}
+		if (ret != 0) {
+			return ret;
+		}
+		reader->wire += bytes;
+		reader->written += bytes;
+	}
+	if (!zero_copy && !deflater) {
+		while ((bytes = (int)fread(buffer + _TR50_FILE_CHUNK_HEAD, 1, chunk_size, fp)) > 0) {
+			reader->written += bytes;
+			if ((ret = _tr50_file_send_chunk(reader, bytes)) != 0) {
+				return ret;
+			}
+		}
+		if (ferror(fp)) {
+			return ERR_TR50_FILE_PUT_HTTP;
+		}
+	}
+	if (reader->wire > 0) {
+		return _tcp_send(socket, "\r\n0\r\n\r\n", 7, _TR50_FILE_HTTP_TIMEOUT);
+	}
+	return _tcp_send(socket, "0\r\n\r\n", 5, _TR50_FILE_HTTP_TIMEOUT);
+}
+
+static int _tr50_file_upload(_TR50_CLIENT *client, const char *thing_key, const char *src, const char *dest, const char *tags, char* is_public, char **error_msg, int is_global, int log_completion, volatile int *abort) {
+	void *tr50 = client;
+	char request[_TR50_FILE_REQUEST_MAX];
+	int ret;
+	void * json_reply_optional = NULL;
+	JSON *optional_params = NULL;
+	const char *file_id;
+	FILE *fi;
+	_TR50_HTTP_READER reader;
+	_TR50_HTTP_RESPONSE response;
+	void *deflater = NULL;
+	int level = client->config.file_gzip_level;
+
+	_memory_memset(&reader, 0, sizeof(reader));
+
+	if ((fi = fopen(src, "rb")) == NULL) {
+		return ERR_TR50_LOCAL_FILE_NOTFOUND;
+	}
+	if ((optional_params = tr50_json_create_object()) == NULL) {
+		fclose(fi);
+		return ERR_TR50_MALLOC;
+	}
+
+	tr50_json_add_bool_to_object(optional_params, "global", is_global);
+	tr50_json_add_bool_to_object(optional_params, "logComplete", log_completion);
+
+	if ((!is_global) && thing_key) {
+		tr50_json_add_string_to_object(optional_params, "thingKey", thing_key);
+	}
+
+	if (tags) {
+		char *token = NULL, *reent = NULL;
+		char *tags_clone = NULL;
+		JSON *tags_json = tr50_json_create_array();
+		tags_clone = _memory_clone((char*)tags, strlen(tags));
+		if (tags_clone != NULL) {
+			token = strtok_r(tags_clone, ",", &reent);
+		}
+		while (token) {
+			tr50_json_add_item_to_array(tags_json, tr50_json_create_string(token));
+			token = strtok_r(NULL, ",", &reent);
+		}
+		if (tags_clone) _memory_free(tags_clone);
+		tr50_json_add_item_to_object(optional_params, "tags", tags_json);
+	}
+	if (is_public != NULL) {
+		tr50_json_add_bool_to_object(optional_params, "public", *is_public);
+	}
+
+	if ((ret = tr50_file_put_ex(tr50, dest, optional_params, &json_reply_optional, error_msg)) != 0) {
+		goto _end_err;
+	}
+	if ((json_reply_optional == NULL || ((file_id = tr50_json_get_object_item_as_string(json_reply_optional, "fileId")) == NULL))) {
+		ret = ERR_TR50_PARMS;
+		goto _end_err;
+	}
+	reader.client = client;
+	reader.abort = abort;
+	reader.size = client->config.file_chunk_size;
+	if ((reader.buffer = _memory_malloc(_TR50_FILE_CHUNK_HEAD + reader.size)) == NULL) {
+		ret = ERR_TR50_MALLOC;
+		goto _end_err;
+	}
+	if (level > 0 && ((deflater = _tr50_file_gzip_take(client, 0, level)) == NULL || (reader.inflated = _memory_malloc(reader.size)) == NULL)) {
+		ret = ERR_TR50_MALLOC;
+		goto _end_err;
+	}
+	snprintf(request, sizeof(request), POST_COMMAND, file_id, tr50_config_get_host(tr50));
+	while ((ret = _tr50_http_open(&reader, request, NULL)) == 0) {
+		if ((ret = _tr50_file_send(&reader, fi, deflater)) == 0) {
+			ret = _tr50_http_response(&reader, &response);
+		}
+		// a kept connection the server had closed takes the body and drops it, start over on the next one
+		if (ret == 0 || ret == ERR_TR50_CANCELED || !reader.reused || reader.end > 0 || fseek(fi, 0, SEEK_SET) != 0 ||
+			(deflater && _compress_gzip_reset(deflater) != 0)) {
+			break;
+		}
+		_tr50_http_close(&reader, 0);
+	}
+	_tr50_file_count(client, 1, reader.written, reader.wire);
+	if (ret == 0) {
+		if (response.status < 200 || response.status > 299) {
+			ret = ERR_TR50_FILE_PUT_HTTP;
+		}
+		_tr50_http_close(&reader, _tr50_http_finish(&reader, &response));
+	}
+
+_end_err:
+	if (fi) fclose(fi);
+	_tr50_http_close(&reader, 0);
+	_tr50_file_gzip_release(client, deflater, 0, level);
+	if (reader.inflated) _memory_free(reader.inflated);
+	if (reader.buffer) _memory_free(reader.buffer);
+	if (json_reply_optional) tr50_json_delete(json_reply_optional);
+	return ret;
+}
+
+TR50_EXPORT int tr50_helper_file_upload(void* tr50, const char *thing_key, const char *src, const char *dest, const char *tags, char* is_public, char **error_msg, int is_global, int log_completion) {
+	return _tr50_file_upload(tr50, thing_key, src, dest, tags, is_public, error_msg, is_global, log_completion, NULL);
+}
+
+// Next segment not yet written, -1 when there is none or the download failed.
+static int _tr50_file_download_next(_TR50_FILE_DOWNLOAD *download) {
+	int segment = -1;
+
+	_tr50_mutex_lock(download->mux);
+	while (download->error == 0 && download->next < download->segments) {
+		if (!download->completed[download->next++]) {
+			segment = download->next - 1;
+			break;
+		}
+	}
+	_tr50_mutex_unlock(download->mux);
+	return segment;
+}
+
+// Fetches bytes *start to end into fp, moving *start past what was written even when it fails.
+static int _tr50_file_download_range(_TR50_FILE_DOWNLOAD *download, _TR50_HTTP_READER *reader, FILE *fp, long long *start, long long end) {
+	_TR50_HTTP_RESPONSE response;
+	char request[_TR50_FILE_REQUEST_MAX];
+	int ret, keep = 0;
+
+	snprintf(request, sizeof(request), GET_RANGE_COMMAND, download->file_id, tr50_config_get_host(download->client), *start, end);
+	reader->written = 0;
+	if ((ret = _tr50_http_open(reader, request, &response)) == 0) {
+		if (response.status != 206 || response.range_start != *start || response.range_total != download->total) {
+			ret = ERR_TR50_FILE_GET_HTTP;
+			keep = _tr50_http_finish(reader, &response);
+		} else if (_tr50_file_seek(fp, *start) != 0) {
+			ret = ERR_TR50_FILE_WRITE_FAILED;
+		} else {
+			ret = response.is_chunked ? _tr50_http_chunked_body(reader, fp) : _tr50_http_body(reader, fp, end - *start + 1);
+			keep = ret == 0 && !response.close;
+		}
+	}
+	_tr50_http_close(reader, keep);
+	*start += reader->written;
+	return ret;
+}
+
+static void *_tr50_file_download_worker(void *arg) {
+	_TR50_FILE_DOWNLOAD *download = arg;
+	_TR50_HTTP_READER reader;
+	long long start, end, before;
+	int segment, tries, ret = 0;
+	FILE *fp;
+
+	_memory_memset(&reader, 0, sizeof(reader));
+	reader.client = download->client;
+	reader.abort = download->abort;
+	reader.progress = download;
+	reader.size = download->client->config.file_chunk_size;
+	if ((reader.buffer = _memory_malloc(reader.size)) == NULL) {
+		ret = ERR_TR50_MALLOC;
+	} else if ((fp = fopen(download->dest, "r+b")) == NULL) {
+		ret = ERR_TR50_FILE_WRITE_FAILED;
+	} else {
+		setvbuf(fp, NULL, _IONBF, 0);
+		while ((segment = _tr50_file_download_next(download)) >= 0) {
+			start = (long long)segment * download->segment_size;
+			end = start + download->segment_size < download->total ? start + download->segment_size - 1 : download->total - 1;
+			for (tries = 0; tries < _TR50_FILE_SEGMENT_RETRIES; ++tries) {
+				before = start;
+				if ((ret = _tr50_file_download_range(download, &reader, fp, &start, end)) == 0 || ret == ERR_TR50_FILE_WRITE_FAILED || ret == ERR_TR50_CANCELED) {
+					break;
+				}
+				if (start > before) {
+					tries = -1; // the link dropped after some progress, carry on from there
+				} else {
+					_thread_sleep(1000 * (tries + 1));
+				}
+			}
+			if (ret != 0) {
+				break;
+			}
+			_tr50_mutex_lock(download->mux);
+			download->completed[segment] = 1;
+			fprintf(download->journal, "%d\n", segment);
+			fflush(download->journal);
+			_tr50_mutex_unlock(download->mux);
+		}
+		fclose(fp);
+	}
+	if (ret != 0) {
+		_tr50_mutex_lock(download->mux);
+		if (download->error == 0) {
+			download->error = ret;
+		}
+		_tr50_mutex_unlock(download->mux);
+	}
+	if (reader.buffer) _memory_free(reader.buffer);
+	return NULL;
+}
+
+// Opens dest and its journal, keeping the segments a previous attempt on the same file finished.
+static int _tr50_file_download_resume(_TR50_FILE_DOWNLOAD *download, const char *journal_name, const char *etag) {
+	char line[256], header[256];
+	FILE *fp;
+	int segment;
+
+	snprintf(header, sizeof(header), JOURNAL_HEADER, download->total, download->segment_size, *etag ? etag : "-");
+	if ((download->journal = fopen(journal_name, "r")) != NULL) {
+		if (fgets(line, sizeof(line), download->journal) && strcmp(line, header) == 0 && (fp = fopen(download->dest, "rb")) != NULL) {
+			fclose(fp);
+			while (fgets(line, sizeof(line), download->journal)) {
+				if ((segment = atoi(line)) >= 0 && segment < download->segments && !download->completed[segment]) {
+					download->completed[segment] = 1;
+					download->done += segment == download->segments - 1 ? download->total - (long long)segment * download->segment_size : download->segment_size;
+				}
+			}
+		}
+		fclose(download->journal);
+	}
+	if (download->done == 0) {
+		_memory_memset(download->completed, 0, download->segments);
+		if ((fp = fopen(download->dest, "wb")) == NULL) {
+			return ERR_TR50_LOCAL_FILE_NOTFOUND;
+		}
+		fclose(fp);
+		if ((download->journal = fopen(journal_name, "w")) != NULL) {
+			fputs(header, download->journal);
+		}
+	} else {
+		download->journal = fopen(journal_name, "a");
+	}
+	if (download->journal == NULL) {
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	fflush(download->journal);
+	return 0;
+}
+
+// Spreads the segments over the configured connections, the calling thread being one of them.
+static int _tr50_file_download_ranges(_TR50_FILE_DOWNLOAD *download, const char *etag) {
+	_TR50_CONFIG *config = &download->client->config;
+	char *journal_name = NULL;
+	void **threads = NULL;
+	int i, count, ret;
+
+	download->segment_size = config->file_segment_size;
+	download->segments = (int)((download->total + download->segment_size - 1) / download->segment_size);
+	if ((journal_name = _memory_malloc((int)strlen(download->dest) + 6)) == NULL ||
+		(download->completed = _memory_malloc(download->segments + 1)) == NULL) {
+		ret = ERR_TR50_MALLOC;
+		goto end_error;
+	}
+	sprintf(journal_name, "%s.part", download->dest);
+	_memory_memset(download->completed, 0, download->segments + 1);
+	if ((ret = _tr50_file_download_resume(download, journal_name, etag)) != 0) {
+		goto end_error;
+	}
+
+	for (i = 0, count = 0; i < download->segments && count < config->file_connections; ++i) {
+		count += !download->completed[i];
+	}
+	if (count > 1 && (threads = _memory_malloc(sizeof(void *) * count)) != NULL) {
+		_memory_memset(threads, 0, sizeof(void *) * count);
+		for (i = 1; i < count; ++i) {
+			_thread_create(&threads[i], "TR50:Download", _tr50_file_download_worker, download);
+		}
+	}
+	_tr50_file_download_worker(download);
+	for (i = 1; threads && i < count; ++i) {
+		if (threads[i]) {
+			_thread_join(threads[i]);
+			_thread_delete(threads[i]);
+		}
+	}
+
+	fclose(download->journal);
+	if ((ret = download->error) == 0) {
+		remove(journal_name);
+	}
+end_error:
+	if (threads) _memory_free(threads);
+	if (journal_name) _memory_free(journal_name);
+	if (download->completed) _memory_free(download->completed);
+	return ret;
+}
+
+static int _tr50_file_download(_TR50_CLIENT *client, const char *thing_key, const char *src, const char *dest, char **error_msg, int is_global, volatile int *abort) {
+	void *tr50 = client;
+	char request[_TR50_FILE_REQUEST_MAX];
+	JSON *optional_params;
+	void * json_reply_optional = NULL;
+	FILE *fp = NULL;
+	_TR50_FILE_DOWNLOAD download;
+	_TR50_HTTP_READER reader;
+	_TR50_HTTP_RESPONSE response;
+	int ranged = 0, ret = 0;
+
+	_memory_memset(&download, 0, sizeof(download));
+	_memory_memset(&reader, 0, sizeof(reader));
+
+	if ((optional_params = tr50_json_create_object()) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	tr50_json_add_string_to_object(optional_params, "fileName", src);
+	tr50_json_add_bool_to_object(optional_params, "global", is_global);
+	if ((!is_global) && thing_key) {
+		tr50_json_add_string_to_object(optional_params, "thingKey", thing_key);
+	}
+	if ((ret = tr50_file_get_ex(tr50, src, optional_params, &json_reply_optional, error_msg)) != 0) {
+		goto _end_err_get;
+	}
+	if ((json_reply_optional == NULL || ((download.file_id = tr50_json_get_object_item_as_string(json_reply_optional, "fileId")) == NULL))) {
+		ret = ERR_TR50_PARMS;
+		goto _end_err_get;
+	}
+	download.client = client;
+	download.abort = abort;
+	download.file_name = src;
+	download.dest = dest;
+	download.started = download.reported = _time_now();
+	_tr50_mutex_create(&download.mux);
+	reader.client = client;
+	reader.abort = abort;
+	reader.progress = &download;
+	reader.size = client->config.file_chunk_size;
+	if ((reader.buffer = _memory_malloc(reader.size)) == NULL) {
+		ret = ERR_TR50_MALLOC;
+		goto _end_err_get;
+	}
+
+	if (client->config.file_gunzip) {
+		// the inflater needs the body in order, so the whole file comes in one stream
+		if ((reader.inflater = _tr50_file_gzip_take(client, 1, 0)) == NULL || (reader.inflated = _memory_malloc(reader.size)) == NULL) {
+			ret = ERR_TR50_MALLOC;
+			goto _end_err_get;
+		}
+		snprintf(request, sizeof(request), GET_COMMAND, download.file_id, tr50_config_get_host(tr50));
+	} else {
+		// the first byte tells whether the server answers ranges, and the size and version of the file
+		snprintf(request, sizeof(request), GET_RANGE_COMMAND, download.file_id, tr50_config_get_host(tr50), 0LL, 0LL);
+	}
+	if ((ret = _tr50_http_open(&reader, request, &response)) != 0) {
+		ret = ERR_TR50_FILE_GET_HTTP;
+	} else if (reader.inflater == NULL && ((response.status == 206 && response.range_total > 0) || (response.status == 416 && response.range_total == 0))) {
+		_tr50_http_close(&reader, _tr50_http_finish(&reader, &response));
+		ranged = 1;
+		download.total = response.range_total;
+		if (download.total == 0) {
+			ret = (fp = fopen(dest, "wb")) == NULL ? ERR_TR50_LOCAL_FILE_NOTFOUND : 0;
+		} else if ((ret = _tr50_file_download_ranges(&download, response.etag)) != 0 && ret != ERR_TR50_FILE_WRITE_FAILED &&
+					ret != ERR_TR50_LOCAL_FILE_NOTFOUND && ret != ERR_TR50_MALLOC && ret != ERR_TR50_CANCELED) {
+			ret = ERR_TR50_FILE_GET_HTTP;
+		}
+	} else {
+		if (response.status == 206) {
+			// ranges of a file of unknown size, ask for all of it
+			_tr50_http_close(&reader, _tr50_http_finish(&reader, &response));
+			snprintf(request, sizeof(request), GET_COMMAND, download.file_id, tr50_config_get_host(tr50));
+			ret = _tr50_http_open(&reader, request, &response);
+		}
+		if (ret != 0 || response.status != 200) {
+			ret = ERR_TR50_FILE_GET_HTTP;
+			goto _end_err_get;
+		}
+		// no ranges, the whole file follows on this connection
+		download.total = response.content_length;
+		if ((fp = fopen(dest, "wb")) == NULL) {
+			ret = ERR_TR50_LOCAL_FILE_NOTFOUND;
+			goto _end_err_get;
+		}
+		// writes are as large as the reads, stdio buffering would only copy them once more
+		setvbuf(fp, NULL, _IONBF, 0);
+		if (response.is_gzip) {
+			reader.gunzip = _TR50_GUNZIP_ON;
+		} else if (client->config.file_gunzip == TR50_FILE_GUNZIP_SNIFF) {
+			reader.gunzip = _TR50_GUNZIP_DETECT;
+		}
+		ret = response.is_chunked ? _tr50_http_chunked_body(&reader, fp) : _tr50_http_body(&reader, fp, response.content_length);
+		if (ret == 0) {
+			ret = _tr50_file_write_end(&reader, fp);
+		}
+		if (ret == 0) {
+			_tr50_http_close(&reader, !response.close && (response.is_chunked || response.content_length >= 0));
+		} else if (ret != ERR_TR50_FILE_WRITE_FAILED && ret != ERR_TR50_CANCELED) {
+			ret = ERR_TR50_FILE_GET_HTTP;
+		}
+	}
+	_tr50_file_count(client, 0, download.received, ranged ? download.received : reader.wire);
+_end_err_get:
+	if (fp) fclose(fp);
+	_tr50_http_close(&reader, 0);
+	_tr50_file_gzip_release(client, reader.inflater, 1, 0);
+	if (reader.inflated) _memory_free(reader.inflated);
+	if (reader.buffer) _memory_free(reader.buffer);
+	if (download.mux) _tr50_mutex_delete(download.mux);
+	if (json_reply_optional) tr50_json_delete(json_reply_optional);
+	return ret;
+}
+
+TR50_EXPORT int tr50_file_download(void* tr50, const char *thing_key, const char *src, const char *dest, char **error_msg, int is_global) {
+	return _tr50_file_download(tr50, thing_key, src, dest, error_msg, is_global, NULL);
+}
+
+static void _tr50_file_task_delete(_TR50_FILE_TASK *task) {
+	if (task->thing_key) _memory_free(task->thing_key);
+	if (task->src) _memory_free(task->src);
+	if (task->dest) _memory_free(task->dest);
+	if (task->tags) _memory_free(task->tags);
+	_memory_free(task);
+}
+
+static void *_tr50_file_worker(void *arg) {
+	_TR50_CLIENT *client = arg;
+	_TR50_FILES *files = &client->files;
+	_TR50_FILE_TASK *task, **link;
+	char *error_msg;
+	int ret;
+
+	while (1) {
+		_tr50_mutex_lock(files->mux);
+		if (files->stopping) {
+			_tr50_mutex_unlock(files->mux);
+			break;
+		}
+		if ((task = files->queue) == NULL) {
+			_tr50_event_reset(files->evt);
+			_tr50_mutex_unlock(files->mux);
+			_tr50_event_wait_timeout(files->evt, 1000);
+			continue;
+		}
+		files->queue = task->next;
+		--files->queued;
+		task->next = files->running;
+		files->running = task;
+		++files->running_count;
+		_tr50_mutex_unlock(files->mux);
+
+		error_msg = NULL;
+		if (task->is_upload) {
+			ret = _tr50_file_upload(client, task->thing_key, task->src, task->dest, task->tags, task->has_public ? &task->is_public : NULL,
+				&error_msg, task->is_global, task->log_completion, &task->abort);
+		} else {
+			ret = _tr50_file_download(client, task->thing_key, task->src, task->dest, &error_msg, task->is_global, &task->abort);
+		}
+
+		_tr50_mutex_lock(files->mux);
+		for (link = &files->running; *link != task; link = &(*link)->next)
+			; /* Nothing. */
+		*link = task->next;
+		--files->running_count;
+		if (ret == ERR_TR50_CANCELED && files->stopping) {
+			ret = ERR_TR50_STOPPED;
+		}
+		_tr50_mutex_unlock(files->mux);
+
+		if (task->callback) {
+			task->callback(client, task->id, ret, error_msg, task->custom);
+		}
+		if (error_msg) _memory_free(error_msg);
+		_tr50_file_task_delete(task);
+	}
+	return NULL;
+}
+
+static int _tr50_file_submit(_TR50_CLIENT *client, _TR50_FILE_TASK *task, int *id) {
+	_TR50_FILES *files = &client->files;
+	_TR50_FILE_TASK **link;
+	int ret = 0;
+
+	_tr50_mutex_lock(files->mux);
+	if (files->stopping) {
+		ret = ERR_TR50_STOPPED;
+	} else if (files->queued >= client->config.file_queue_max + client->config.file_workers - files->running_count) {
+		ret = ERR_TR50_WOULD_BLOCK;
+	} else {
+		while (files->thread_count < client->config.file_workers && files->thread_count < files->running_count + files->queued + 1) {
+			if (_thread_create(&files->threads[files->thread_count], "TR50:File", _tr50_file_worker, client) != 0) {
+				break;
+			}
+			++files->thread_count;
+		}
+		if (files->thread_count == 0) {
+			ret = ERR_TR50_MALLOC;
+		}
+	}
+	if (ret != 0) {
+		_tr50_mutex_unlock(files->mux);
+		_tr50_file_task_delete(task);
+		return ret;
+	}
+	task->id = ++files->next_id;
+	for (link = &files->queue; *link != NULL && (*link)->priority >= task->priority; link = &(*link)->next)
+		; /* Nothing. */
+	task->next = *link;
+	*link = task;
+	++files->queued;
+	if (id) {
+		*id = task->id;
+	}
+	_tr50_event_signal(files->evt);
+	_tr50_mutex_unlock(files->mux);
+	return 0;
+}
+
+static _TR50_FILE_TASK *_tr50_file_task_create(const char *thing_key, const char *src, const char *dest, tr50_file_transfer_callback callback, void *custom) {
+	_TR50_FILE_TASK *task;
+
+	if ((task = _memory_malloc(sizeof(_TR50_FILE_TASK))) == NULL) {
+		return NULL;
+	}
+	_memory_memset(task, 0, sizeof(_TR50_FILE_TASK));
+	task->callback = callback;
+	task->custom = custom;
+	if ((thing_key && (task->thing_key = _memory_clone((void *)thing_key, (int)strlen(thing_key))) == NULL) ||
+		(task->src = _memory_clone((void *)src, (int)strlen(src))) == NULL ||
+		(task->dest = _memory_clone((void *)dest, (int)strlen(dest))) == NULL) {
+		_tr50_file_task_delete(task);
+		return NULL;
+	}
+	return task;
+}
+
+TR50_EXPORT int tr50_file_upload_async(void* tr50, const char *thing_key, const char *src, const char *dest, const char *tags, char* is_public, int is_global, int log_completion, int priority, int *id, tr50_file_transfer_callback callback, void *custom) {
+	_TR50_FILE_TASK *task;
+
+	if (tr50 == NULL || src == NULL || dest == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((task = _tr50_file_task_create(thing_key, src, dest, callback, custom)) == NULL ||
+		(tags && (task->tags = _memory_clone((void *)tags, (int)strlen(tags))) == NULL)) {
+		if (task) _tr50_file_task_delete(task);
+		return ERR_TR50_MALLOC;
+	}
+	task->is_upload = 1;
+	task->priority = priority;
+	task->is_global = is_global;
+	task->log_completion = log_completion;
+	if (is_public) {
+		task->has_public = 1;
+		task->is_public = *is_public;
+	}
+	return _tr50_file_submit(tr50, task, id);
+}
+
+TR50_EXPORT int tr50_file_download_async(void* tr50, const char *thing_key, const char *src, const char *dest, int is_global, int priority, int *id, tr50_file_transfer_callback callback, void *custom) {
+	_TR50_FILE_TASK *task;
+
+	if (tr50 == NULL || src == NULL || dest == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((task = _tr50_file_task_create(thing_key, src, dest, callback, custom)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	task->priority = priority;
+	task->is_global = is_global;
+	return _tr50_file_submit(tr50, task, id);
+}
+
+TR50_EXPORT int tr50_file_transfer_cancel(void *tr50, int id) {
+	_TR50_FILES *files = &((_TR50_CLIENT *)tr50)->files;
+	_TR50_FILE_TASK *task, **link;
+
+	_tr50_mutex_lock(files->mux);
+	for (link = &files->queue; (task = *link) != NULL && task->id != id; link = &task->next)
+		; /* Nothing. */
+	if (task != NULL) {
+		*link = task->next;
+		--files->queued;
+	} else {
+		for (task = files->running; task != NULL && task->id != id; task = task->next)
+			; /* Nothing. */
+		if (task != NULL) {
+			task->abort = 1;
+		}
+		_tr50_mutex_unlock(files->mux);
+		return task != NULL ? 0 : ERR_TR50_PARMS;
+	}
+	_tr50_mutex_unlock(files->mux);
+
+	if (task->callback) {
+		task->callback(tr50, task->id, ERR_TR50_CANCELED, NULL, task->custom);
+	}
+	_tr50_file_task_delete(task);
+	return 0;
+}
+
+TR50_EXPORT int tr50_file_transfer_count(void *tr50) {
+	_TR50_FILES *files = &((_TR50_CLIENT *)tr50)->files;
+	int count;
+
+	_tr50_mutex_lock(files->mux);
+	count = files->queued + files->running_count;
+	_tr50_mutex_unlock(files->mux);
+	return count;
+}
+
+TR50_EXPORT int tr50_file_stats(void *tr50, TR50_FILE_STATS *stats) {
+	_TR50_FILES *files;
+
+	if (tr50 == NULL || stats == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	files = &((_TR50_CLIENT *)tr50)->files;
+	_tr50_mutex_lock(files->mux);
+	*stats = files->stats;
+	_tr50_mutex_unlock(files->mux);
+	return 0;
+}
+
+void _tr50_file_create(_TR50_CLIENT *client) {
+	_TR50_FILES *files = &client->files;
+
+	_memory_memset(files, 0, sizeof(_TR50_FILES));
+	_tr50_mutex_create(&files->mux);
+	_tr50_event_create(&files->evt);
+}
+
+void _tr50_file_delete(_TR50_CLIENT *client) {
+	_TR50_FILES *files = &client->files;
+	_TR50_FILE_TASK *task, *queue;
+	_TR50_HTTP_IDLE *idle;
+	int i;
+
+	_tr50_mutex_lock(files->mux);
+	files->stopping = 1;
+	for (task = files->running; task != NULL; task = task->next) {
+		task->abort = 1;
+	}
+	queue = files->queue;
+	files->queue = NULL;
+	files->queued = 0;
+	_tr50_event_signal(files->evt);
+	_tr50_mutex_unlock(files->mux);
+
+	for (i = 0; i < files->thread_count; ++i) {
+		_thread_join(files->threads[i]);
+		_thread_delete(files->threads[i]);
+	}
+	while ((task = queue) != NULL) {
+		queue = task->next;
+		if (task->callback) {
+			task->callback(client, task->id, ERR_TR50_STOPPED, NULL, task->custom);
+		}
+		_tr50_file_task_delete(task);
+	}
+	while ((idle = files->idle) != NULL) {
+		files->idle = idle->next;
+		_tcp_disconnect(idle->socket);
+		_memory_free(idle);
+	}
+	while (files->deflater_count > 0) {
+		_compress_gzip_delete(files->deflaters[--files->deflater_count]);
+	}
+	while (files->inflater_count > 0) {
+		_compress_gzip_delete(files->inflaters[--files->inflater_count]);
+	}
+	_tr50_event_delete(files->evt);
+	_tr50_mutex_delete(files->mux);
+}
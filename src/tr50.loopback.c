@@ -0,0 +1,546 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+#include <tr50/internal/tr50.h>
+#include <tr50/mqtt/mqtt.h>
+
+#include <tr50/util/event.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/platform.h>
+#include <tr50/util/tcp.h>
+
+// In-process transport: each connection is a pair of byte queues, and the client's side of
+// the stream is parsed on the sending thread by a minimal broker that acks CONNECT,
+// SUBSCRIBE, UNSUBSCRIBE, PINGREQ and QoS 1 PUBLISH, and hands every PUBLISH to the
+// loopback's publish handler. Nothing crosses the kernel.
+#define TR50_LOOPBACK_BUFFER_SIZE		4096
+#define TR50_LOOPBACK_TOPIC_MAX			256
+
+typedef struct _TR50_LOOPBACK_SESSION {
+	struct _TR50_LOOPBACK *loopback;
+	char	name[TR50_LOOPBACK_TOPIC_MAX + 1];	// CONNECT username, or client id without one
+
+	// broker -> client
+	void *	inbox_mux;
+	void *	inbox_evt;
+	char *	inbox;
+	int		inbox_pos;
+	int		inbox_len;
+	int		inbox_size;
+	int		is_closed;
+
+	// client -> broker, up to one partial packet
+	void *	outbox_mux;
+	char *	outbox;
+	int		outbox_len;
+	int		outbox_size;
+
+	struct _TR50_LOOPBACK_SESSION *next;
+} _TR50_LOOPBACK_SESSION;
+
+typedef struct _TR50_LOOPBACK {
+	TR50_TRANSPORT transport;
+
+	void *	mux;
+	_TR50_LOOPBACK_SESSION *sessions;
+
+	tr50_loopback_publish_callback publish_callback;
+	void *	publish_custom;
+} _TR50_LOOPBACK;
+
+static int _tr50_loopback_reserve(char **buffer, int *size, int needed) {
+	char *grown;
+	int new_size = *size ? *size : TR50_LOOPBACK_BUFFER_SIZE;
+
+	if (needed <= *size) {
+		return 0;
+	}
+	while (new_size < needed) {
+		new_size *= 2;
+	}
+	if ((grown = (char *)_memory_realloc(*buffer, new_size)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	*buffer = grown;
+	*size = new_size;
+	return 0;
+}
+
+// Queues bytes for the client to read.
+static int _tr50_loopback_deliver(_TR50_LOOPBACK_SESSION *session, const char **bufs, const int *lens, int count) {
+	int i, total = 0, ret;
+
+	for (i = 0; i < count; ++i) {
+		total += lens[i];
+	}
+	_tr50_mutex_lock(session->inbox_mux);
+	if (session->is_closed) {
+		_tr50_mutex_unlock(session->inbox_mux);
+		return ERR_TR50_SOCK_SHUTDOWN;
+	}
+	if (session->inbox_pos > 0) { // compact what was already read
+		memmove(session->inbox, session->inbox + session->inbox_pos, session->inbox_len - session->inbox_pos);
+		session->inbox_len -= session->inbox_pos;
+		session->inbox_pos = 0;
+	}
+	if ((ret = _tr50_loopback_reserve(&session->inbox, &session->inbox_size, session->inbox_len + total)) != 0) {
+		_tr50_mutex_unlock(session->inbox_mux);
+		return ret;
+	}
+	for (i = 0; i < count; ++i) {
+		_memory_memcpy(session->inbox + session->inbox_len, (void *)bufs[i], lens[i]);
+		session->inbox_len += lens[i];
+	}
+	_tr50_mutex_unlock(session->inbox_mux);
+	_tr50_event_signal(session->inbox_evt);
+	return 0;
+}
+
+static int _tr50_loopback_deliver_one(_TR50_LOOPBACK_SESSION *session, const char *buf, int len) {
+	return _tr50_loopback_deliver(session, &buf, &len, 1);
+}
+
+static int _tr50_loopback_handle_publish(_TR50_LOOPBACK_SESSION *session, const char *packet, int header_len, int len) {
+	_TR50_LOOPBACK *loopback = session->loopback;
+	char topic[TR50_LOOPBACK_TOPIC_MAX + 1];
+	char puback[4];
+	const char *ptr = packet + header_len;
+	unsigned short topic_len, msg_id;
+	int qos = (packet[0] & MQTT_OPT_QOS_1) ? 1 : 0;
+	int payload_len;
+
+	if (header_len + 2 > len) {
+		log_important_info("_tr50_loopback_handle_publish(): dropping publish of [%d] bytes", len);
+		return 0;
+	}
+	_memory_memcpy(&topic_len, (void *)ptr, 2);
+	topic_len = swap16(topic_len);
+	ptr += 2;
+	if (topic_len > TR50_LOOPBACK_TOPIC_MAX || header_len + 2 + topic_len + qos * 2 > len) {
+		log_important_info("_tr50_loopback_handle_publish(): dropping publish, topic length [%d]", topic_len);
+		return 0;
+	}
+	_memory_memcpy(topic, (void *)ptr, topic_len);
+	topic[topic_len] = 0;
+	ptr += topic_len;
+
+	if (qos) {
+		_memory_memcpy(&msg_id, (void *)ptr, 2);
+		ptr += 2;
+		puback[0] = (char)MQTT_MSG_TYPE_PUBACK;
+		puback[1] = 2;
+		_memory_memcpy(puback + 2, &msg_id, 2); // still in network order
+		_tr50_loopback_deliver_one(session, puback, 4);
+	}
+
+	payload_len = len - (int)(ptr - packet);
+	if (loopback->publish_callback) {
+		loopback->publish_callback(loopback, session, topic, ptr, payload_len, loopback->publish_custom);
+	}
+	return 0;
+}
+
+// Reads one length-prefixed CONNECT payload field, returning its end or -1.
+static int _tr50_loopback_connect_field(const char *packet, int pos, int len, const char **value, int *value_len) {
+	unsigned short field_len;
+
+	if (pos + 2 > len) {
+		return -1;
+	}
+	_memory_memcpy(&field_len, (void *)(packet + pos), 2);
+	field_len = swap16(field_len);
+	if (pos + 2 + field_len > len) {
+		return -1;
+	}
+	*value = packet + pos + 2;
+	*value_len = field_len;
+	return pos + 2 + field_len;
+}
+
+static void _tr50_loopback_handle_connect(_TR50_LOOPBACK_SESSION *session, const char *packet, int header_len, int len) {
+	const char *value, *name = NULL;
+	int pos, flags, value_len, name_len = 0;
+
+	// protocol name, level, flags, keepalive
+	if ((pos = _tr50_loopback_connect_field(packet, header_len, len, &value, &value_len)) < 0 || pos + 4 > len) {
+		return;
+	}
+	flags = (unsigned char)packet[pos + 1];
+	pos += 4;
+	if ((pos = _tr50_loopback_connect_field(packet, pos, len, &name, &name_len)) < 0) {
+		return;
+	}
+	if (flags & MQTT_CONN_OPT_WILL) {
+		if ((pos = _tr50_loopback_connect_field(packet, pos, len, &value, &value_len)) < 0 || (pos = _tr50_loopback_connect_field(packet, pos, len, &value, &value_len)) < 0) {
+			return;
+		}
+	}
+	if ((flags & MQTT_CONN_OPT_USERNAME) && _tr50_loopback_connect_field(packet, pos, len, &value, &value_len) >= 0) {
+		name = value;
+		name_len = value_len;
+	}
+	if (name_len > TR50_LOOPBACK_TOPIC_MAX) {
+		name_len = TR50_LOOPBACK_TOPIC_MAX;
+	}
+	_memory_memcpy(session->name, (void *)name, name_len);
+	session->name[name_len] = 0;
+}
+
+static int _tr50_loopback_handle_packet(_TR50_LOOPBACK_SESSION *session, const char *packet, int header_len, int len) {
+	static const char connack[] = { (char)MQTT_MSG_TYPE_CONNACK, 0x02, 0x00, 0x00 };
+	static const char pingresp[] = { (char)MQTT_MSG_TYPE_PINGRESP, 0x00 };
+	char ack[TR50_LOOPBACK_TOPIC_MAX + 4];
+	int pos, granted;
+	unsigned short topic_len;
+
+	switch (packet[0] & MQTT_GET_MSG_TYPE) {
+	case MQTT_MSG_TYPE_CONNECT:
+		_tr50_loopback_handle_connect(session, packet, header_len, len);
+		return _tr50_loopback_deliver_one(session, connack, sizeof(connack));
+	case MQTT_MSG_TYPE_PUBLISH:
+		return _tr50_loopback_handle_publish(session, packet, header_len, len);
+	case MQTT_MSG_TYPE_SUBSCRIBE:
+		if (header_len + 2 > len) { // no message id
+			return 0;
+		}
+		// grant every requested filter at the requested qos
+		ack[0] = (char)MQTT_MSG_TYPE_SUBACK;
+		ack[2] = packet[header_len];
+		ack[3] = packet[header_len + 1];
+		granted = 0;
+		for (pos = header_len + 2; pos + 2 < len && granted < TR50_LOOPBACK_TOPIC_MAX; ++granted) {
+			_memory_memcpy(&topic_len, (void *)(packet + pos), 2);
+			pos += 2 + swap16(topic_len);
+			ack[4 + granted] = pos < len ? packet[pos] : 0;
+			++pos;
+		}
+		ack[1] = (char)(2 + granted);
+		return _tr50_loopback_deliver_one(session, ack, 4 + granted);
+	case MQTT_MSG_TYPE_UNSUBSCRIBE:
+		if (header_len + 2 > len) {
+			return 0;
+		}
+		ack[0] = (char)MQTT_MSG_TYPE_UNSUBACK;
+		ack[1] = 2;
+		ack[2] = packet[header_len];
+		ack[3] = packet[header_len + 1];
+		return _tr50_loopback_deliver_one(session, ack, 4);
+	case MQTT_MSG_TYPE_PINGREQ:
+		return _tr50_loopback_deliver_one(session, pingresp, sizeof(pingresp));
+	}
+	return 0; // DISCONNECT and acks for our qos 0 publishes need no answer
+}
+
+// Runs every complete packet in the outbox through the broker. Called with outbox_mux held.
+static void _tr50_loopback_process(_TR50_LOOPBACK_SESSION *session) {
+	int pos = 0, header_len, remaining, multiplier;
+	unsigned char byte;
+
+	for (;;) {
+		remaining = 0;
+		multiplier = 1;
+		for (header_len = 1; pos + header_len < session->outbox_len; ++header_len) {
+			byte = (unsigned char)session->outbox[pos + header_len];
+			remaining += (byte & 0x7f) * multiplier;
+			multiplier *= 128;
+			if ((byte & 0x80) == 0 || header_len == 4) {
+				break;
+			}
+		}
+		if (pos + header_len >= session->outbox_len) {
+			break;
+		}
+		++header_len;
+		if (pos + header_len + remaining > session->outbox_len) {
+			break;
+		}
+		_tr50_loopback_handle_packet(session, session->outbox + pos, header_len, header_len + remaining);
+		pos += header_len + remaining;
+	}
+	if (pos > 0) {
+		memmove(session->outbox, session->outbox + pos, session->outbox_len - pos);
+		session->outbox_len -= pos;
+	}
+}
+
+static int _tr50_loopback_writev(void *sock, const char **bufs, const int *lens, int count, int timeout) {
+	_TR50_LOOPBACK_SESSION *session = (_TR50_LOOPBACK_SESSION *)sock;
+	int i, total = 0, ret;
+
+	if (session == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	for (i = 0; i < count; ++i) {
+		total += lens[i];
+	}
+	_tr50_mutex_lock(session->outbox_mux);
+	if ((ret = _tr50_loopback_reserve(&session->outbox, &session->outbox_size, session->outbox_len + total)) != 0) {
+		_tr50_mutex_unlock(session->outbox_mux);
+		return ret;
+	}
+	for (i = 0; i < count; ++i) {
+		_memory_memcpy(session->outbox + session->outbox_len, (void *)bufs[i], lens[i]);
+		session->outbox_len += lens[i];
+	}
+	_tr50_loopback_process(session);
+	_tr50_mutex_unlock(session->outbox_mux);
+	return 0;
+}
+
+static int _tr50_loopback_send(void *sock, const char *buf, int len, int timeout) {
+	return _tr50_loopback_writev(sock, &buf, &len, 1, timeout);
+}
+
+static int _tr50_loopback_recv(void *sock, char *buf, int *len, int timeout) {
+	_TR50_LOOPBACK_SESSION *session = (_TR50_LOOPBACK_SESSION *)sock;
+	int available, ret;
+
+	if (session == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	for (;;) {
+		_tr50_mutex_lock(session->inbox_mux);
+		if ((available = session->inbox_len - session->inbox_pos) > 0) {
+			if (available > *len) {
+				available = *len;
+			}
+			_memory_memcpy(buf, session->inbox + session->inbox_pos, available);
+			session->inbox_pos += available;
+			if (session->inbox_pos == session->inbox_len) {
+				session->inbox_pos = 0;
+				session->inbox_len = 0;
+			}
+			_tr50_mutex_unlock(session->inbox_mux);
+			*len = available;
+			return 0;
+		}
+		if (session->is_closed) {
+			_tr50_mutex_unlock(session->inbox_mux);
+			*len = 0;
+			return ERR_TR50_SOCK_SHUTDOWN;
+		}
+		_tr50_event_reset(session->inbox_evt);
+		_tr50_mutex_unlock(session->inbox_mux);
+
+		if (timeout > 0) {
+			if ((ret = _tr50_event_wait_timeout(session->inbox_evt, timeout)) == ERR_TR50_TIMEOUT) {
+				*len = 0;
+				return ERR_TR50_SOCK_TIMEOUT;
+			}
+		} else {
+			ret = _tr50_event_wait(session->inbox_evt);
+		}
+		if (ret != 0) {
+			return ret;
+		}
+	}
+}
+
+static int _tr50_loopback_connect(void *custom, void **sock, const char *host, long port, int options) {
+	_TR50_LOOPBACK *loopback = (_TR50_LOOPBACK *)custom;
+	_TR50_LOOPBACK_SESSION *session;
+
+	if ((session = (_TR50_LOOPBACK_SESSION *)_memory_malloc(sizeof(_TR50_LOOPBACK_SESSION))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(session, 0, sizeof(_TR50_LOOPBACK_SESSION));
+	session->loopback = loopback;
+	_tr50_mutex_create(&session->inbox_mux);
+	_tr50_mutex_create(&session->outbox_mux);
+	_tr50_event_create(&session->inbox_evt);
+
+	_tr50_mutex_lock(loopback->mux);
+	session->next = loopback->sessions;
+	loopback->sessions = session;
+	_tr50_mutex_unlock(loopback->mux);
+
+	*sock = session;
+	return 0;
+}
+
+static int _tr50_loopback_disconnect(void *sock) {
+	_TR50_LOOPBACK_SESSION *session = (_TR50_LOOPBACK_SESSION *)sock;
+	_TR50_LOOPBACK *loopback;
+	_TR50_LOOPBACK_SESSION **ptr;
+
+	if (session == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	loopback = session->loopback;
+
+	_tr50_mutex_lock(loopback->mux);
+	for (ptr = &loopback->sessions; *ptr; ptr = &(*ptr)->next) {
+		if (*ptr == session) {
+			*ptr = session->next;
+			break;
+		}
+	}
+	_tr50_mutex_unlock(loopback->mux);
+
+	_tr50_mutex_delete(session->inbox_mux);
+	_tr50_mutex_delete(session->outbox_mux);
+	_tr50_event_delete(session->inbox_evt);
+	if (session->inbox) {
+		_memory_free(session->inbox);
+	}
+	if (session->outbox) {
+		_memory_free(session->outbox);
+	}
+	_memory_free(session);
+	return 0;
+}
+
+int tr50_loopback_create(void **loopback_handle) {
+	_TR50_LOOPBACK *loopback;
+
+	if (loopback_handle == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((loopback = (_TR50_LOOPBACK *)_memory_malloc(sizeof(_TR50_LOOPBACK))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(loopback, 0, sizeof(_TR50_LOOPBACK));
+	loopback->transport.name = "loopback";
+	loopback->transport.connect = _tr50_loopback_connect;
+	loopback->transport.disconnect = _tr50_loopback_disconnect;
+	loopback->transport.send = _tr50_loopback_send;
+	loopback->transport.recv = _tr50_loopback_recv;
+	loopback->transport.writev = _tr50_loopback_writev;
+	loopback->transport.readiness_fd = NULL;
+	loopback->transport.custom = loopback;
+	_tr50_mutex_create(&loopback->mux);
+	*loopback_handle = loopback;
+	return 0;
+}
+
+const TR50_TRANSPORT *tr50_loopback_transport(void *loopback_handle) {
+	_TR50_LOOPBACK *loopback = (_TR50_LOOPBACK *)loopback_handle;
+	return loopback ? &loopback->transport : NULL;
+}
+
+int tr50_loopback_set_publish_handler(void *loopback_handle, tr50_loopback_publish_callback callback, void *custom) {
+	_TR50_LOOPBACK *loopback = (_TR50_LOOPBACK *)loopback_handle;
+
+	if (loopback == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(loopback->mux);
+	loopback->publish_callback = callback;
+	loopback->publish_custom = custom;
+	_tr50_mutex_unlock(loopback->mux);
+	return 0;
+}
+
+const char *tr50_loopback_session_name(void *session_handle) {
+	_TR50_LOOPBACK_SESSION *session = (_TR50_LOOPBACK_SESSION *)session_handle;
+	return session ? session->name : NULL;
+}
+
+// Publishes to one session, to the sessions with the given name, or to all of them.
+static int _tr50_loopback_publish_to(_TR50_LOOPBACK *loopback, void *session_handle, const char *name, const char *topic, const char *data, int len) {
+	_TR50_LOOPBACK_SESSION *session;
+	char header[MQTT_PUBLISH_HEADER_MAX];
+	const char *bufs[2];
+	int lens[2];
+	int ret, found = 0;
+
+	if (loopback == NULL || topic == NULL || (data == NULL && len > 0)) {
+		return ERR_TR50_PARMS;
+	}
+	if ((ret = _mqtt_msg_build_publish_header(topic, 0, 0, 0, len, header, sizeof(header), &lens[0])) != 0) {
+		return ret;
+	}
+	bufs[0] = header;
+	bufs[1] = data;
+	lens[1] = len;
+
+	// sessions are only freed under this mutex, so a stale handle is detected instead of used
+	_tr50_mutex_lock(loopback->mux);
+	for (session = loopback->sessions; session; session = session->next) {
+		if ((session_handle == NULL || session == session_handle) && (name == NULL || strcmp(session->name, name) == 0)) {
+			ret = _tr50_loopback_deliver(session, bufs, lens, 2);
+			++found;
+		}
+	}
+	_tr50_mutex_unlock(loopback->mux);
+	return found ? ret : ERR_TR50_NOT_CONNECTED;
+}
+
+int tr50_loopback_publish(void *loopback_handle, void *session_handle, const char *topic, const char *data, int len) {
+	return _tr50_loopback_publish_to((_TR50_LOOPBACK *)loopback_handle, session_handle, NULL, topic, data, len);
+}
+
+int _tr50_loopback_publish_named(void *loopback_handle, const char *name, const char *topic, const char *data, int len) {
+	return _tr50_loopback_publish_to((_TR50_LOOPBACK *)loopback_handle, NULL, name, topic, data, len);
+}
+
+int _tr50_loopback_has_sessions(void *loopback_handle) {
+	_TR50_LOOPBACK *loopback = (_TR50_LOOPBACK *)loopback_handle;
+	int ret;
+
+	_tr50_mutex_lock(loopback->mux);
+	ret = loopback->sessions != NULL;
+	_tr50_mutex_unlock(loopback->mux);
+	return ret;
+}
+
+int tr50_loopback_close(void *loopback_handle, void *session_handle) {
+	_TR50_LOOPBACK *loopback = (_TR50_LOOPBACK *)loopback_handle;
+	_TR50_LOOPBACK_SESSION *session;
+
+	if (loopback == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(loopback->mux);
+	for (session = loopback->sessions; session; session = session->next) {
+		if (session_handle == NULL || session == session_handle) {
+			_tr50_mutex_lock(session->inbox_mux);
+			session->is_closed = 1;
+			_tr50_mutex_unlock(session->inbox_mux);
+			_tr50_event_signal(session->inbox_evt);
+		}
+	}
+	_tr50_mutex_unlock(loopback->mux);
+	return 0;
+}
+
+int tr50_loopback_delete(void *loopback_handle) {
+	_TR50_LOOPBACK *loopback = (_TR50_LOOPBACK *)loopback_handle;
+
+	if (loopback == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if (loopback->sessions) {
+		return ERR_TR50_CONNECTED;
+	}
+	_tr50_mutex_delete(loopback->mux);
+	_memory_free(loopback);
+	return 0;
+}
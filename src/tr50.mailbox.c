@@ -23,9 +23,13 @@
  */
 
 #include <tr50/internal/tr50.h>
+#include <stdio.h>
 #include <string.h>
+#include <tr50/util/atomic.h>
+#include <tr50/util/executor.h>
 #include <tr50/util/log.h>
 #include <tr50/util/json.h>
+#include <tr50/util/memory.h>
 #include <tr50/util/mutex.h>
 
 int tr50_mailbox_suspend(void *tr50) {
@@ -43,10 +47,146 @@ int tr50_mailbox_resume(void *tr50, int check_immediately) {
 	return 0;
 }
 
+// Acks and updates answer items already taken off the mailbox, so they are not held back by the
+// in-flight caps; they may be sent from the receive thread, which must not wait for credit.
+static int _tr50_mailbox_send(_TR50_CLIENT *client, void *message) {
+	int ret;
+
+	if ((ret = _tr50_api_call_async_ex(client, message, NULL, NULL, NULL, 30000, FALSE)) != 0) {
+		tr50_message_delete(message);
+	}
+	return ret;
+}
+
+// Sends a mailbox.ack or mailbox.update, taking params. While checked items are being handled it
+// joins the batch instead, which goes out when it is full or when the last item is done.
+int _tr50_mailbox_reply(_TR50_CLIENT *client, const char *command, JSON *params) {
+	void *message = NULL;
+	char cmd_id[16];
+	int ret;
+
+	if (client->config.mailbox_ack_batch <= 1) {
+		if ((ret = tr50_message_create(&message)) != 0) {
+			tr50_json_delete(params);
+			return ret;
+		}
+		tr50_message_add_command(message, "1", command, params);
+		return _tr50_mailbox_send(client, message);
+	}
+
+	_tr50_mutex_lock(client->mailbox_ack_mux);
+	if (client->mailbox_acks == NULL && (ret = tr50_message_create(&client->mailbox_acks)) != 0) {
+		_tr50_mutex_unlock(client->mailbox_ack_mux);
+		tr50_json_delete(params);
+		return ret;
+	}
+	snprintf(cmd_id, sizeof(cmd_id), "%d", ++client->mailbox_ack_count);
+	tr50_message_add_command(client->mailbox_acks, cmd_id, command, params);
+	if (client->mailbox_ack_count >= client->config.mailbox_ack_batch || _atomic_load32(&client->mailbox_dispatching) == 0) {
+		message = client->mailbox_acks;
+		client->mailbox_acks = NULL;
+		client->mailbox_ack_count = 0;
+	}
+	_tr50_mutex_unlock(client->mailbox_ack_mux);
+
+	return message ? _tr50_mailbox_send(client, message) : 0;
+}
+
+int _tr50_mailbox_flush(_TR50_CLIENT *client) {
+	void *message;
+
+	_tr50_mutex_lock(client->mailbox_ack_mux);
+	message = client->mailbox_acks;
+	client->mailbox_acks = NULL;
+	client->mailbox_ack_count = 0;
+	_tr50_mutex_unlock(client->mailbox_ack_mux);
+
+	return message ? _tr50_mailbox_send(client, message) : 0;
+}
+
+// The last item of the checked pages flushes the acks its handlers left in the batch.
+static void _tr50_mailbox_dispatched(_TR50_CLIENT *client) {
+	if (_atomic_add32(&client->mailbox_dispatching, -1) == 1) {
+		_tr50_mailbox_flush(client);
+	}
+}
+
+static void _tr50_mailbox_dispatch(void *tr50, JSON *item, void *custom) {
+	const char *id = tr50_json_get_object_item_as_string(item, "id");
+	const char *thing_key = tr50_json_get_object_item_as_string(item, "thingKey");
+	const char *command = tr50_json_get_object_item_as_string(item, "command");
+	const char *from = tr50_json_get_object_item_as_string(item, "from");
+	JSON *params = tr50_json_get_object_item(item, "params");
+	if (!id || !thing_key || !command) {
+		return;
+	}
+	if (strcmp(command, "method.exec") == 0) {
+		const char* method = tr50_json_get_object_item_as_string(params, "method");
+		JSON * method_params = tr50_json_get_object_item(params, "params");
+		tr50_method_process(tr50, id, thing_key, method, from, method_params, custom);
+	}
+	tr50_command_process(tr50, id, thing_key, command, from, params,custom);
+}
+
+typedef struct {
+	_EXECUTOR_TASK	task;
+	void *			tr50;
+	JSON *			item;
+	void *			custom;
+} _TR50_MAILBOX_TASK;
+
+static void _tr50_mailbox_task_run(_EXECUTOR_TASK *task) {
+	_TR50_MAILBOX_TASK *mailbox = (_TR50_MAILBOX_TASK *)task;
+
+	_tr50_mailbox_dispatch(mailbox->tr50, mailbox->item, mailbox->custom);
+	_tr50_mailbox_dispatched((_TR50_CLIENT *)mailbox->tr50);
+	tr50_json_delete(mailbox->item);
+	_memory_free(mailbox);
+}
+
+// With an executor each item becomes its own task, keyed by its thingKey or by the check.
+static int _tr50_mailbox_submit(_TR50_CLIENT *client, JSON *methods, int seq_id, void *custom) {
+	_TR50_MAILBOX_TASK *mailbox;
+	const char *thing_key;
+	unsigned int key = 0;
+
+	if ((mailbox = (_TR50_MAILBOX_TASK *)_memory_malloc(sizeof(_TR50_MAILBOX_TASK))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	mailbox->task.run = _tr50_mailbox_task_run;
+	mailbox->tr50 = client;
+	mailbox->item = tr50_json_detach_item_from_array(methods, 0);
+	mailbox->custom = custom;
+	if (client->executor_order == TR50_EXECUTOR_ORDER_THING) {
+		thing_key = tr50_json_get_object_item_as_string(mailbox->item, "thingKey");
+		key = _tr50_order_key(thing_key ? thing_key : "", thing_key ? (int)strlen(thing_key) : 0);
+	} else if (client->executor_order == TR50_EXECUTOR_ORDER_SEQ_ID) {
+		key = (unsigned int)seq_id;
+	}
+	return _executor_submit(client->executor, key, &mailbox->task);
+}
+
+// Ends the check in flight. Another one starts when again is set or a notification came in
+// meanwhile.
+static void _tr50_mailbox_check_next(_TR50_CLIENT *client, int again) {
+	_tr50_mutex_lock(client->mailbox_check_mux);
+	client->mailbox_send_in_progress = FALSE;
+	if (again || (client->mailbox_another_request == TRUE)) {
+		log_debug("_tr50_mailbox_check_callback(): another mailbox check being done.");
+		client->mailbox_another_request = FALSE;
+		_tr50_mutex_unlock(client->mailbox_check_mux);
+		tr50_mailbox_check(client);
+	}
+	else  {
+		_tr50_mutex_unlock(client->mailbox_check_mux);
+	}
+}
+
 void _tr50_mailbox_check_callback(void *tr50, int status, const void *request_message, void *message,void* custom) {
 	JSON *methods, *params;
-	int count = 0, i = 0;
+	int count = 0, i = 0, page_size, pipelined = FALSE;
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	void *executor = client->executor;
 
 	if (status != 0) {
 		log_debug("_tr50_mailbox_check_callback(): failed with status[%d]", status);
@@ -62,44 +202,42 @@ void _tr50_mailbox_check_callback(void *tr50, int status, const void *request_me
 	}
 
 	count = tr50_json_get_array_size(methods);
+
+	_atomic_add32(&client->mailbox_dispatching, count);
+
+	// a full page leaves more behind: have the next page on its way while this one is handled
+	page_size = client->config.mailbox_page_size;
+	if (page_size > 0 && count >= page_size) {
+		pipelined = TRUE;
+		_tr50_mailbox_check_next(client, TRUE);
+	}
+
 	for (i = 0; i < count; ++i) {
-		JSON *item = tr50_json_get_array_item(methods, i);
-		const char *id = tr50_json_get_object_item_as_string(item, "id");
-		const char *thing_key = tr50_json_get_object_item_as_string(item, "thingKey");
-		const char *command = tr50_json_get_object_item_as_string(item, "command");
-		const char *from = tr50_json_get_object_item_as_string(item, "from");
-		JSON *params = tr50_json_get_object_item(item, "params");
-		if (!id || !thing_key || !command) {
-			continue;
-		}
-		if (strcmp(command, "method.exec") == 0) {
-			const char* method = tr50_json_get_object_item_as_string(params, "method");
-			JSON * method_params = tr50_json_get_object_item(params, "params");
-			tr50_method_process(tr50, id, thing_key, method, from, method_params, custom);
+		if (executor == NULL) {
+			_tr50_mailbox_dispatch(tr50, tr50_json_get_array_item(methods, i), custom);
+			_tr50_mailbox_dispatched(client);
+		} else if (_tr50_mailbox_submit(client, methods, ((_TR50_MESSAGE *)request_message)->seq_id, custom) != 0) {
+			// out of memory, the item is still first: run it here
+			_tr50_mailbox_dispatch(tr50, tr50_json_get_array_item(methods, 0), custom);
+			_tr50_mailbox_dispatched(client);
+			tr50_json_delete(tr50_json_detach_item_from_array(methods, 0));
 		}
-		tr50_command_process(tr50, id, thing_key, command, from, params,custom);
 	}
 	
 	tr50_message_delete(message);
-		
-check_for_another_mail_item:
-	_tr50_mutex_lock(client->mailbox_check_mux);
-	client->mailbox_send_in_progress = FALSE;
-	if ((count > 0) || (client->mailbox_another_request == TRUE)) {
-		log_debug("_tr50_mailbox_check_callback(): another mailbox check being done.");
-		client->mailbox_another_request = FALSE;
-		_tr50_mutex_unlock(client->mailbox_check_mux);
-		tr50_mailbox_check(tr50);
-	}
-	else  {
-		_tr50_mutex_unlock(client->mailbox_check_mux);
+	if (pipelined) {
+		return;
 	}
-	
+
+check_for_another_mail_item:
+	// a short page drained the mailbox; an unlimited one is checked again until it comes back empty
+	_tr50_mailbox_check_next(client, count > 0 && client->config.mailbox_page_size <= 0);
 }
 
 int tr50_mailbox_check(void *tr50) {
 	int ret, id;
 	void *request;
+	JSON *params = NULL;
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 
 	if (((_TR50_CLIENT *)tr50)->mailbox_suspend) return ERR_TR50_MAILBOX_SUSPENDED;
@@ -122,9 +260,14 @@ int tr50_mailbox_check(void *tr50) {
 		goto end_error;
 	}
 
-	tr50_message_add_command(request, "1", "mailbox.check", NULL);
+	if (client->config.mailbox_page_size > 0) {
+		params = tr50_json_create_object();
+		tr50_json_add_number_to_object(params, "limit", client->config.mailbox_page_size);
+	}
+	tr50_message_add_command(request, "1", "mailbox.check", params);
 
-	if ((ret = tr50_api_call_async(tr50, request, &id, _tr50_mailbox_check_callback, tr50, 30000)) != 0) {
+	// one check at a time, so it is not held back by the in-flight caps
+	if ((ret = _tr50_api_call_async_ex(tr50, request, &id, _tr50_mailbox_check_callback, tr50, 30000, FALSE)) != 0) {
 		log_debug("_tr50_mailbox_check_callback(): tr50_api_call_async failed [%d]", ret);
 		tr50_message_delete(request);
 		goto end_error;
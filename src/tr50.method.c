@@ -31,55 +31,64 @@
 #include <tr50/util/memory.h>
 #include <tr50/util/time.h>
 
-int method_registration_inuse = FALSE;
-int tr50_is_method_registered() {
-	return method_registration_inuse;
+// method.exec goes to the method handlers once this client has any, else to a command handler.
+int tr50_is_method_registered(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	return _tr50_registry_count(&client->methods) > 0;
 }
+
 int tr50_method_register(void *tr50, const char *method_name, tr50_method_callback func) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	_TR50_METHOD *method = (_TR50_METHOD*)_memory_malloc(sizeof(_TR50_METHOD));
-	_memory_memset(method, 0, sizeof(_TR50_METHOD));
-	method_registration_inuse = TRUE;
-	method->callback = func;
-	strncpy(method->name, method_name, TR50_METHOD_NAME_LEN);
-	method->next = client->method_head;
-	client->method_head = method;
-	log_important_info("tr50_method_register(): method[%s] registered.", method->name);
+	int ret;
+
+	if ((ret = _tr50_registry_set(&client->methods, method_name, (void *)func)) != 0) {
+		return ret;
+	}
+	log_important_info("tr50_method_register(): method[%s] registered.", method_name);
+	return 0;
+}
+
+int tr50_method_unregister(void *tr50, const char *method_name) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+
+	if (method_name == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if (!_tr50_registry_remove(&client->methods, method_name)) {
+		return ERR_TR50_METHOD_UNKNOWN;
+	}
+	log_important_info("tr50_method_unregister(): method[%s] unregistered.", method_name);
 	return 0;
 }
- 
 
 int tr50_method_process(void *tr50, const char *id, const char *key, const char *method_name, const char *from, JSON *params, void* custom) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 	int ret;
-	_TR50_METHOD *method = client->method_head;
-	if (!method_registration_inuse) return 0;
+	tr50_method_callback callback;
+
+	if (!tr50_is_method_registered(tr50)) return 0;
 	if (!method_name) {
 		return ERR_TR50_METHOD_UNKNOWN;
 	}
 
-	while (method) {
-		if (strcmp(method->name, method_name) == 0) {
-			long long ended, started;
-			log_debug("tr50_method_process(): executing method[%s] ...", method->name);
-			started = _time_now();
-			if ((ret = method->callback(tr50, id, key, method_name, from, params, NULL)) != 0) {
-				log_important_info("tr50_method_process(): cmd[%s] failed [%d]", method_name, ret);
-			}
-			ended = _time_now();
-			if (ended - started > 1000) {
-				log_need_investigation("tr50_method_process(): method callback for [%s] is taking [%d]ms.", method->name, ended - started);
-			}
-			return ret;
+	if ((callback = (tr50_method_callback)_tr50_registry_find(&client->methods, method_name)) != NULL) {
+		long long ended, started;
+		log_debug("tr50_method_process(): executing method[%s] ...", method_name);
+		started = _time_now();
+		if ((ret = callback(tr50, id, key, method_name, from, params, NULL)) != 0) {
+			log_important_info("tr50_method_process(): cmd[%s] failed [%d]", method_name, ret);
 		}
-		method = (_TR50_METHOD *)method->next;
+		ended = _time_now();
+		if (ended - started > 1000) {
+			log_need_investigation("tr50_method_process(): method callback for [%s] is taking [%d]ms.", method_name, (int)(ended - started));
+		}
+		return ret;
 	}
 	log_need_investigation("tr50_method_process(): unknown method[%s] recv'ed", method_name);
 	tr50_method_ack(tr50, id, ERR_TR50_METHOD_UNKNOWN, "Unknown method", NULL);
 	return ERR_TR50_METHOD_UNKNOWN;
 } 
 int tr50_method_update(void *tr50, const char *id, const char *msg) {
-	void *message;
 	JSON *params = tr50_json_create_object();
 
 	tr50_json_add_string_to_object(params, "id", id);
@@ -87,17 +96,11 @@ int tr50_method_update(void *tr50, const char *id, const char *msg) {
 		tr50_json_add_string_to_object(params, "msg", msg);
 	}
 
-	tr50_message_create(&message);
-	tr50_message_add_command(message,"1","mailbox.update", params);
-	if (tr50_api_call(tr50, message) != 0) {
-		tr50_message_delete(message);
-	}
+	_tr50_mailbox_reply((_TR50_CLIENT *)tr50, "mailbox.update", params);
 	return 0;
 }
 
 int tr50_method_ack(void *tr50, const char *id, int status, const char *err_message, JSON *ack_params) {
-	int ret;
-	void *message;
 	JSON *params = tr50_json_create_object();
 
 	tr50_json_add_string_to_object(params, "id", id);
@@ -112,10 +115,5 @@ int tr50_method_ack(void *tr50, const char *id, int status, const char *err_mess
 		tr50_json_add_item_to_object(params, "params", ack_params);
 	}
 
-	tr50_message_create(&message);
-	tr50_message_add_command(message,"1","mailbox.ack", params);
-	if ((ret = tr50_api_call(tr50, message)) != 0) {
-		tr50_message_delete(message);
-	}
-	return ret;
+	return _tr50_mailbox_reply((_TR50_CLIENT *)tr50, "mailbox.ack", params);
 }
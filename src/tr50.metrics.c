@@ -0,0 +1,437 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+
+#include <tr50/internal/tr50.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/blob.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/tcp.h>
+#include <tr50/util/thread.h>
+
+#define TR50_METRICS_RENDER_SIZE			16384
+#define TR50_METRICS_ACCEPT_TIMEOUT			500
+#define TR50_METRICS_REQUEST_TIMEOUT		2000
+#define TR50_METRICS_REQUEST_MAX			1024
+#define TR50_METRICS_SLEEP_SLICE			250
+#define TR50_METRICS_CONTENT_TYPE			"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+// Fixed exposition buckets in ms; the histograms keep finer buckets internally.
+static const long long _tr50_metrics_latency_bounds[] = { 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000 };
+#define TR50_METRICS_LATENCY_BOUNDS			(int)(sizeof(_tr50_metrics_latency_bounds) / sizeof(_tr50_metrics_latency_bounds[0]))
+
+static const char *_tr50_metrics_rate_windows[] = { "1m", "5m", "15m" };
+
+void _tr50_metrics_create(_TR50_CLIENT *client) {
+	_tr50_mutex_create(&client->metrics.mux);
+}
+
+void _tr50_metrics_delete(_TR50_CLIENT *client) {
+	tr50_metrics_stop(client);
+	_tr50_mutex_delete(client->metrics.mux);
+}
+
+static int _tr50_metrics_append(void *blob, const char *format, ...) {
+	char buffer[512];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if (len < 0) {
+		return ERR_TR50_PARMS;
+	}
+	if (len >= (int)sizeof(buffer)) {
+		len = sizeof(buffer) - 1;
+	}
+	return _blob_append(blob, buffer, len);
+}
+
+// Label values escape backslash, double quote and line feed.
+static void _tr50_metrics_label(char *out, int out_len, const char *value) {
+	int i = 0;
+
+	for (; value && *value && i < out_len - 2; ++value) {
+		if (*value == '\\' || *value == '"') {
+			out[i++] = '\\';
+			out[i++] = *value;
+		} else if (*value == '\n') {
+			out[i++] = '\\';
+			out[i++] = 'n';
+		} else {
+			out[i++] = *value;
+		}
+	}
+	out[i] = 0;
+}
+
+static void _tr50_metrics_family(void *blob, const char *name, const char *type, const char *help) {
+	_tr50_metrics_append(blob, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void _tr50_metrics_counter(void *blob, const char *name, const char *help, long long value) {
+	_tr50_metrics_family(blob, name, "counter", help);
+	_tr50_metrics_append(blob, "%s_total %lld\n", name, value);
+}
+
+static void _tr50_metrics_gauge(void *blob, const char *name, const char *help, long long value) {
+	_tr50_metrics_family(blob, name, "gauge", help);
+	_tr50_metrics_append(blob, "%s %lld\n", name, value);
+}
+
+static void _tr50_metrics_rates(void *blob, const char *name, const char *help, const double *rates) {
+	int i;
+
+	_tr50_metrics_family(blob, name, "gauge", help);
+	for (i = 0; i < 3; ++i) {
+		_tr50_metrics_append(blob, "%s{window=\"%s\"} %.3f\n", name, _tr50_metrics_rate_windows[i], rates[i]);
+	}
+}
+
+// label is either empty or a complete `name="value"` pair.
+static void _tr50_metrics_histogram(void *blob, const char *name, const char *label, _HISTOGRAM *histogram) {
+	long long counts[TR50_METRICS_LATENCY_BOUNDS];
+	long long count, sum;
+	int i;
+
+	_histogram_cumulative(histogram, _tr50_metrics_latency_bounds, counts, TR50_METRICS_LATENCY_BOUNDS, &count, &sum);
+	for (i = 0; i < TR50_METRICS_LATENCY_BOUNDS; ++i) {
+		_tr50_metrics_append(blob, "%s_bucket{%s%sle=\"%g\"} %lld\n", name, label, *label ? "," : "", _tr50_metrics_latency_bounds[i] / 1000.0, counts[i]);
+	}
+	_tr50_metrics_append(blob, "%s_bucket{%s%sle=\"+Inf\"} %lld\n", name, label, *label ? "," : "", count);
+	_tr50_metrics_append(blob, "%s_count%s%s%s %lld\n", name, *label ? "{" : "", label, *label ? "}" : "", count);
+	_tr50_metrics_append(blob, "%s_sum%s%s%s %.3f\n", name, *label ? "{" : "", label, *label ? "}" : "", sum / 1000.0);
+}
+
+// The work is bounded by the number of metric families, command slots and histogram buckets,
+// never by how much traffic the client has seen.
+static int _tr50_metrics_render(_TR50_CLIENT *client, void *blob) {
+	TR50_STATS_SNAPSHOT snapshot;
+	TR50_EXECUTOR_STATS executor;
+	TR50_FILE_STATS files;
+	_TR50_STATS_LATENCY_SLOT *slot;
+	char value[TR50_COMMAND_NAME_LEN * 2 + 16];
+	char label[sizeof(value) + 16];
+	int status, ret, i;
+
+	if ((ret = tr50_stats_snapshot(client, &snapshot)) != 0) {
+		return ret;
+	}
+	status = tr50_current_status(client);
+
+	_tr50_metrics_label(value, sizeof(value), client->config.client_id);
+	_tr50_metrics_family(blob, "tr50_client", "info", "Client identity.");
+	_tr50_metrics_append(blob, "tr50_client_info{client_id=\"%s\"} 1\n", value);
+
+	_tr50_metrics_gauge(blob, "tr50_connected", "1 while the MQTT session is up.", status == TR50_STATUS_CONNECTED);
+	_tr50_metrics_gauge(blob, "tr50_status", "Client status, one of TR50_STATUS_*.", status);
+	_tr50_metrics_gauge(blob, "tr50_last_connected_timestamp_seconds", "Time of the last successful connect.", snapshot.connected_timestamp / 1000);
+	_tr50_metrics_counter(blob, "tr50_connects", "Successful connects.", snapshot.connected_count);
+	_tr50_metrics_counter(blob, "tr50_reconnect_attempts", "Reconnect attempts.", snapshot.reconnect_attempt_count);
+	_tr50_metrics_counter(blob, "tr50_reconnects", "Successful reconnects.", snapshot.reconnect_count);
+	_tr50_metrics_gauge(blob, "tr50_last_error", "Last error code, 0 when cleared.", snapshot.last_error);
+
+	_tr50_metrics_counter(blob, "tr50_publish_sent", "TR50 publishes sent.", snapshot.pub_sent);
+	_tr50_metrics_counter(blob, "tr50_publish_received", "TR50 publishes received.", snapshot.pub_recv);
+	_tr50_metrics_counter(blob, "tr50_publish_sent_bytes", "TR50 payload bytes sent.", snapshot.pub_byte_sent);
+	_tr50_metrics_counter(blob, "tr50_publish_received_bytes", "TR50 payload bytes received.", snapshot.pub_byte_recv);
+	_tr50_metrics_counter(blob, "tr50_transport_sent_bytes", "Bytes written to the connection.", snapshot.byte_sent);
+	_tr50_metrics_counter(blob, "tr50_transport_received_bytes", "Bytes read from the connection.", snapshot.byte_recv);
+	_tr50_metrics_rates(blob, "tr50_publish_rate", "Publishes per second, moving average.", snapshot.msg_rate);
+	_tr50_metrics_rates(blob, "tr50_publish_bytes_rate", "Payload bytes per second, moving average.", snapshot.byte_rate);
+	_tr50_metrics_counter(blob, "tr50_notifications", "Mailbox notifications received.", snapshot.notify_count);
+	_tr50_metrics_counter(blob, "tr50_mailbox_checks", "Mailbox checks sent.", snapshot.mailbox_check_count);
+
+	_tr50_metrics_gauge(blob, "tr50_pending_requests", "Requests waiting for a reply.", snapshot.pending_count);
+	_tr50_metrics_counter(blob, "tr50_pending_expired", "Requests that timed out waiting for a reply.", snapshot.pending_expired_count);
+	_tr50_metrics_gauge(blob, "tr50_pending_bytes", "Serialized bytes of the requests waiting for a reply.", snapshot.pending_bytes);
+	_tr50_metrics_counter(blob, "tr50_pending_refused", "Submits refused by the in-flight caps.", snapshot.pending_refused_count);
+	_tr50_metrics_gauge(blob, "tr50_qos_inflight", "QoS 1 messages waiting for an ack.", snapshot.qos_inflight);
+	_tr50_metrics_counter(blob, "tr50_qos_expired", "Times an ack did not arrive in time.", snapshot.qos_expired_count);
+
+	_tr50_metrics_gauge(blob, "tr50_compression_ratio_percent", "Space saved by compression over the recent history.", snapshot.compress_ratio);
+	_tr50_metrics_gauge(blob, "tr50_compression_state", "Codec negotiation state, one of TR50_COMPRESS_STATE_*.", snapshot.compress_state);
+
+	if (tr50_executor_stats(client, &executor) == 0 && executor.threads > 0) {
+		_tr50_metrics_gauge(blob, "tr50_executor_threads", "Callback executor threads.", executor.threads);
+		_tr50_metrics_gauge(blob, "tr50_executor_queued", "Callbacks waiting for an executor thread.", executor.queued);
+		_tr50_metrics_counter(blob, "tr50_executor_tasks", "Callbacks run by the executor.", executor.executed);
+		_tr50_metrics_counter(blob, "tr50_executor_blocked", "Submits that waited for room in a full queue.", executor.blocked);
+		_tr50_metrics_family(blob, "tr50_executor_lag_seconds", "summary", "Time a callback waited in the queue before it ran.");
+		_tr50_metrics_append(blob, "# UNIT tr50_executor_lag_seconds seconds\n");
+		_tr50_metrics_append(blob, "tr50_executor_lag_seconds{quantile=\"0.5\"} %.6f\n", executor.lag_p50_us / 1000000.0);
+		_tr50_metrics_append(blob, "tr50_executor_lag_seconds{quantile=\"0.99\"} %.6f\n", executor.lag_p99_us / 1000000.0);
+		_tr50_metrics_append(blob, "tr50_executor_lag_seconds{quantile=\"1\"} %.6f\n", executor.lag_max_us / 1000000.0);
+		_tr50_metrics_append(blob, "tr50_executor_lag_seconds_count %lld\n", executor.executed);
+	}
+
+	if (tr50_file_stats(client, &files) == 0 && files.uploads + files.downloads > 0) {
+		_tr50_metrics_counter(blob, "tr50_file_uploads", "File uploads finished or failed.", files.uploads);
+		_tr50_metrics_counter(blob, "tr50_file_upload_bytes", "File bytes read for uploads.", files.upload_bytes);
+		_tr50_metrics_counter(blob, "tr50_file_upload_wire_bytes", "Upload body bytes sent, after gzip.", files.upload_wire_bytes);
+		_tr50_metrics_counter(blob, "tr50_file_downloads", "File downloads finished or failed.", files.downloads);
+		_tr50_metrics_counter(blob, "tr50_file_download_bytes", "File bytes written by downloads.", files.download_bytes);
+		_tr50_metrics_counter(blob, "tr50_file_download_wire_bytes", "Download body bytes received, before gunzip.", files.download_wire_bytes);
+	}
+
+	if (client->stats.latency) {
+		_tr50_metrics_family(blob, "tr50_request_duration_seconds", "histogram", "Request to reply round trip.");
+		_tr50_metrics_append(blob, "# UNIT tr50_request_duration_seconds seconds\n");
+		_tr50_metrics_histogram(blob, "tr50_request_duration_seconds", "", client->stats.latency);
+
+		_tr50_metrics_family(blob, "tr50_command_duration_seconds", "histogram", "Round trip of requests carrying the command.");
+		_tr50_metrics_append(blob, "# UNIT tr50_command_duration_seconds seconds\n");
+		for (i = 0; i < _TR50_STATS_LATENCY_COMMANDS_MAX; ++i) {
+			slot = &client->stats.latency_commands[i];
+			if (_atomic_load32(&slot->state) != _TR50_STATS_LATENCY_SLOT_READY || slot->histogram == NULL) {
+				continue;
+			}
+			_tr50_metrics_label(value, sizeof(value), slot->command);
+			snprintf(label, sizeof(label), "command=\"%s\"", value);
+			_tr50_metrics_histogram(blob, "tr50_command_duration_seconds", label, slot->histogram);
+		}
+	}
+	return _tr50_metrics_append(blob, "# EOF\n");
+}
+
+int tr50_metrics_render(void *tr50, char **text, int *text_len) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	void *blob;
+	int ret;
+
+	if (client == NULL || text == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((ret = _blob_create(&blob, TR50_METRICS_RENDER_SIZE)) != 0) {
+		return ret;
+	}
+	if ((ret = _tr50_metrics_render(client, blob)) != 0) {
+		_blob_delete(blob);
+		return ret;
+	}
+	*text = _blob_get_buffer(blob);
+	if (text_len) {
+		*text_len = _blob_get_length(blob);
+	}
+	_blob_delete_object(blob);
+	return 0;
+}
+
+static void _tr50_metrics_http_reply(_TR50_CLIENT *client, void *sock) {
+	char request[TR50_METRICS_REQUEST_MAX + 1];
+	char header[256];
+	int len = 0, recv_len, header_len, ret;
+	char *text = NULL;
+	int text_len = 0;
+
+	while (len < TR50_METRICS_REQUEST_MAX) {
+		recv_len = TR50_METRICS_REQUEST_MAX - len;
+		if (_tcp_recv(sock, request + len, &recv_len, TR50_METRICS_REQUEST_TIMEOUT) != 0) {
+			return;
+		}
+		len += recv_len;
+		request[len] = 0;
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+			break;
+		}
+	}
+	request[len] = 0;
+
+	if (strncmp(request, "GET /metrics", 12) == 0 && (request[12] == ' ' || request[12] == '?')) {
+		if ((ret = tr50_metrics_render(client, &text, &text_len)) != 0) {
+			header_len = snprintf(header, sizeof(header), "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+			_tcp_send(sock, header, header_len, TR50_METRICS_REQUEST_TIMEOUT);
+			return;
+		}
+		header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", TR50_METRICS_CONTENT_TYPE, text_len);
+		if (_tcp_send(sock, header, header_len, TR50_METRICS_REQUEST_TIMEOUT) == 0) {
+			_tcp_send(sock, text, text_len, TR50_METRICS_REQUEST_TIMEOUT);
+		}
+		_memory_free(text);
+	} else {
+		header_len = snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+		_tcp_send(sock, header, header_len, TR50_METRICS_REQUEST_TIMEOUT);
+	}
+}
+
+static void *_tr50_metrics_http_handler(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_METRICS *metrics = &client->metrics;
+	void *sock;
+	int ret;
+
+	while (!metrics->is_stopping) {
+		if ((ret = _tcp_accept(metrics->http_sock, &sock, TR50_METRICS_ACCEPT_TIMEOUT)) != 0) {
+			if (ret != ERR_TR50_SOCK_TIMEOUT) {
+				log_recurring(LOG_TYPE_IMPORTANT_INFO, __FILE__, __LINE__, 60, 1, "_tr50_metrics_http_handler(): accept failed [%d]", ret);
+				_thread_sleep(TR50_METRICS_ACCEPT_TIMEOUT);
+			}
+			continue;
+		}
+		_tr50_metrics_http_reply(client, sock);
+		_tcp_disconnect(sock);
+	}
+	return NULL;
+}
+
+// Written to a temporary file first so scrapers never see a partial exposition.
+static int _tr50_metrics_write(_TR50_CLIENT *client, const char *path) {
+	char tmp_path[512];
+	char *text;
+	int text_len, ret;
+	FILE *fp;
+
+	if ((ret = tr50_metrics_render(client, &text, &text_len)) != 0) {
+		return ret;
+	}
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if ((fp = fopen(tmp_path, "wb")) == NULL) {
+		_memory_free(text);
+		return ERR_TR50_FILE_WRITE_FAILED;
+	}
+	ret = (int)fwrite(text, 1, text_len, fp) == text_len ? 0 : ERR_TR50_FILE_WRITE_FAILED;
+	fclose(fp);
+	_memory_free(text);
+	if (ret == 0) {
+#if defined(_WIN32)
+		remove(path);
+#endif
+		if (rename(tmp_path, path) != 0) {
+			ret = ERR_TR50_FILE_WRITE_FAILED;
+		}
+	}
+	if (ret != 0) {
+		remove(tmp_path);
+	}
+	return ret;
+}
+
+static void *_tr50_metrics_file_handler(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_METRICS *metrics = &client->metrics;
+	int slept, ret;
+
+	while (!metrics->is_stopping) {
+		if ((ret = _tr50_metrics_write(client, metrics->file_path)) != 0) {
+			log_recurring(LOG_TYPE_IMPORTANT_INFO, __FILE__, __LINE__, 60, 1, "_tr50_metrics_file_handler(): write [%s] failed [%d]", metrics->file_path, ret);
+		}
+		for (slept = 0; slept < metrics->file_interval_in_ms && !metrics->is_stopping; slept += TR50_METRICS_SLEEP_SLICE) {
+			_thread_sleep(TR50_METRICS_SLEEP_SLICE);
+		}
+	}
+	return NULL;
+}
+
+int tr50_metrics_serve(void *tr50, int port) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_METRICS *metrics;
+	int ret;
+
+	if (client == NULL || port <= 0 || port > 65535) {
+		return ERR_TR50_PARMS;
+	}
+	metrics = &client->metrics;
+	_tr50_mutex_lock(metrics->mux);
+	if (metrics->http_thread) {
+		_tr50_mutex_unlock(metrics->mux);
+		return ERR_TR50_ALREADY_STARTED;
+	}
+	if ((ret = _tcp_listen(&metrics->http_sock, port)) != 0) {
+		log_important_info("tr50_metrics_serve(): listen on [%d] failed [%d]", port, ret);
+		metrics->http_sock = NULL;
+		_tr50_mutex_unlock(metrics->mux);
+		return ret;
+	}
+	metrics->is_stopping = 0;
+	_thread_create(&metrics->http_thread, "TR50:Metrics", _tr50_metrics_http_handler, client);
+	_tr50_mutex_unlock(metrics->mux);
+	return 0;
+}
+
+int tr50_metrics_write_file(void *tr50, const char *path, int interval_in_ms) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_METRICS *metrics;
+
+	if (client == NULL || path == NULL || interval_in_ms <= 0) {
+		return ERR_TR50_PARMS;
+	}
+	metrics = &client->metrics;
+	_tr50_mutex_lock(metrics->mux);
+	if (metrics->file_thread) {
+		_tr50_mutex_unlock(metrics->mux);
+		return ERR_TR50_ALREADY_STARTED;
+	}
+	if ((metrics->file_path = _memory_clone((void *)path, strlen(path) + 1)) == NULL) {
+		_tr50_mutex_unlock(metrics->mux);
+		return ERR_TR50_MALLOC;
+	}
+	metrics->file_interval_in_ms = interval_in_ms;
+	metrics->is_stopping = 0;
+	_thread_create(&metrics->file_thread, "TR50:MetricsFile", _tr50_metrics_file_handler, client);
+	_tr50_mutex_unlock(metrics->mux);
+	return 0;
+}
+
+// Stops both the listener and the file writer.
+int tr50_metrics_stop(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_METRICS *metrics;
+
+	if (client == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	metrics = &client->metrics;
+	_tr50_mutex_lock(metrics->mux);
+	metrics->is_stopping = 1;
+	if (metrics->http_thread) {
+		_thread_join(metrics->http_thread);
+		_thread_delete(metrics->http_thread);
+		metrics->http_thread = NULL;
+	}
+	if (metrics->http_sock) {
+		_tcp_disconnect(metrics->http_sock);
+		metrics->http_sock = NULL;
+	}
+	if (metrics->file_thread) {
+		_thread_join(metrics->file_thread);
+		_thread_delete(metrics->file_thread);
+		metrics->file_thread = NULL;
+	}
+	if (metrics->file_path) {
+		_memory_free(metrics->file_path);
+		metrics->file_path = NULL;
+	}
+	metrics->is_stopping = 0;
+	_tr50_mutex_unlock(metrics->mux);
+	return 0;
+}
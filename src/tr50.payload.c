@@ -42,17 +42,23 @@ int tr50_message_to_string(const char *topic, void *tr50_message, char **data, i
 }
 
 int tr50_message_from_string(const char *payload, int payload_len, void **tr50_message) {
-	JSON *body, *json;
-	const char *command;
-	_TR50_MESSAGE *message;
-	int ret = 0;
+	JSON *json;
 
 	if (!(json = tr50_json_parse(payload))) {
 		return ERR_TR50_JSON_INVALID;
 	}
+	return _tr50_message_from_json(json, tr50_message);
+}
+
+// Takes ownership of json.
+int _tr50_message_from_json(JSON *json, void **tr50_message) {
+	JSON *body;
+	const char *command;
+	_TR50_MESSAGE *message;
+	int ret = 0;
 
 	if ((body = tr50_json_get_array_item(json, 0)) == NULL) {
-		log_need_investigation("invalid tr50 json: %s", payload);
+		log_need_investigation("invalid tr50 json: no command item");
 	}
 	ret = tr50_message_create((void *)&message);
 	tr50_json_delete(message->json);
@@ -26,6 +26,7 @@
 
 #include <tr50/internal/tr50.h>
 
+#include <tr50/util/event.h>
 #include <tr50/util/log.h>
 #include <tr50/util/mutex.h>
 #include <tr50/util/thread.h>
@@ -43,6 +44,7 @@ void *_tr50_pending_expiration_handler(void *client);
 int tr50_pending_create(_TR50_CLIENT *client) {
 	_TR50_PENDING *pending = &client->pending;
 	_tr50_mutex_create(&pending->mux);
+	_tr50_event_create(&pending->credit_evt);
 	_thread_create(&pending->thread, "TR50:Pending", _tr50_pending_expiration_handler, client);
 	return 0;
 }
@@ -52,15 +54,86 @@ int tr50_pending_delete(_TR50_CLIENT *client) {
 	pending->is_deleting = 1;
 	_thread_join(pending->thread);
 	_thread_delete(pending->thread);
+	_tr50_event_delete(pending->credit_evt);
 	_tr50_mutex_delete(pending->mux);
 	return 0;
 }
 
+// Caller holds pending->mux.
+static int _tr50_pending_has_credit(_TR50_CLIENT *client) {
+	_TR50_PENDING *pending = &client->pending;
+	_TR50_CONFIG *config = &client->config;
+
+	return (config->inflight_max_requests == 0 || pending->count < config->inflight_max_requests) &&
+		(config->inflight_max_bytes == 0 || pending->bytes < config->inflight_max_bytes);
+}
+
+// Caller holds pending->mux; returns whether producers are to be told there is credit again.
+static int _tr50_pending_credit_returned(_TR50_CLIENT *client) {
+	_TR50_PENDING *pending = &client->pending;
+
+	if (pending->refused && _tr50_pending_has_credit(client)) {
+		pending->refused = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static void _tr50_pending_writable(_TR50_CLIENT *client) {
+	_tr50_event_signal(client->pending.credit_evt);
+	if (client->config.writable_handler) {
+		client->config.writable_handler(client, client->config.writable_handler_custom);
+	}
+}
+
+void _tr50_pending_notify(_TR50_CLIENT *client) {
+	_TR50_PENDING *pending = &client->pending;
+	int writable;
+
+	_tr50_mutex_lock(pending->mux);
+	writable = _tr50_pending_credit_returned(client);
+	_tr50_mutex_unlock(pending->mux);
+	if (writable) {
+		_tr50_pending_writable(client);
+	}
+}
+
+int _tr50_pending_admit(_TR50_CLIENT *client) {
+	_TR50_PENDING *pending = &client->pending;
+	int ret = 0;
+
+	_tr50_mutex_lock(pending->mux);
+	if (!_tr50_pending_has_credit(client)) {
+		pending->refused = 1;
+		++pending->refused_count;
+		ret = ERR_TR50_WOULD_BLOCK;
+	}
+	_tr50_mutex_unlock(pending->mux);
+	return ret;
+}
+
+// Waits until a request could be admitted; another producer may still take the credit first.
+int _tr50_pending_wait_credit(_TR50_CLIENT *client, int timeout) {
+	_TR50_PENDING *pending = &client->pending;
+
+	_tr50_mutex_lock(pending->mux);
+	if (_tr50_pending_has_credit(client)) {
+		_tr50_mutex_unlock(pending->mux);
+		return 0;
+	}
+	pending->refused = 1;
+	_tr50_event_reset(pending->credit_evt);
+	_tr50_mutex_unlock(pending->mux);
+	return _tr50_event_wait_timeout(pending->credit_evt, timeout);
+}
+
 int tr50_pending_add(_TR50_CLIENT *client, _TR50_MESSAGE *message) {
 	_TR50_PENDING *pending = &client->pending;
 	_TR50_MESSAGE *tail;
 	message->pending_sent_timestamp = _time_now();
 	message->pending_expiration_timestamp = message->pending_sent_timestamp + message->callback_timeout;
+	message->pending_next = NULL;
+	message->pending_previous = NULL;
 
 	_tr50_mutex_lock(pending->mux);
 
@@ -73,7 +146,9 @@ int tr50_pending_add(_TR50_CLIENT *client, _TR50_MESSAGE *message) {
 		pending->list_tail = message;
 	}
 	++pending->count;
+	pending->bytes += message->pending_bytes;
 	_tr50_mutex_unlock(pending->mux);
+	_tr50_trace(client, message->seq_id, _TR50_TRACE_ENQUEUED);
 	return 0;
 }
 
@@ -94,11 +169,13 @@ void _tr50_pending_linklist_remove(_TR50_CLIENT *client, _TR50_MESSAGE *message)
 		pending->list_tail = previous;
 	}
 	--pending->count;
+	pending->bytes -= message->pending_bytes;
 }
 
 _TR50_MESSAGE *tr50_pending_find_and_remove(_TR50_CLIENT *client, int hash) {
 	_TR50_PENDING *pending = &client->pending;
 	_TR50_MESSAGE *ptr;
+	int writable;
 
 	_tr50_mutex_lock(pending->mux);
 	ptr = (_TR50_MESSAGE *)pending->list_head;
@@ -106,7 +183,11 @@ _TR50_MESSAGE *tr50_pending_find_and_remove(_TR50_CLIENT *client, int hash) {
 	while (ptr) {
 		if (ptr->seq_id == hash) {
 			_tr50_pending_linklist_remove(client, ptr);
+			writable = _tr50_pending_credit_returned(client);
 			_tr50_mutex_unlock(pending->mux);
+			if (writable) {
+				_tr50_pending_writable(client);
+			}
 			return ptr;
 		}
 		ptr = ptr->pending_next;
@@ -115,44 +196,75 @@ _TR50_MESSAGE *tr50_pending_find_and_remove(_TR50_CLIENT *client, int hash) {
 	return NULL;
 }
 
-void *_tr50_pending_expiration_handler(void *tr50) {
-	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+// Expires one request ahead of the expiry thread, without its callback; FALSE when a reply or
+// the expiry thread already took it, its callback runs then.
+int _tr50_pending_cancel(_TR50_CLIENT *client, int seq_id) {
+	_TR50_MESSAGE *message;
+
+	if ((message = tr50_pending_find_and_remove(client, seq_id)) == NULL) {
+		return FALSE;
+	}
+	_tr50_mutex_lock(client->pending.mux);
+	++client->pending.expired_count;
+	_tr50_mutex_unlock(client->pending.mux);
+	_tr50_trace(client, seq_id, _TR50_TRACE_EXPIRED);
+	log_debug("message seq_id[%d] expired.", seq_id);
+	tr50_message_delete(message);
+	return TRUE;
+}
+
+// Expires every pending message whose deadline passed at [now]; returns how many expired.
+int _tr50_pending_expire(_TR50_CLIENT *client, long long now) {
 	_TR50_PENDING *pending = &client->pending;
+	_TR50_MESSAGE *next;
+	int expired = 0, writable;
 
-	while (!pending->is_deleting) {
-		long long now = _time_now();
-		_TR50_MESSAGE *next;
-
-		_tr50_mutex_lock(pending->mux);
-		next = (_TR50_MESSAGE *)pending->list_head;
-		while (next) {
-			_TR50_MESSAGE *message = next;
-			next = (_TR50_MESSAGE *)message->pending_next; // set next first coz it might be removed below.
-
-			if (message->pending_expiration_timestamp <= now) {
-				if (message->pending_expiration_timestamp - now > TR50_PENDING_TIME_SHIFT_ALLOW) { // if time shifted forward
-					log_important_info("message rescheduled expiration: expiration - now = [%d]", (int)(message->pending_expiration_timestamp - now));
-					message->pending_expiration_timestamp = now + message->callback_timeout;
-				} else {
-					++pending->expired_count;
-					_tr50_pending_linklist_remove(client, message);
-
-					if (message->message_type == TR50_MESSAGE_TYPE_OBJ && message->reply_callback) {
-						((tr50_async_reply_callback)message->reply_callback)(tr50, ERR_TR50_REQ_TIMEOUT, message, NULL, message->callback_custom);
-					} else if (message->message_type == TR50_MESSAGE_TYPE_RAW && message->raw_callback) {
-						((tr50_async_raw_reply_callback)message->raw_callback)(ERR_TR50_REQ_TIMEOUT, NULL, message->callback_custom);
-					}
-
-					log_debug("message seq_id[%d] expired.", message->seq_id);
-					tr50_message_delete(message);
-				}
-			} else if (now - message->pending_expiration_timestamp > TR50_PENDING_TIME_SHIFT_ALLOW + message->callback_timeout) { // if time shifted backward
+	_tr50_mutex_lock(pending->mux);
+	next = (_TR50_MESSAGE *)pending->list_head;
+	while (next) {
+		_TR50_MESSAGE *message = next;
+		next = (_TR50_MESSAGE *)message->pending_next; // set next first coz it might be removed below.
+
+		if (message->pending_expiration_timestamp <= now) {
+			if (message->pending_expiration_timestamp - now > TR50_PENDING_TIME_SHIFT_ALLOW) { // if time shifted forward
 				log_important_info("message rescheduled expiration: expiration - now = [%d]", (int)(message->pending_expiration_timestamp - now));
 				message->pending_expiration_timestamp = now + message->callback_timeout;
-			}
+			} else {
+				++pending->expired_count;
+				++expired;
+				_tr50_pending_linklist_remove(client, message);
+				_tr50_trace(client, message->seq_id, _TR50_TRACE_EXPIRED);
 
+				if (message->message_type == TR50_MESSAGE_TYPE_OBJ && message->reply_callback) {
+					((tr50_async_reply_callback)message->reply_callback)(client, ERR_TR50_REQ_TIMEOUT, message, NULL, message->callback_custom);
+				} else if (message->message_type == TR50_MESSAGE_TYPE_RAW && message->raw_callback) {
+					((tr50_async_raw_reply_callback)message->raw_callback)(ERR_TR50_REQ_TIMEOUT, NULL, message->callback_custom);
+				}
+
+				log_debug("message seq_id[%d] expired.", message->seq_id);
+				tr50_message_delete(message);
+			}
+		} else if (now - message->pending_expiration_timestamp > TR50_PENDING_TIME_SHIFT_ALLOW + message->callback_timeout) { // if time shifted backward
+			log_important_info("message rescheduled expiration: expiration - now = [%d]", (int)(message->pending_expiration_timestamp - now));
+			message->pending_expiration_timestamp = now + message->callback_timeout;
 		}
-		_tr50_mutex_unlock(pending->mux);
+
+	}
+	writable = _tr50_pending_credit_returned(client);
+	_tr50_mutex_unlock(pending->mux);
+	if (writable) {
+		_tr50_pending_writable(client);
+	}
+	return expired;
+}
+
+void *_tr50_pending_expiration_handler(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_PENDING *pending = &client->pending;
+
+	while (!pending->is_deleting) {
+		_tr50_pending_expire(client, _time_now());
+		_tr50_stats_tick(client);
 		_thread_sleep(TR50_PENDING_EXPIRATION_CHECK_INTERVAL);
 	}
 	return NULL;
@@ -168,3 +280,13 @@ int tr50_pending_expired_count(void *tr50) {
 	return client->pending.expired_count;
 }
 
+long long tr50_pending_bytes(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	return client->pending.bytes;
+}
+
+int tr50_pending_refused_count(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	return client->pending.refused_count;
+}
+
@@ -0,0 +1,162 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <tr50/internal/tr50.h>
+
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+
+#define TR50_REGISTRY_BUCKETS_MIN	16
+
+static unsigned int _tr50_registry_hash(const char *name) {
+	unsigned int hash = 2166136261u;
+
+	while (*name) {
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash;
+}
+
+// Caller holds registry->mux.
+static _TR50_HANDLER **_tr50_registry_slot(_TR50_REGISTRY *registry, const char *name, unsigned int hash) {
+	_TR50_HANDLER **slot = &registry->buckets[hash & (registry->bucket_count - 1)];
+
+	while (*slot && ((*slot)->hash != hash || strcmp((*slot)->name, name) != 0)) {
+		slot = (_TR50_HANDLER **)&(*slot)->next;
+	}
+	return slot;
+}
+
+// Caller holds registry->mux; doubles the buckets once there is more than one handler per bucket.
+static void _tr50_registry_grow(_TR50_REGISTRY *registry) {
+	_TR50_HANDLER **buckets, *handler, *next;
+	int i, bucket_count = registry->bucket_count * 2;
+
+	if ((buckets = (_TR50_HANDLER **)_memory_malloc(sizeof(_TR50_HANDLER *) * bucket_count)) == NULL) {
+		return; // chains just get longer
+	}
+	_memory_memset(buckets, 0, sizeof(_TR50_HANDLER *) * bucket_count);
+	for (i = 0; i < registry->bucket_count; ++i) {
+		for (handler = registry->buckets[i]; handler; handler = next) {
+			next = (_TR50_HANDLER *)handler->next;
+			handler->next = buckets[handler->hash & (bucket_count - 1)];
+			buckets[handler->hash & (bucket_count - 1)] = handler;
+		}
+	}
+	_memory_free(registry->buckets);
+	registry->buckets = buckets;
+	registry->bucket_count = bucket_count;
+}
+
+int _tr50_registry_create(_TR50_REGISTRY *registry) {
+	_memory_memset(registry, 0, sizeof(_TR50_REGISTRY));
+	if ((registry->buckets = (_TR50_HANDLER **)_memory_malloc(sizeof(_TR50_HANDLER *) * TR50_REGISTRY_BUCKETS_MIN)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(registry->buckets, 0, sizeof(_TR50_HANDLER *) * TR50_REGISTRY_BUCKETS_MIN);
+	registry->bucket_count = TR50_REGISTRY_BUCKETS_MIN;
+	return _tr50_mutex_create(&registry->mux);
+}
+
+void _tr50_registry_delete(_TR50_REGISTRY *registry) {
+	_TR50_HANDLER *handler, *next;
+	int i;
+
+	if (registry->buckets == NULL) {
+		return;
+	}
+	for (i = 0; i < registry->bucket_count; ++i) {
+		for (handler = registry->buckets[i]; handler; handler = next) {
+			next = (_TR50_HANDLER *)handler->next;
+			_memory_free(handler);
+		}
+	}
+	_memory_free(registry->buckets);
+	registry->buckets = NULL;
+	_tr50_mutex_delete(registry->mux);
+}
+
+// Registering a name again replaces its callback.
+int _tr50_registry_set(_TR50_REGISTRY *registry, const char *name, void *callback) {
+	unsigned int hash;
+	_TR50_HANDLER **slot;
+
+	if (name == NULL || callback == NULL || strlen(name) >= TR50_HANDLER_NAME_LEN) {
+		return ERR_TR50_PARMS;
+	}
+	hash = _tr50_registry_hash(name);
+
+	_tr50_mutex_lock(registry->mux);
+	if (*(slot = _tr50_registry_slot(registry, name, hash)) == NULL) {
+		if ((*slot = (_TR50_HANDLER *)_memory_malloc(sizeof(_TR50_HANDLER))) == NULL) {
+			_tr50_mutex_unlock(registry->mux);
+			return ERR_TR50_MALLOC;
+		}
+		_memory_memset(*slot, 0, sizeof(_TR50_HANDLER));
+		(*slot)->hash = hash;
+		strcpy((*slot)->name, name);
+		++registry->count;
+	}
+	(*slot)->callback = callback;
+	if (registry->count > registry->bucket_count) {
+		_tr50_registry_grow(registry);
+	}
+	_tr50_mutex_unlock(registry->mux);
+	return 0;
+}
+
+// Returns FALSE when [name] is not registered.
+int _tr50_registry_remove(_TR50_REGISTRY *registry, const char *name) {
+	_TR50_HANDLER **slot, *handler;
+
+	_tr50_mutex_lock(registry->mux);
+	if ((handler = *(slot = _tr50_registry_slot(registry, name, _tr50_registry_hash(name)))) == NULL) {
+		_tr50_mutex_unlock(registry->mux);
+		return FALSE;
+	}
+	*slot = (_TR50_HANDLER *)handler->next;
+	--registry->count;
+	_tr50_mutex_unlock(registry->mux);
+	_memory_free(handler);
+	return TRUE;
+}
+
+// The callback is copied out so it runs without the lock; one that is removed meanwhile may
+// still be called once by a dispatch that found it first.
+void *_tr50_registry_find(_TR50_REGISTRY *registry, const char *name) {
+	_TR50_HANDLER *handler;
+	void *callback;
+
+	_tr50_mutex_lock(registry->mux);
+	handler = *_tr50_registry_slot(registry, name, _tr50_registry_hash(name));
+	callback = handler ? handler->callback : NULL;
+	_tr50_mutex_unlock(registry->mux);
+	return callback;
+}
+
+int _tr50_registry_count(_TR50_REGISTRY *registry) {
+	return registry->count;
+}
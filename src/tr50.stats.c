@@ -29,45 +29,89 @@
 
 #include <tr50/mqtt/mqtt.h>
 
+#include <tr50/util/atomic.h>
 #include <tr50/util/memory.h>
 #include <tr50/util/mutex.h>
 #include <tr50/util/time.h>
 
+void _tr50_stats_create(_TR50_CLIENT *client) {
+	_TR50_STATS *stats = &client->stats;
+	_tr50_mutex_create(&stats->mux);
+	_histogram_create(&stats->latency);
+	stats->rate_timestamp = _time_now();
+}
+
+void _tr50_stats_delete(_TR50_CLIENT *client) {
+	_TR50_STATS *stats = &client->stats;
+	int i;
+
+	_tr50_mutex_delete(stats->mux);
+	_histogram_delete(stats->latency);
+	for (i = 0; i < _TR50_STATS_LATENCY_COMMANDS_MAX; ++i) {
+		_histogram_delete(stats->latency_commands[i].histogram);
+	}
+}
+
 void _tr50_stats_pub_recv_up(_TR50_CLIENT *client, int byte_recv) {
 	_TR50_STATS *stats = &client->stats;
-	_tr50_mutex_lock(stats->mux);
-	stats->pub_byte_recv += byte_recv;
-	++stats->pub_recv;
-	_tr50_mutex_unlock(stats->mux);
+	_atomic_add64(&stats->pub_byte_recv, byte_recv);
+	_atomic_add64(&stats->pub_recv, 1);
 }
 
 void _tr50_stats_pub_sent_up(_TR50_CLIENT *client, int byte_sent) {
 	_TR50_STATS *stats = &client->stats;
-	_tr50_mutex_lock(stats->mux);
-	stats->pub_byte_sent += byte_sent;
-	++stats->pub_sent;
-	_tr50_mutex_unlock(stats->mux);
+	_atomic_add64(&stats->pub_byte_sent, byte_sent);
+	_atomic_add64(&stats->pub_sent, 1);
 }
 
 void _tr50_stats_notify_up(_TR50_CLIENT *client) {
-	_TR50_STATS *stats = &client->stats;
-	_tr50_mutex_lock(stats->mux);
-	++stats->notify_count;
-	_tr50_mutex_unlock(stats->mux);
+	_atomic_add64(&client->stats.notify_count, 1);
 }
 
 void _tr50_stats_mailbox_check_up(_TR50_CLIENT *client) {
+	_atomic_add64(&client->stats.mailbox_check_count, 1);
+}
+
+void _tr50_stats_set_connected(_TR50_CLIENT *client) {
 	_TR50_STATS *stats = &client->stats;
 	_tr50_mutex_lock(stats->mux);
-	++stats->mailbox_check_count;
+	stats->connected_timestamp = _time_now();
+	_atomic_add64(&stats->connected_count, 1);
 	_tr50_mutex_unlock(stats->mux);
 }
 
-void _tr50_stats_set_connected(_TR50_CLIENT *client) {
+// exp(-interval / window) for the 1, 5 and 15 minute windows at a 5 second interval.
+static const double _tr50_stats_rate_decay[_TR50_STATS_RATE_WINDOWS] = { 0.920044415, 0.983471454, 0.994459848 };
+
+// Called from the pending thread about once a second; folds the publish counters into the
+// moving averages every _TR50_STATS_RATE_INTERVAL.
+void _tr50_stats_tick(_TR50_CLIENT *client) {
 	_TR50_STATS *stats = &client->stats;
+	long long now = _time_now();
+	long long msgs, bytes, elapsed;
+	double msg_rate, byte_rate;
+	int i;
+
 	_tr50_mutex_lock(stats->mux);
-	stats->connected_timestamp = _time_now();
-	++stats->connected_count;
+	elapsed = now - stats->rate_timestamp;
+	if (elapsed < _TR50_STATS_RATE_INTERVAL) {
+		if (elapsed < 0) { // clock moved backward, restart the interval
+			stats->rate_timestamp = now;
+		}
+		_tr50_mutex_unlock(stats->mux);
+		return;
+	}
+	msgs = _atomic_load64(&stats->pub_sent) + _atomic_load64(&stats->pub_recv);
+	bytes = _atomic_load64(&stats->pub_byte_sent) + _atomic_load64(&stats->pub_byte_recv);
+	msg_rate = (double)(msgs - stats->rate_last_msgs) * 1000.0 / (double)elapsed;
+	byte_rate = (double)(bytes - stats->rate_last_bytes) * 1000.0 / (double)elapsed;
+	for (i = 0; i < _TR50_STATS_RATE_WINDOWS; ++i) {
+		stats->rate_msgs[i] = stats->rate_msgs[i] * _tr50_stats_rate_decay[i] + msg_rate * (1.0 - _tr50_stats_rate_decay[i]);
+		stats->rate_bytes[i] = stats->rate_bytes[i] * _tr50_stats_rate_decay[i] + byte_rate * (1.0 - _tr50_stats_rate_decay[i]);
+	}
+	stats->rate_last_msgs = msgs;
+	stats->rate_last_bytes = bytes;
+	stats->rate_timestamp = now;
 	_tr50_mutex_unlock(stats->mux);
 }
 
@@ -92,60 +136,261 @@ void _tr50_stats_set_last_error(_TR50_CLIENT *client, int error, const char *err
 	_tr50_mutex_unlock(stats->mux);
 }
 
+static unsigned int _tr50_stats_command_hash(const char *command) {
+	unsigned int hash = 5381;
+	while (*command) {
+		hash = hash * 33 + (unsigned char)*command++;
+	}
+	return hash;
+}
+
+// Finds the command's slot, claiming a free one when create is set. Returns NULL once the
+// table is full; those commands only count towards the overall histogram.
+static _TR50_STATS_LATENCY_SLOT *_tr50_stats_latency_slot(_TR50_STATS *stats, const char *command, int create) {
+	_TR50_STATS_LATENCY_SLOT *slot;
+	unsigned int hash = _tr50_stats_command_hash(command);
+	int i, state;
+
+	for (i = 0; i < _TR50_STATS_LATENCY_COMMANDS_MAX; ++i) {
+		slot = &stats->latency_commands[(hash + i) % _TR50_STATS_LATENCY_COMMANDS_MAX];
+		state = _atomic_load32(&slot->state);
+		if (state == _TR50_STATS_LATENCY_SLOT_FREE) {
+			if (!create) {
+				return NULL;
+			}
+			if (_atomic_cas32(&slot->state, _TR50_STATS_LATENCY_SLOT_FREE, _TR50_STATS_LATENCY_SLOT_CLAIMED)) {
+				strncpy(slot->command, command, TR50_COMMAND_NAME_LEN - 1);
+				_histogram_create(&slot->histogram);
+				_atomic_store32(&slot->state, _TR50_STATS_LATENCY_SLOT_READY);
+				return slot;
+			}
+		}
+		while ((state = _atomic_load32(&slot->state)) == _TR50_STATS_LATENCY_SLOT_CLAIMED) {
+			// another thread is filling in the name, it is only a few instructions away.
+		}
+		if (strncmp(slot->command, command, TR50_COMMAND_NAME_LEN - 1) == 0) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+// Called when a reply is matched to its pending request. Each distinct command of a batched
+// request is charged the round trip once.
+void _tr50_stats_latency(_TR50_CLIENT *client, _TR50_MESSAGE *request, long long latency) {
+	_TR50_STATS *stats = &client->stats;
+	_TR50_STATS_LATENCY_SLOT *slot;
+	JSON *item, *previous;
+	const char *command;
+
+	if (stats->latency == NULL) {
+		return;
+	}
+	_histogram_record(stats->latency, latency);
+
+	if (request->message_type != TR50_MESSAGE_TYPE_OBJ || request->json == NULL) {
+		return;
+	}
+	for (item = request->json->child; item; item = item->next) {
+		if ((command = tr50_json_get_object_item_as_string(item, "command")) == NULL) {
+			continue;
+		}
+		for (previous = request->json->child; previous != item; previous = previous->next) {
+			const char *seen = tr50_json_get_object_item_as_string(previous, "command");
+			if (seen && strcmp(seen, command) == 0) {
+				break;
+			}
+		}
+		if (previous != item) {
+			continue;
+		}
+		if ((slot = _tr50_stats_latency_slot(stats, command, 1)) != NULL && slot->histogram) {
+			_histogram_record(slot->histogram, latency);
+		}
+	}
+}
+
+static void _tr50_stats_latency_fill(_HISTOGRAM *histogram, TR50_STATS_LATENCY *latency) {
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+	long long values[5];
+
+	_histogram_percentiles(histogram, percentiles, values, 5, &latency->count);
+	latency->p50 = values[0];
+	latency->p90 = values[1];
+	latency->p99 = values[2];
+	latency->p999 = values[3];
+	latency->max = _atomic_load64(&histogram->max);
+}
+
+int tr50_stats_latency(void *tr50, const char *command, TR50_STATS_LATENCY *latency) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_STATS_LATENCY_SLOT *slot;
+	_HISTOGRAM *histogram = client->stats.latency;
+
+	if (latency == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_memory_memset(latency, 0, sizeof(TR50_STATS_LATENCY));
+	if (command) {
+		slot = _tr50_stats_latency_slot(&client->stats, command, 0);
+		histogram = slot ? slot->histogram : NULL;
+	}
+	if (histogram) {
+		_tr50_stats_latency_fill(histogram, latency);
+	}
+	return 0;
+}
+
+int tr50_stats_latency_for_each(void *tr50, tr50_stats_latency_callback callback, void *custom) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_STATS_LATENCY_SLOT *slot;
+	TR50_STATS_LATENCY latency;
+	int i;
+
+	if (callback == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	for (i = 0; i < _TR50_STATS_LATENCY_COMMANDS_MAX; ++i) {
+		slot = &client->stats.latency_commands[i];
+		if (_atomic_load32(&slot->state) == _TR50_STATS_LATENCY_SLOT_READY && slot->histogram) {
+			_memory_memset(&latency, 0, sizeof(TR50_STATS_LATENCY));
+			_tr50_stats_latency_fill(slot->histogram, &latency);
+			callback(slot->command, &latency, custom);
+		}
+	}
+	return 0;
+}
+
 int tr50_stats_pub_recv(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	return client->stats.pub_recv;
+	return (int)_atomic_load64(&client->stats.pub_recv);
 }
 int tr50_stats_pub_sent(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	return client->stats.pub_sent;
+	return (int)_atomic_load64(&client->stats.pub_sent);
 }
 
-int tr50_stats_byte_recv(void *tr50) {
+// tr50_stop() frees the mqtt client without client->mux held, having already folded its byte
+// counts into the totals, so it is only read while no stop is in progress.
+// Caller holds client->mux.
+static void *_tr50_stats_mqtt_locked(_TR50_CLIENT *client) {
+	return client->is_stopping ? NULL : client->mqtt;
+}
+
+long long tr50_stats_byte_recv(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	if (client->mqtt) {
-		return client->stats.total_recv + mqtt_async_stats_byte_recv(client->mqtt);
+	long long recv;
+	void *mqtt;
+
+	_tr50_mutex_lock(client->mux);
+	recv = _atomic_load64(&client->stats.total_recv);
+	if ((mqtt = _tr50_stats_mqtt_locked(client)) != NULL) {
+		recv += mqtt_async_stats_byte_recv(mqtt);
 	}
-	return client->stats.total_recv;
+	_tr50_mutex_unlock(client->mux);
+	return recv;
 }
 
-int tr50_stats_byte_sent(void *tr50) {
+long long tr50_stats_byte_sent(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	if (client->mqtt) {
-		return client->stats.total_sent + mqtt_async_stats_byte_sent(client->mqtt);
+	long long sent;
+	void *mqtt;
+
+	_tr50_mutex_lock(client->mux);
+	sent = _atomic_load64(&client->stats.total_sent);
+	if ((mqtt = _tr50_stats_mqtt_locked(client)) != NULL) {
+		sent += mqtt_async_stats_byte_sent(mqtt);
 	}
-	return client->stats.total_sent;
+	_tr50_mutex_unlock(client->mux);
+	return sent;
 }
 
-int tr50_stats_compress_ratio(void *tr50) {
-	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+// Caller holds stats->mux.
+static int _tr50_stats_compress_ratio_locked(_TR50_STATS *stats) {
 	int i;
 	int count;
-	int compressed_sum = 0;
-	int uncompressed_sum = 0;
-	int ratio = 0;
-
-	count = client->stats.compression_ratio_count;
+	long long compressed_sum = 0;
+	long long uncompressed_sum = 0;
 
-	if (count == 0) {
+	count = stats->compression_ratio_count;
+	if (count > _TR50_COMPRESSION_HISTORY_MAX) {
+		count = _TR50_COMPRESSION_HISTORY_MAX;
+	}
+	for (i = 0; i < count; ++i) {
+		compressed_sum += stats->compression_compressed_len[i];
+		uncompressed_sum += stats->compression_original_len[i];
+	}
+	if (uncompressed_sum == 0) {
 		return 0;
 	}
+	return (int)(100 - (100 * compressed_sum) / uncompressed_sum);
+}
 
-	if (count > 100) {
-		for (i = 0; i < 100; ++i) {
-			compressed_sum += client->stats.compression_compressed_len[i];
-			uncompressed_sum += client->stats.compression_original_len[i];
-		}
-	} else {
-		for (i = 0; i < count; ++i) {
-			compressed_sum += client->stats.compression_compressed_len[i];
-			uncompressed_sum += client->stats.compression_original_len[i];
-		}
-	}
-	ratio = 100 - (100 * compressed_sum) / uncompressed_sum;
+int tr50_stats_compress_ratio(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	int ratio;
+
+	_tr50_mutex_lock(client->stats.mux);
+	ratio = _tr50_stats_compress_ratio_locked(&client->stats);
+	_tr50_mutex_unlock(client->stats.mux);
 	return ratio;
 }
 
+int tr50_stats_snapshot(void *tr50, TR50_STATS_SNAPSHOT *snapshot) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_STATS *stats;
+	void *mqtt;
+	int i;
+
+	if (client == NULL || snapshot == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	stats = &client->stats;
+	_memory_memset(snapshot, 0, sizeof(TR50_STATS_SNAPSHOT));
+
+	// Transport-level numbers come from the mqtt client and must be read outside stats->mux.
+	snapshot->byte_sent = tr50_stats_byte_sent(tr50);
+	snapshot->byte_recv = tr50_stats_byte_recv(tr50);
+	snapshot->reconnect_attempt_count = tr50_stats_reconnect_attempt_count(tr50);
+	snapshot->reconnect_count = tr50_stats_reconnect_count(tr50);
+	snapshot->pending_count = tr50_pending_count(tr50);
+	snapshot->pending_expired_count = tr50_pending_expired_count(tr50);
+	snapshot->pending_bytes = tr50_pending_bytes(tr50);
+	snapshot->pending_refused_count = tr50_pending_refused_count(tr50);
+	snapshot->compress_state = client->compress_state;
+	_tr50_mutex_lock(client->mux);
+	if ((mqtt = _tr50_stats_mqtt_locked(client)) != NULL) {
+		snapshot->qos_inflight = mqtt_async_stats_qos_inflight(mqtt);
+		snapshot->qos_expired_count = mqtt_async_stats_qos_expired(mqtt);
+	}
+	_tr50_mutex_unlock(client->mux);
+
+	_tr50_mutex_lock(stats->mux);
+	snapshot->timestamp = _time_now();
+	snapshot->pub_sent = _atomic_load64(&stats->pub_sent);
+	snapshot->pub_recv = _atomic_load64(&stats->pub_recv);
+	snapshot->pub_byte_sent = _atomic_load64(&stats->pub_byte_sent);
+	snapshot->pub_byte_recv = _atomic_load64(&stats->pub_byte_recv);
+	snapshot->connected_timestamp = stats->connected_timestamp;
+	snapshot->connected_count = _atomic_load64(&stats->connected_count);
+	snapshot->notify_count = _atomic_load64(&stats->notify_count);
+	snapshot->mailbox_check_count = _atomic_load64(&stats->mailbox_check_count);
+	snapshot->last_error = stats->last_error;
+	snapshot->last_error_timestamp = stats->last_error_timestamp;
+	snapshot->compress_ratio = _tr50_stats_compress_ratio_locked(stats);
+	for (i = 0; i < _TR50_STATS_RATE_WINDOWS; ++i) {
+		snapshot->msg_rate[i] = stats->rate_msgs[i];
+		snapshot->byte_rate[i] = stats->rate_bytes[i];
+	}
+	_tr50_mutex_unlock(stats->mux);
+	return 0;
+}
+
+int tr50_stats_compress_state(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	return client->compress_state;
+}
+
 void tr50_stats_clear_compression_ratio(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 	_TR50_STATS *stats;
@@ -156,31 +401,41 @@ void tr50_stats_clear_compression_ratio(void *tr50) {
 	stats = &client->stats;
 	_tr50_mutex_lock(stats->mux);
 	client->stats.compression_ratio_count = 0;
-	_memory_memset(client->stats.compression_compressed_len, 0, _TR50_COMPRESSION_HISTORY_MAX);
+	_memory_memset(client->stats.compression_compressed_len, 0, sizeof(client->stats.compression_compressed_len));
+	_memory_memset(client->stats.compression_original_len, 0, sizeof(client->stats.compression_original_len));
 	_tr50_mutex_unlock(stats->mux);
 }
 
 void tr50_stats_clear_send_recv(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
 	_TR50_STATS *stats;
+	void *mqtt;
 
 	if (client == NULL) {
 		return;
 	}
 	stats = &client->stats;
+	_tr50_mutex_lock(client->mux);
 	_tr50_mutex_lock(stats->mux);
-	if (client->mqtt) {
-		mqtt_async_stats_clear(client->mqtt);
+	if ((mqtt = _tr50_stats_mqtt_locked(client)) != NULL) {
+		mqtt_async_stats_clear(mqtt);
 	}
-	stats->pub_byte_sent = 0;
-	stats->pub_sent = 0;
-	stats->total_sent = 0;
+	_atomic_store64(&stats->pub_byte_sent, 0);
+	_atomic_store64(&stats->pub_sent, 0);
+	_atomic_store64(&stats->total_sent, 0);
 
-	stats->pub_byte_recv = 0;
-	stats->pub_recv = 0;
-	stats->total_recv = 0;
+	_atomic_store64(&stats->pub_byte_recv, 0);
+	_atomic_store64(&stats->pub_recv, 0);
+	_atomic_store64(&stats->total_recv, 0);
+
+	stats->rate_last_msgs = 0;
+	stats->rate_last_bytes = 0;
+	stats->rate_timestamp = _time_now();
+	_memory_memset(stats->rate_msgs, 0, sizeof(stats->rate_msgs));
+	_memory_memset(stats->rate_bytes, 0, sizeof(stats->rate_bytes));
 
 	_tr50_mutex_unlock(stats->mux);
+	_tr50_mutex_unlock(client->mux);
 }
 
 void tr50_stats_clear_last_error(void *tr50) {
@@ -205,18 +460,28 @@ long long tr50_stats_last_connected(void *tr50) {
 
 int tr50_stats_reconnect_attempt_count(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	if (client->mqtt) {
-		return mqtt_async_reconnect_attempt_count(client->mqtt);
+	int count = 0;
+	void *mqtt;
+
+	_tr50_mutex_lock(client->mux);
+	if ((mqtt = _tr50_stats_mqtt_locked(client)) != NULL) {
+		count = mqtt_async_reconnect_attempt_count(mqtt);
 	}
-	return 0;
+	_tr50_mutex_unlock(client->mux);
+	return count;
 }
 
 int tr50_stats_reconnect_count(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	if (client->mqtt) {
-		return mqtt_async_reconnect_count(client->mqtt);
+	int count = 0;
+	void *mqtt;
+
+	_tr50_mutex_lock(client->mux);
+	if ((mqtt = _tr50_stats_mqtt_locked(client)) != NULL) {
+		count = mqtt_async_reconnect_count(mqtt);
 	}
-	return 0;
+	_tr50_mutex_unlock(client->mux);
+	return count;
 }
 
 int tr50_stats_last_error(void *tr50) {
@@ -226,12 +491,12 @@ int tr50_stats_last_error(void *tr50) {
 
 int tr50_stats_notify(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	return client->stats.notify_count;
+	return (int)_atomic_load64(&client->stats.notify_count);
 }
 
 int tr50_stats_mailbox_check(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
-	return client->stats.mailbox_check_count;
+	return (int)_atomic_load64(&client->stats.mailbox_check_count);
 }
 
 int tr50_stats_in_api_call_async(void *tr50) {
@@ -243,3 +508,21 @@ int tr50_stats_in_api_raw_async(void *tr50) {
 	_TR50_CLIENT *client = (_TR50_CLIENT*)tr50;
 	return client->stats.in_api_raw_async;
 }
+
+// Command names stay registered, only their samples are dropped.
+void tr50_stats_clear_latency(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_STATS_LATENCY_SLOT *slot;
+	int i;
+
+	if (client == NULL || client->stats.latency == NULL) {
+		return;
+	}
+	_histogram_clear(client->stats.latency);
+	for (i = 0; i < _TR50_STATS_LATENCY_COMMANDS_MAX; ++i) {
+		slot = &client->stats.latency_commands[i];
+		if (_atomic_load32(&slot->state) == _TR50_STATS_LATENCY_SLOT_READY && slot->histogram) {
+			_histogram_clear(slot->histogram);
+		}
+	}
+}
@@ -0,0 +1,248 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+
+#include <tr50/internal/tr50.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/blob.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+#define TR50_TRACE_EXPORT_SIZE		65536
+
+static void _tr50_trace_at(_TR50_CLIENT *client, int seq_id, int type, long long timestamp) {
+	_TR50_TRACE *trace = &client->trace;
+	_TR50_TRACE_EVENT *event;
+	long long index;
+
+	_atomic_add32(&trace->writers, 1);
+	if (!trace->enabled) { // stopped since the caller looked
+		_atomic_add32(&trace->writers, -1);
+		return;
+	}
+	index = _atomic_add64(&trace->head, 1);
+	event = &trace->events[index & trace->mask];
+	_atomic_store64(&event->sequence, 0);
+	_atomic_fence();
+	event->timestamp = timestamp;
+	event->seq_id = seq_id;
+	event->type = type;
+	_thread_id(&event->thread_id);
+	_atomic_fence();
+	_atomic_store64(&event->sequence, index + 1);
+	_atomic_add32(&trace->writers, -1);
+}
+
+void _tr50_trace(_TR50_CLIENT *client, int seq_id, int type) {
+	if (client->trace.enabled) {
+		_tr50_trace_at(client, seq_id, type, _time_now_us());
+	}
+}
+
+// The seq_id is only assigned under the client lock, so the submit time is taken before
+// locking and recorded together with the moment the lock was acquired.
+void _tr50_trace_submitted(_TR50_CLIENT *client, int seq_id, long long submitted) {
+	if (client->trace.enabled && submitted) {
+		_tr50_trace_at(client, seq_id, _TR50_TRACE_SUBMITTED, submitted);
+		_tr50_trace_at(client, seq_id, _TR50_TRACE_LOCKED, _time_now_us());
+	}
+}
+
+void _tr50_trace_delete(_TR50_CLIENT *client) {
+	_TR50_TRACE *trace = &client->trace;
+
+	trace->enabled = 0;
+	if (trace->events) {
+		_memory_free(trace->events);
+		trace->events = NULL;
+	}
+}
+
+// The ring is kept until tr50_delete() because a writer that saw tracing enabled may still
+// be filling a slot; a restart waits for those writers, then reuses it and drops the old events.
+// Writers that come later see tracing disabled and leave the ring alone.
+int tr50_trace_start(void *tr50, int capacity) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_TRACE *trace;
+	int size = 1;
+
+	if (client == NULL || capacity <= 0 || capacity > _TR50_TRACE_CAPACITY_MAX) {
+		return ERR_TR50_PARMS;
+	}
+	trace = &client->trace;
+	if (trace->enabled) {
+		return ERR_TR50_ALREADY_STARTED;
+	}
+	if (trace->events == NULL) {
+		while (size < capacity) {
+			size <<= 1;
+		}
+		if ((trace->events = _memory_malloc(size * sizeof(_TR50_TRACE_EVENT))) == NULL) {
+			return ERR_TR50_MALLOC;
+		}
+		trace->mask = size - 1;
+	}
+	while (_atomic_load32(&trace->writers) != 0) {
+		_thread_sleep(0);
+	}
+	_memory_memset(trace->events, 0, (trace->mask + 1) * sizeof(_TR50_TRACE_EVENT));
+	_atomic_store64(&trace->head, 0);
+	_atomic_fence();
+	trace->enabled = 1;
+	return 0;
+}
+
+int tr50_trace_stop(void *tr50) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+
+	if (client == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	client->trace.enabled = 0;
+	return 0;
+}
+
+static int _tr50_trace_compare(const void *a, const void *b) {
+	const _TR50_TRACE_EVENT *ea = (const _TR50_TRACE_EVENT *)a;
+	const _TR50_TRACE_EVENT *eb = (const _TR50_TRACE_EVENT *)b;
+
+	if (ea->seq_id != eb->seq_id) {
+		return ea->seq_id < eb->seq_id ? -1 : 1;
+	}
+	if (ea->timestamp != eb->timestamp) {
+		return ea->timestamp < eb->timestamp ? -1 : 1;
+	}
+	return ea->type - eb->type;
+}
+
+// Name of the stage that ends with the event.
+static const char *_tr50_trace_stage(int type) {
+	switch (type) {
+	case _TR50_TRACE_LOCKED:			return "lock wait";
+	case _TR50_TRACE_SERIALIZED:		return "serialize";
+	case _TR50_TRACE_COMPRESSED:		return "compress";
+	case _TR50_TRACE_ENQUEUED:			return "enqueue";
+	case _TR50_TRACE_WRITTEN:			return "socket write";
+	case _TR50_TRACE_REPLY_RECEIVED:	return "broker";
+	case _TR50_TRACE_PARSED:			return "inflate/parse";
+	case _TR50_TRACE_CALLBACK_START:	return "dispatch";
+	case _TR50_TRACE_CALLBACK_END:		return "callback";
+	case _TR50_TRACE_EXPIRED:			return "timeout";
+	}
+	return "unknown";
+}
+
+static void _tr50_trace_append(void *blob, int *first, const char *phase, const char *name, int id, long long ts, int tid, int seq_id) {
+	char line[256];
+	int len;
+
+	len = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"cat\":\"tr50\",\"ph\":\"%s\",\"id\":%d,\"ts\":%lld,\"pid\":1,\"tid\":%d,\"args\":{\"seq_id\":%d}}",
+		*first ? "" : ",\n", name, phase, id, ts, tid, seq_id);
+	*first = 0;
+	_blob_append(blob, line, len);
+}
+
+// Each request becomes an async track: one span for the whole request with nested spans for
+// the stages between consecutive events.
+static void _tr50_trace_render(void *blob, _TR50_TRACE_EVENT *events, int count) {
+	const char *header = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char name[32];
+	int first = 1, id = 0, start, end, i;
+
+	_blob_append(blob, header, strlen(header));
+
+	for (start = 0; start < count; start = end) {
+		for (end = start + 1; end < count; ++end) {
+			if (events[end].seq_id != events[start].seq_id || events[end].type == _TR50_TRACE_SUBMITTED) {
+				break;
+			}
+		}
+		++id;
+		snprintf(name, sizeof(name), "request %d", events[start].seq_id);
+		_tr50_trace_append(blob, &first, "b", name, id, events[start].timestamp, events[start].thread_id, events[start].seq_id);
+		for (i = start + 1; i < end; ++i) {
+			_tr50_trace_append(blob, &first, "b", _tr50_trace_stage(events[i].type), id, events[i - 1].timestamp, events[i].thread_id, events[i].seq_id);
+			_tr50_trace_append(blob, &first, "e", _tr50_trace_stage(events[i].type), id, events[i].timestamp, events[i].thread_id, events[i].seq_id);
+		}
+		_tr50_trace_append(blob, &first, "e", name, id, events[end - 1].timestamp, events[end - 1].thread_id, events[start].seq_id);
+	}
+	_blob_append(blob, "\n]}\n", 4);
+}
+
+int tr50_trace_export(void *tr50, char **json, int *json_len) {
+	_TR50_CLIENT *client = (_TR50_CLIENT *)tr50;
+	_TR50_TRACE *trace;
+	_TR50_TRACE_EVENT *events, *slot;
+	long long head, index, sequence;
+	int count = 0, ret;
+	void *blob;
+
+	if (client == NULL || json == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	trace = &client->trace;
+	if (trace->events == NULL) {
+		return ERR_TR50_ALREADY_STOPPED;
+	}
+	if ((events = _memory_malloc((trace->mask + 1) * sizeof(_TR50_TRACE_EVENT))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+
+	// copy what is still in the ring, skipping slots being rewritten while we read them.
+	head = _atomic_load64(&trace->head);
+	for (index = head > trace->mask + 1 ? head - trace->mask - 1 : 0; index < head; ++index) {
+		slot = &trace->events[index & trace->mask];
+		if ((sequence = _atomic_load64(&slot->sequence)) != index + 1) {
+			continue;
+		}
+		_atomic_fence();
+		events[count] = *slot;
+		_atomic_fence();
+		if (_atomic_load64(&slot->sequence) == sequence) {
+			++count;
+		}
+	}
+	qsort(events, count, sizeof(_TR50_TRACE_EVENT), _tr50_trace_compare);
+
+	if ((ret = _blob_create(&blob, TR50_TRACE_EXPORT_SIZE)) != 0) {
+		_memory_free(events);
+		return ret;
+	}
+	_tr50_trace_render(blob, events, count);
+	_memory_free(events);
+
+	*json = _blob_get_buffer(blob);
+	if (json_len) {
+		*json_len = _blob_get_length(blob);
+	}
+	_blob_delete_object(blob);
+	return 0;
+}
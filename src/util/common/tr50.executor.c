@@ -0,0 +1,274 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <tr50/error.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/event.h>
+#include <tr50/util/executor.h>
+#include <tr50/util/histogram.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+#define EXECUTOR_THREADS_MAX	64
+
+struct _EXECUTOR_S;
+
+typedef struct {
+	struct _EXECUTOR_S *executor;
+	void *			thread;
+	volatile int	thread_id;
+	void *			mux;
+	void *			ready_evt;		// signaled when a task arrives for an idle worker
+	void *			space_evt;		// signaled when a task leaves while submitters wait
+	_EXECUTOR_TASK *head;
+	_EXECUTOR_TASK *tail;
+	int				depth;
+	int				idle;
+	int				space_waiters;
+} _EXECUTOR_WORKER;
+
+typedef struct _EXECUTOR_S {
+	_EXECUTOR_WORKER *	workers;
+	int					worker_count;
+	int					threads;		// started
+	int					queue_depth;
+	volatile int		is_stopping;
+	volatile int		next;			// round robin for key 0
+	volatile int		queued;
+	volatile long long	queued_max;
+	volatile long long	outstanding;	// queued or running, the workers stop at 0
+	volatile long long	executed;
+	volatile long long	blocked;
+	_HISTOGRAM *		lag;
+} _EXECUTOR;
+
+static int _executor_is_worker(_EXECUTOR *executor) {
+	int i, thread_id;
+
+	if (_thread_id(&thread_id) != 0) {
+		return 0;
+	}
+	for (i = 0; i < executor->threads; ++i) {
+		if (executor->workers[i].thread_id == thread_id) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void _executor_wake_all(_EXECUTOR *executor) {
+	_EXECUTOR_WORKER *worker;
+	int i;
+
+	for (i = 0; i < executor->threads; ++i) {
+		worker = &executor->workers[i];
+		_tr50_mutex_lock(worker->mux);
+		worker->idle = 0;
+		_tr50_event_signal(worker->ready_evt);
+		_tr50_mutex_unlock(worker->mux);
+	}
+}
+
+static void *_executor_worker(void *arg) {
+	_EXECUTOR_WORKER *worker = (_EXECUTOR_WORKER *)arg;
+	_EXECUTOR *executor = worker->executor;
+	_EXECUTOR_TASK *task;
+	int thread_id;
+
+	if (_thread_id(&thread_id) == 0) {
+		worker->thread_id = thread_id;
+	}
+	for (;;) {
+		_tr50_mutex_lock(worker->mux);
+		while (worker->head == NULL) {
+			if (executor->is_stopping && _atomic_load64(&executor->outstanding) == 0) {
+				_tr50_mutex_unlock(worker->mux);
+				return NULL;
+			}
+			worker->idle = 1;
+			_tr50_event_reset(worker->ready_evt);
+			_tr50_mutex_unlock(worker->mux);
+			_tr50_event_wait(worker->ready_evt);
+			_tr50_mutex_lock(worker->mux);
+		}
+		task = worker->head;
+		if ((worker->head = task->next) == NULL) {
+			worker->tail = NULL;
+		}
+		--worker->depth;
+		if (worker->space_waiters) {
+			_tr50_event_signal(worker->space_evt);
+		}
+		_tr50_mutex_unlock(worker->mux);
+
+		_atomic_add32(&executor->queued, -1);
+		_histogram_record(executor->lag, _time_now_us() - task->enqueued_us);
+		task->run(task);
+		_atomic_add64(&executor->executed, 1);
+		if (_atomic_add64(&executor->outstanding, -1) == 1 && executor->is_stopping) {
+			_executor_wake_all(executor);
+		}
+	}
+}
+
+int _executor_create(void **handle, int threads, int queue_depth) {
+	_EXECUTOR *executor;
+	_EXECUTOR_WORKER *worker;
+	int i, ret;
+
+	if (handle == NULL || threads < 1 || threads > EXECUTOR_THREADS_MAX || queue_depth < 1) {
+		return ERR_TR50_PARMS;
+	}
+	if ((executor = (_EXECUTOR *)_memory_malloc(sizeof(_EXECUTOR))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(executor, 0, sizeof(_EXECUTOR));
+	executor->queue_depth = queue_depth;
+	if ((executor->workers = (_EXECUTOR_WORKER *)_memory_malloc(sizeof(_EXECUTOR_WORKER) * threads)) == NULL) {
+		_memory_free(executor);
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(executor->workers, 0, sizeof(_EXECUTOR_WORKER) * threads);
+	if ((ret = _histogram_create(&executor->lag)) != 0) {
+		_memory_free(executor->workers);
+		_memory_free(executor);
+		return ret;
+	}
+	for (i = 0; i < threads; ++i) {
+		worker = &executor->workers[i];
+		worker->executor = executor;
+		worker->thread_id = -1;
+		_tr50_mutex_create(&worker->mux);
+		_tr50_event_create(&worker->ready_evt);
+		_tr50_event_create(&worker->space_evt);
+	}
+	executor->worker_count = threads;
+	for (i = 0; i < threads; ++i) {
+		if ((ret = _thread_create(&executor->workers[i].thread, "TR50:Executor", _executor_worker, &executor->workers[i])) != 0) {
+			break;
+		}
+		executor->threads = i + 1;
+	}
+	if (ret != 0) {
+		_executor_delete(executor);
+		return ret;
+	}
+	*handle = executor;
+	return 0;
+}
+
+int _executor_submit(void *handle, unsigned int key, _EXECUTOR_TASK *task) {
+	_EXECUTOR *executor = (_EXECUTOR *)handle;
+	_EXECUTOR_WORKER *worker;
+	long long queued;
+	int waited = 0, from_worker = -1;
+
+	if (key == 0) {
+		key = (unsigned int)_atomic_add32(&executor->next, 1);
+	}
+	worker = &executor->workers[key % (unsigned int)executor->threads];
+	task->next = NULL;
+
+	_tr50_mutex_lock(worker->mux);
+	while (worker->depth >= executor->queue_depth && !executor->is_stopping) {
+		if (from_worker < 0) {
+			from_worker = _executor_is_worker(executor);
+		}
+		if (from_worker) {
+			break;
+		}
+		waited = 1;
+		++worker->space_waiters;
+		_tr50_event_reset(worker->space_evt);
+		_tr50_mutex_unlock(worker->mux);
+		_tr50_event_wait(worker->space_evt);
+		_tr50_mutex_lock(worker->mux);
+		--worker->space_waiters;
+	}
+	_atomic_add64(&executor->outstanding, 1);
+	task->enqueued_us = _time_now_us();
+	if (worker->tail) {
+		worker->tail->next = task;
+	} else {
+		worker->head = task;
+	}
+	worker->tail = task;
+	++worker->depth;
+	if (worker->idle) {
+		worker->idle = 0;
+		_tr50_event_signal(worker->ready_evt);
+	}
+	_tr50_mutex_unlock(worker->mux);
+
+	queued = _atomic_add32(&executor->queued, 1) + 1;
+	_atomic_max64(&executor->queued_max, queued);
+	if (waited) {
+		_atomic_add64(&executor->blocked, 1);
+	}
+	return 0;
+}
+
+void _executor_delete(void *handle) {
+	_EXECUTOR *executor = (_EXECUTOR *)handle;
+	_EXECUTOR_WORKER *worker;
+	int i;
+
+	executor->is_stopping = 1;
+	_executor_wake_all(executor);
+	for (i = 0; i < executor->threads; ++i) {
+		_thread_join(executor->workers[i].thread);
+		_thread_delete(executor->workers[i].thread);
+	}
+	for (i = 0; i < executor->worker_count; ++i) {
+		worker = &executor->workers[i];
+		_tr50_event_delete(worker->space_evt);
+		_tr50_event_delete(worker->ready_evt);
+		_tr50_mutex_delete(worker->mux);
+	}
+	_histogram_delete(executor->lag);
+	_memory_free(executor->workers);
+	_memory_free(executor);
+}
+
+void _executor_stats(void *handle, _EXECUTOR_STATS *stats) {
+	static const double percentiles[] = { 50, 99 };
+	_EXECUTOR *executor = (_EXECUTOR *)handle;
+	long long values[2];
+
+	_memory_memset(stats, 0, sizeof(_EXECUTOR_STATS));
+	stats->threads = executor->threads;
+	stats->queue_depth = executor->queue_depth;
+	stats->queued = _atomic_load32(&executor->queued);
+	stats->queued_max = (int)_atomic_load64(&executor->queued_max);
+	stats->executed = _atomic_load64(&executor->executed);
+	stats->blocked = _atomic_load64(&executor->blocked);
+	_histogram_percentiles(executor->lag, percentiles, values, 2, NULL);
+	stats->lag_p50_us = values[0];
+	stats->lag_p99_us = values[1];
+	stats->lag_max_us = _atomic_load64(&executor->lag->max);
+	stats->lag_sum_us = _atomic_load64(&executor->lag->sum);
+}
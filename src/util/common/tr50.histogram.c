@@ -0,0 +1,148 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <tr50/error.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/histogram.h>
+#include <tr50/util/memory.h>
+
+static int _histogram_index(long long value) {
+	int magnitude = 0;
+	long long v;
+
+	if (value < 0) {
+		value = 0;
+	}
+	if (value < HISTOGRAM_SUB_BUCKETS) {
+		return (int)value;
+	}
+	for (v = value; v >= 2 * HISTOGRAM_SUB_BUCKETS && magnitude < HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_SUB_BUCKET_BITS; v >>= 1) {
+		++magnitude;
+	}
+	if (v >= 2 * HISTOGRAM_SUB_BUCKETS) { // beyond the tracked range
+		return HISTOGRAM_BUCKETS - 1;
+	}
+	return HISTOGRAM_SUB_BUCKETS * (magnitude + 1) + (int)(v - HISTOGRAM_SUB_BUCKETS);
+}
+
+// Highest value that maps to the bucket.
+static long long _histogram_bucket_value(int index) {
+	int magnitude, sub;
+
+	if (index < HISTOGRAM_SUB_BUCKETS) {
+		return index;
+	}
+	magnitude = index / HISTOGRAM_SUB_BUCKETS - 1;
+	sub = index % HISTOGRAM_SUB_BUCKETS;
+	return ((long long)(HISTOGRAM_SUB_BUCKETS + sub + 1) << magnitude) - 1;
+}
+
+int _histogram_create(_HISTOGRAM **histogram) {
+	if ((*histogram = _memory_malloc(sizeof(_HISTOGRAM))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset((void *)*histogram, 0, sizeof(_HISTOGRAM));
+	return 0;
+}
+
+void _histogram_delete(_HISTOGRAM *histogram) {
+	if (histogram) {
+		_memory_free(histogram);
+	}
+}
+
+void _histogram_record(_HISTOGRAM *histogram, long long value) {
+	_atomic_add64(&histogram->counts[_histogram_index(value)], 1);
+	_atomic_max64(&histogram->max, value);
+	if (value > 0) {
+		_atomic_add64(&histogram->sum, value);
+	}
+}
+
+void _histogram_clear(_HISTOGRAM *histogram) {
+	int i;
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		_atomic_store64(&histogram->counts[i], 0);
+	}
+	_atomic_store64(&histogram->max, 0);
+	_atomic_store64(&histogram->sum, 0);
+}
+
+void _histogram_percentiles(_HISTOGRAM *histogram, const double *percentiles, long long *values, int percentile_count, long long *count) {
+	long long counts[HISTOGRAM_BUCKETS];
+	long long total = 0, seen, rank, max;
+	int i, p;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		counts[i] = _atomic_load64(&histogram->counts[i]);
+		total += counts[i];
+	}
+	max = _atomic_load64(&histogram->max);
+	if (count) {
+		*count = total;
+	}
+
+	for (p = 0; p < percentile_count; ++p) {
+		values[p] = 0;
+		if (total == 0) {
+			continue;
+		}
+		rank = (long long)(percentiles[p] / 100.0 * (double)total + 0.5);
+		if (rank < 1) {
+			rank = 1;
+		}
+		for (i = 0, seen = 0; i < HISTOGRAM_BUCKETS; ++i) {
+			seen += counts[i];
+			if (seen >= rank) {
+				values[p] = _histogram_bucket_value(i);
+				break;
+			}
+		}
+		if (values[p] > max) { // the bucket edge can overshoot the largest value seen
+			values[p] = max;
+		}
+	}
+}
+
+void _histogram_cumulative(_HISTOGRAM *histogram, const long long *bounds, long long *counts, int bound_count, long long *count, long long *sum) {
+	long long seen = 0;
+	int i, b = 0;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		while (b < bound_count && _histogram_bucket_value(i) > bounds[b]) {
+			counts[b++] = seen;
+		}
+		seen += _atomic_load64(&histogram->counts[i]);
+	}
+	while (b < bound_count) {
+		counts[b++] = seen;
+	}
+	if (count) {
+		*count = seen;
+	}
+	if (sum) {
+		*sum = _atomic_load64(&histogram->sum);
+	}
+}
@@ -27,6 +27,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <tr50/error.h>
+
 #include <tr50/util/json.h>
 #include <tr50/util/memory.h>
 #include <tr50/util/platform.h>
@@ -622,3 +624,221 @@ JSON *tr50_json_create_longlong_array(long long  *numbers, int count) { int i; J
 JSON *tr50_json_create_float_array(float *numbers, int count) { int i; JSON *n = 0, *p = 0, *a = tr50_json_create_array(); for (i = 0; i<count; i++) { n = tr50_json_create_number(numbers[i]); if (!i)a->child = n; else suffix_object(p, n); p = n; }return a; }
 JSON *tr50_json_create_double_array(double *numbers, int count) { int i; JSON *n = 0, *p = 0, *a = tr50_json_create_array(); for (i = 0; i<count; i++) { n = tr50_json_create_number(numbers[i]); if (!i)a->child = n; else suffix_object(p, n); p = n; }return a; }
 JSON *tr50_json_create_string_array(const char **strings, int count) { int i; JSON *n = 0, *p = 0, *a = tr50_json_create_array(); for (i = 0; i<count; i++) { n = tr50_json_create_string(strings[i]); if (!i)a->child = n; else suffix_object(p, n); p = n; }return a; }
+
+// Incremental parser: the text is fed in arbitrary chunks and only the scalar being read
+// (a string, number or literal) is ever buffered. Scalars are handed to parse_value() so
+// the resulting items are identical to tr50_json_parse()'s.
+#define JSON_STREAM_MAX_DEPTH	64
+#define JSON_STREAM_TOKEN_SIZE	64
+
+#define JSON_STREAM_VALUE	0	// expecting a value
+#define JSON_STREAM_KEY		1	// expecting an object key
+#define JSON_STREAM_COLON	2
+#define JSON_STREAM_NEXT	3	// expecting ',' or the end of the container
+#define JSON_STREAM_STRING	4
+#define JSON_STREAM_SCALAR	5	// number or literal
+#define JSON_STREAM_DONE	6
+#define JSON_STREAM_ERROR	7
+
+typedef struct {
+	JSON *root;
+	JSON *containers[JSON_STREAM_MAX_DEPTH];
+	JSON *last_child[JSON_STREAM_MAX_DEPTH];
+	int depth;
+	int state;
+	int empty_ok;		// container just opened, may close right away
+	int string_is_key;
+	int escaped;
+	char *key;
+	char *token;
+	int token_len;
+	int token_size;
+} _JSON_STREAM;
+
+void *_json_stream_create(void) {
+	_JSON_STREAM *stream = (_JSON_STREAM *)_memory_malloc(sizeof(_JSON_STREAM));
+	if (!stream) return 0;
+	_memory_memset(stream, 0, sizeof(_JSON_STREAM));
+	stream->state = JSON_STREAM_VALUE;
+	return stream;
+}
+
+void _json_stream_delete(void *handle) {
+	_JSON_STREAM *stream = (_JSON_STREAM *)handle;
+	if (!stream) return;
+	if (stream->root) tr50_json_delete(stream->root);
+	if (stream->key) _memory_free(stream->key);
+	if (stream->token) _memory_free(stream->token);
+	_memory_free(stream);
+}
+
+static int _json_stream_token_append(_JSON_STREAM *stream, char c) {
+	if (stream->token_len + 1 >= stream->token_size) {
+		int size = stream->token_size ? stream->token_size * 2 : JSON_STREAM_TOKEN_SIZE;
+		char *token = (char *)_memory_realloc(stream->token, size);
+		if (!token) return ERR_TR50_MALLOC;
+		stream->token = token;
+		stream->token_size = size;
+	}
+	stream->token[stream->token_len++] = c;
+	stream->token[stream->token_len] = 0;
+	return 0;
+}
+
+// Attach a finished item to the open container (or make it the root).
+static int _json_stream_add(_JSON_STREAM *stream, JSON *item) {
+	JSON *container;
+
+	if (stream->depth == 0) {
+		stream->root = item;
+	} else {
+		container = stream->containers[stream->depth - 1];
+		if (container->type == JSON_OBJECT) {
+			item->string = stream->key;
+			stream->key = 0;
+		}
+		if (stream->last_child[stream->depth - 1]) suffix_object(stream->last_child[stream->depth - 1], item);
+		else container->child = item;
+		stream->last_child[stream->depth - 1] = item;
+	}
+
+	if (item->type == JSON_OBJECT || item->type == JSON_ARRAY) {
+		if (stream->depth == JSON_STREAM_MAX_DEPTH) return ERR_TR50_JSON_INVALID;
+		stream->containers[stream->depth] = item;
+		stream->last_child[stream->depth] = 0;
+		++stream->depth;
+		stream->state = item->type == JSON_OBJECT ? JSON_STREAM_KEY : JSON_STREAM_VALUE;
+		stream->empty_ok = 1;
+	} else {
+		stream->state = stream->depth == 0 ? JSON_STREAM_DONE : JSON_STREAM_NEXT;
+	}
+	return 0;
+}
+
+static int _json_stream_finish_token(_JSON_STREAM *stream) {
+	JSON *item;
+	const char *end;
+
+	if (!(item = tr50_json_new_item())) return ERR_TR50_MALLOC;
+	end = parse_value(item, stream->token);
+	if (!end || end != stream->token + stream->token_len) {
+		tr50_json_delete(item);
+		return ERR_TR50_JSON_INVALID;
+	}
+	stream->token_len = 0;
+
+	if (stream->string_is_key) {
+		stream->string_is_key = 0;
+		stream->key = item->valuestring;
+		item->valuestring = 0;
+		tr50_json_delete(item);
+		stream->state = JSON_STREAM_COLON;
+		return 0;
+	}
+	return _json_stream_add(stream, item);
+}
+
+static int _json_stream_close(_JSON_STREAM *stream, int type) {
+	if (stream->depth == 0 || stream->containers[stream->depth - 1]->type != type) return ERR_TR50_JSON_INVALID;
+	--stream->depth;
+	stream->state = stream->depth == 0 ? JSON_STREAM_DONE : JSON_STREAM_NEXT;
+	return 0;
+}
+
+static int _json_stream_char(_JSON_STREAM *stream, char c) {
+	JSON *item;
+	int ret;
+
+	switch (stream->state) {
+	case JSON_STREAM_STRING:
+		if ((unsigned char)c < 32) return ERR_TR50_JSON_INVALID;
+		if ((ret = _json_stream_token_append(stream, c)) != 0) return ret;
+		if (stream->escaped) stream->escaped = 0;
+		else if (c == '\\') stream->escaped = 1;
+		else if (c == '\"') return _json_stream_finish_token(stream);
+		return 0;
+
+	case JSON_STREAM_SCALAR:
+		if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.') {
+			return _json_stream_token_append(stream, c);
+		}
+		if ((ret = _json_stream_finish_token(stream)) != 0) return ret;
+		return _json_stream_char(stream, c); // the terminator belongs to the next state.
+
+	case JSON_STREAM_DONE:
+		return 0; // like tr50_json_parse(), anything after the value is ignored.
+	}
+
+	if ((unsigned char)c <= 32) return 0;
+
+	switch (stream->state) {
+	case JSON_STREAM_VALUE:
+		if (c == ']' && stream->empty_ok) return _json_stream_close(stream, JSON_ARRAY);
+		stream->empty_ok = 0;
+		if (c == '{' || c == '[') {
+			if (!(item = tr50_json_new_item())) return ERR_TR50_MALLOC;
+			item->type = c == '{' ? JSON_OBJECT : JSON_ARRAY;
+			return _json_stream_add(stream, item); // attached even on failure, freed with the tree.
+		}
+		if (c == '\"') {
+			stream->state = JSON_STREAM_STRING;
+			return _json_stream_token_append(stream, c);
+		}
+		stream->state = JSON_STREAM_SCALAR;
+		return _json_stream_token_append(stream, c);
+
+	case JSON_STREAM_KEY:
+		if (c == '}' && stream->empty_ok) return _json_stream_close(stream, JSON_OBJECT);
+		stream->empty_ok = 0;
+		if (c != '\"') return ERR_TR50_JSON_INVALID;
+		stream->string_is_key = 1;
+		stream->state = JSON_STREAM_STRING;
+		return _json_stream_token_append(stream, c);
+
+	case JSON_STREAM_COLON:
+		if (c != ':') return ERR_TR50_JSON_INVALID;
+		stream->state = JSON_STREAM_VALUE;
+		return 0;
+
+	case JSON_STREAM_NEXT:
+		if (c == ',') {
+			stream->state = stream->containers[stream->depth - 1]->type == JSON_OBJECT ? JSON_STREAM_KEY : JSON_STREAM_VALUE;
+			return 0;
+		}
+		if (c == '}') return _json_stream_close(stream, JSON_OBJECT);
+		if (c == ']') return _json_stream_close(stream, JSON_ARRAY);
+		return ERR_TR50_JSON_INVALID;
+	}
+	return ERR_TR50_JSON_INVALID;
+}
+
+int _json_stream_feed(void *handle, const char *data, int data_len) {
+	_JSON_STREAM *stream = (_JSON_STREAM *)handle;
+	int i, ret;
+
+	if (stream->state == JSON_STREAM_ERROR) return ERR_TR50_JSON_INVALID;
+	for (i = 0; i < data_len; ++i) {
+		if ((ret = _json_stream_char(stream, data[i])) != 0) {
+			stream->state = JSON_STREAM_ERROR;
+			return ret;
+		}
+	}
+	return 0;
+}
+
+// Completes the parse; on success the caller owns *json.
+int _json_stream_finish(void *handle, JSON **json) {
+	_JSON_STREAM *stream = (_JSON_STREAM *)handle;
+	int ret;
+
+	if (stream->state == JSON_STREAM_SCALAR && stream->depth == 0) {
+		if ((ret = _json_stream_finish_token(stream)) != 0) {
+			stream->state = JSON_STREAM_ERROR;
+			return ret;
+		}
+	}
+	if (stream->state != JSON_STREAM_DONE) return ERR_TR50_JSON_INVALID;
+	*json = stream->root;
+	stream->root = 0;
+	return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/log.h>
+#include <tr50/util/memory.h>
+#include <tr50/util/thread.h>
+#include <tr50/util/time.h>
+
+// Records are handed to a single writer thread through a bounded multi-producer ring,
+// so logging never blocks the calling thread on stdout. When the ring is full the record
+// is dropped and counted; the writer reports the count once it catches up.
+#define LOG_RING_RECORDS		256
+#define LOG_RECORD_SIZE			1024
+#define LOG_WRITER_IDLE_MS		10
+
+#define LOG_RECURRING_SITES		64
+
+#define LOG_STATE_IDLE			0
+#define LOG_STATE_STARTING		1
+#define LOG_STATE_RUNNING		2
+#define LOG_STATE_SYNC			3
+
+typedef struct {
+	volatile long long sequence;
+	int len;
+	char text[LOG_RECORD_SIZE];
+} _LOG_RECORD;
+
+// A site is claimed by the state word and published once file and line are in place, so no
+// caller ever sees half of its key.
+#define LOG_SITE_FREE		0
+#define LOG_SITE_CLAIMED	1
+#define LOG_SITE_PUBLISHED	2
+
+typedef struct {
+	volatile int state;
+	const char *file;
+	int line;
+	volatile int hash;
+	volatile int suppressed;
+	volatile long long last_logged;
+} _LOG_RECURRING_SITE;
+
+static _LOG_RECORD *g_log_ring = NULL;
+static volatile long long g_log_enqueue = 0;
+static volatile long long g_log_dequeue = 0;
+static volatile long long g_log_dropped = 0;
+static volatile int g_log_state = LOG_STATE_IDLE;
+static volatile int g_log_stopping = 0;
+static void *g_log_thread = NULL;
+
+static _LOG_RECURRING_SITE g_log_recurring_sites[LOG_RECURRING_SITES];
+
+static void _log_output(const char *text, int len) {
+	fwrite(text, 1, len, stdout);
+	fputc('\n', stdout);
+}
+
+static int _log_drain(void) {
+	_LOG_RECORD *record;
+	int count = 0;
+
+	for (;;) {
+		record = &g_log_ring[g_log_dequeue & (LOG_RING_RECORDS - 1)];
+		if (_atomic_load64(&record->sequence) != g_log_dequeue + 1) {
+			break;
+		}
+		_log_output(record->text, record->len);
+		_atomic_store64(&record->sequence, g_log_dequeue + LOG_RING_RECORDS);
+		_atomic_add64(&g_log_dequeue, 1);
+		++count;
+	}
+	return count;
+}
+
+static void *_log_writer(void *arg) {
+	long long dropped;
+	char buffer[64];
+	int len;
+
+	for (;;) {
+		if (_log_drain() > 0) {
+			if ((dropped = _atomic_load64(&g_log_dropped)) > 0) {
+				_atomic_add64(&g_log_dropped, -dropped);
+				len = snprintf(buffer, sizeof(buffer), "log: [%lld] records dropped", dropped);
+				_log_output(buffer, len);
+			}
+			fflush(stdout);
+		} else if (_atomic_load32(&g_log_stopping)) {
+			break;
+		} else {
+			_thread_sleep(LOG_WRITER_IDLE_MS);
+		}
+	}
+	fflush(stdout);
+	return NULL;
+}
+
+static void _log_stop(void) {
+	if (!_atomic_cas32(&g_log_state, LOG_STATE_RUNNING, LOG_STATE_SYNC)) {
+		return;
+	}
+	_atomic_store32(&g_log_stopping, 1);
+	_thread_join(g_log_thread);
+	_thread_delete(g_log_thread);
+	g_log_thread = NULL;
+	// records pushed by a racing producer after the writer left
+	_log_drain();
+	fflush(stdout);
+}
+
+static void _log_start(void) {
+	int i;
+
+	if ((g_log_ring = _memory_malloc(sizeof(_LOG_RECORD) * LOG_RING_RECORDS)) == NULL) {
+		_atomic_store32(&g_log_state, LOG_STATE_SYNC);
+		return;
+	}
+	for (i = 0; i < LOG_RING_RECORDS; ++i) {
+		g_log_ring[i].sequence = i;
+	}
+	if (_thread_create(&g_log_thread, "TR50:Log", _log_writer, NULL) != 0) {
+		_memory_free(g_log_ring);
+		g_log_ring = NULL;
+		_atomic_store32(&g_log_state, LOG_STATE_SYNC);
+		return;
+	}
+	atexit(_log_stop);
+	_atomic_store32(&g_log_state, LOG_STATE_RUNNING);
+}
+
+static int _log_push(const char *text, int len) {
+	_LOG_RECORD *record;
+	long long pos = _atomic_load64(&g_log_enqueue);
+	long long diff;
+
+	for (;;) {
+		record = &g_log_ring[pos & (LOG_RING_RECORDS - 1)];
+		diff = _atomic_load64(&record->sequence) - pos;
+		if (diff == 0) {
+			if (_atomic_cas64(&g_log_enqueue, pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) { // full
+			_atomic_add64(&g_log_dropped, 1);
+			return -1;
+		}
+		pos = _atomic_load64(&g_log_enqueue);
+	}
+	memcpy(record->text, text, len);
+	record->len = len;
+	_atomic_store64(&record->sequence, pos + 1);
+	return 0;
+}
+
+void _log_write(int type, const char *text, int len) {
+	int state = _atomic_load32(&g_log_state);
+
+	if (len < 0) {
+		len = (int)strlen(text);
+	}
+	if (len > LOG_RECORD_SIZE) {
+		len = LOG_RECORD_SIZE;
+	}
+	if (state == LOG_STATE_IDLE && _atomic_cas32(&g_log_state, LOG_STATE_IDLE, LOG_STATE_STARTING)) {
+		_log_start();
+		state = _atomic_load32(&g_log_state);
+	}
+	if (state != LOG_STATE_RUNNING) { // not started yet, or the writer could not be created
+		_log_output(text, len);
+		return;
+	}
+	_log_push(text, len);
+}
+
+void log_flush(void) {
+	int i;
+
+	if (_atomic_load32(&g_log_state) != LOG_STATE_RUNNING) {
+		fflush(stdout);
+		return;
+	}
+	for (i = 0; i < 1000 && _atomic_load64(&g_log_dequeue) != _atomic_load64(&g_log_enqueue); ++i) {
+		_thread_sleep(1);
+	}
+}
+
+static int _log_hash(const char *text) {
+	unsigned int hash = 2166136261u;
+
+	while (*text) {
+		hash = (hash ^ (unsigned char)*text++) * 16777619u;
+	}
+	return (int)(hash | 1);
+}
+
+int _log_recurring_check(const char *file, int line, int minutes_between_logs, int check_for_changes, const char *text, int *suppressed) {
+	_LOG_RECURRING_SITE *site;
+	long long now = _time_now();
+	long long last;
+	int hash = check_for_changes ? _log_hash(text) : 0;
+	int start = (int)(((size_t)file >> 3) ^ ((unsigned int)line * 31u)) & (LOG_RECURRING_SITES - 1);
+	int i;
+
+	*suppressed = 0;
+	for (i = 0; i < LOG_RECURRING_SITES; ++i) {
+		site = &g_log_recurring_sites[(start + i) & (LOG_RECURRING_SITES - 1)];
+		if (_atomic_load32(&site->state) == LOG_SITE_FREE) {
+			if (!_atomic_cas32(&site->state, LOG_SITE_FREE, LOG_SITE_CLAIMED)) {
+				--i; // lost the slot, it may have gone to this very site
+				continue;
+			}
+			site->file = file;
+			site->line = line;
+			site->hash = hash;
+			_atomic_store64(&site->last_logged, now);
+			_atomic_store32(&site->state, LOG_SITE_PUBLISHED);
+			return 1;
+		}
+		while (_atomic_load32(&site->state) != LOG_SITE_PUBLISHED) {
+			_thread_sleep(0); // its key is being written
+		}
+		if (site->file != file || site->line != line) {
+			continue;
+		}
+
+		if (check_for_changes && _atomic_load32(&site->hash) != hash) {
+			_atomic_store32(&site->hash, hash);
+			_atomic_store64(&site->last_logged, now);
+			*suppressed = _atomic_exchange32(&site->suppressed, 0);
+			return 1;
+		}
+		last = _atomic_load64(&site->last_logged);
+		if (now - last >= (long long)minutes_between_logs * 60000 && _atomic_cas64(&site->last_logged, last, now)) {
+			*suppressed = _atomic_exchange32(&site->suppressed, 0);
+			return 1;
+		}
+		_atomic_add32(&site->suppressed, 1);
+		return 0;
+	}
+	return 1; // table full, log everything rather than nothing
+}
@@ -0,0 +1,343 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/tr50.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/memory.h>
+
+#define MEMORY_SITES_MAX		2048	// power of two
+#define MEMORY_SUBSYSTEM_OTHER	4
+#define MEMORY_SUBSYSTEMS		5
+
+typedef struct {
+	volatile long long	live_bytes;
+	volatile long long	live_count;
+	volatile long long	total_count;
+	volatile long long	total_bytes;
+	volatile long long	peak_bytes;
+} _MEMORY_COUNTERS;
+
+// Counts and totals of subsystems and the process are summed from the sites when read; only the
+// live bytes are kept as they go, since a peak cannot be summed afterwards.
+typedef struct {
+	volatile long long	live_bytes;
+	volatile long long	peak_bytes;
+} _MEMORY_LEVEL;
+
+typedef struct {
+	const char * volatile	file;	// set last, once the rest is in place
+	const char				*name;	// file from src/ on
+	int						line;
+	int						subsystem;
+	_MEMORY_COUNTERS		counters;
+} _MEMORY_SITE;
+
+static const char *g_memory_subsystem_names[MEMORY_SUBSYSTEMS] = { "mqtt", "json", "pending", "compress", "other" };
+
+volatile int g_memory_accounting;
+
+static _MEMORY_SITE g_memory_sites[MEMORY_SITES_MAX];
+static volatile int g_memory_sites_lock;
+static _MEMORY_LEVEL g_memory_subsystems[MEMORY_SUBSYSTEMS];
+static _MEMORY_LEVEL g_memory_total;
+
+static const char *_memory_site_name(const char *file) {
+	const char *name = file, *p;
+
+	for (p = file; (p = strstr(p, "src")) != NULL; ++p) {
+		if (p[3] == '/' || p[3] == '\\') {
+			name = p + 4;
+		}
+	}
+	return name;
+}
+
+// By the file name: mqtt.*, *.json.*, compress, and pending for messages and the requests that
+// wait in the pending table.
+static int _memory_subsystem(const char *file) {
+	const char *name = file, *p;
+
+	for (p = file; *p; ++p) {
+		if (*p == '/' || *p == '\\') {
+			name = p + 1;
+		}
+	}
+	if (strncmp(name, "mqtt.", 5) == 0) {
+		return 0;
+	}
+	if (strstr(name, ".json.")) {
+		return 1;
+	}
+	if (strstr(name, "pending") || strstr(name, "tr50.message.") || strstr(name, "tr50.api.async.")) {
+		return 2;
+	}
+	if (strstr(name, "compress")) {
+		return 3;
+	}
+	return MEMORY_SUBSYSTEM_OTHER;
+}
+
+// __FILE__ is a literal, so its address stands in for the name. Returns the site id, 0 when full.
+static int _memory_site_find(const char *file, int line) {
+	unsigned int hash = ((unsigned int)((size_t)file >> 3) * 31u + (unsigned int)line) & (MEMORY_SITES_MAX - 1);
+	unsigned int i, slot;
+	_MEMORY_SITE *site;
+
+	for (i = 0; i < MEMORY_SITES_MAX; ++i) {
+		slot = (hash + i) & (MEMORY_SITES_MAX - 1);
+		site = &g_memory_sites[slot];
+		if (site->file == NULL) {
+			while (!_atomic_cas32(&g_memory_sites_lock, 0, 1)) {
+			}
+			if (site->file == NULL) {
+				site->name = _memory_site_name(file);
+				site->line = line;
+				site->subsystem = _memory_subsystem(file);
+				_atomic_fence();
+				site->file = file;
+			}
+			_atomic_store32(&g_memory_sites_lock, 0);
+		}
+		if (site->file == file && site->line == line) {
+			return (int)slot + 1;
+		}
+	}
+	return 0;
+}
+
+static void _memory_counters_add(_MEMORY_COUNTERS *counters, long long size) {
+	long long live = _atomic_add64(&counters->live_bytes, size) + size;
+
+	_atomic_add64(&counters->live_count, 1);
+	_atomic_add64(&counters->total_count, 1);
+	_atomic_add64(&counters->total_bytes, size);
+	_atomic_max64(&counters->peak_bytes, live);
+}
+
+static void _memory_level_add(_MEMORY_LEVEL *level, long long size) {
+	long long live = _atomic_add64(&level->live_bytes, size) + size;
+
+	_atomic_max64(&level->peak_bytes, live);
+}
+
+int _memory_account_alloc(size_t size, const char *file, int line) {
+	int id = _memory_site_find(file, line);
+	_MEMORY_SITE *site;
+
+	if (id == 0) {
+		return 0;
+	}
+	site = &g_memory_sites[id - 1];
+	_memory_counters_add(&site->counters, (long long)size);
+	_memory_level_add(&g_memory_subsystems[site->subsystem], (long long)size);
+	_memory_level_add(&g_memory_total, (long long)size);
+	return id;
+}
+
+void _memory_account_free(int id, size_t size) {
+	_MEMORY_SITE *site = &g_memory_sites[id - 1];
+
+	_atomic_add64(&site->counters.live_bytes, -(long long)size);
+	_atomic_add64(&site->counters.live_count, -1);
+	_atomic_add64(&g_memory_subsystems[site->subsystem].live_bytes, -(long long)size);
+	_atomic_add64(&g_memory_total.live_bytes, -(long long)size);
+}
+
+int tr50_memory_accounting_start() {
+	if (!_memory_accounting_supported()) {
+		return ERR_TR50_NOT_SUPPORTED;
+	}
+	_atomic_store32(&g_memory_accounting, 1);
+	return 0;
+}
+
+int tr50_memory_accounting_stop() {
+	_atomic_store32(&g_memory_accounting, 0);
+	return 0;
+}
+
+static void _memory_site_fill(TR50_MEMORY_SITE *out, _MEMORY_COUNTERS *counters, const char *file, int line, const char *subsystem) {
+	out->file = file;
+	out->line = line;
+	out->subsystem = subsystem;
+	out->live_bytes = _atomic_load64(&counters->live_bytes);
+	out->live_count = _atomic_load64(&counters->live_count);
+	out->total_count = _atomic_load64(&counters->total_count);
+	out->total_bytes = _atomic_load64(&counters->total_bytes);
+	out->peak_bytes = _atomic_load64(&counters->peak_bytes);
+}
+
+// subsystem -1 sums every site
+static void _memory_level_fill(TR50_MEMORY_SITE *out, int subsystem) {
+	_MEMORY_LEVEL *level = subsystem < 0 ? &g_memory_total : &g_memory_subsystems[subsystem];
+	_MEMORY_SITE *site;
+	int i;
+
+	memset(out, 0, sizeof(*out));
+	out->subsystem = subsystem < 0 ? NULL : g_memory_subsystem_names[subsystem];
+	for (i = 0; i < MEMORY_SITES_MAX; ++i) {
+		site = &g_memory_sites[i];
+		if (site->file != NULL && (subsystem < 0 || site->subsystem == subsystem)) {
+			out->live_count += _atomic_load64(&site->counters.live_count);
+			out->total_count += _atomic_load64(&site->counters.total_count);
+			out->total_bytes += _atomic_load64(&site->counters.total_bytes);
+		}
+	}
+	out->live_bytes = _atomic_load64(&level->live_bytes);
+	out->peak_bytes = _atomic_load64(&level->peak_bytes);
+}
+
+static int _memory_site_compare(const void *a, const void *b) {
+	const TR50_MEMORY_SITE *x = (const TR50_MEMORY_SITE *)a, *y = (const TR50_MEMORY_SITE *)b;
+
+	if (x->live_bytes != y->live_bytes) {
+		return x->live_bytes > y->live_bytes ? -1 : 1;
+	}
+	return x->total_count > y->total_count ? -1 : x->total_count < y->total_count;
+}
+
+// Copies the used sites, largest live bytes first; the array is released with _memory_free().
+static int _memory_sites_snapshot(TR50_MEMORY_SITE **sites, int *count) {
+	_MEMORY_SITE *site;
+	int i, used = 0;
+
+	for (i = 0; i < MEMORY_SITES_MAX; ++i) {
+		used += g_memory_sites[i].file != NULL;
+	}
+	// sites added from here on wait for the next call
+	if ((*sites = (TR50_MEMORY_SITE *)_memory_malloc(sizeof(TR50_MEMORY_SITE) * (used + 1))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	*count = 0;
+	for (i = 0; i < MEMORY_SITES_MAX && *count < used; ++i) {
+		site = &g_memory_sites[i];
+		if (site->file != NULL) {
+			_memory_site_fill(&(*sites)[(*count)++], &site->counters, site->name, site->line, g_memory_subsystem_names[site->subsystem]);
+		}
+	}
+	qsort(*sites, *count, sizeof(TR50_MEMORY_SITE), _memory_site_compare);
+	return 0;
+}
+
+int tr50_memory_site_for_each(tr50_memory_site_callback callback, void *custom) {
+	TR50_MEMORY_SITE *sites;
+	int i, count, ret;
+
+	if (callback == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	if ((ret = _memory_sites_snapshot(&sites, &count)) != 0) {
+		return ret;
+	}
+	for (i = 0; i < count; ++i) {
+		callback(&sites[i], custom);
+	}
+	_memory_free(sites);
+	return 0;
+}
+
+int tr50_memory_subsystem_for_each(tr50_memory_site_callback callback, void *custom) {
+	TR50_MEMORY_SITE subsystem;
+	int i;
+
+	if (callback == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	for (i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+		_memory_level_fill(&subsystem, i);
+		callback(&subsystem, custom);
+	}
+	return 0;
+}
+
+int tr50_memory_total(TR50_MEMORY_SITE *total) {
+	if (total == NULL) {
+		return ERR_TR50_PARMS;
+	}
+	_memory_level_fill(total, -1);
+	return 0;
+}
+
+static JSON *_memory_site_to_json(const TR50_MEMORY_SITE *site) {
+	JSON *item = tr50_json_create_object();
+
+	if (site->file) {
+		tr50_json_add_string_to_object(item, "file", site->file);
+		tr50_json_add_number_to_object(item, "line", site->line);
+	}
+	if (site->subsystem) {
+		tr50_json_add_string_to_object(item, "subsystem", site->subsystem);
+	}
+	tr50_json_add_item_to_object(item, "liveBytes", tr50_json_create_integer(site->live_bytes));
+	tr50_json_add_item_to_object(item, "liveCount", tr50_json_create_integer(site->live_count));
+	tr50_json_add_item_to_object(item, "totalCount", tr50_json_create_integer(site->total_count));
+	tr50_json_add_item_to_object(item, "totalBytes", tr50_json_create_integer(site->total_bytes));
+	tr50_json_add_item_to_object(item, "peakBytes", tr50_json_create_integer(site->peak_bytes));
+	return item;
+}
+
+int tr50_memory_dump(int top, char **json, int *json_len) {
+	TR50_MEMORY_SITE *sites, entry;
+	JSON *root, *list;
+	int i, count, ret;
+
+	if (json == NULL || top < 0) {
+		return ERR_TR50_PARMS;
+	}
+	if ((ret = _memory_sites_snapshot(&sites, &count)) != 0) {
+		return ret;
+	}
+	root = tr50_json_create_object();
+	tr50_json_add_item_to_object(root, "enabled", g_memory_accounting ? tr50_json_create_true() : tr50_json_create_false());
+	tr50_memory_total(&entry);
+	tr50_json_add_item_to_object(root, "total", _memory_site_to_json(&entry));
+
+	list = tr50_json_create_array();
+	for (i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+		_memory_level_fill(&entry, i);
+		tr50_json_add_item_to_array(list, _memory_site_to_json(&entry));
+	}
+	tr50_json_add_item_to_object(root, "subsystems", list);
+
+	list = tr50_json_create_array();
+	for (i = 0; i < count && (top == 0 || i < top); ++i) {
+		tr50_json_add_item_to_array(list, _memory_site_to_json(&sites[i]));
+	}
+	tr50_json_add_item_to_object(root, "sites", list);
+	_memory_free(sites);
+
+	*json = tr50_json_print_unformatted(root);
+	tr50_json_delete(root);
+	if (*json == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	if (json_len) {
+		*json_len = (int)strlen(*json);
+	}
+	return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2014 ILS Technology, LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <tr50/util/atomic.h>
+#include <tr50/util/pool.h>
+
+#define POOL_SMALL_CLASSES		8	// 16 byte steps up to 128
+#define POOL_LARGE				POOL_CLASSES
+#define POOL_LOOKUP_SIZE		4096
+
+typedef struct {
+	volatile int	lock;
+	void			*head;
+} _POOL_CLASS;
+
+static _POOL_CLASS g_pool_classes[POOL_CLASSES];
+static volatile long long g_pool_chunk_bytes;
+static volatile long long g_pool_large_bytes;
+
+#define _pool_next(block)		(*(void **)(block))
+
+// Class of every 16 byte step up to POOL_LOOKUP_SIZE, filled on first use.
+static unsigned char g_pool_lookup[POOL_LOOKUP_SIZE / 16];
+static volatile int g_pool_lookup_ready;
+
+static int _pool_class_index_slow(size_t size) {
+	int bits = 0;
+	size_t v;
+
+	if (size <= 16 * POOL_SMALL_CLASSES) {
+		return (int)((size - 1) >> 4);
+	}
+	for (v = size - 1; v > 1; v >>= 1) {
+		++bits;
+	}
+	return POOL_SMALL_CLASSES + (bits - 7) * 4 + (int)(((size - 1) >> (bits - 2)) & 3);
+}
+
+static int _pool_class_index(size_t size) {
+	int i;
+
+	if (size == 0) {
+		size = 1;
+	}
+	if (size > POOL_LOOKUP_SIZE) {
+		return _pool_class_index_slow(size);
+	}
+	if (!g_pool_lookup_ready) {
+		// racing threads write the same values
+		for (i = 0; i < POOL_LOOKUP_SIZE / 16; ++i) {
+			g_pool_lookup[i] = (unsigned char)_pool_class_index_slow((size_t)(i + 1) * 16);
+		}
+		_atomic_fence();
+		g_pool_lookup_ready = 1;
+	}
+	return g_pool_lookup[(size - 1) >> 4];
+}
+
+static size_t _pool_class_size(int index) {
+	int bits;
+
+	if (index < POOL_SMALL_CLASSES) {
+		return (size_t)(index + 1) << 4;
+	}
+	bits = 7 + (index - POOL_SMALL_CLASSES) / 4;
+	return (size_t)(5 + (index - POOL_SMALL_CLASSES) % 4) << (bits - 2);
+}
+
+static void _pool_lock(_POOL_CLASS *pool_class) {
+	while (!_atomic_cas32(&pool_class->lock, 0, 1)) {
+		while (pool_class->lock) {
+		}
+	}
+}
+
+static void _pool_unlock(_POOL_CLASS *pool_class) {
+	_atomic_store32(&pool_class->lock, 0);
+}
+
+// Carves a new chunk into a list of blocks of the class; returns the list and its length.
+static void *_pool_carve(int index, int *count) {
+	size_t stride = sizeof(_POOL_HEADER) + _pool_class_size(index);
+	int blocks = (int)(POOL_CHUNK_SIZE / stride), i;
+	char *chunk, *block;
+	void *head = NULL;
+
+	if (blocks < 4) {
+		blocks = 4;
+	}
+	if ((chunk = (char *)malloc(stride * blocks)) == NULL) {
+		*count = 0;
+		return NULL;
+	}
+	_atomic_add64(&g_pool_chunk_bytes, (long long)(stride * blocks));
+	for (i = blocks - 1; i >= 0; --i) {
+		block = chunk + stride * i + sizeof(_POOL_HEADER);
+		_pool_header(block)->info.index = index;
+		_pool_next(block) = head;
+		head = block;
+	}
+	*count = blocks;
+	return head;
+}
+
+// Takes up to want blocks off the shared list, carving a chunk when it is empty.
+static void *_pool_take(int index, int want, int *count) {
+	_POOL_CLASS *pool_class = &g_pool_classes[index];
+	void *head, *tail;
+	int taken = 1;
+
+	_pool_lock(pool_class);
+	if ((head = pool_class->head) != NULL) {
+		for (tail = head; taken < want && _pool_next(tail); tail = _pool_next(tail)) {
+			++taken;
+		}
+		pool_class->head = _pool_next(tail);
+		_pool_next(tail) = NULL;
+		_pool_unlock(pool_class);
+		*count = taken;
+		return head;
+	}
+	_pool_unlock(pool_class);
+	return _pool_carve(index, count);
+}
+
+// Puts a list of count blocks ending at tail back on the shared list.
+static void _pool_give(int index, void *head, void *tail) {
+	_POOL_CLASS *pool_class = &g_pool_classes[index];
+
+	_pool_lock(pool_class);
+	_pool_next(tail) = pool_class->head;
+	pool_class->head = head;
+	_pool_unlock(pool_class);
+}
+
+static void *_pool_large_malloc(size_t size) {
+	_POOL_HEADER *header;
+
+	if ((header = (_POOL_HEADER *)malloc(sizeof(_POOL_HEADER) + size)) == NULL) {
+		return NULL;
+	}
+	header->info.size = size;
+	header->info.index = POOL_LARGE;
+	header->info.site = 0;
+	_atomic_add64(&g_pool_large_bytes, (long long)size);
+	return header + 1;
+}
+
+void *_pool_malloc(_POOL_CACHE *cache, size_t size) {
+	void *block;
+	int index, count;
+
+	if (size > POOL_MAX_SIZE) {
+		return _pool_large_malloc(size);
+	}
+	index = _pool_class_index(size);
+	if (cache == NULL) {
+		if ((block = _pool_take(index, 1, &count)) != NULL && _pool_next(block)) {
+			// a fresh chunk; the rest goes to the shared list
+			void *tail;
+
+			for (tail = _pool_next(block); _pool_next(tail); tail = _pool_next(tail)) {
+			}
+			_pool_give(index, _pool_next(block), tail);
+		}
+	} else {
+		if (cache->heads[index] == NULL) {
+			cache->heads[index] = _pool_take(index, POOL_BATCH, &cache->counts[index]);
+		}
+		if ((block = cache->heads[index]) != NULL) {
+			cache->heads[index] = _pool_next(block);
+			--cache->counts[index];
+		}
+	}
+	if (block) {
+		_pool_header(block)->info.size = size;
+		_pool_header(block)->info.site = 0;
+	}
+	return block;
+}
+
+void _pool_free(_POOL_CACHE *cache, void *ptr) {
+	void *tail;
+	int index, i;
+
+	if (ptr == NULL) {
+		return;
+	}
+	index = _pool_header(ptr)->info.index;
+	if (index == POOL_LARGE) {
+		_atomic_add64(&g_pool_large_bytes, -(long long)_pool_header(ptr)->info.size);
+		free(_pool_header(ptr));
+		return;
+	}
+	if (cache == NULL) {
+		_pool_next(ptr) = NULL;
+		_pool_give(index, ptr, ptr);
+		return;
+	}
+	_pool_next(ptr) = cache->heads[index];
+	cache->heads[index] = ptr;
+	if (++cache->counts[index] < 2 * POOL_BATCH) {
+		return;
+	}
+	// keep one batch, hand the other back
+	for (tail = ptr, i = 1; i < POOL_BATCH; ++i) {
+		tail = _pool_next(tail);
+	}
+	cache->heads[index] = _pool_next(tail);
+	cache->counts[index] -= POOL_BATCH;
+	_pool_give(index, ptr, tail);
+}
+
+void *_pool_realloc(_POOL_CACHE *cache, void *ptr, size_t size) {
+	_POOL_HEADER *header;
+	size_t old_size;
+	void *grown;
+
+	if (ptr == NULL) {
+		return _pool_malloc(cache, size);
+	}
+	header = _pool_header(ptr);
+	old_size = header->info.size;
+	if (header->info.index == POOL_LARGE) {
+		if (size > POOL_MAX_SIZE) {
+			if ((header = (_POOL_HEADER *)realloc(header, sizeof(_POOL_HEADER) + size)) == NULL) {
+				return NULL;
+			}
+			header->info.size = size;
+			_atomic_add64(&g_pool_large_bytes, (long long)size - (long long)old_size);
+			return header + 1;
+		}
+	} else if (size <= _pool_class_size(header->info.index)) {
+		header->info.size = size;
+		return ptr;
+	}
+	if ((grown = _pool_malloc(cache, size)) == NULL) {
+		return NULL;
+	}
+	memcpy(grown, ptr, old_size < size ? old_size : size);
+	_pool_free(cache, ptr);
+	return grown;
+}
+
+_POOL_CACHE *_pool_cache_create() {
+	_POOL_CACHE *cache;
+
+	if ((cache = (_POOL_CACHE *)_pool_malloc(NULL, sizeof(_POOL_CACHE))) != NULL) {
+		memset(cache, 0, sizeof(_POOL_CACHE));
+	}
+	return cache;
+}
+
+void _pool_cache_delete(_POOL_CACHE *cache) {
+	void *tail;
+	int index;
+
+	if (cache == NULL) {
+		return;
+	}
+	for (index = 0; index < POOL_CLASSES; ++index) {
+		if (cache->heads[index]) {
+			for (tail = cache->heads[index]; _pool_next(tail); tail = _pool_next(tail)) {
+			}
+			_pool_give(index, cache->heads[index], tail);
+		}
+	}
+	_pool_free(NULL, cache);
+}
+
+void _pool_stats(long long *chunk_bytes, long long *large_bytes) {
+	if (chunk_bytes) {
+		*chunk_bytes = _atomic_load64(&g_pool_chunk_bytes);
+	}
+	if (large_bytes) {
+		*large_bytes = _atomic_load64(&g_pool_large_bytes);
+	}
+}
@@ -41,19 +41,27 @@ void log_filter_maximum_log_level(int level) {
 	g_log_filter_level = level;
 }
 
-void _log_vsnprintf(char *buffer, int len, const char *msg, va_list args) {
-	vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+int _log_vsnprintf(char *buffer, int len, const char *msg, va_list args) {
+	int ret = vsnprintf(buffer, len, msg, args);
+
+	// older runtimes return -1 instead of the untruncated length
+	if (ret < 0 || ret >= len) {
+		buffer[len - 1] = 0;
+		ret = len - 1;
+	}
+	return ret;
 }
 
 void _log_this_internal(int type, const char *file, int line, const char *msg, va_list args) {
 	char buffer[LOG_BUFFER_SIZE];
+	int len;
 
 	if (type > g_log_filter_level) {
 		return;
 	}
 
-	buffer[LOG_BUFFER_SIZE - 1] = 0;
-	printf("\n");
+	len = _log_vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+	_log_write(type, buffer, len);
 }
 
 void _log_this(int type, const char *file, int line, const char *msg, ...) {
@@ -65,10 +73,33 @@ void _log_this(int type, const char *file, int line, const char *msg, ...) {
 }
 
 void log_recurring(int type, const char *filename, int line, int minutes_between_logs, int check_for_changes, const char *msg, ...) {
+	char buffer[LOG_BUFFER_SIZE];
+	int suppressed;
 	va_list args;
-	va_start(args, msg);
-	_log_this_internal(type, filename, line, msg, args);
-	va_end(args);
+
+	if (type > g_log_filter_level) {
+		return;
+	}
+
+	// a change can only be told from the text; otherwise the message is formatted once it is due
+	if (check_for_changes) {
+		va_start(args, msg);
+		_log_vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+		va_end(args);
+	}
+	if (!_log_recurring_check(filename, line, minutes_between_logs, check_for_changes, check_for_changes ? buffer : NULL, &suppressed)) {
+		return;
+	}
+	if (!check_for_changes) {
+		va_start(args, msg);
+		_log_vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+		va_end(args);
+	}
+	if (suppressed > 0) {
+		_log_this(type, filename, line, "Recurring[%d]: %s", suppressed, buffer);
+		return;
+	}
+	_log_write(type, buffer, -1);
 }
 
 char *_log_hexdump(const char *msg, const void *data, int len) {
@@ -123,10 +154,21 @@ char *_log_hexdump(const char *msg, const void *data, int len) {
 
 void log_hexdump(int type, const char *msg, const char *data, int len) {
 	char *dump;
+	char *line;
+	char *next;
+
 	if (type > g_log_filter_level) {
 		return;
 	}
-	dump = _log_hexdump(msg, data, len);
-	printf("deviceWISE -%d- %s\n", type, dump);
+	if ((dump = _log_hexdump(msg, data, len)) == NULL) {
+		return;
+	}
+	// one record per line so a large dump does not get truncated by the log ring
+	for (line = dump; line != NULL; line = next) {
+		if ((next = strchr(line, '\n')) != NULL) {
+			*next++ = 0;
+		}
+		_log_write(type, line, -1);
+	}
 	_memory_free(dump);
 }
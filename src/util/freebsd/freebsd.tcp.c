@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -460,6 +461,142 @@ int _tcp_recv(void *handle, char *buffer, int *length, int timeout) {
 	}
 }
 
+int _tcp_send_file(void *handle, FILE *fp, long long offset, int length, int timeout) {
+	ABSTRACT_SOCKET *sock = handle;
+	fd_set	sockSet;
+	struct timeval to;
+	off_t sent;
+	int current_sent = 0;
+	int tint = 1;
+	int ret;
+
+	if (handle == NULL || fp == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+
+	// TLS has to see the bytes, the caller sends those itself
+	if (sock->is_ssl) {
+		return ERR_TR50_NOT_SUPPORTED;
+	}
+
+	if (timeout < -1) {
+		sock->err = errno;
+		return ERR_TR50_SOCK_OTHER;
+	}
+
+	// sendfile() has no MSG_NOSIGNAL, a peer that hangs up must not raise SIGPIPE in the application
+	setsockopt(sock->s, SOL_SOCKET, SO_NOSIGPIPE, (char *)&tint, sizeof(tint));
+
+	while (current_sent < length) {
+		if (timeout > 0) {
+			to.tv_usec = (timeout % 1000) * 1000;
+			to.tv_sec = timeout / 1000;
+			FD_ZERO(&sockSet);
+			FD_SET(sock->s, &sockSet);
+
+			if ((ret = select(sock->s + 1, NULL, &sockSet, NULL, &to)) == 0) {
+				sock->err = ERR_TR50_SOCK_TIMEOUT;
+				return ERR_TR50_SOCK_TIMEOUT;
+			} else if (ret == -1) {
+				sock->err = errno;
+				return ERR_TR50_SOCK_SELECT_FAILED;
+			}
+		}
+
+		sent = 0;
+		ret = sendfile(fileno(fp), sock->s, (off_t)(offset + current_sent), length - current_sent > DTCPBUF ? DTCPBUF : length - current_sent, NULL, &sent, 0);
+		current_sent += (int)sent;
+
+		if (ret == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			sock->err = errno;
+			// file systems without sendfile support fail before anything is sent
+			return (current_sent == 0 && (errno == EINVAL || errno == EOPNOTSUPP)) ? ERR_TR50_NOT_SUPPORTED : ERR_TR50_SOCK_SEND_FAILED;
+		} else if (ret == 0 && sent == 0) {
+			// the file is shorter than it was when the transfer started
+			return ERR_TR50_FILE_PUT_HTTP;
+		}
+	}
+	return 0;
+}
+
+int _tcp_listen(void **handle, long port) {
+	ABSTRACT_SOCKET *sock;
+	struct sockaddr_in sa;
+	int tint = 1;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if ((sock = _memory_malloc(sizeof(ABSTRACT_SOCKET))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(sock, 0, sizeof(ABSTRACT_SOCKET));
+	sock->type = SOCKET_TYPE_SOCK;
+
+	if ((sock->s = (int)socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) <= 0) {
+		_memory_free(sock);
+		return ERR_TR50_SOCK_SOCKET_FAILED;
+	}
+	setsockopt(sock->s, SOL_SOCKET, SO_REUSEADDR, (char *)&tint, sizeof(tint));
+	fcntl(sock->s, F_SETFD, fcntl(sock->s, F_GETFD) | FD_CLOEXEC);
+
+	_memory_memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons((unsigned short)port);
+	if (bind(sock->s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		sock->err = errno;
+		_tcp_disconnect(sock);
+		return ERR_TR50_SOCK_BIND_FAILED;
+	}
+	if (listen(sock->s, 8) != 0) {
+		sock->err = errno;
+		_tcp_disconnect(sock);
+		return ERR_TR50_SOCK_LISTEN_FAILED;
+	}
+	*handle = sock;
+	return 0;
+}
+
+int _tcp_accept(void *listen_handle, void **handle, int timeout) {
+	ABSTRACT_SOCKET *listener = listen_handle;
+	ABSTRACT_SOCKET *sock;
+	fd_set sockSet;
+	struct timeval to;
+	int s, ret;
+
+	if (listen_handle == NULL || handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (timeout > 0) {
+		to.tv_usec = (timeout % 1000) * 1000;
+		to.tv_sec = timeout / 1000;
+
+		FD_ZERO(&sockSet);
+		FD_SET(listener->s, &sockSet);
+		if ((ret = select(listener->s + 1, &sockSet, NULL, NULL, &to)) == 0) {
+			return ERR_TR50_SOCK_TIMEOUT;
+		} else if (ret == -1) {
+			listener->err = errno;
+			return ERR_TR50_SOCK_SELECT_FAILED;
+		}
+	}
+	if ((s = accept(listener->s, NULL, NULL)) < 0) {
+		listener->err = errno;
+		return ERR_TR50_SOCK_ACCEPT_FAILED;
+	}
+	if ((sock = _memory_malloc(sizeof(ABSTRACT_SOCKET))) == NULL) {
+		close(s);
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(sock, 0, sizeof(ABSTRACT_SOCKET));
+	sock->type = SOCKET_TYPE_SOCK;
+
+	sock->s = s;
+	*handle = sock;
+	return 0;
+}
+
 int _tcp_connect_ssl(void *handle) {
 	int ret;
 	void *ctx;
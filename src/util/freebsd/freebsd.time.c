@@ -23,6 +23,7 @@
  */
 
 #include <sys/time.h>
+#include <time.h>
 
 #include <stdio.h>
 
@@ -47,6 +48,13 @@ int _time_now_in_sec() {
 	return (int)ltime.tv_sec;
 }
 
+long long _time_now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 void time_strptime(const char *timestamp_str, const char *time_format, long long *mstime) {
 	struct tm tim;
 	*mstime = 0LL;
@@ -23,6 +23,7 @@
  */
 
 #include <tr50/error.h>
+#include <tr50/util/compress.h>
 
 int _compress_is_supported() {
 	return 0;
@@ -35,3 +36,34 @@ int _compress_deflate(const char *in, int in_len, char **out, int *out_len) {
 int _compress_inflate(const char *in, int in_len, char **out, int *out_len) {
 	return ERR_TR50_NOPORT;
 }
+
+unsigned long _compress_dictionary_id(const char *dict, int dict_len) {
+	return 0;
+}
+
+int _compress_deflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_inflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_inflate_stream(const char *in, int in_len, const char *dict, int dict_len, _compress_sink sink, void *custom) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_gzip_create(void **stream, int is_inflate, int level) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_gzip_reset(void *stream) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_gzip_step(void *stream, const char **in, int *in_len, char **out, int *out_len, int finish) {
+	return ERR_TR50_NOPORT;
+}
+
+void _compress_gzip_delete(void *stream) {
+}
@@ -22,6 +22,8 @@
  * THE SOFTWARE.
  */
 
+#include <tr50/error.h>
+
 int _tr50_event_create(void **evt) {
 	return 0;
 }
@@ -37,3 +39,29 @@ int _tr50_event_signal(void *evt) {
 int _tr50_event_delete(void *evt) {
 	return 0;
 }
+
+int _tr50_event_reset(void *evt) {
+	return ERR_TR50_NOPORT;
+}
+
+int _tr50_event_wait_timeout(void *evt, int timeout_in_ms) {
+	return ERR_TR50_NOPORT;
+}
+
+// No timed event wait on this port: the wait ignores its timeout and is woken by the pending
+// expiry as before.
+int _tr50_waiter_take(void **waiter) {
+	return _tr50_event_create(waiter);
+}
+
+int _tr50_waiter_wait(void *waiter, int timeout_in_ms) {
+	return _tr50_event_wait(waiter);
+}
+
+int _tr50_waiter_wake(void *waiter) {
+	return _tr50_event_signal(waiter);
+}
+
+void _tr50_waiter_give(void *waiter) {
+	_tr50_event_delete(waiter);
+}
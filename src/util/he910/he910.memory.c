@@ -66,3 +66,7 @@ int _memory_handle_count() {
 	return g_memory_handle_count;
 }
 
+int _memory_accounting_supported() {
+	return 0;
+}
+
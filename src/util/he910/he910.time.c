@@ -40,6 +40,10 @@ int _time_now_in_sec() {
 	return rtctime_Time(0);
 }
 
+long long _time_now_us() {
+	return _time_now() * 1000;
+}
+
 void time_strptime(const char *timestamp_str, const char *time_format, long long *mstime) {
 	struct tm tim;
 	*mstime = 0LL;
@@ -618,8 +618,9 @@ int _tr50_at_cmd_dwstatus_get(void *token, void *output_blob) {
 	//last latency
 	int latency = -1;
 
-	int byte_recv = tr50_stats_byte_recv(g_tr50_at_wrapper.tr50);
-	int byte_sent = tr50_stats_byte_sent(g_tr50_at_wrapper.tr50);
+	// the AT reply keeps its 32-bit fields
+	int byte_recv = (int)tr50_stats_byte_recv(g_tr50_at_wrapper.tr50);
+	int byte_sent = (int)tr50_stats_byte_sent(g_tr50_at_wrapper.tr50);
 
 	int pub_recv = tr50_stats_pub_recv(g_tr50_at_wrapper.tr50);
 	int pub_sent = tr50_stats_pub_sent(g_tr50_at_wrapper.tr50);
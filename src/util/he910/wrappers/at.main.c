@@ -113,7 +113,12 @@ int _tr50_method_event_execute(const char *id, const char *thing_key, const char
 }
 
 int tr50_at_init(tr50_at_unsol_callback ring_callback) {
+	int ret;
+
 	_memory_memset(&g_tr50_at_wrapper, 0, sizeof(_AT_WRAPPER));
+	if ((ret = tr50_at_storage_config(TR50_AT_STORAGE_SIZE_DEFAULT, TR50_AT_STORAGE_LIFO, 0)) != 0) {
+		return ret;
+	}
 
 	log_filter_maximum_log_level(LOG_TYPE_LOW_LEVEL);
 	tr50_create(&g_tr50_at_wrapper.tr50, "AT Wrapper", "demo.deviceiwse.com", 1883);
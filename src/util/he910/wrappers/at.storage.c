@@ -27,7 +27,9 @@
 #include <tr50/util/blob.h>
 #include <tr50/util/log.h>
 #include <tr50/util/memory.h>
+#include <tr50/util/mutex.h>
 #include <tr50/util/platform.h>
+#include <tr50/util/time.h>
 #include <tr50/tr50.h>
 
 #if defined(_AT_SIMULATOR)
@@ -36,156 +38,343 @@
 #include <tr50/wrappers/at.h>
 #endif
 
-typedef struct {
+// Replies waiting for AT#DWRCV/AT#DWRCVR. Entries live in a preallocated array, chained by id in
+// hash buckets (oldest first, ids repeat) and by age in one list for eviction and AT#DWLRCV.
+typedef struct _AT_STORAGE {
 	int		id;
 	char 	*output_str;
 	int		output_len;
-	int		is_used;
 	int		mode;
 	int		status;
+	long long	stored_at;
+	struct _AT_STORAGE *bucket_next;
+	struct _AT_STORAGE *older;
+	struct _AT_STORAGE *newer;
 } _AT_STORAGE;
 
-#define TR50_AT_STORAGE_SIZE	20
+typedef struct {
+	void *			mux;
+	_AT_STORAGE *	slots;
+	_AT_STORAGE *	free;
+	_AT_STORAGE **	buckets;
+	unsigned int	bucket_mask;
+	_AT_STORAGE *	oldest;
+	_AT_STORAGE *	newest;
+	int				policy;
+	int				ttl_ms;
+	TR50_AT_STORAGE_STATS stats;
+} _AT_STORE;
 
-_AT_STORAGE g_tr50_at_storage[TR50_AT_STORAGE_SIZE];
-int g_tr50_at_storage_count = 0;
+static _AT_STORE g_tr50_at_store;
 
-int _tr50_at_storage_put(void *message, int mode, int id, int *len) {
+static _AT_STORAGE **_tr50_at_storage_bucket(int id) {
+	return &g_tr50_at_store.buckets[(unsigned int)id & g_tr50_at_store.bucket_mask];
+}
+
+// Unlinks an entry and returns its slot, the caller owns output_str again.
+static void _tr50_at_storage_unlink(_AT_STORAGE *entry) {
+	_AT_STORAGE **link;
+
+	for (link = _tr50_at_storage_bucket(entry->id); *link != entry; link = &(*link)->bucket_next)
+		; /* Nothing. */
+	*link = entry->bucket_next;
+	if (entry->older) {
+		entry->older->newer = entry->newer;
+	} else {
+		g_tr50_at_store.oldest = entry->newer;
+	}
+	if (entry->newer) {
+		entry->newer->older = entry->older;
+	} else {
+		g_tr50_at_store.newest = entry->older;
+	}
+	entry->bucket_next = g_tr50_at_store.free;
+	g_tr50_at_store.free = entry;
+	--g_tr50_at_store.stats.count;
+}
+
+static void _tr50_at_storage_drop(_AT_STORAGE *entry) {
+	if (entry->output_str) {
+		_memory_free(entry->output_str);
+	}
+	_tr50_at_storage_unlink(entry);
+}
+
+// Until tr50_at_storage_config() succeeds there is no store to lock or look in.
+#define _TR50_AT_STORAGE_READY() (g_tr50_at_store.slots != NULL)
+
+static void _tr50_at_storage_expire() {
+	long long now;
+
+	if (g_tr50_at_store.policy != TR50_AT_STORAGE_TTL || g_tr50_at_store.ttl_ms <= 0) {
+		return;
+	}
+	now = _time_now();
+	while (g_tr50_at_store.oldest && now - g_tr50_at_store.oldest->stored_at >= g_tr50_at_store.ttl_ms) {
+		log_debug("_tr50_at_storage_expire(): id[%d] expired.", g_tr50_at_store.oldest->id);
+		_tr50_at_storage_drop(g_tr50_at_store.oldest);
+		++g_tr50_at_store.stats.expired;
+	}
+}
+
+static int _tr50_at_storage_insert(int id, int mode, int status, char *output_str, int output_len) {
+	_AT_STORAGE *entry, **link;
+
+	_tr50_at_storage_expire();
+	if (g_tr50_at_store.free == NULL) {
+		if (g_tr50_at_store.policy != TR50_AT_STORAGE_FIFO || g_tr50_at_store.oldest == NULL) {
+			++g_tr50_at_store.stats.refused;
+			return ERR_TR50_AT_STORAGE_FULL;
+		}
+		log_debug("_tr50_at_storage_insert(): id[%d] evicted.", g_tr50_at_store.oldest->id);
+		_tr50_at_storage_drop(g_tr50_at_store.oldest);
+		++g_tr50_at_store.stats.evicted;
+	}
+	entry = g_tr50_at_store.free;
+	g_tr50_at_store.free = entry->bucket_next;
+
+	entry->id = id;
+	entry->mode = mode;
+	entry->status = status;
+	entry->output_str = output_str;
+	entry->output_len = output_len;
+	entry->stored_at = _time_now();
+	entry->bucket_next = NULL;
+	for (link = _tr50_at_storage_bucket(id); *link; link = &(*link)->bucket_next)
+		; /* Nothing. */
+	*link = entry;
+	entry->newer = NULL;
+	entry->older = g_tr50_at_store.newest;
+	if (g_tr50_at_store.newest) {
+		g_tr50_at_store.newest->newer = entry;
+	} else {
+		g_tr50_at_store.oldest = entry;
+	}
+	g_tr50_at_store.newest = entry;
+
+	++g_tr50_at_store.stats.stored;
+	if (++g_tr50_at_store.stats.count > g_tr50_at_store.stats.peak) {
+		g_tr50_at_store.stats.peak = g_tr50_at_store.stats.count;
+	}
+	return 0;
+}
+
+int tr50_at_storage_config(int capacity, int policy, int ttl_ms) {
+	_AT_STORAGE *slots, **buckets, *entry, *oldest;
+	unsigned int bucket_count = 1;
 	int i;
- 
+
+	if (capacity <= 0 || policy < TR50_AT_STORAGE_LIFO || policy > TR50_AT_STORAGE_TTL || ttl_ms < 0) {
+		return ERR_TR50_PARMS;
+	}
+	while (bucket_count < (unsigned int)capacity) {
+		bucket_count <<= 1;
+	}
+	if ((slots = _memory_malloc(sizeof(_AT_STORAGE) * capacity)) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	if ((buckets = _memory_malloc(sizeof(_AT_STORAGE *) * bucket_count)) == NULL) {
+		_memory_free(slots);
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(buckets, 0, sizeof(_AT_STORAGE *) * bucket_count);
+	for (i = 0; i < capacity; ++i) {
+		slots[i].bucket_next = i + 1 < capacity ? &slots[i + 1] : NULL;
+	}
+
+	if (g_tr50_at_store.mux == NULL) {
+		_tr50_mutex_create(&g_tr50_at_store.mux);
+	}
+	_tr50_mutex_lock(g_tr50_at_store.mux);
+	// what is stored moves over, oldest first; past the new capacity the policy decides
+	oldest = g_tr50_at_store.oldest;
+	if (g_tr50_at_store.slots) {
+		_memory_free(g_tr50_at_store.buckets);
+	}
+	g_tr50_at_store.buckets = buckets;
+	g_tr50_at_store.bucket_mask = bucket_count - 1;
+	g_tr50_at_store.free = slots;
+	g_tr50_at_store.oldest = g_tr50_at_store.newest = NULL;
+	g_tr50_at_store.policy = policy;
+	g_tr50_at_store.ttl_ms = ttl_ms;
+	g_tr50_at_store.stats.capacity = capacity;
+	g_tr50_at_store.stats.count = 0;
+	for (entry = oldest; entry; entry = entry->newer) {
+		if (_tr50_at_storage_insert(entry->id, entry->mode, entry->status, entry->output_str, entry->output_len) != 0) {
+			_memory_free(entry->output_str);
+			--g_tr50_at_store.stats.refused;
+			++g_tr50_at_store.stats.evicted;
+		} else {
+			g_tr50_at_store.newest->stored_at = entry->stored_at;
+			--g_tr50_at_store.stats.stored;
+		}
+	}
+	if (g_tr50_at_store.slots) {
+		_memory_free(g_tr50_at_store.slots);
+	}
+	g_tr50_at_store.slots = slots;
+	_tr50_mutex_unlock(g_tr50_at_store.mux);
+	return 0;
+}
+
+int tr50_at_storage_stats(TR50_AT_STORAGE_STATS *stats) {
+	if (stats == NULL || !_TR50_AT_STORAGE_READY()) {
+		return ERR_TR50_PARMS;
+	}
+	_tr50_mutex_lock(g_tr50_at_store.mux);
+	_tr50_at_storage_expire();
+	*stats = g_tr50_at_store.stats;
+	_tr50_mutex_unlock(g_tr50_at_store.mux);
+	return 0;
+}
+
+int _tr50_at_storage_put(void *message, int mode, int id, int *len) {
 	char *error_message = NULL;
- 
-	log_debug("_tr50_at_storage_put(): id[%d] ...", id);
+	char *output_str = NULL;
+	int output_len = 0, status = 0, ret;
 
-	if (g_tr50_at_storage_count > TR50_AT_STORAGE_SIZE) {
-		return ERR_TR50_AT_STORAGE_FULL;
+	log_debug("_tr50_at_storage_put(): id[%d] ...", id);
+	if (!_TR50_AT_STORAGE_READY()) {
+		return ERR_TR50_PARMS;
 	}
 
-	for (i = 0; i < TR50_AT_STORAGE_SIZE; ++i) {
-		if (g_tr50_at_storage[i].is_used) {
-			continue;
+	//new mode timeout and when it comes out put a timeout message
+	if (mode == TR50_AT_SEND_MODE_METHOD) {
+		output_str = message;
+		output_len = strlen(message);
+	} else if (tr50_reply_get_error(message, "1", &error_message) != 0) {
+		status = 1; //tr50_message_get_status(message);
+		if (error_message) {
+			int msg_len = strlen(error_message);
+			output_str = (char *)_memory_malloc(32 + msg_len);
+			snprintf(output_str, 32 + msg_len, "Failed: %s", error_message);
+			_memory_free(error_message);
+		} else {
+			output_str = (char *)_memory_malloc(32);
+			snprintf(output_str, 32, "Failed without message.");
 		}
-		//new mode timeout and when it comes out put a timeout message
-		if (mode == TR50_AT_SEND_MODE_METHOD) {
-			g_tr50_at_storage[i].status = 0;
-			g_tr50_at_storage[i].output_str = message;
-			g_tr50_at_storage[i].output_len = strlen(message);
- 
-		} else if (tr50_reply_get_error(message, "1", &error_message) != 0) {
-		  
-			 
-			g_tr50_at_storage[i].status = 1; //tr50_message_get_status(message);
- 
-
-			if (error_message) {
-				int msg_len = strlen(error_message);
-				g_tr50_at_storage[i].output_str = (char *)_memory_malloc(32 + msg_len);
-				snprintf(g_tr50_at_storage[i].output_str, 32 + msg_len, "Failed: %s", error_message);
-				_memory_free(error_message);
-			} else {
-				g_tr50_at_storage[i].output_str = (char *)_memory_malloc(32);
-				snprintf(g_tr50_at_storage[i].output_str, 32, "Failed without message.");
-			}
-			g_tr50_at_storage[i].output_len = strlen(g_tr50_at_storage[i].output_str);//
-		} else if (mode == TR50_AT_SEND_MODE_DELIMITED) {
-			void *blob;
-			JSON *params, *ptr;
-
-			_blob_create(&blob, 256);
- 
-			if ((params = tr50_reply_get_params(message, "1", FALSE)) && (ptr = params->child)) {
- 
-				while (ptr) {
-					switch (ptr->type) {
-					case JSON_FALSE:
-						_blob_format_append(blob, "%s,false", ptr->string);
-						break;
-					case JSON_TRUE:
-						_blob_format_append(blob, "%s,true", ptr->string);
-						break;
-					case JSON_NUMBER: {
-						int i = ptr->valuedouble;
-						if (ptr->valuedouble == ((double)i)) {
-							_blob_format_append(blob, "%s,%d", ptr->string, ptr->valueint);
-						} else {
-							_blob_format_append(blob, "%s,%lf", ptr->string, ptr->valuedouble);
-						}
-						break;
-					}
-					case JSON_STRING:
-						_blob_format_append(blob, "%s,%s", ptr->string, ptr->valuestring);
-						break;
-					default:
-						break;
-					}
-					if ((ptr = ptr->next)) {
-						_blob_format_append(blob, ",");
+		output_len = strlen(output_str);
+	} else if (mode == TR50_AT_SEND_MODE_DELIMITED) {
+		void *blob;
+		JSON *params, *ptr;
+
+		_blob_create(&blob, 256);
+
+		if ((params = tr50_reply_get_params(message, "1", FALSE)) && (ptr = params->child)) {
+			while (ptr) {
+				switch (ptr->type) {
+				case JSON_FALSE:
+					_blob_format_append(blob, "%s,false", ptr->string);
+					break;
+				case JSON_TRUE:
+					_blob_format_append(blob, "%s,true", ptr->string);
+					break;
+				case JSON_NUMBER: {
+					int i = ptr->valuedouble;
+					if (ptr->valuedouble == ((double)i)) {
+						_blob_format_append(blob, "%s,%d", ptr->string, ptr->valueint);
+					} else {
+						_blob_format_append(blob, "%s,%lf", ptr->string, ptr->valuedouble);
 					}
+					break;
+				}
+				case JSON_STRING:
+					_blob_format_append(blob, "%s,%s", ptr->string, ptr->valuestring);
+					break;
+				default:
+					break;
+				}
+				if ((ptr = ptr->next)) {
+					_blob_format_append(blob, ",");
 				}
-			} else {
-				_blob_format_append(blob, "OK");
 			}
-			g_tr50_at_storage[i].status = 0;
-			g_tr50_at_storage[i].output_str = (char *)_blob_get_buffer(blob);
-			g_tr50_at_storage[i].output_len = _blob_get_length(blob);
-			_blob_delete_object(blob);
-		} else if (mode == TR50_AT_SEND_MODE_RAW) {
-			g_tr50_at_storage[i].status = 0;
-			tr50_message_to_string("reply", message, &g_tr50_at_storage[i].output_str, &g_tr50_at_storage[i].output_len);
 		} else {
-			return ERR_TR50_AT_SEND_MODE_UNKNOWN;
+			_blob_format_append(blob, "OK");
 		}
-		g_tr50_at_storage[i].mode = mode;
-		g_tr50_at_storage[i].is_used = 1;
-		g_tr50_at_storage[i].id = id;
-		++g_tr50_at_storage_count;
+		output_str = (char *)_blob_get_buffer(blob);
+		output_len = _blob_get_length(blob);
+		_blob_delete_object(blob);
+	} else if (mode == TR50_AT_SEND_MODE_RAW) {
+		tr50_message_to_string("reply", message, &output_str, &output_len);
+	} else {
+		return ERR_TR50_AT_SEND_MODE_UNKNOWN;
+	}
 
-		*len = g_tr50_at_storage[i].output_len;
-		log_debug("_tr50_at_storage_put(): id[%d] len[%d] OK.", id, *len);
-		return 0;
+	_tr50_mutex_lock(g_tr50_at_store.mux);
+	ret = _tr50_at_storage_insert(id, mode, status, output_str, output_len);
+	_tr50_mutex_unlock(g_tr50_at_store.mux);
+	if (ret != 0) {
+		// a method's output is still the caller's
+		if (mode != TR50_AT_SEND_MODE_METHOD && output_str) {
+			_memory_free(output_str);
+		}
+		return ret;
 	}
 
-	return ERR_TR50_AT_STORAGE_FULL;
+	*len = output_len;
+	log_debug("_tr50_at_storage_put(): id[%d] len[%d] OK.", id, *len);
+	return 0;
 }
 
 int _tr50_at_storage_get(int id, int mode, int *status, char **output, int *output_len) {
-	int i;
-	for (i = 0; i < TR50_AT_STORAGE_SIZE; ++i) {
-		if (!g_tr50_at_storage[i].is_used) {
-			log_debug("_tr50_at_storage_get(): index[%d] is not used.", i);
-			continue;
-		}
-		if (g_tr50_at_storage[i].id != id) {
-			log_debug("_tr50_at_storage_get(): index[%d] is not equal to [%d].", i, mode);
+	_AT_STORAGE *entry;
+	int ret = ERR_TR50_AT_STORAGE_NOTFOUND;
+
+	if (!_TR50_AT_STORAGE_READY()) {
+		return ERR_TR50_AT_STORAGE_NOTFOUND;
+	}
+	_tr50_mutex_lock(g_tr50_at_store.mux);
+	_tr50_at_storage_expire();
+	for (entry = *_tr50_at_storage_bucket(id); entry; entry = entry->bucket_next) {
+		if (entry->id != id) {
 			continue;
 		}
-		if (g_tr50_at_storage[i].mode != mode && (g_tr50_at_storage[i].mode == TR50_AT_SEND_MODE_METHOD && mode != TR50_AT_SEND_MODE_DELIMITED)) {
-			log_debug("_tr50_at_storage_get(): index[%d] is mode mismatch.", i);
+		if (entry->mode != mode && (entry->mode == TR50_AT_SEND_MODE_METHOD && mode != TR50_AT_SEND_MODE_DELIMITED)) {
+			log_debug("_tr50_at_storage_get(): id[%d] is mode mismatch.", id);
 			continue;
 		}
-		*status = g_tr50_at_storage[i].status;
-		*output = g_tr50_at_storage[i].output_str;
-		*output_len = g_tr50_at_storage[i].output_len;
-		g_tr50_at_storage[i].is_used = 0;
-		--g_tr50_at_storage_count;
-		return 0;
-	}
-	return ERR_TR50_AT_STORAGE_NOTFOUND;
+		*status = entry->status;
+		*output = entry->output_str;
+		*output_len = entry->output_len;
+		_tr50_at_storage_unlink(entry);
+		++g_tr50_at_store.stats.taken;
+		ret = 0;
+		break;
+	}
+	if (ret != 0) {
+		++g_tr50_at_store.stats.not_found;
+	}
+	_tr50_mutex_unlock(g_tr50_at_store.mux);
+	return ret;
 }
 
 void _tr50_at_storage_list(void *blob) {
-	int i;
-	_blob_format_append(blob, "%d", g_tr50_at_storage_count);
-	for (i = 0; i < TR50_AT_STORAGE_SIZE; ++i) {
-		if (!g_tr50_at_storage[i].is_used) {
-			continue;
-		}
-		_blob_format_append(blob, ",%d,%d", g_tr50_at_storage[i].id, g_tr50_at_storage[i].output_len);
+	_AT_STORAGE *entry;
+
+	if (!_TR50_AT_STORAGE_READY()) {
+		_blob_format_append(blob, "0");
+		return;
 	}
+	_tr50_mutex_lock(g_tr50_at_store.mux);
+	_tr50_at_storage_expire();
+	_blob_format_append(blob, "%d", g_tr50_at_store.stats.count);
+	for (entry = g_tr50_at_store.oldest; entry; entry = entry->newer) {
+		_blob_format_append(blob, ",%d,%d", entry->id, entry->output_len);
+	}
+	_tr50_mutex_unlock(g_tr50_at_store.mux);
 }
 
+// Whether a send should be refused up front because its reply would find no room. Under FIFO
+// the oldest reply makes room instead.
 int _tr50_at_storage_is_full() {
-	// Default to LIFO
-	// return (g_tr50_at_storage_count >= TR50_AT_STORAGE_SIZE);
-	return 0;
+	int is_full;
+
+	if (!_TR50_AT_STORAGE_READY()) {
+		return TRUE;
+	}
+	_tr50_mutex_lock(g_tr50_at_store.mux);
+	_tr50_at_storage_expire();
+	is_full = g_tr50_at_store.policy != TR50_AT_STORAGE_FIFO && g_tr50_at_store.free == NULL;
+	_tr50_mutex_unlock(g_tr50_at_store.mux);
+	return is_full;
 }
@@ -27,6 +27,7 @@
 #include <tr50/error.h>
 
 #include <tr50/util/blob.h>
+#include <tr50/util/compress.h>
 #include <tr50/util/memory.h>
 
 int _compress_is_supported() {
@@ -112,3 +113,228 @@ int _compress_inflate(const char *in, int in_len, char **out, int *out_len) {
 
 	return 0;
 }
+
+unsigned long _compress_dictionary_id(const char *dict, int dict_len) {
+	return adler32(adler32(0L, Z_NULL, 0), (const Bytef *)dict, dict_len);
+}
+
+int _compress_deflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	z_stream strm;
+	unsigned char *cbuffer;
+	unsigned long cbuffer_len;
+
+	_memory_memset(&strm, 0, sizeof(z_stream));
+	if (deflateInit(&strm, Z_BEST_COMPRESSION) != Z_OK) {
+		return ERR_TR50_COMPRESS_DEFLATE;
+	}
+	if (deflateSetDictionary(&strm, (const Bytef *)dict, dict_len) != Z_OK) {
+		deflateEnd(&strm);
+		return ERR_TR50_COMPRESS_DICTIONARY;
+	}
+
+	cbuffer_len = deflateBound(&strm, in_len);
+	if ((cbuffer = _memory_malloc(cbuffer_len)) == NULL) {
+		deflateEnd(&strm);
+		return ERR_TR50_MALLOC;
+	}
+
+	strm.next_in = (Bytef *)in;
+	strm.avail_in = (unsigned int)in_len;
+	strm.next_out = cbuffer;
+	strm.avail_out = (unsigned int)cbuffer_len;
+
+	if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&strm);
+		_memory_free(cbuffer);
+		return ERR_TR50_COMPRESS_DEFLATE;
+	}
+
+	*out = (char *)cbuffer;
+	*out_len = (int)strm.total_out;
+	deflateEnd(&strm);
+	return 0;
+}
+
+int _compress_inflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	int ret;
+	void *blob;
+	z_stream strm;
+	unsigned char *cbuffer;
+
+	_memory_memset(&strm, 0, sizeof(z_stream));
+	if (inflateInit(&strm) != Z_OK) {
+		return ERR_TR50_COMPRESS_INFLATE;
+	}
+	if ((cbuffer = _memory_malloc(STOMP_COMPRESSION_CHUNK)) == NULL) {
+		inflateEnd(&strm);
+		return ERR_TR50_MALLOC;
+	}
+	_blob_create(&blob, 256);
+
+	strm.avail_in = (unsigned int)in_len;
+	strm.next_in = (unsigned char *)in;
+
+	do {
+		strm.avail_out = STOMP_COMPRESSION_CHUNK;
+		strm.next_out = cbuffer;
+#if defined(_VXWORKS)
+		ret = dwinflate(&strm, Z_NO_FLUSH);
+#else
+		ret = inflate(&strm, Z_NO_FLUSH);
+#endif
+		if (ret == Z_NEED_DICT) {
+			if (strm.adler != _compress_dictionary_id(dict, dict_len) || inflateSetDictionary(&strm, (const Bytef *)dict, dict_len) != Z_OK) {
+				ret = ERR_TR50_COMPRESS_DICTIONARY;
+				goto end_error;
+			}
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			ret = ERR_TR50_COMPRESS_INFLATE;
+			goto end_error;
+		}
+		_blob_append(blob, (char *)cbuffer, STOMP_COMPRESSION_CHUNK - strm.avail_out);
+		if (ret == Z_OK && strm.avail_in == 0 && strm.avail_out != 0) {
+			ret = ERR_TR50_COMPRESS_INFLATE;
+			goto end_error;
+		}
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&strm);
+	_memory_free(cbuffer);
+
+	*out = _blob_get_buffer(blob);
+	*out_len = _blob_get_length(blob);
+	_blob_delete_object(blob);
+	return 0;
+
+end_error:
+	inflateEnd(&strm);
+	_memory_free(cbuffer);
+	_blob_delete(blob);
+	return ret;
+}
+
+int _compress_inflate_stream(const char *in, int in_len, const char *dict, int dict_len, _compress_sink sink, void *custom) {
+	int ret, result = 0;
+	z_stream strm;
+	unsigned char *cbuffer;
+
+	_memory_memset(&strm, 0, sizeof(z_stream));
+	if (inflateInit(&strm) != Z_OK) {
+		return ERR_TR50_COMPRESS_INFLATE;
+	}
+	if ((cbuffer = _memory_malloc(STOMP_COMPRESSION_CHUNK)) == NULL) {
+		inflateEnd(&strm);
+		return ERR_TR50_MALLOC;
+	}
+
+	strm.avail_in = (unsigned int)in_len;
+	strm.next_in = (unsigned char *)in;
+
+	do {
+		strm.avail_out = STOMP_COMPRESSION_CHUNK;
+		strm.next_out = cbuffer;
+#if defined(_VXWORKS)
+		ret = dwinflate(&strm, Z_NO_FLUSH);
+#else
+		ret = inflate(&strm, Z_NO_FLUSH);
+#endif
+		if (ret == Z_NEED_DICT) {
+			if (dict == NULL || strm.adler != _compress_dictionary_id(dict, dict_len) || inflateSetDictionary(&strm, (const Bytef *)dict, dict_len) != Z_OK) {
+				result = ERR_TR50_COMPRESS_DICTIONARY;
+				break;
+			}
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			result = ERR_TR50_COMPRESS_INFLATE;
+			break;
+		}
+		if (STOMP_COMPRESSION_CHUNK - strm.avail_out > 0 && (result = sink((char *)cbuffer, STOMP_COMPRESSION_CHUNK - strm.avail_out, custom)) != 0) {
+			break;
+		}
+		if (ret == Z_OK && strm.avail_in == 0 && strm.avail_out != 0) {
+			result = ERR_TR50_COMPRESS_INFLATE;
+			break;
+		}
+	} while (ret != Z_STREAM_END);
+
+	inflateEnd(&strm);
+	_memory_free(cbuffer);
+	return result;
+}
+
+typedef struct {
+	z_stream	strm;
+	int			is_inflate;
+} _COMPRESS_GZIP;
+
+int _compress_gzip_create(void **stream, int is_inflate, int level) {
+	_COMPRESS_GZIP *gzip;
+	int ret;
+
+	if ((gzip = _memory_malloc(sizeof(_COMPRESS_GZIP))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(gzip, 0, sizeof(_COMPRESS_GZIP));
+	gzip->is_inflate = is_inflate;
+	// 16 + MAX_WBITS selects the gzip wrapper instead of the zlib one
+	if (is_inflate) {
+		ret = inflateInit2(&gzip->strm, 16 + MAX_WBITS);
+	} else {
+		ret = deflateInit2(&gzip->strm, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	}
+	if (ret != Z_OK) {
+		_memory_free(gzip);
+		return is_inflate ? ERR_TR50_COMPRESS_INFLATE : ERR_TR50_COMPRESS_DEFLATE;
+	}
+	*stream = gzip;
+	return 0;
+}
+
+int _compress_gzip_reset(void *stream) {
+	_COMPRESS_GZIP *gzip = stream;
+
+	if (gzip->is_inflate) {
+		return inflateReset(&gzip->strm) == Z_OK ? 0 : ERR_TR50_COMPRESS_INFLATE;
+	}
+	return deflateReset(&gzip->strm) == Z_OK ? 0 : ERR_TR50_COMPRESS_DEFLATE;
+}
+
+int _compress_gzip_step(void *stream, const char **in, int *in_len, char **out, int *out_len, int finish) {
+	_COMPRESS_GZIP *gzip = stream;
+	int ret;
+
+	gzip->strm.next_in = (Bytef *)*in;
+	gzip->strm.avail_in = (unsigned int)*in_len;
+	gzip->strm.next_out = (Bytef *)*out;
+	gzip->strm.avail_out = (unsigned int)*out_len;
+	if (gzip->is_inflate) {
+		ret = inflate(&gzip->strm, Z_NO_FLUSH);
+	} else {
+		ret = deflate(&gzip->strm, finish ? Z_FINISH : Z_NO_FLUSH);
+	}
+	*in = (const char *)gzip->strm.next_in;
+	*in_len = (int)gzip->strm.avail_in;
+	*out = (char *)gzip->strm.next_out;
+	*out_len = (int)gzip->strm.avail_out;
+
+	if (ret == Z_STREAM_END) {
+		return 1;
+	} else if (ret == Z_OK || ret == Z_BUF_ERROR) { // Z_BUF_ERROR: no room or no input this time
+		return 0;
+	}
+	return gzip->is_inflate ? ERR_TR50_COMPRESS_INFLATE : ERR_TR50_COMPRESS_DEFLATE;
+}
+
+void _compress_gzip_delete(void *stream) {
+	_COMPRESS_GZIP *gzip = stream;
+
+	if (gzip->is_inflate) {
+		inflateEnd(&gzip->strm);
+	} else {
+		deflateEnd(&gzip->strm);
+	}
+	_memory_free(gzip);
+}
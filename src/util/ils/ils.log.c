@@ -119,7 +119,10 @@ void _log_this_recurring_internal(int type, const char *file, int line, int minu
 	_LOG_RECURRING_ENTRY *oldest = NULL;
 	int now = _time_now_in_sec();
 
-	_log_vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+	// a change can only be told from the text; a repeat that is not printed is never formatted
+	if (check_for_changes) {
+		_log_vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+	}
 
 	// find in array, if not found, replace the oldest one, and print old one if greater than 1
 	for (i = 0; i < LOG_RECURRING_ENTRY_MAX; ++i) {
@@ -151,6 +154,9 @@ void _log_this_recurring_internal(int type, const char *file, int line, int minu
 	}
 	
 	// if not found, add to first empty slot then print
+	if (!check_for_changes) {
+		_log_vsnprintf(buffer, LOG_BUFFER_SIZE, msg, args);
+	}
 	for (i = 0; i < LOG_RECURRING_ENTRY_MAX; ++i) {
 		_LOG_RECURRING_ENTRY *entry = &g_log_recurring_entries[i];
 		if (!entry->is_used) {
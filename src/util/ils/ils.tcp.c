@@ -217,3 +217,16 @@ int _tcp_recv(void *sock, char *buf, int *len, int timeout) {
 
 	return ret;
 }
+
+int _tcp_send_file(void *sock, FILE *fp, long long offset, int length, int timeout) {
+	// no zero-copy path here, the caller reads and sends the file itself
+	return ERR_TR50_NOT_SUPPORTED;
+}
+
+int _tcp_listen(void **sock, long port) {
+	return ERR_TR50_NOPORT;
+}
+
+int _tcp_accept(void *listen_sock, void **sock, int timeout) {
+	return ERR_TR50_NOPORT;
+}
@@ -22,12 +22,345 @@
  * THE SOFTWARE.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include <config.h>
+#endif
+
 #include <tr50/error.h>
+#include <tr50/util/compress.h>
+
+#if defined(HAVE_LIBZ)
+
+#include <pthread.h>
+#include <zlib.h>
+
+#include <tr50/util/blob.h>
+#include <tr50/util/memory.h>
+
+#define COMPRESS_INFLATE_CHUNK	16384
+
+static voidpf _compress_zalloc(voidpf opaque, uInt items, uInt size) {
+	return _memory_malloc((size_t)items * size);
+}
+
+static void _compress_zfree(voidpf opaque, voidpf address) {
+	_memory_free(address);
+}
+
+// Each thread keeps the deflate and inflate stream it used last and resets it for the next
+// message, since their windows are above POOL_MAX_SIZE and would come from malloc every time.
+// A stream still busy on the thread, when a sink compresses, means one of its own instead.
+typedef struct {
+	z_stream	strm;		// first, so a stream handed out finds its slot
+	int			ready;
+	int			busy;
+} _COMPRESS_STREAM;
+
+typedef struct {
+	_COMPRESS_STREAM	stream[2];	// deflate, inflate
+} _COMPRESS_STREAMS;
+
+static __thread _COMPRESS_STREAMS *t_compress_streams;
+static pthread_key_t g_compress_streams_key;
+static pthread_once_t g_compress_streams_once = PTHREAD_ONCE_INIT;
+
+static int _compress_stream_init(z_stream *strm, int is_inflate) {
+	_memory_memset(strm, 0, sizeof(z_stream));
+	strm->zalloc = _compress_zalloc;
+	strm->zfree = _compress_zfree;
+	return (is_inflate ? inflateInit(strm) : deflateInit(strm, Z_BEST_COMPRESSION)) == Z_OK;
+}
+
+static void _compress_stream_end(z_stream *strm, int is_inflate) {
+	if (is_inflate) {
+		inflateEnd(strm);
+	} else {
+		deflateEnd(strm);
+	}
+}
+
+static void _compress_streams_release(void *ptr) {
+	_COMPRESS_STREAMS *streams = (_COMPRESS_STREAMS *)ptr;
+	int i;
+
+	t_compress_streams = NULL;
+	for (i = 0; i < 2; ++i) {
+		if (streams->stream[i].ready) {
+			_compress_stream_end(&streams->stream[i].strm, i);
+		}
+	}
+	_memory_free(streams);
+}
+
+static void _compress_streams_key_create() {
+	pthread_key_create(&g_compress_streams_key, _compress_streams_release);
+}
+
+// Returns a stream ready for a new message: the thread's own, or else [local] set up afresh.
+static z_stream *_compress_stream_take(z_stream *local, int is_inflate) {
+	_COMPRESS_STREAM *cached;
+
+	if (t_compress_streams == NULL) {
+		pthread_once(&g_compress_streams_once, _compress_streams_key_create);
+		if ((t_compress_streams = _memory_malloc(sizeof(_COMPRESS_STREAMS))) != NULL) {
+			_memory_memset(t_compress_streams, 0, sizeof(_COMPRESS_STREAMS));
+			pthread_setspecific(g_compress_streams_key, t_compress_streams);
+		}
+	}
+	if (t_compress_streams && !(cached = &t_compress_streams->stream[is_inflate])->busy) {
+		if (cached->ready && (is_inflate ? inflateReset(&cached->strm) : deflateReset(&cached->strm)) != Z_OK) {
+			_compress_stream_end(&cached->strm, is_inflate);
+			cached->ready = 0;
+		}
+		if (!cached->ready) {
+			cached->ready = _compress_stream_init(&cached->strm, is_inflate);
+		}
+		if (cached->ready) {
+			cached->busy = 1;
+			return &cached->strm;
+		}
+	}
+	return _compress_stream_init(local, is_inflate) ? local : NULL;
+}
+
+static void _compress_stream_give(z_stream *strm, z_stream *local, int is_inflate) {
+	if (strm == local) {
+		_compress_stream_end(strm, is_inflate);
+	} else {
+		((_COMPRESS_STREAM *)strm)->busy = 0;
+	}
+}
+
+int _compress_is_supported(void) {
+	return 1;
+}
+
+unsigned long _compress_dictionary_id(const char *dict, int dict_len) {
+	return adler32(adler32(0L, Z_NULL, 0), (const Bytef *)dict, dict_len);
+}
+
+static int _compress_deflate_internal(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	z_stream local, *strm;
+	unsigned char *cbuffer;
+	unsigned long cbuffer_len;
+
+	if ((strm = _compress_stream_take(&local, 0)) == NULL) {
+		return ERR_TR50_COMPRESS_DEFLATE;
+	}
+	if (dict && deflateSetDictionary(strm, (const Bytef *)dict, dict_len) != Z_OK) {
+		_compress_stream_give(strm, &local, 0);
+		return ERR_TR50_COMPRESS_DICTIONARY;
+	}
+
+	cbuffer_len = deflateBound(strm, in_len);
+	if ((cbuffer = _memory_malloc(cbuffer_len)) == NULL) {
+		_compress_stream_give(strm, &local, 0);
+		return ERR_TR50_MALLOC;
+	}
+
+	strm->next_in = (Bytef *)in;
+	strm->avail_in = (unsigned int)in_len;
+	strm->next_out = cbuffer;
+	strm->avail_out = (unsigned int)cbuffer_len;
+
+	if (deflate(strm, Z_FINISH) != Z_STREAM_END) {
+		_compress_stream_give(strm, &local, 0);
+		_memory_free(cbuffer);
+		return ERR_TR50_COMPRESS_DEFLATE;
+	}
+
+	*out = (char *)cbuffer;
+	*out_len = (int)strm->total_out;
+	_compress_stream_give(strm, &local, 0);
+	return 0;
+}
+
+int _compress_inflate_stream(const char *in, int in_len, const char *dict, int dict_len, _compress_sink sink, void *custom) {
+	int ret, result = 0;
+	z_stream local, *strm;
+	unsigned char *cbuffer = NULL;
+
+	if ((strm = _compress_stream_take(&local, 1)) == NULL) {
+		return ERR_TR50_COMPRESS_INFLATE;
+	}
+	if ((cbuffer = _memory_malloc(COMPRESS_INFLATE_CHUNK)) == NULL) {
+		_compress_stream_give(strm, &local, 1);
+		return ERR_TR50_MALLOC;
+	}
+
+	strm->avail_in = (unsigned int)in_len;
+	strm->next_in = (Bytef *)in;
+
+	do {
+		strm->avail_out = COMPRESS_INFLATE_CHUNK;
+		strm->next_out = cbuffer;
+		ret = inflate(strm, Z_NO_FLUSH);
+		if (ret == Z_NEED_DICT) {
+			// the stream names its dictionary by adler32; refuse anything we don't hold.
+			if (dict == NULL || strm->adler != _compress_dictionary_id(dict, dict_len)) {
+				result = ERR_TR50_COMPRESS_DICTIONARY;
+				goto end;
+			}
+			if (inflateSetDictionary(strm, (const Bytef *)dict, dict_len) != Z_OK) {
+				result = ERR_TR50_COMPRESS_DICTIONARY;
+				goto end;
+			}
+			continue;
+		}
+		if (ret != Z_OK && ret != Z_STREAM_END) {
+			result = ERR_TR50_COMPRESS_INFLATE;
+			goto end;
+		}
+		if (COMPRESS_INFLATE_CHUNK - strm->avail_out > 0 && (result = sink((char *)cbuffer, COMPRESS_INFLATE_CHUNK - strm->avail_out, custom)) != 0) {
+			goto end;
+		}
+		if (ret == Z_OK && strm->avail_in == 0 && strm->avail_out != 0) { // truncated input
+			result = ERR_TR50_COMPRESS_INFLATE;
+			goto end;
+		}
+	} while (ret != Z_STREAM_END);
+
+end:
+	_compress_stream_give(strm, &local, 1);
+	_memory_free(cbuffer);
+	return result;
+}
+
+static int _compress_blob_sink(const char *data, int data_len, void *blob) {
+	return _blob_append(blob, data, data_len);
+}
+
+static int _compress_inflate_internal(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	void *blob = NULL;
+	int ret;
+
+	if ((ret = _blob_create(&blob, in_len * 4)) != 0) {
+		return ret;
+	}
+	if ((ret = _compress_inflate_stream(in, in_len, dict, dict_len, _compress_blob_sink, blob)) != 0) {
+		_blob_delete(blob);
+		return ret;
+	}
+	// keep the result usable as a C string.
+	if ((ret = _blob_append(blob, "", 1)) != 0) {
+		_blob_delete(blob);
+		return ret;
+	}
+
+	*out = _blob_get_buffer(blob);
+	*out_len = _blob_get_length(blob) - 1;
+	_blob_delete_object(blob);
+	return 0;
+}
+
+int _compress_deflate(const char *in, int in_len, char **out, int *out_len) {
+	return _compress_deflate_internal(in, in_len, NULL, 0, out, out_len);
+}
+
+int _compress_inflate(const char *in, int in_len, char **out, int *out_len) {
+	return _compress_inflate_internal(in, in_len, NULL, 0, out, out_len);
+}
+
+int _compress_deflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	if (dict == NULL || dict_len <= 0) {
+		return ERR_TR50_PARMS;
+	}
+	return _compress_deflate_internal(in, in_len, dict, dict_len, out, out_len);
+}
+
+int _compress_inflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	if (dict == NULL || dict_len <= 0) {
+		return ERR_TR50_PARMS;
+	}
+	return _compress_inflate_internal(in, in_len, dict, dict_len, out, out_len);
+}
+
+typedef struct {
+	z_stream	strm;
+	int			is_inflate;
+} _COMPRESS_GZIP;
+
+int _compress_gzip_create(void **stream, int is_inflate, int level) {
+	_COMPRESS_GZIP *gzip;
+	int ret;
+
+	if ((gzip = _memory_malloc(sizeof(_COMPRESS_GZIP))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(gzip, 0, sizeof(_COMPRESS_GZIP));
+	gzip->is_inflate = is_inflate;
+	gzip->strm.zalloc = _compress_zalloc;
+	gzip->strm.zfree = _compress_zfree;
+	// 16 + MAX_WBITS selects the gzip wrapper instead of the zlib one
+	if (is_inflate) {
+		ret = inflateInit2(&gzip->strm, 16 + MAX_WBITS);
+	} else {
+		ret = deflateInit2(&gzip->strm, level, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	}
+	if (ret != Z_OK) {
+		_memory_free(gzip);
+		return is_inflate ? ERR_TR50_COMPRESS_INFLATE : ERR_TR50_COMPRESS_DEFLATE;
+	}
+	*stream = gzip;
+	return 0;
+}
+
+int _compress_gzip_reset(void *stream) {
+	_COMPRESS_GZIP *gzip = stream;
+
+	if (gzip->is_inflate) {
+		return inflateReset(&gzip->strm) == Z_OK ? 0 : ERR_TR50_COMPRESS_INFLATE;
+	}
+	return deflateReset(&gzip->strm) == Z_OK ? 0 : ERR_TR50_COMPRESS_DEFLATE;
+}
+
+int _compress_gzip_step(void *stream, const char **in, int *in_len, char **out, int *out_len, int finish) {
+	_COMPRESS_GZIP *gzip = stream;
+	int ret;
+
+	gzip->strm.next_in = (Bytef *)*in;
+	gzip->strm.avail_in = (unsigned int)*in_len;
+	gzip->strm.next_out = (Bytef *)*out;
+	gzip->strm.avail_out = (unsigned int)*out_len;
+	if (gzip->is_inflate) {
+		ret = inflate(&gzip->strm, Z_NO_FLUSH);
+	} else {
+		ret = deflate(&gzip->strm, finish ? Z_FINISH : Z_NO_FLUSH);
+	}
+	*in = (const char *)gzip->strm.next_in;
+	*in_len = (int)gzip->strm.avail_in;
+	*out = (char *)gzip->strm.next_out;
+	*out_len = (int)gzip->strm.avail_out;
+
+	if (ret == Z_STREAM_END) {
+		return 1;
+	} else if (ret == Z_OK || ret == Z_BUF_ERROR) { // Z_BUF_ERROR: no room or no input this time
+		return 0;
+	}
+	return gzip->is_inflate ? ERR_TR50_COMPRESS_INFLATE : ERR_TR50_COMPRESS_DEFLATE;
+}
+
+void _compress_gzip_delete(void *stream) {
+	_COMPRESS_GZIP *gzip = stream;
+
+	if (gzip->is_inflate) {
+		inflateEnd(&gzip->strm);
+	} else {
+		deflateEnd(&gzip->strm);
+	}
+	_memory_free(gzip);
+}
+
+#else
 
 int _compress_is_supported(void) {
 	return 0;
 }
 
+unsigned long _compress_dictionary_id(const char *dict, int dict_len) {
+	return 0;
+}
+
 int _compress_deflate(const char *in, int in_len, char **out, int *out_len) {
 	return ERR_TR50_NOPORT;
 }
@@ -35,3 +368,32 @@ int _compress_deflate(const char *in, int in_len, char **out, int *out_len) {
 int _compress_inflate(const char *in, int in_len, char **out, int *out_len) {
 	return ERR_TR50_NOPORT;
 }
+
+int _compress_deflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_inflate_dict(const char *in, int in_len, const char *dict, int dict_len, char **out, int *out_len) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_inflate_stream(const char *in, int in_len, const char *dict, int dict_len, _compress_sink sink, void *custom) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_gzip_create(void **stream, int is_inflate, int level) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_gzip_reset(void *stream) {
+	return ERR_TR50_NOPORT;
+}
+
+int _compress_gzip_step(void *stream, const char **in, int *in_len, char **out, int *out_len, int finish) {
+	return ERR_TR50_NOPORT;
+}
+
+void _compress_gzip_delete(void *stream) {
+}
+
+#endif
@@ -22,21 +22,26 @@
  * THE SOFTWARE.
  */
 
+#include <errno.h>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <tr50/tr50.h>
 #include <tr50/error.h>
 
 #include <tr50/internal/tr50.h>
 
+#include <tr50/util/atomic.h>
 #include <tr50/util/event.h>
 #include <tr50/util/json.h>
 #include <tr50/util/log.h>
 #include <tr50/util/memory.h>
 
 #define EVENT_NAME_LEN	64
-#define ETIMEDOUT		138
 
 
 typedef struct _EVENT_S {
@@ -130,6 +135,56 @@ int _tr50_event_signal(void *handle) {
 	return 0;
 }
 
+int _tr50_event_reset(void *handle) {
+	_EVENT *evt = handle;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+
+	if ((pthread_mutex_lock(&evt->mux)) != 0) {
+		return ERR_TR50_OS;
+	}
+	evt->is_locked = TRUE;
+	if ((pthread_mutex_unlock(&evt->mux)) != 0) {
+		return ERR_TR50_OS;
+	}
+	return 0;
+}
+
+int _tr50_event_wait_timeout(void *handle, int timeout_in_ms) {
+	_EVENT *evt = handle;
+	struct timespec deadline;
+	int ret = 0;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_in_ms / 1000;
+	deadline.tv_nsec += (timeout_in_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		++deadline.tv_sec;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	if (pthread_mutex_lock(&evt->mux) != 0) {
+		return ERR_TR50_OS;
+	}
+	while (evt->is_locked && ret == 0) {
+		++evt->wait_count;
+		ret = pthread_cond_timedwait(&evt->cond, &evt->mux, &deadline);
+		--evt->wait_count;
+	}
+	pthread_mutex_unlock(&evt->mux);
+
+	if (!evt->is_locked) {
+		return 0;
+	}
+	return ret == ETIMEDOUT ? ERR_TR50_TIMEOUT : ERR_TR50_OS;
+}
+
 int _tr50_event_delete(void *handle) {
 	_EVENT *evt = handle;
 	int ret;
@@ -147,3 +202,109 @@ int _tr50_event_delete(void *handle) {
 	_memory_free(handle);
 	return 0;
 }
+
+// A futex word: 0 until woken. Each thread keeps one waiter, released when the thread exits.
+typedef struct {
+	volatile int state;
+	int is_cached;
+	int in_use;
+} _WAITER;
+
+static __thread _WAITER *t_waiter;
+static pthread_key_t g_waiter_key;
+static pthread_once_t g_waiter_once = PTHREAD_ONCE_INIT;
+
+static void _tr50_waiter_release(void *waiter) {
+	t_waiter = NULL;
+	_memory_free(waiter);
+}
+
+static void _tr50_waiter_key_create() {
+	pthread_key_create(&g_waiter_key, _tr50_waiter_release);
+}
+
+int _tr50_waiter_take(void **handle) {
+	_WAITER *waiter = t_waiter;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (waiter == NULL || waiter->in_use) {
+		if ((waiter = (_WAITER *)_memory_malloc(sizeof(_WAITER))) == NULL) {
+			return ERR_TR50_MALLOC;
+		}
+		_memory_memset(waiter, 0, sizeof(_WAITER));
+		if (t_waiter == NULL) {
+			pthread_once(&g_waiter_once, _tr50_waiter_key_create);
+			if (pthread_setspecific(g_waiter_key, waiter) == 0) {
+				waiter->is_cached = TRUE;
+				t_waiter = waiter;
+			}
+		}
+	}
+	waiter->in_use = TRUE;
+	_atomic_store32(&waiter->state, 0);
+	*handle = waiter;
+	return 0;
+}
+
+int _tr50_waiter_wait(void *handle, int timeout_in_ms) {
+	_WAITER *waiter = handle;
+	struct timespec deadline, now, left;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (timeout_in_ms >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_in_ms / 1000;
+		deadline.tv_nsec += (timeout_in_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
+	while (_atomic_load32(&waiter->state) == 0) {
+		if (timeout_in_ms >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			left.tv_sec = deadline.tv_sec - now.tv_sec;
+			left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+			if (left.tv_nsec < 0) {
+				--left.tv_sec;
+				left.tv_nsec += 1000000000L;
+			}
+			if (left.tv_sec < 0) {
+				return ERR_TR50_TIMEOUT;
+			}
+		}
+		// returns at once when the word is no longer 0, spurious wakes loop
+		syscall(SYS_futex, &waiter->state, FUTEX_WAIT_PRIVATE, 0, timeout_in_ms >= 0 ? &left : NULL, NULL, 0);
+	}
+	return 0;
+}
+
+// The waiting thread may return as soon as the word is set; a wake that then reaches a reused
+// word only causes a spurious wake.
+int _tr50_waiter_wake(void *handle) {
+	_WAITER *waiter = handle;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	_atomic_store32(&waiter->state, 1);
+	syscall(SYS_futex, &waiter->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	return 0;
+}
+
+void _tr50_waiter_give(void *handle) {
+	_WAITER *waiter = handle;
+
+	if (waiter == NULL) {
+		return;
+	}
+	if (waiter->is_cached) {
+		waiter->in_use = FALSE;
+	} else {
+		_memory_free(waiter);
+	}
+}
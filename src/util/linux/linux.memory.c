@@ -27,6 +27,70 @@
 #include <string.h>
 
 #include <tr50/util/memory.h>
+#include <tr50/util/pool.h>
+
+#if TR50_MEMORY_POOL
+#include <pthread.h>
+
+// Each thread allocates through its own pool cache, returned to the pool when the thread exits.
+static __thread _POOL_CACHE *t_memory_cache __attribute__((tls_model("initial-exec")));
+static pthread_key_t g_memory_cache_key;
+static pthread_once_t g_memory_cache_once = PTHREAD_ONCE_INIT;
+
+static void _memory_cache_release(void *cache) {
+	t_memory_cache = NULL;
+	_pool_cache_delete((_POOL_CACHE *)cache);
+}
+
+static void _memory_cache_key_create() {
+	pthread_key_create(&g_memory_cache_key, _memory_cache_release);
+}
+
+static _POOL_CACHE *_memory_cache() {
+	if (t_memory_cache == NULL) {
+		pthread_once(&g_memory_cache_once, _memory_cache_key_create);
+		if ((t_memory_cache = _pool_cache_create()) != NULL) {
+			pthread_setspecific(g_memory_cache_key, t_memory_cache);
+		}
+	}
+	return t_memory_cache;
+}
+
+// The block header keeps the site id, so accounting can be switched on and off at any time.
+static void *_memory_charge(void *ptr, size_t size, const char *file, int line) {
+	if (ptr && g_memory_accounting) {
+		_pool_header(ptr)->info.site = _memory_account_alloc(size, file, line);
+	}
+	return ptr;
+}
+
+void *_memory_malloc_ex(size_t size, const char *file, int line) {
+	return _memory_charge(_pool_malloc(_memory_cache(), size), size, file, line);
+}
+
+void *_memory_realloc_ex(void *ptr, size_t size, const char *file, int line) {
+	int site = ptr ? _pool_header(ptr)->info.site : 0;
+	size_t old_size = ptr ? _pool_header(ptr)->info.size : 0;
+	void *grown;
+
+	if ((grown = _pool_realloc(_memory_cache(), ptr, size)) == NULL) {
+		return NULL;
+	}
+	if (site) {
+		_memory_account_free(site, old_size);
+		_pool_header(grown)->info.site = 0;
+	}
+	return _memory_charge(grown, size, file, line);
+}
+
+void _memory_free_ex(void *ptr, const char *file, int line) {
+	if (ptr && _pool_header(ptr)->info.site) {
+		_memory_account_free(_pool_header(ptr)->info.site, _pool_header(ptr)->info.size);
+	}
+	_pool_free(_memory_cache(), ptr);
+}
+
+#else
 
 void *_memory_malloc_ex(size_t size, const char *file, int line) {
 	return malloc(size);
@@ -38,10 +102,10 @@ void *_memory_realloc_ex(void *ptr, size_t size, const char *file, int line) {
 
 void _memory_free_ex(void *ptr, const char *file, int line) {
 	free(ptr);
-
-	return;
 }
 
+#endif
+
 void *_memory_memset(void *dest, int value, size_t size) {
 	return memset(dest, value, size);
 }
@@ -60,3 +124,7 @@ void *_memory_clone_ex(void *ptr, size_t size, const char *file, int line) {
 
 	return clone;
 }
+
+int _memory_accounting_supported() {
+	return TR50_MEMORY_POOL;
+}
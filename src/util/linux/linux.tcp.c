@@ -24,12 +24,15 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -450,6 +453,156 @@ int _tcp_recv(void *handle, char *buffer, int *length, int timeout) {
 	}
 }
 
+int _tcp_send_file(void *handle, FILE *fp, long long offset, int length, int timeout) {
+	ABSTRACT_SOCKET *sock = handle;
+	fd_set	sockSet;
+	struct timeval to;
+	sigset_t pipe_set, old_set;
+	struct timespec no_wait = { 0, 0 };
+	off_t position = (off_t)offset;
+	int current_sent = 0;
+	ssize_t ret;
+
+	if (handle == NULL || fp == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+
+	// TLS has to see the bytes, the caller sends those itself
+	if (sock->is_ssl) {
+		return ERR_TR50_NOT_SUPPORTED;
+	}
+
+	if (timeout < -1) {
+		sock->err = errno;
+		return ERR_TR50_SOCK_OTHER;
+	}
+
+	// sendfile() has no MSG_NOSIGNAL, a peer that hangs up must not raise SIGPIPE in the application
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+
+	while (current_sent < length) {
+		if (timeout > 0) {
+			to.tv_usec = (timeout % 1000) * 1000;
+			to.tv_sec = timeout / 1000;
+			FD_ZERO(&sockSet);
+			FD_SET(sock->s, &sockSet);
+
+			if ((ret = select(sock->s + 1, NULL, &sockSet, NULL, &to)) == 0) {
+				sock->err = ERR_TR50_SOCK_TIMEOUT;
+				ret = ERR_TR50_SOCK_TIMEOUT;
+				break;
+			} else if (ret == -1) {
+				sock->err = errno;
+				ret = ERR_TR50_SOCK_SELECT_FAILED;
+				break;
+			}
+		}
+
+		ret = sendfile(sock->s, fileno(fp), &position, length - current_sent > DTCPBUF ? DTCPBUF : length - current_sent);
+
+		if (ret > 0) {
+			current_sent += (int)ret;
+			ret = 0;
+		} else if (ret == 0) {
+			// the file is shorter than it was when the transfer started
+			ret = ERR_TR50_FILE_PUT_HTTP;
+			break;
+		} else if (errno == EINTR || errno == EAGAIN) {
+			ret = 0;
+		} else {
+			sock->err = errno;
+			// file systems without sendfile support fail before anything is sent
+			ret = (current_sent == 0 && (errno == EINVAL || errno == ENOSYS)) ? ERR_TR50_NOT_SUPPORTED : ERR_TR50_SOCK_SEND_FAILED;
+			if (errno == EPIPE) {
+				while (sigtimedwait(&pipe_set, NULL, &no_wait) == -1 && errno == EINTR)
+					; /* Nothing. */
+			}
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+	return (int)ret;
+}
+
+int _tcp_listen(void **handle, long port) {
+	ABSTRACT_SOCKET *sock;
+	struct sockaddr_in sa;
+	int tint = 1;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if ((sock = _memory_malloc(sizeof(ABSTRACT_SOCKET))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(sock, 0, sizeof(ABSTRACT_SOCKET));
+
+	if ((sock->s = (int)socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) <= 0) {
+		_memory_free(sock);
+		return ERR_TR50_SOCK_SOCKET_FAILED;
+	}
+	setsockopt(sock->s, SOL_SOCKET, SO_REUSEADDR, (char *)&tint, sizeof(tint));
+	fcntl(sock->s, F_SETFD, fcntl(sock->s, F_GETFD) | FD_CLOEXEC);
+
+	_memory_memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons((unsigned short)port);
+	if (bind(sock->s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		sock->err = errno;
+		_tcp_disconnect(sock);
+		return ERR_TR50_SOCK_BIND_FAILED;
+	}
+	if (listen(sock->s, 8) != 0) {
+		sock->err = errno;
+		_tcp_disconnect(sock);
+		return ERR_TR50_SOCK_LISTEN_FAILED;
+	}
+	*handle = sock;
+	return 0;
+}
+
+int _tcp_accept(void *listen_handle, void **handle, int timeout) {
+	ABSTRACT_SOCKET *listener = listen_handle;
+	ABSTRACT_SOCKET *sock;
+	fd_set sockSet;
+	struct timeval to;
+	int s, ret;
+
+	if (listen_handle == NULL || handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (timeout > 0) {
+		to.tv_usec = (timeout % 1000) * 1000;
+		to.tv_sec = timeout / 1000;
+
+		FD_ZERO(&sockSet);
+		FD_SET(listener->s, &sockSet);
+		if ((ret = select(listener->s + 1, &sockSet, NULL, NULL, &to)) == 0) {
+			return ERR_TR50_SOCK_TIMEOUT;
+		} else if (ret == -1) {
+			listener->err = errno;
+			return ERR_TR50_SOCK_SELECT_FAILED;
+		}
+	}
+	if ((s = accept(listener->s, NULL, NULL)) < 0) {
+		listener->err = errno;
+		return ERR_TR50_SOCK_ACCEPT_FAILED;
+	}
+	if ((sock = _memory_malloc(sizeof(ABSTRACT_SOCKET))) == NULL) {
+		close(s);
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(sock, 0, sizeof(ABSTRACT_SOCKET));
+
+	sock->s = s;
+	*handle = sock;
+	return 0;
+}
+
 int _tcp_connect_ssl(void *handle) {
 	int ret;
 	void *ctx;
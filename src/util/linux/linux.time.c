@@ -49,6 +49,13 @@ int _time_now_in_sec(void) {
 	return (int)ltime.tv_sec;
 }
 
+long long _time_now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 void tr50_time_sprintf(char *buffer, const char *time_format, long long mstime) {
 	tr50_time_sprintf2(buffer, time_format, mstime, 0);
 }
@@ -37,3 +37,26 @@ int _tr50_event_signal(void *evt) {
 int _tr50_event_delete(void *evt) {
 	return 0;
 }
+
+int _tr50_event_reset(void *evt) {
+	return 0;
+}
+
+int _tr50_event_wait_timeout(void *evt, int timeout_in_ms) {
+	return 0;
+}
+
+int _tr50_waiter_take(void **waiter) {
+	return 0;
+}
+
+int _tr50_waiter_wait(void *waiter, int timeout_in_ms) {
+	return 0;
+}
+
+int _tr50_waiter_wake(void *waiter) {
+	return 0;
+}
+
+void _tr50_waiter_give(void *waiter) {
+}
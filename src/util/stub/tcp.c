@@ -39,3 +39,15 @@ int _tcp_send(void *sock, const char *buf, int len, int timeout) {
 int _tcp_recv(void *sock, char *buf, int *len, int timeout) {
 	return 0;
 }
+
+int _tcp_send_file(void *sock, FILE *fp, long long offset, int length, int timeout) {
+	return 0;
+}
+
+int _tcp_listen(void **sock, long port) {
+	return 0;
+}
+
+int _tcp_accept(void *listen_sock, void **sock, int timeout) {
+	return 0;
+}
@@ -30,6 +30,10 @@ int _time_now_in_sec() {
 	return 0;
 }
 
+long long _time_now_us() {
+	return 0;
+}
+
 void time_strptime(const char *timestamp_str, const char *time_format, long long *mstime) {
 	return 0;
 }
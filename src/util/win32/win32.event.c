@@ -88,6 +88,36 @@ int _tr50_event_signal(void *handle) {
 	return 0;
 }
 
+int _tr50_event_reset(void *handle) {
+	_EVENT *evt = handle;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+
+	if (!ResetEvent(evt->handle)) {
+		return ERR_TR50_OS;
+	}
+	return 0;
+}
+
+int _tr50_event_wait_timeout(void *handle, int timeout_in_ms) {
+	_EVENT *evt = handle;
+	int ret;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+
+	ret = WaitForSingleObject(evt->handle, timeout_in_ms);
+	if (ret == WAIT_TIMEOUT) {
+		return ERR_TR50_TIMEOUT;
+	} else if (ret != WAIT_OBJECT_0) {
+		return ERR_TR50_OS;
+	}
+	return 0;
+}
+
 int _tr50_event_delete(void *handle) {
 	_EVENT *evt = handle;
 
@@ -102,3 +132,100 @@ int _tr50_event_delete(void *handle) {
 	_memory_free(handle);
 	return 0;
 }
+
+// An auto-reset event, set once per take. Each thread keeps one waiter; the fiber local slot
+// closes it when the thread exits.
+typedef struct {
+	HANDLE handle;
+	int is_cached;
+	int in_use;
+} _WAITER;
+
+static __declspec(thread) _WAITER *t_waiter;
+static DWORD g_waiter_slot = FLS_OUT_OF_INDEXES;
+static INIT_ONCE g_waiter_once = INIT_ONCE_STATIC_INIT;
+
+static void _tr50_waiter_free(_WAITER *waiter) {
+	CloseHandle(waiter->handle);
+	_memory_free(waiter);
+}
+
+static void WINAPI _tr50_waiter_release(void *waiter) {
+	t_waiter = NULL;
+	_tr50_waiter_free((_WAITER *)waiter);
+}
+
+static BOOL CALLBACK _tr50_waiter_slot_create(PINIT_ONCE once, void *param, void **context) {
+	g_waiter_slot = FlsAlloc(_tr50_waiter_release);
+	return TRUE;
+}
+
+int _tr50_waiter_take(void **handle) {
+	_WAITER *waiter = t_waiter;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (waiter == NULL || waiter->in_use) {
+		if ((waiter = (_WAITER *)_memory_malloc(sizeof(_WAITER))) == NULL) {
+			return ERR_TR50_MALLOC;
+		}
+		_memory_memset(waiter, 0, sizeof(_WAITER));
+		if ((waiter->handle = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL) {
+			_memory_free(waiter);
+			return ERR_TR50_OS;
+		}
+		if (t_waiter == NULL) {
+			InitOnceExecuteOnce(&g_waiter_once, _tr50_waiter_slot_create, NULL, NULL);
+			if (g_waiter_slot != FLS_OUT_OF_INDEXES && FlsSetValue(g_waiter_slot, waiter)) {
+				waiter->is_cached = TRUE;
+				t_waiter = waiter;
+			}
+		}
+	}
+	waiter->in_use = TRUE;
+	*handle = waiter;
+	return 0;
+}
+
+// Returns only once the wake's SetEvent() went through, so the handle can be closed after.
+int _tr50_waiter_wait(void *handle, int timeout_in_ms) {
+	_WAITER *waiter = handle;
+	DWORD ret;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	ret = WaitForSingleObject(waiter->handle, timeout_in_ms >= 0 ? (DWORD)timeout_in_ms : INFINITE);
+	if (ret == WAIT_TIMEOUT) {
+		return ERR_TR50_TIMEOUT;
+	} else if (ret != WAIT_OBJECT_0) {
+		return ERR_TR50_OS;
+	}
+	return 0;
+}
+
+int _tr50_waiter_wake(void *handle) {
+	_WAITER *waiter = handle;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (!SetEvent(waiter->handle)) {
+		return ERR_TR50_OS;
+	}
+	return 0;
+}
+
+void _tr50_waiter_give(void *handle) {
+	_WAITER *waiter = handle;
+
+	if (waiter == NULL) {
+		return;
+	}
+	if (waiter->is_cached) {
+		waiter->in_use = FALSE;
+	} else {
+		_tr50_waiter_free(waiter);
+	}
+}
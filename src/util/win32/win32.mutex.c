@@ -43,7 +43,7 @@ int _tr50_mutex_create_internal(void **mux, const char *file, int line) {
 		return ERR_TR50_BADHANDLE;
 	}
 
-	if ((*mux = malloc(sizeof(_MUTEX))) == NULL) {
+	if ((*mux = _memory_malloc(sizeof(_MUTEX))) == NULL) {
 		return ERR_TR50_MALLOC;
 	}
 	_memory_memset(*mux, 0, sizeof(_MUTEX));
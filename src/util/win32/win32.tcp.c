@@ -310,6 +310,92 @@ int _tcp_ssl_config(const char *password, const char *file, int verify_peer) {
 	return 0;
 }
 
+int _tcp_send_file(void *handle, FILE *fp, long long offset, int length, int timeout) {
+	// no zero-copy path here, the caller reads and sends the file itself
+	return ERR_TR50_NOT_SUPPORTED;
+}
+
+int _tcp_listen(void **handle, long port) {
+	ABSTRACT_SOCKET *sock;
+	struct sockaddr_in sa;
+	WSADATA wsaData;
+
+	if (handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (g_once == 0) {
+		WSAStartup(MAKEWORD(2, 0), &wsaData);
+		ssl_init();
+		g_once = 1;
+	}
+	if ((sock = _memory_malloc(sizeof(ABSTRACT_SOCKET))) == NULL) {
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(sock, 0, sizeof(ABSTRACT_SOCKET));
+	sock->type = SOCKET_TYPE_SOCK;
+
+	if ((sock->s = (int)socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) <= 0) {
+		_memory_free(sock);
+		return ERR_TR50_SOCK_SOCKET_FAILED;
+	}
+
+	_memory_memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = htons((unsigned short)port);
+	if (bind(sock->s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+		sock->err = WSAGetLastError();
+		_tcp_disconnect(sock);
+		return ERR_TR50_SOCK_BIND_FAILED;
+	}
+	if (listen(sock->s, 8) != 0) {
+		sock->err = WSAGetLastError();
+		_tcp_disconnect(sock);
+		return ERR_TR50_SOCK_LISTEN_FAILED;
+	}
+	*handle = sock;
+	return 0;
+}
+
+int _tcp_accept(void *listen_handle, void **handle, int timeout) {
+	ABSTRACT_SOCKET *listener = listen_handle;
+	ABSTRACT_SOCKET *sock;
+	fd_set sockSet;
+	struct timeval to;
+	SOCKET s;
+	int ret;
+
+	if (listen_handle == NULL || handle == NULL) {
+		return ERR_TR50_BADHANDLE;
+	}
+	if (timeout > 0) {
+		to.tv_usec = (timeout % 1000) * 1000;
+		to.tv_sec = timeout / 1000;
+
+		FD_ZERO(&sockSet);
+		FD_SET(listener->s, &sockSet);
+		if ((ret = select(listener->s + 1, &sockSet, NULL, NULL, &to)) == 0) {
+			return ERR_TR50_SOCK_TIMEOUT;
+		} else if (ret == SOCKET_ERROR) {
+			listener->err = WSAGetLastError();
+			return ERR_TR50_SOCK_SELECT_FAILED;
+		}
+	}
+	if ((s = accept(listener->s, NULL, NULL)) == INVALID_SOCKET) {
+		listener->err = WSAGetLastError();
+		return ERR_TR50_SOCK_ACCEPT_FAILED;
+	}
+	if ((sock = _memory_malloc(sizeof(ABSTRACT_SOCKET))) == NULL) {
+		closesocket(s);
+		return ERR_TR50_MALLOC;
+	}
+	_memory_memset(sock, 0, sizeof(ABSTRACT_SOCKET));
+	sock->type = SOCKET_TYPE_SOCK;
+	sock->s = (int)s;
+	*handle = sock;
+	return 0;
+}
+
 int _tcp_connect_ssl(void *handle) {
 	int ret;
 	void *ctx;
@@ -151,13 +151,13 @@ int _thread_create(void **handle, const char *name, _thread_function thread, voi
 	_THREAD_OBJECT *thd;
 	_THREAD_WRAPPER_EXEC *tse;
 
-	if ((*handle = malloc(sizeof(_THREAD_OBJECT))) == NULL) {
+	if ((*handle = _memory_malloc(sizeof(_THREAD_OBJECT))) == NULL) {
 		return ERR_TR50_MALLOC;
 	}
 	_memory_memset(*handle, 0, sizeof(_THREAD_OBJECT));
 	thd = *handle;
 
-	if ((tse = malloc(sizeof(_THREAD_WRAPPER_EXEC))) == NULL) {
+	if ((tse = _memory_malloc(sizeof(_THREAD_WRAPPER_EXEC))) == NULL) {
 		return ERR_TR50_MALLOC;
 	}
 	_memory_memset(tse, 0, sizeof(_THREAD_WRAPPER_EXEC));
@@ -129,6 +129,17 @@ int time_now_in_sec() {
 int _time_now_in_sec() {
 	return time_now_in_sec();
 }
+
+long long _time_now_us() {
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+	return (long long)(counter.QuadPart / frequency.QuadPart) * 1000000 + (long long)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
 void tr50_time_sprintf2(char *buffer, const char *time_format, long long mstime, int use_gmt) {
 
 	SYSTEMTIME st;